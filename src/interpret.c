@@ -39,14 +39,14 @@ main(int argc, char **argv)
 {
 	struct _vte_matcher *matcher = NULL;
 	GArray *array;
-	unsigned int i, j;
+	unsigned int i, j, k;
 	int l;
 	unsigned char buf[4096];
-	GValue *value;
+	const struct _vte_matcher_param *value;
 	int infile;
 	struct _vte_iso2022_state *subst;
 	const char *tmp;
-	GValueArray *values;
+	struct _vte_matcher_params values;
 
 	_vte_debug_init();
 
@@ -89,13 +89,13 @@ main(int argc, char **argv)
 		i = 0;
 		while (i <= array->len) {
 			tmp = NULL;
-			values = NULL;
 			for (j = 1; j < (array->len - i); j++) {
 				_vte_matcher_match(matcher,
 						   &g_array_index(array, gunichar, i),
 						   j,
 						   &tmp,
 						   NULL,
+						   NULL,
 						   &values);
 				if ((tmp == NULL) || (strlen(tmp) > 0)) {
 					break;
@@ -121,27 +121,26 @@ main(int argc, char **argv)
 
 			l = j;
 			g_print("%s(", tmp);
-			for (j = 0; (values != NULL) && (j < values->n_values); j++) {
+			for (j = 0; j < values.n_params; j++) {
 				if (j > 0) {
 					g_print(", ");
 				}
-				value = g_value_array_get_nth(values, j);
-				if (G_VALUE_HOLDS_LONG(value)) {
-					g_print("%ld", g_value_get_long(value));
+				value = &values.params[j];
+				if (value->type == VTE_MATCHER_PARAM_NUMBER) {
+					g_print("%ld", value->number);
 				}
-				if (G_VALUE_HOLDS_STRING(value)) {
-					g_print("`%s'",
-						g_value_get_string(value));
+				if (value->type == VTE_MATCHER_PARAM_SUBPARAMS) {
+					for (k = 0; k < value->n_sub; k++) {
+						g_print(k > 0 ? ":%ld" : "%ld",
+							values.subparams[value->sub_start + k]);
+					}
 				}
-				if (G_VALUE_HOLDS_POINTER(value)) {
-					g_print("`%ls'",
-						(wchar_t*)
-						g_value_get_pointer(value));
+				if (value->type == VTE_MATCHER_PARAM_STRING) {
+					g_print("`%.*ls'",
+						(int) value->str_len,
+						(wchar_t*) value->str);
 				}
 			}
-			if (values != NULL) {
-				_vte_matcher_free_params_array(matcher, values);
-			}
 			g_print(")\n");
 			i += l;
 		}
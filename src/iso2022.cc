@@ -41,15 +41,27 @@
 
 #include <gdk/gdkkeysyms.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /* An invalid codepoint. */
 #define INVALID_CODEPOINT 0xFFFD
 
 struct _vte_iso2022_state {
 	const gchar *codeset, *native_codeset, *utf8_codeset, *target_codeset;
+	gboolean utf8;  /* decode directly, without going through iconv */
 	VteConv conv;
 	VteByteArray *buffer;
 };
 
+static gboolean
+_vte_iso2022_codeset_is_utf8(const char *codeset)
+{
+	return g_ascii_strcasecmp(codeset, "UTF-8") == 0 ||
+	       g_ascii_strcasecmp(codeset, "UTF8") == 0;
+}
+
 struct _vte_iso2022_state *
 _vte_iso2022_state_new(const char *native_codeset)
 {
@@ -67,20 +79,20 @@ _vte_iso2022_state_new(const char *native_codeset)
 	_vte_debug_print(VTE_DEBUG_SUBSTITUTION,
 			"Native codeset \"%s\", currently %s\n",
 			state->native_codeset, state->codeset);
-	state->conv = _vte_conv_open(state->target_codeset, state->codeset);
 	state->buffer = _vte_byte_array_new();
+	state->utf8 = _vte_iso2022_codeset_is_utf8(state->codeset);
+	if (state->utf8) {
+		state->conv = VTE_INVALID_CONV;
+		return state;
+	}
+	state->conv = _vte_conv_open(state->target_codeset, state->codeset);
 	if (state->conv == VTE_INVALID_CONV) {
 		g_warning(_("Unable to convert characters from %s to %s."),
 			  state->codeset, state->target_codeset);
 		_vte_debug_print(VTE_DEBUG_SUBSTITUTION,
 				"Using UTF-8 instead.\n");
 		state->codeset = state->utf8_codeset;
-		state->conv = _vte_conv_open(state->target_codeset,
-					     state->codeset);
-		if (state->conv == VTE_INVALID_CONV) {
-			g_error(_("Unable to convert characters from %s to %s."),
-				state->codeset, state->target_codeset);
-		}
+		state->utf8 = TRUE;
 	}
 	return state;
 }
@@ -106,16 +118,21 @@ _vte_iso2022_state_set_codeset(struct _vte_iso2022_state *state,
 	g_return_if_fail(strlen(codeset) > 0);
 
 	_vte_debug_print(VTE_DEBUG_SUBSTITUTION, "%s\n", codeset);
-	conv = _vte_conv_open(state->target_codeset, codeset);
-	if (conv == VTE_INVALID_CONV) {
-		g_warning(_("Unable to convert characters from %s to %s."),
-			  codeset, state->target_codeset);
-		return;
+	if (_vte_iso2022_codeset_is_utf8(codeset)) {
+		conv = VTE_INVALID_CONV;
+	} else {
+		conv = _vte_conv_open(state->target_codeset, codeset);
+		if (conv == VTE_INVALID_CONV) {
+			g_warning(_("Unable to convert characters from %s to %s."),
+				  codeset, state->target_codeset);
+			return;
+		}
 	}
 	if (state->conv != VTE_INVALID_CONV) {
 		_vte_conv_close(state->conv);
 	}
 	state->codeset = g_intern_string (codeset);
+	state->utf8 = (conv == VTE_INVALID_CONV);
 	state->conv = conv;
 }
 
@@ -125,6 +142,136 @@ _vte_iso2022_state_get_codeset(struct _vte_iso2022_state *state)
 	return state->codeset;
 }
 
+/* Copy a run of plain 7-bit ASCII characters (excluding NUL) from @in to @out,
+ * widening each byte to a gunichar. Returns the number of bytes copied, which
+ * is less than @length if a NUL or a non-ASCII byte was encountered. */
+static inline gsize
+_vte_iso2022_copy_ascii(const guchar *in, gsize length, gunichar *out)
+{
+	gsize i = 0;
+
+#ifdef __SSE2__
+	/* Check and widen 16 bytes at a time. Any byte with its high bit set,
+	 * or equal to NUL, makes the whole block fall back to the slow path. */
+	const __m128i zero = _mm_setzero_si128();
+	while (i + 16 <= length) {
+		__m128i v, lo, hi;
+
+		v = _mm_loadu_si128((const __m128i *)(in + i));
+		if (_mm_movemask_epi8(_mm_or_si128(v, _mm_cmpeq_epi8(v, zero))) != 0)
+			break;
+
+		lo = _mm_unpacklo_epi8(v, zero);
+		hi = _mm_unpackhi_epi8(v, zero);
+		_mm_storeu_si128((__m128i *)(out + i), _mm_unpacklo_epi16(lo, zero));
+		_mm_storeu_si128((__m128i *)(out + i + 4), _mm_unpackhi_epi16(lo, zero));
+		_mm_storeu_si128((__m128i *)(out + i + 8), _mm_unpacklo_epi16(hi, zero));
+		_mm_storeu_si128((__m128i *)(out + i + 12), _mm_unpackhi_epi16(hi, zero));
+		i += 16;
+	}
+#endif
+
+	/* 0x01..0x7F */
+	while (i < length && (guchar)(in[i] - 1) < 0x7f) {
+		out[i] = in[i];
+		i++;
+	}
+	return i;
+}
+
+/* Decode UTF-8 straight into @gunichars, without going through iconv.
+ * Follows the same rules as the iconv path: each invalid byte is replaced
+ * by INVALID_CODEPOINT, NULs are dropped, and an incomplete sequence at the
+ * end of the input is left unconsumed. */
+static gsize
+_vte_iso2022_process_utf8(const guchar *cdata, gsize length,
+                          GArray *gunichars)
+{
+	const guchar *p, *end;
+	gunichar *out, *outstart;
+	gunichar c;
+	guchar b, lo, hi;
+	gsize n, need, i;
+	guint oldlen;
+
+	/* Every input byte produces at most one character. */
+	oldlen = gunichars->len;
+	g_array_set_size(gunichars, oldlen + length);
+	outstart = out = &g_array_index(gunichars, gunichar, oldlen);
+
+	p = cdata;
+	end = cdata + length;
+	while (p < end) {
+		n = _vte_iso2022_copy_ascii(p, end - p, out);
+		p += n;
+		out += n;
+		if (p == end)
+			break;
+
+		b = *p;
+		if (b == '\0') {
+			/* Skip the padding character. */
+			p++;
+			continue;
+		}
+
+		/* Multibyte sequence; reject overlong forms, surrogates and
+		 * anything beyond U+10FFFF by narrowing the range allowed
+		 * for the second byte. */
+		lo = 0x80;
+		hi = 0xbf;
+		if (b < 0xc2) {
+			goto invalid;
+		} else if (b < 0xe0) {
+			need = 1;
+			c = b & 0x1f;
+		} else if (b < 0xf0) {
+			need = 2;
+			c = b & 0x0f;
+			if (b == 0xe0)
+				lo = 0xa0;
+			else if (b == 0xed)
+				hi = 0x9f;
+		} else if (b < 0xf5) {
+			need = 3;
+			c = b & 0x07;
+			if (b == 0xf0)
+				lo = 0x90;
+			else if (b == 0xf4)
+				hi = 0x8f;
+		} else {
+			goto invalid;
+		}
+
+		for (i = 1; i <= need; i++) {
+			if (p + i == end) {
+				/* Incomplete. Save for later. */
+				goto done;
+			}
+			if (p[i] < lo || p[i] > hi)
+				goto invalid;
+			c = (c << 6) | (p[i] & 0x3f);
+			lo = 0x80;
+			hi = 0xbf;
+		}
+		*out++ = c;
+		p += need + 1;
+		continue;
+
+invalid:
+		/* Munge the input. */
+		*out++ = INVALID_CODEPOINT;
+		p++;
+	}
+
+done:
+	gunichars->len = oldlen + (out - outstart);
+
+	_vte_debug_print(VTE_DEBUG_SUBSTITUTION,
+                        "Consuming %ld bytes.\n", (long) (p - cdata));
+	return p - cdata;
+}
+
 gsize
 _vte_iso2022_process(struct _vte_iso2022_state *state,
                      const guchar *cdata, gsize length,
@@ -139,6 +286,10 @@ _vte_iso2022_process(struct _vte_iso2022_state *state,
 	gunichar c;
         gboolean stop;
 
+		if (G_LIKELY(state->utf8)) {
+			return _vte_iso2022_process_utf8(cdata, length, gunichars);
+		}
+
 		inbuf = cdata;
 		inbytes = length;
 		_vte_byte_array_set_minimum_size(state->buffer,
@@ -199,3 +350,110 @@ _vte_iso2022_process(struct _vte_iso2022_state *state,
                         "Consuming %ld bytes.\n", (long) processed);
         return processed;
 }
+
+#ifdef ISO2022_MAIN
+
+/* Run @input through a state, returning the decoded characters. */
+static GArray *
+process(struct _vte_iso2022_state *state,
+        const char *input, gsize length, gsize *processed)
+{
+        GArray *gunichars = g_array_new(FALSE, FALSE, sizeof(gunichar));
+        *processed = _vte_iso2022_process(state, (const guchar *)input, length, gunichars);
+        return gunichars;
+}
+
+/* The direct UTF-8 decoder must agree with the iconv path. */
+static void
+test_utf8_matches_iconv(void)
+{
+        static const struct {
+                const char *input;
+                gsize length;
+        } tests[] = {
+                { "", 0 },
+                { "plain ascii, long enough for a block or two\r\n", 46 },
+                { "ab\0cd\0\0ef", 9 },
+                { "0123456789abcde\0fghijklmnopqrstuv", 33 },
+                { "0123456789abcde\xc3\xa9xyz", 20 },
+                { "\xe2\x94\x80\xe2\x94\x82\xe2\x94\x8c", 9 },
+                { "\xf0\x9f\x98\x80", 4 },
+                { "ab\x80" "cd", 5 },
+                { "\xc0\xaf\xc1\xbf", 4 },
+                { "\xe0\x80\xaf" "x", 4 },
+                { "\xed\xa0\x80" "x", 4 },
+                { "\xf4\x90\x80\x80" "x", 5 },
+                { "\xf5\xff" "x", 3 },
+                { "x\xe2\x94", 3 },
+                { "x\xf0\x9f\x98", 4 },
+                { "x\xe2" "x\xe2\x94", 5 },
+        };
+        guint i;
+
+        for (i = 0; i < G_N_ELEMENTS(tests); i++) {
+                struct _vte_iso2022_state *direct, *iconv;
+                GArray *a, *b;
+                gsize pa, pb;
+
+                direct = _vte_iso2022_state_new("UTF-8");
+                g_assert_true(direct->utf8);
+
+                /* Force the generic path. */
+                iconv = _vte_iso2022_state_new("UTF-8");
+                iconv->conv = _vte_conv_open(iconv->target_codeset, "UTF-8");
+                iconv->utf8 = FALSE;
+
+                a = process(direct, tests[i].input, tests[i].length, &pa);
+                b = process(iconv, tests[i].input, tests[i].length, &pb);
+
+                g_assert_cmpuint(pa, ==, pb);
+                g_assert_cmpuint(a->len, ==, b->len);
+                g_assert_cmpint(memcmp(a->data, b->data, a->len * sizeof(gunichar)), ==, 0);
+
+                g_array_free(a, TRUE);
+                g_array_free(b, TRUE);
+                _vte_iso2022_state_free(direct);
+                _vte_iso2022_state_free(iconv);
+        }
+}
+
+static void
+test_utf8_codeset_switch(void)
+{
+        struct _vte_iso2022_state *state;
+        GArray *a;
+        gsize processed;
+
+        state = _vte_iso2022_state_new("UTF-8");
+        _vte_iso2022_state_set_codeset(state, "ISO-8859-1");
+        g_assert_false(state->utf8);
+        a = process(state, "\xe9", 1, &processed);
+        g_assert_cmpuint(processed, ==, 1);
+        g_assert_cmpuint(a->len, ==, 1);
+        g_assert_cmpuint(g_array_index(a, gunichar, 0), ==, 0xe9);
+        g_array_free(a, TRUE);
+
+        _vte_iso2022_state_set_codeset(state, "utf8");
+        g_assert_true(state->utf8);
+        g_assert_cmpstr(_vte_iso2022_state_get_codeset(state), ==, "utf8");
+        a = process(state, "\xc3\xa9", 2, &processed);
+        g_assert_cmpuint(processed, ==, 2);
+        g_assert_cmpuint(a->len, ==, 1);
+        g_assert_cmpuint(g_array_index(a, gunichar, 0), ==, 0xe9);
+        g_array_free(a, TRUE);
+
+        _vte_iso2022_state_free(state);
+}
+
+int
+main (int argc,
+      char *argv[])
+{
+        g_test_init (&argc, &argv, nullptr);
+
+        g_test_add_func ("/vte/iso2022/utf8/matches-iconv", test_utf8_matches_iconv);
+        g_test_add_func ("/vte/iso2022/utf8/codeset-switch", test_utf8_codeset_switch);
+
+	return g_test_run ();
+}
+#endif
@@ -24,12 +24,13 @@
 #include "debug.h"
 #include "caps.h"
 #include "matcher.h"
+#include "parser.h"
 #include "table.h"
 
 struct _vte_matcher {
 	_vte_matcher_match_func match; /* shortcut to the most common op */
 	struct _vte_matcher_impl *impl;
-	GValueArray *free_params;
+	GPtrArray *names; /* interned names, indexed by opcode */
 };
 
 static GMutex _vte_matcher_mutex;
@@ -39,14 +40,18 @@ static int _vte_matcher_ref_count = 0;
 static struct _vte_matcher_impl dummy_vte_matcher_table = {
 	&_vte_matcher_table
 };
+static struct _vte_matcher_impl dummy_vte_matcher_parser = {
+	&_vte_matcher_parser
+};
 
 /* Add a string to the matcher. */
 static void
 _vte_matcher_add(const struct _vte_matcher *matcher,
 		 const char *pattern, gssize length,
-		 const char *result)
+		 const char *result, guint opcode)
 {
-	matcher->impl->klass->add(matcher->impl, pattern, length, result);
+	matcher->impl->klass->add(matcher->impl, pattern, length,
+				  result, opcode);
 }
 
 /* Loads all sequences into matcher */
@@ -56,12 +61,27 @@ _vte_matcher_init(struct _vte_matcher *matcher)
 	const char *code, *value;
         char *c1;
         int i, k, n, variants;
+        guint opcode;
+        GHashTable *opcodes;
 
 	_vte_debug_print(VTE_DEBUG_LIFECYCLE, "_vte_matcher_init()\n");
 
+        /* Opcodes are handed out in order of first appearance in the
+         * capability list, so they're the same every time the matcher
+         * is created. */
+        opcodes = g_hash_table_new(g_direct_hash, g_direct_equal);
+        g_ptr_array_add(matcher->names, NULL); /* VTE_MATCHER_OPCODE_NONE */
+
         code = _vte_xterm_capability_strings;
         do {
-                value = strchr(code, '\0') + 1;
+                value = g_intern_string(strchr(code, '\0') + 1);
+                opcode = GPOINTER_TO_UINT(g_hash_table_lookup(opcodes, value));
+                if (opcode == VTE_MATCHER_OPCODE_NONE) {
+                        opcode = matcher->names->len;
+                        g_ptr_array_add(matcher->names, (gpointer) value);
+                        g_hash_table_insert(opcodes, (gpointer) value,
+                                            GUINT_TO_POINTER(opcode));
+                }
 
                 /* Escape sequences from \e@ to \e_ have a C1 counterpart
                  * with the eighth bit set instead of a preceding '\x1b'.
@@ -96,12 +116,14 @@ _vte_matcher_init(struct _vte_matcher *matcher)
                                         k++;
                                 }
                         }
-                        _vte_matcher_add(matcher, c1, strlen(c1), value);
+                        _vte_matcher_add(matcher, c1, strlen(c1), value, opcode);
                         g_free(c1);
                 }
 
-                code = strchr(value, '\0') + 1;
+                code = strchr(code, '\0') + 1;
+                code = strchr(code, '\0') + 1;
         } while (*code);
+        g_hash_table_destroy(opcodes);
 
 	_VTE_DEBUG_IF(VTE_DEBUG_MATCHER) {
 		g_printerr("Matcher contents:\n");
@@ -118,9 +140,15 @@ _vte_matcher_create(void)
 
 	_vte_debug_print(VTE_DEBUG_LIFECYCLE, "_vte_matcher_create()\n");
 	ret = g_slice_new(struct _vte_matcher);
-        ret->impl = &dummy_vte_matcher_table;
+        /* VTE_MATCHER=parser selects the state machine instead of the
+         * table, so the two can be compared. */
+        if (g_strcmp0(g_getenv("VTE_MATCHER"), "parser") == 0) {
+                ret->impl = &dummy_vte_matcher_parser;
+        } else {
+                ret->impl = &dummy_vte_matcher_table;
+        }
 	ret->match = NULL;
-	ret->free_params = NULL;
+	ret->names = g_ptr_array_new();
 
 	return ret;
 }
@@ -130,11 +158,9 @@ static void
 _vte_matcher_destroy(struct _vte_matcher *matcher)
 {
 	_vte_debug_print(VTE_DEBUG_LIFECYCLE, "_vte_matcher_destroy()\n");
-	if (matcher->free_params != NULL) {
-		g_value_array_free (matcher->free_params);
-	}
 	if (matcher->match != NULL) /* do not call destroy on dummy values */
 		matcher->impl->klass->destroy(matcher->impl);
+	g_ptr_array_free(matcher->names, TRUE);
 	g_slice_free(struct _vte_matcher, matcher);
 }
 
@@ -179,42 +205,33 @@ _vte_matcher_free(struct _vte_matcher *matcher)
 const char *
 _vte_matcher_match(struct _vte_matcher *matcher,
 		   const gunichar *pattern, gssize length,
-		   const char **res, const gunichar **consumed,
-		   GValueArray **array)
+		   const char **res, guint *opcode,
+		   const gunichar **consumed,
+		   struct _vte_matcher_params *params)
 {
-	if (G_UNLIKELY (array != NULL && matcher->free_params != NULL)) {
-		*array = matcher->free_params;
-		matcher->free_params = NULL;
-	}
 	return matcher->match(matcher->impl, pattern, length,
-					res, consumed, array);
+					res, opcode, consumed, params);
 }
 
-/* Dump out the contents of a matcher, mainly for debugging. */
-void
-_vte_matcher_print(struct _vte_matcher *matcher)
+/* Get the number of opcodes in use, VTE_MATCHER_OPCODE_NONE included. */
+guint
+_vte_matcher_get_n_opcodes(struct _vte_matcher *matcher)
 {
-	matcher->impl->klass->print(matcher->impl);
+	return matcher->names->len;
 }
 
-/* Free a parameter array.  Most of the GValue elements can clean up after
- * themselves, but we're using gpointers to hold unicode character strings, and
- * we need to free those ourselves. */
+/* Get the sequence name an opcode stands for. */
+const char *
+_vte_matcher_get_opcode_name(struct _vte_matcher *matcher,
+			     guint opcode)
+{
+	g_return_val_if_fail(opcode < matcher->names->len, NULL);
+	return (const char *) g_ptr_array_index(matcher->names, opcode);
+}
+
+/* Dump out the contents of a matcher, mainly for debugging. */
 void
-_vte_matcher_free_params_array(struct _vte_matcher *matcher,
-		               GValueArray *params)
+_vte_matcher_print(struct _vte_matcher *matcher)
 {
-	guint i;
-	for (i = 0; i < params->n_values; i++) {
-		GValue *value = &params->values[i];
-		if (G_UNLIKELY (g_type_is_a (value->g_type, G_TYPE_POINTER))) {
-			g_free (g_value_get_pointer (value));
-		}
-	}
-	if (G_UNLIKELY (matcher == NULL || matcher->free_params != NULL)) {
-		g_value_array_free (params);
-	} else {
-		matcher->free_params = params;
-		params->n_values = 0;
-	}
+	matcher->impl->klass->print(matcher->impl);
 }
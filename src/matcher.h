@@ -28,6 +28,102 @@ G_BEGIN_DECLS
 
 struct _vte_matcher;
 
+/* Every distinct sequence name is given a small integer opcode when the
+ * matcher is set up, so that sequences can be dispatched through a table
+ * instead of by name.  Opcodes are dense, starting at 1. */
+#define VTE_MATCHER_OPCODE_NONE 0
+
+/* The parameters of a matched sequence.  The block lives on the caller's
+ * stack and strings point into the matched input rather than being copied,
+ * so matching a sequence doesn't allocate.  Parameters which don't fit are
+ * dropped. */
+#define VTE_MATCHER_MAX_PARAMS 32
+#define VTE_MATCHER_MAX_SUBPARAMS 32
+
+typedef enum {
+	VTE_MATCHER_PARAM_NUMBER,
+	VTE_MATCHER_PARAM_SUBPARAMS,	/* a ':'-separated group of numbers */
+	VTE_MATCHER_PARAM_STRING
+} VteMatcherParamType;
+
+struct _vte_matcher_param {
+	VteMatcherParamType type;
+	long number;			/* NUMBER */
+	guint sub_start, n_sub;		/* SUBPARAMS, indices into subparams */
+	const gunichar *str;		/* STRING, not NUL-terminated */
+	gsize str_len;
+};
+
+struct _vte_matcher_params {
+	guint n_params;
+	guint n_subparams;
+	struct _vte_matcher_param params[VTE_MATCHER_MAX_PARAMS];
+	long subparams[VTE_MATCHER_MAX_SUBPARAMS];
+};
+
+static inline void
+_vte_matcher_params_clear(struct _vte_matcher_params *params)
+{
+	params->n_params = 0;
+	params->n_subparams = 0;
+}
+
+/* Append a parameter, or return NULL if there's no room left. */
+static inline struct _vte_matcher_param *
+_vte_matcher_params_add(struct _vte_matcher_params *params,
+			VteMatcherParamType type)
+{
+	struct _vte_matcher_param *param;
+
+	if (G_UNLIKELY(params->n_params >= VTE_MATCHER_MAX_PARAMS))
+		return NULL;
+	param = &params->params[params->n_params++];
+	param->type = type;
+	param->number = 0;
+	param->sub_start = params->n_subparams;
+	param->n_sub = 0;
+	param->str = NULL;
+	param->str_len = 0;
+	return param;
+}
+
+static inline void
+_vte_matcher_params_add_number(struct _vte_matcher_params *params,
+			       long number)
+{
+	struct _vte_matcher_param *param;
+
+	param = _vte_matcher_params_add(params, VTE_MATCHER_PARAM_NUMBER);
+	if (param != NULL)
+		param->number = number;
+}
+
+/* Append a number to the group @param, which must be the last parameter. */
+static inline void
+_vte_matcher_params_add_subparam(struct _vte_matcher_params *params,
+				 struct _vte_matcher_param *param,
+				 long number)
+{
+	if (param == NULL ||
+	    G_UNLIKELY(params->n_subparams >= VTE_MATCHER_MAX_SUBPARAMS))
+		return;
+	params->subparams[params->n_subparams++] = number;
+	param->n_sub++;
+}
+
+static inline void
+_vte_matcher_params_add_string(struct _vte_matcher_params *params,
+			       const gunichar *str, gsize length)
+{
+	struct _vte_matcher_param *param;
+
+	param = _vte_matcher_params_add(params, VTE_MATCHER_PARAM_STRING);
+	if (param != NULL) {
+		param->str = str;
+		param->str_len = length;
+	}
+}
+
 struct _vte_matcher_impl {
 	const struct _vte_matcher_class *klass;
 	/* private */
@@ -36,11 +132,11 @@ struct _vte_matcher_impl {
 typedef struct _vte_matcher_impl *(*_vte_matcher_create_func)(void);
 typedef const char *(*_vte_matcher_match_func)(struct _vte_matcher_impl *impl,
 		const gunichar *pattern, gssize length,
-		const char **res, const gunichar **consumed,
-		GValueArray **array);
+		const char **res, guint *opcode,
+		const gunichar **consumed, struct _vte_matcher_params *params);
 typedef void (*_vte_matcher_add_func)(struct _vte_matcher_impl *impl,
 		const char *pattern, gssize length,
-		const char *result);
+		const char *result, guint opcode);
 typedef void (*_vte_matcher_print_func)(struct _vte_matcher_impl *impl);
 typedef void (*_vte_matcher_destroy_func)(struct _vte_matcher_impl *impl);
 struct _vte_matcher_class{
@@ -60,15 +156,20 @@ void _vte_matcher_free(struct _vte_matcher *matcher);
 /* Check if a string matches a sequence the matcher knows about. */
 const char *_vte_matcher_match(struct _vte_matcher *matcher,
 			       const gunichar *pattern, gssize length,
-			       const char **res, const gunichar **consumed,
-			       GValueArray **array);
+			       const char **res, guint *opcode,
+			       const gunichar **consumed,
+			       struct _vte_matcher_params *params);
+
+/* Get the number of opcodes in use, VTE_MATCHER_OPCODE_NONE included. */
+guint _vte_matcher_get_n_opcodes(struct _vte_matcher *matcher);
+
+/* Get the sequence name an opcode stands for. */
+const char *_vte_matcher_get_opcode_name(struct _vte_matcher *matcher,
+                                         guint opcode);
 
 /* Dump out the contents of a matcher, mainly for debugging. */
 void _vte_matcher_print(struct _vte_matcher *matcher);
 
-/* Free a parameter array. */
-void _vte_matcher_free_params_array(struct _vte_matcher *matcher, GValueArray *params);
-
 G_END_DECLS
 
 #endif
@@ -0,0 +1,1271 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <config.h>
+#include <sys/types.h>
+#include <string.h>
+#include <wchar.h>
+#include <glib.h>
+#include <glib-object.h>
+#include "debug.h"
+#include "matcher.h"
+#include "parser.h"
+
+/* Character classes. Everything at or above 0xA0 is CL_HIGH. */
+enum {
+        CL_C0,                  /* C0 controls, except the ones below */
+        CL_BEL,
+        CL_CAN_SUB,
+        CL_ESC,
+        CL_INTERMEDIATE,        /* 0x20..0x2F */
+        CL_PARAM,               /* 0x30..0x3B: digits, ':' and ';' */
+        CL_PRIVATE,             /* 0x3C..0x3F */
+        CL_FINAL,               /* 0x40..0x7E, except the ones below */
+        CL_CSI,                 /* '[' */
+        CL_OSC,                 /* ']' */
+        CL_DCS,                 /* 'P' */
+        CL_SOS,                 /* 'X', '^' and '_' */
+        CL_BACKSLASH,
+        CL_DEL,
+        CL_C1,                  /* C1 controls, except the ones below */
+        CL_C1_CSI,
+        CL_C1_OSC,
+        CL_C1_DCS,
+        CL_C1_SOS,
+        CL_C1_ST,
+        CL_HIGH,
+        CL_COUNT
+};
+
+#define VTE_PARSER_N_CLASSES 0xA0
+
+/* States. */
+enum {
+        ST_GROUND,
+        ST_ESCAPE,
+        ST_ESCAPE_INTERMEDIATE,
+        ST_CSI_ENTRY,
+        ST_CSI_PARAM,
+        ST_CSI_INTERMEDIATE,
+        ST_CSI_IGNORE,
+        ST_OSC_STRING,
+        ST_DCS_STRING,
+        ST_OSC_STRING_ESC,
+        ST_DCS_STRING_ESC,
+        ST_COUNT
+};
+
+/* Actions performed on a transition. */
+enum {
+        A_NONE,
+        A_PRINT,
+        A_EXECUTE,
+        A_INTERRUPT,
+        A_INTRO,
+        A_COLLECT,
+        A_PARAM,
+        A_ESC_DISPATCH,
+        A_CSI_DISPATCH,
+        A_STRING_DISPATCH,
+        A_IGNORE,               /* discard up to and including this character */
+        A_ABORT,                /* discard up to this character */
+        A_ABORT_PREV            /* discard up to the previous character */
+};
+
+#define TRANSITION(action, state) ((guint8)(((action) << 4) | (state)))
+#define TRANSITION_ACTION(t) ((t) >> 4)
+#define TRANSITION_STATE(t) ((t) & 0xf)
+
+/* Kinds of known sequences. */
+enum {
+        KIND_ESC,
+        KIND_CSI,
+        KIND_OSC,
+        KIND_DCS
+};
+
+/* Parameter slots of known sequences. */
+enum {
+        SLOT_EMPTY,             /* nothing between two separators */
+        SLOT_NUMBER,            /* %d */
+        SLOT_LIST,              /* %m */
+        SLOT_STRING             /* %s */
+};
+
+#define VTE_PARSER_MAX_SLOTS 8
+#define VTE_PARSER_MAX_PREFIX 8
+
+struct _vte_parser_pattern {
+        const char *result;
+        guint opcode;
+        guint16 next;           /* 1-based index of the next pattern in the chain */
+        guint8 kind;
+        guint8 n_slots;
+        guint8 slots[VTE_PARSER_MAX_SLOTS];
+        gunichar introducer;
+        gunichar private_marker;
+        gunichar intermediate;
+        gunichar final;
+        gboolean st_terminated;
+        guint prefix_len;
+        gunichar prefix[VTE_PARSER_MAX_PREFIX];
+};
+
+struct _vte_parser {
+        struct _vte_matcher_impl impl;
+        guint8 classes[VTE_PARSER_N_CLASSES];
+        guint8 transitions[ST_COUNT][CL_COUNT];
+        /* Known control functions, indexed by character. */
+        const char *controls[VTE_PARSER_N_CLASSES];
+        guint control_opcodes[VTE_PARSER_N_CLASSES];
+        /* Chains of known sequences, 1-based indices into @patterns. */
+        guint16 esc_heads[0x7F - 0x30];
+        guint16 csi_heads[0x7F - 0x40];
+        guint16 string_head;
+        GArray *patterns;
+};
+
+static void
+_vte_parser_init_classes(struct _vte_parser *parser)
+{
+        guint8 *cl = parser->classes;
+        guint c;
+
+        for (c = 0x00; c < 0x20; c++)
+                cl[c] = CL_C0;
+        cl[0x07] = CL_BEL;
+        cl[0x18] = cl[0x1A] = CL_CAN_SUB;
+        cl[0x1B] = CL_ESC;
+        for (c = 0x20; c < 0x30; c++)
+                cl[c] = CL_INTERMEDIATE;
+        for (c = 0x30; c < 0x3C; c++)
+                cl[c] = CL_PARAM;
+        for (c = 0x3C; c < 0x40; c++)
+                cl[c] = CL_PRIVATE;
+        for (c = 0x40; c < 0x7F; c++)
+                cl[c] = CL_FINAL;
+        cl['['] = CL_CSI;
+        cl[']'] = CL_OSC;
+        cl['P'] = CL_DCS;
+        cl['X'] = cl['^'] = cl['_'] = CL_SOS;
+        cl['\\'] = CL_BACKSLASH;
+        cl[0x7F] = CL_DEL;
+        for (c = 0x80; c < 0xA0; c++)
+                cl[c] = CL_C1;
+        cl[0x9B] = CL_C1_CSI;
+        cl[0x9D] = CL_C1_OSC;
+        cl[0x90] = CL_C1_DCS;
+        cl[0x98] = cl[0x9E] = cl[0x9F] = CL_C1_SOS;
+        cl[0x9C] = CL_C1_ST;
+}
+
+static void
+_vte_parser_set(struct _vte_parser *parser,
+                guint state, guint first, guint last,
+                guint action, guint next)
+{
+        guint cls;
+        for (cls = first; cls <= last; cls++)
+                parser->transitions[state][cls] = TRANSITION(action, next);
+}
+
+static void
+_vte_parser_init_transitions(struct _vte_parser *parser)
+{
+        guint state;
+
+        /* Inside any sequence: ESC and C1 controls start over, CAN and SUB
+         * cancel, C0 controls are executed in place, DEL is ignored and
+         * anything above C1 cannot be part of a sequence. */
+        for (state = ST_ESCAPE; state < ST_COUNT; state++) {
+                _vte_parser_set(parser, state, CL_C0, CL_BEL, A_INTERRUPT, state);
+                _vte_parser_set(parser, state, CL_CAN_SUB, CL_CAN_SUB, A_IGNORE, ST_GROUND);
+                _vte_parser_set(parser, state, CL_ESC, CL_ESC, A_ABORT, ST_GROUND);
+                _vte_parser_set(parser, state, CL_DEL, CL_DEL, A_NONE, state);
+                _vte_parser_set(parser, state, CL_C1, CL_C1_ST, A_ABORT, ST_GROUND);
+                _vte_parser_set(parser, state, CL_HIGH, CL_HIGH, A_ABORT, ST_GROUND);
+        }
+
+        _vte_parser_set(parser, ST_GROUND, CL_C0, CL_CAN_SUB, A_EXECUTE, ST_GROUND);
+        _vte_parser_set(parser, ST_GROUND, CL_ESC, CL_ESC, A_NONE, ST_ESCAPE);
+        _vte_parser_set(parser, ST_GROUND, CL_INTERMEDIATE, CL_BACKSLASH, A_PRINT, ST_GROUND);
+        _vte_parser_set(parser, ST_GROUND, CL_DEL, CL_C1, A_EXECUTE, ST_GROUND);
+        _vte_parser_set(parser, ST_GROUND, CL_C1_ST, CL_C1_ST, A_EXECUTE, ST_GROUND);
+        _vte_parser_set(parser, ST_GROUND, CL_C1_CSI, CL_C1_CSI, A_INTRO, ST_CSI_ENTRY);
+        _vte_parser_set(parser, ST_GROUND, CL_C1_OSC, CL_C1_OSC, A_INTRO, ST_OSC_STRING);
+        _vte_parser_set(parser, ST_GROUND, CL_C1_DCS, CL_C1_SOS, A_INTRO, ST_DCS_STRING);
+        _vte_parser_set(parser, ST_GROUND, CL_HIGH, CL_HIGH, A_PRINT, ST_GROUND);
+
+        _vte_parser_set(parser, ST_ESCAPE, CL_INTERMEDIATE, CL_INTERMEDIATE, A_COLLECT, ST_ESCAPE_INTERMEDIATE);
+        _vte_parser_set(parser, ST_ESCAPE, CL_PARAM, CL_FINAL, A_ESC_DISPATCH, ST_GROUND);
+        _vte_parser_set(parser, ST_ESCAPE, CL_BACKSLASH, CL_BACKSLASH, A_ESC_DISPATCH, ST_GROUND);
+        _vte_parser_set(parser, ST_ESCAPE, CL_CSI, CL_CSI, A_INTRO, ST_CSI_ENTRY);
+        _vte_parser_set(parser, ST_ESCAPE, CL_OSC, CL_OSC, A_INTRO, ST_OSC_STRING);
+        _vte_parser_set(parser, ST_ESCAPE, CL_DCS, CL_SOS, A_INTRO, ST_DCS_STRING);
+
+        _vte_parser_set(parser, ST_ESCAPE_INTERMEDIATE, CL_INTERMEDIATE, CL_INTERMEDIATE, A_COLLECT, ST_ESCAPE_INTERMEDIATE);
+        _vte_parser_set(parser, ST_ESCAPE_INTERMEDIATE, CL_PARAM, CL_BACKSLASH, A_ESC_DISPATCH, ST_GROUND);
+
+        _vte_parser_set(parser, ST_CSI_ENTRY, CL_INTERMEDIATE, CL_INTERMEDIATE, A_COLLECT, ST_CSI_INTERMEDIATE);
+        _vte_parser_set(parser, ST_CSI_ENTRY, CL_PARAM, CL_PARAM, A_PARAM, ST_CSI_PARAM);
+        _vte_parser_set(parser, ST_CSI_ENTRY, CL_PRIVATE, CL_PRIVATE, A_COLLECT, ST_CSI_PARAM);
+        _vte_parser_set(parser, ST_CSI_ENTRY, CL_FINAL, CL_BACKSLASH, A_CSI_DISPATCH, ST_GROUND);
+
+        _vte_parser_set(parser, ST_CSI_PARAM, CL_INTERMEDIATE, CL_INTERMEDIATE, A_COLLECT, ST_CSI_INTERMEDIATE);
+        _vte_parser_set(parser, ST_CSI_PARAM, CL_PARAM, CL_PARAM, A_PARAM, ST_CSI_PARAM);
+        _vte_parser_set(parser, ST_CSI_PARAM, CL_PRIVATE, CL_PRIVATE, A_NONE, ST_CSI_IGNORE);
+        _vte_parser_set(parser, ST_CSI_PARAM, CL_FINAL, CL_BACKSLASH, A_CSI_DISPATCH, ST_GROUND);
+
+        _vte_parser_set(parser, ST_CSI_INTERMEDIATE, CL_INTERMEDIATE, CL_INTERMEDIATE, A_COLLECT, ST_CSI_INTERMEDIATE);
+        _vte_parser_set(parser, ST_CSI_INTERMEDIATE, CL_PARAM, CL_PRIVATE, A_NONE, ST_CSI_IGNORE);
+        _vte_parser_set(parser, ST_CSI_INTERMEDIATE, CL_FINAL, CL_BACKSLASH, A_CSI_DISPATCH, ST_GROUND);
+
+        _vte_parser_set(parser, ST_CSI_IGNORE, CL_INTERMEDIATE, CL_PRIVATE, A_NONE, ST_CSI_IGNORE);
+        _vte_parser_set(parser, ST_CSI_IGNORE, CL_FINAL, CL_BACKSLASH, A_IGNORE, ST_GROUND);
+
+        /* Strings take everything up to their terminator, including C0
+         * controls, like the "%s" patterns of the table matcher. OSC may be
+         * terminated by BEL as well as by ST. */
+        for (state = ST_OSC_STRING; state <= ST_DCS_STRING; state++) {
+                _vte_parser_set(parser, state, CL_C0, CL_BEL, A_NONE, state);
+                _vte_parser_set(parser, state, CL_INTERMEDIATE, CL_DEL, A_NONE, state);
+                _vte_parser_set(parser, state, CL_HIGH, CL_HIGH, A_NONE, state);
+                _vte_parser_set(parser, state, CL_C1_ST, CL_C1_ST, A_STRING_DISPATCH, ST_GROUND);
+        }
+        _vte_parser_set(parser, ST_OSC_STRING, CL_BEL, CL_BEL, A_STRING_DISPATCH, ST_GROUND);
+        _vte_parser_set(parser, ST_OSC_STRING, CL_ESC, CL_ESC, A_NONE, ST_OSC_STRING_ESC);
+        _vte_parser_set(parser, ST_DCS_STRING, CL_ESC, CL_ESC, A_NONE, ST_DCS_STRING_ESC);
+
+        /* ESC inside a string: either the start of ST, or the start of
+         * another sequence which aborts the string. */
+        for (state = ST_OSC_STRING_ESC; state <= ST_DCS_STRING_ESC; state++) {
+                _vte_parser_set(parser, state, CL_C0, CL_HIGH, A_ABORT_PREV, ST_GROUND);
+                _vte_parser_set(parser, state, CL_BACKSLASH, CL_BACKSLASH, A_STRING_DISPATCH, ST_GROUND);
+        }
+}
+
+/* Create an empty parser. */
+struct _vte_parser *
+_vte_parser_new(void)
+{
+        struct _vte_parser *ret;
+
+        ret = g_slice_new0(struct _vte_parser);
+        ret->impl.klass = &_vte_matcher_parser;
+        ret->patterns = g_array_new(FALSE, TRUE, sizeof(struct _vte_parser_pattern));
+        _vte_parser_init_classes(ret);
+        _vte_parser_init_transitions(ret);
+        return ret;
+}
+
+/* Free a parser. */
+void
+_vte_parser_free(struct _vte_parser *parser)
+{
+        g_array_free(parser->patterns, TRUE);
+        g_slice_free(struct _vte_parser, parser);
+}
+
+static inline guint
+_vte_parser_class(struct _vte_parser *parser,
+                  gunichar c)
+{
+        return c < VTE_PARSER_N_CLASSES ? parser->classes[c] : CL_HIGH;
+}
+
+/* Parse the parameter section of a pattern ("%d;%d", "%m", ";%d", ...)
+ * into slots. Returns the number of characters consumed, or -1. */
+static gssize
+_vte_parser_pattern_slots(const guchar *p, const guchar *end,
+                          struct _vte_parser_pattern *pattern)
+{
+        const guchar *start = p;
+        guint8 slot = SLOT_EMPTY;
+        gboolean started = FALSE;
+
+        while (p < end) {
+                if (p + 1 < end && p[0] == '%' &&
+                    (p[1] == 'd' || p[1] == 'm' || p[1] == 's')) {
+                        slot = p[1] == 'd' ? SLOT_NUMBER :
+                               p[1] == 'm' ? SLOT_LIST : SLOT_STRING;
+                        started = TRUE;
+                        p += 2;
+                } else if (p[0] == ';') {
+                        if (pattern->n_slots == VTE_PARSER_MAX_SLOTS)
+                                return -1;
+                        pattern->slots[pattern->n_slots++] = slot;
+                        slot = SLOT_EMPTY;
+                        started = TRUE;
+                        p++;
+                } else {
+                        break;
+                }
+        }
+        if (started) {
+                if (pattern->n_slots == VTE_PARSER_MAX_SLOTS)
+                        return -1;
+                pattern->slots[pattern->n_slots++] = slot;
+        }
+        return p - start;
+}
+
+static gboolean
+_vte_parser_pattern_equal(const struct _vte_parser_pattern *a,
+                          const struct _vte_parser_pattern *b)
+{
+        return a->kind == b->kind &&
+               a->introducer == b->introducer &&
+               a->private_marker == b->private_marker &&
+               a->intermediate == b->intermediate &&
+               a->final == b->final &&
+               a->st_terminated == b->st_terminated &&
+               a->n_slots == b->n_slots &&
+               memcmp(a->slots, b->slots, a->n_slots) == 0 &&
+               a->prefix_len == b->prefix_len &&
+               memcmp(a->prefix, b->prefix, a->prefix_len * sizeof(gunichar)) == 0;
+}
+
+/* Append a compiled pattern to its chain, unless it's already there. */
+static void
+_vte_parser_add_pattern(struct _vte_parser *parser,
+                        guint16 *head,
+                        struct _vte_parser_pattern *pattern)
+{
+        struct _vte_parser_pattern *other;
+        guint16 prev = 0;       /* the last pattern of the chain, + 1 */
+        guint16 link;
+
+        for (link = *head; link != 0; link = other->next) {
+                other = &g_array_index(parser->patterns,
+                                       struct _vte_parser_pattern, link - 1);
+                if (_vte_parser_pattern_equal(other, pattern)) {
+                        if (other->result != pattern->result)
+                                _vte_debug_print(VTE_DEBUG_PARSE,
+                                                 "`%s' and `%s' are indistinguishable.\n",
+                                                 other->result, pattern->result);
+                        other->result = pattern->result;
+                        other->opcode = pattern->opcode;
+                        return;
+                }
+                prev = link;
+        }
+
+        /* Appending can move the array, so look up the predecessor afterwards. */
+        g_assert_cmpuint(parser->patterns->len, <, G_MAXUINT16);
+        g_array_append_val(parser->patterns, *pattern);
+        if (prev == 0)
+                *head = parser->patterns->len;
+        else
+                g_array_index(parser->patterns,
+                              struct _vte_parser_pattern, prev - 1).next = parser->patterns->len;
+}
+
+/* Teach the parser the name of a sequence. Patterns use the same syntax as
+ * the ones in caps.cc; each character of @pattern is taken as a code point. */
+void
+_vte_parser_add(struct _vte_parser *parser,
+                const char *pattern, gssize length,
+                const char *result, guint opcode)
+{
+        struct _vte_parser_pattern compiled;
+        const guchar *p, *end;
+        guint cls;
+        gssize n;
+
+        if (length == -1) {
+                length = strlen(pattern);
+        }
+        p = (const guchar *) pattern;
+        end = p + length;
+        result = g_intern_string(result);
+
+        if (length == 0) {
+                return;
+        }
+
+        /* Single control functions. */
+        cls = _vte_parser_class(parser, p[0]);
+        if (length == 1) {
+                if (cls == CL_C0 || cls == CL_BEL || cls == CL_CAN_SUB ||
+                    cls == CL_DEL || cls == CL_C1 || cls == CL_C1_ST) {
+                        parser->controls[p[0]] = result;
+                        parser->control_opcodes[p[0]] = opcode;
+                        return;
+                }
+                goto unsupported;
+        }
+
+        memset(&compiled, 0, sizeof(compiled));
+        compiled.result = result;
+        compiled.opcode = opcode;
+
+        /* The introducer, in its 7-bit or 8-bit form. */
+        if (cls == CL_ESC) {
+                p++;
+                cls = _vte_parser_class(parser, p[0]);
+                switch (cls) {
+                case CL_CSI:
+                        compiled.kind = KIND_CSI;
+                        break;
+                case CL_OSC:
+                        compiled.kind = KIND_OSC;
+                        break;
+                case CL_DCS:
+                case CL_SOS:
+                        compiled.kind = KIND_DCS;
+                        break;
+                default:
+                        compiled.kind = KIND_ESC;
+                        break;
+                }
+                if (compiled.kind != KIND_ESC) {
+                        compiled.introducer = *p++;
+                }
+        } else {
+                switch (cls) {
+                case CL_C1_CSI:
+                        compiled.kind = KIND_CSI;
+                        break;
+                case CL_C1_OSC:
+                        compiled.kind = KIND_OSC;
+                        break;
+                case CL_C1_DCS:
+                case CL_C1_SOS:
+                        compiled.kind = KIND_DCS;
+                        break;
+                default:
+                        goto unsupported;
+                }
+                compiled.introducer = *p++ - 0x40;
+        }
+
+        switch (compiled.kind) {
+        case KIND_ESC:
+                /* Intermediate (possibly an escaped '%'), then the final. */
+                if (p < end && _vte_parser_class(parser, p[0]) == CL_INTERMEDIATE) {
+                        compiled.intermediate = p[0];
+                        p += (p[0] == '%' && p + 1 < end && p[1] == '%') ? 2 : 1;
+                }
+                if (p + 1 != end || p[0] < 0x30 || p[0] > 0x7E)
+                        goto unsupported;
+                compiled.final = *p++;
+                _vte_parser_add_pattern(parser,
+                                        &parser->esc_heads[compiled.final - 0x30],
+                                        &compiled);
+                return;
+
+        case KIND_CSI:
+                if (p < end && _vte_parser_class(parser, p[0]) == CL_PRIVATE) {
+                        compiled.private_marker = *p++;
+                }
+                n = _vte_parser_pattern_slots(p, end, &compiled);
+                if (n < 0)
+                        goto unsupported;
+                p += n;
+                if (p < end && _vte_parser_class(parser, p[0]) == CL_INTERMEDIATE) {
+                        compiled.intermediate = *p++;
+                }
+                if (p + 1 != end || p[0] < 0x40 || p[0] > 0x7E)
+                        goto unsupported;
+                if (compiled.n_slots > 1) {
+                        for (n = 0; n < compiled.n_slots; n++)
+                                if (compiled.slots[n] == SLOT_LIST)
+                                        goto unsupported;
+                }
+                compiled.final = *p++;
+                _vte_parser_add_pattern(parser,
+                                        &parser->csi_heads[compiled.final - 0x40],
+                                        &compiled);
+                return;
+
+        default:
+                /* A literal prefix, then the arguments, then the terminator. */
+                while (p < end && p[0] != '%' &&
+                       p[0] != 0x07 && p[0] != 0x1B && p[0] != 0x9C) {
+                        if (compiled.prefix_len == VTE_PARSER_MAX_PREFIX)
+                                goto unsupported;
+                        compiled.prefix[compiled.prefix_len++] = *p++;
+                }
+                n = _vte_parser_pattern_slots(p, end, &compiled);
+                if (n < 0)
+                        goto unsupported;
+                p += n;
+                if (end - p == 1 && p[0] == 0x07 && compiled.kind == KIND_OSC) {
+                        compiled.st_terminated = FALSE;
+                } else if ((end - p == 1 && p[0] == 0x9C) ||
+                           (end - p == 2 && p[0] == 0x1B && p[1] == '\\')) {
+                        compiled.st_terminated = TRUE;
+                } else {
+                        goto unsupported;
+                }
+                _vte_parser_add_pattern(parser, &parser->string_head, &compiled);
+                return;
+        }
+
+unsupported:
+        _vte_debug_print(VTE_DEBUG_PARSE,
+                         "Sequence `%s' not supported by the parser.\n", result);
+}
+
+/* Recognize the sequence (if any) at the start of @candidate. */
+VteParserAction
+_vte_parser_parse(struct _vte_parser *parser,
+                  const gunichar *candidate, gssize length,
+                  struct _vte_parser_sequence *seq)
+{
+        const gunichar *p, *end;
+        gunichar c;
+        guint state, t, n, i;
+        gboolean ignore;
+
+        seq->introducer = 0;
+        seq->private_marker = 0;
+        seq->intermediate = 0;
+        seq->n_params = 0;
+        seq->colon_mask = 0;
+        seq->str = NULL;
+        seq->str_len = 0;
+
+        state = ST_GROUND;
+        ignore = FALSE;
+        n = 0;
+        end = candidate + length;
+        for (p = candidate; p < end; p++) {
+                c = *p;
+                t = parser->transitions[state][_vte_parser_class(parser, c)];
+                state = TRANSITION_STATE(t);
+
+                switch (TRANSITION_ACTION(t)) {
+                case A_NONE:
+                        break;
+
+                case A_PRINT:
+                        seq->end = p;
+                        return seq->action = VTE_PARSER_ACTION_NONE;
+
+                case A_EXECUTE:
+                        seq->control = c;
+                        seq->end = p + 1;
+                        return seq->action = VTE_PARSER_ACTION_EXECUTE;
+
+                case A_INTERRUPT:
+                        seq->control = c;
+                        seq->end = p;
+                        return seq->action = VTE_PARSER_ACTION_INTERRUPT;
+
+                case A_INTRO:
+                        seq->introducer = c >= 0x80 ? c - 0x40 : c;
+                        seq->str = p + 1;
+                        break;
+
+                case A_COLLECT:
+                        if (c >= 0x3C) {
+                                seq->private_marker = c;
+                        } else if (seq->intermediate == 0) {
+                                seq->intermediate = c;
+                        } else {
+                                /* We only know sequences with at most
+                                 * one intermediate. */
+                                ignore = TRUE;
+                        }
+                        break;
+
+                case A_PARAM:
+                        if (n == 0) {
+                                seq->params[0] = -1;
+                                n = 1;
+                        }
+                        i = MIN(n, VTE_PARSER_MAX_PARAMS + 1) - 1;
+                        if (c <= '9') {
+                                int v = MAX(seq->params[i], 0) * 10 + (c - '0');
+                                seq->params[i] = MIN(v, G_MAXUSHORT);
+                        } else {
+                                /* ':' or ';' */
+                                if (c == ':' && i < VTE_PARSER_MAX_PARAMS)
+                                        seq->colon_mask |= 1u << i;
+                                if (n <= VTE_PARSER_MAX_PARAMS)
+                                        seq->params[n] = -1;
+                                n++;
+                        }
+                        break;
+
+                case A_ESC_DISPATCH:
+                case A_CSI_DISPATCH:
+                        seq->final = c;
+                        seq->n_params = MIN(n, VTE_PARSER_MAX_PARAMS);
+                        seq->end = p + 1;
+                        if (G_UNLIKELY(ignore))
+                                return seq->action = VTE_PARSER_ACTION_IGNORE;
+                        return seq->action = TRANSITION_ACTION(t) == A_ESC_DISPATCH ?
+                                VTE_PARSER_ACTION_ESC_DISPATCH :
+                                VTE_PARSER_ACTION_CSI_DISPATCH;
+
+                case A_STRING_DISPATCH:
+                        seq->st_terminated = c != 0x07;
+                        seq->str_len = (p - seq->str) - (c == '\\' ? 1 : 0);
+                        seq->end = p + 1;
+                        return seq->action = seq->introducer == ']' ?
+                                VTE_PARSER_ACTION_OSC_DISPATCH :
+                                VTE_PARSER_ACTION_DCS_DISPATCH;
+
+                case A_IGNORE:
+                        seq->end = p + 1;
+                        return seq->action = VTE_PARSER_ACTION_IGNORE;
+
+                case A_ABORT:
+                        seq->end = p;
+                        return seq->action = VTE_PARSER_ACTION_IGNORE;
+
+                case A_ABORT_PREV:
+                        seq->end = p - 1;
+                        return seq->action = VTE_PARSER_ACTION_IGNORE;
+                }
+        }
+
+        seq->end = end;
+        return seq->action = state == ST_GROUND ?
+                VTE_PARSER_ACTION_NONE : VTE_PARSER_ACTION_INCOMPLETE;
+}
+
+/* Append a number, starting or continuing a group if it's followed by
+ * ':'. Once the group is closed, @group is reset. */
+static void
+_vte_parser_append_long(struct _vte_matcher_params *params,
+                        struct _vte_matcher_param **group,
+                        long v,
+                        gboolean colon)
+{
+        if (colon) {
+                if (*group == NULL) {
+                        *group = _vte_matcher_params_add(params,
+                                                         VTE_MATCHER_PARAM_SUBPARAMS);
+                }
+                _vte_matcher_params_add_subparam(params, *group, v);
+        } else if (*group == NULL) {
+                _vte_matcher_params_add_number(params, v);
+        } else {
+                _vte_matcher_params_add_subparam(params, *group, v);
+                *group = NULL;
+        }
+}
+
+/* Parse a "%m" argument of a string sequence the same way as CSI does. */
+static void
+_vte_parser_append_number_list(struct _vte_matcher_params *params,
+                               const gunichar *start,
+                               gsize length)
+{
+        struct _vte_matcher_param *group = NULL;
+        gsize i = 0;
+
+        do {
+                long total = 0;
+                for (; i < length && start[i] != ';' && start[i] != ':'; i++) {
+                        total = MIN(total * 10 + (start[i] - '0'), G_MAXUSHORT);
+                }
+                _vte_parser_append_long(params, &group, total,
+                                        i < length && start[i] == ':');
+        } while (i++ < length);
+}
+
+static gboolean
+_vte_parser_is_numeric(const gunichar *start,
+                       gsize length,
+                       gboolean list)
+{
+        gsize i;
+
+        if (length == 0)
+                return FALSE;
+        for (i = 0; i < length; i++) {
+                if (!((start[i] >= '0' && start[i] <= '9') ||
+                      (list && (start[i] == ';' || start[i] == ':'))))
+                        return FALSE;
+        }
+        return TRUE;
+}
+
+static const struct _vte_parser_pattern *
+_vte_parser_find_csi(struct _vte_parser *parser,
+                     const struct _vte_parser_sequence *seq)
+{
+        const struct _vte_parser_pattern *pattern, *list = NULL;
+        guint16 link;
+        guint i;
+
+        for (link = parser->csi_heads[seq->final - 0x40];
+             link != 0;
+             link = pattern->next) {
+                pattern = &g_array_index(parser->patterns,
+                                         struct _vte_parser_pattern, link - 1);
+                if (pattern->private_marker != seq->private_marker ||
+                    pattern->intermediate != seq->intermediate)
+                        continue;
+                /* Like in the table, "%m" also matches no parameters at
+                 * all; but an exact match takes precedence. */
+                if (pattern->n_slots == 1 && pattern->slots[0] == SLOT_LIST) {
+                        if (list == NULL)
+                                list = pattern;
+                        continue;
+                }
+                if (pattern->n_slots != seq->n_params || seq->colon_mask != 0)
+                        continue;
+                for (i = 0; i < seq->n_params; i++) {
+                        if ((pattern->slots[i] == SLOT_NUMBER) != (seq->params[i] >= 0))
+                                break;
+                }
+                if (i == seq->n_params)
+                        return pattern;
+        }
+        return list;
+}
+
+/* Check whether the arguments of a string sequence fit @pattern, and
+ * extract them into @params if so. */
+static gboolean
+_vte_parser_match_string_args(const struct _vte_parser_pattern *pattern,
+                              const gunichar *start, gsize length,
+                              struct _vte_matcher_params *params)
+{
+        const gunichar *arg, *sep;
+        gsize arg_len;
+        guint i;
+
+        if (pattern->n_slots == 0)
+                return length == 0;
+
+        if (pattern->slots[0] == SLOT_LIST && pattern->n_slots == 1 && length == 0)
+                return TRUE;
+        if (pattern->slots[0] == SLOT_NUMBER || pattern->slots[0] == SLOT_LIST) {
+                if (pattern->n_slots != 1 ||
+                    !_vte_parser_is_numeric(start, length,
+                                            pattern->slots[0] == SLOT_LIST))
+                        return FALSE;
+                if (params != NULL)
+                        _vte_parser_append_number_list(params, start, length);
+                return TRUE;
+        }
+
+        /* All but the last string end at the next ';'. First check that
+         * they're all there, then extract them. */
+        for (arg = start, i = 0; i + 1 < pattern->n_slots; i++) {
+                if (pattern->slots[i] != SLOT_STRING)
+                        return FALSE;
+                for (sep = arg; sep < start + length && *sep != ';'; sep++) ;
+                if (sep == start + length)
+                        return FALSE;
+                arg = sep + 1;
+        }
+        if (params == NULL)
+                return TRUE;
+        for (arg = start, i = 0; i < pattern->n_slots; i++) {
+                if (i + 1 < pattern->n_slots) {
+                        for (sep = arg; *sep != ';'; sep++) ;
+                } else {
+                        sep = start + length;
+                }
+                arg_len = sep - arg;
+                _vte_matcher_params_add_string(params, arg, arg_len);
+                arg = sep + 1;
+        }
+        return TRUE;
+}
+
+static const struct _vte_parser_pattern *
+_vte_parser_find_string(struct _vte_parser *parser,
+                        const struct _vte_parser_sequence *seq)
+{
+        const struct _vte_parser_pattern *pattern, *best = NULL;
+        guint16 link;
+
+        /* Strings are rare, a linear search will do. Prefer the
+         * longest literal prefix. */
+        for (link = parser->string_head; link != 0; link = pattern->next) {
+                pattern = &g_array_index(parser->patterns,
+                                         struct _vte_parser_pattern, link - 1);
+                if (pattern->introducer != seq->introducer ||
+                    pattern->st_terminated != seq->st_terminated ||
+                    pattern->prefix_len > seq->str_len ||
+                    memcmp(pattern->prefix, seq->str,
+                           pattern->prefix_len * sizeof(gunichar)) != 0)
+                        continue;
+                if (best != NULL && best->prefix_len >= pattern->prefix_len)
+                        continue;
+                if (_vte_parser_match_string_args(pattern,
+                                                  seq->str + pattern->prefix_len,
+                                                  seq->str_len - pattern->prefix_len,
+                                                  NULL))
+                        best = pattern;
+        }
+        return best;
+}
+
+/* Check if a string matches a known sequence. The return values and
+ * parameters are the same as those of _vte_table_match(). */
+const char *
+_vte_parser_match(struct _vte_parser *parser,
+                  const gunichar *candidate, gssize length,
+                  const char **res, guint *opcode,
+                  const gunichar **consumed,
+                  struct _vte_matcher_params *params)
+{
+        struct _vte_parser_sequence seq;
+        const struct _vte_parser_pattern *pattern = NULL;
+        const gunichar *dummy_consumed;
+        const char *dummy_res;
+        guint dummy_opcode;
+        const char *ret;
+        struct _vte_matcher_param *group = NULL;
+        guint i;
+
+        if (G_UNLIKELY (res == NULL)) {
+                res = &dummy_res;
+        }
+        *res = NULL;
+        if (G_UNLIKELY (opcode == NULL)) {
+                opcode = &dummy_opcode;
+        }
+        *opcode = VTE_MATCHER_OPCODE_NONE;
+        if (G_UNLIKELY (consumed == NULL)) {
+                consumed = &dummy_consumed;
+        }
+        *consumed = candidate;
+        if (params != NULL) {
+                _vte_matcher_params_clear(params);
+        }
+
+        /* Provide a fast path for the usual "not a sequence" cases. */
+        if (G_LIKELY (length == 0 || candidate == NULL ||
+                      _vte_parser_class(parser, candidate[0]) == CL_HIGH ||
+                      (candidate[0] >= 0x20 && candidate[0] < 0x7F))) {
+                return NULL;
+        }
+
+        switch (_vte_parser_parse(parser, candidate, length, &seq)) {
+        case VTE_PARSER_ACTION_NONE:
+                return NULL;
+
+        case VTE_PARSER_ACTION_INTERRUPT:
+                /* Let the caller execute the control first. */
+                *consumed = seq.end;
+                return NULL;
+
+        case VTE_PARSER_ACTION_INCOMPLETE:
+                *consumed = seq.end;
+                return *res = "";
+
+        case VTE_PARSER_ACTION_EXECUTE:
+                ret = parser->controls[seq.control];
+                if (ret != NULL) {
+                        *consumed = seq.end;
+                        *opcode = parser->control_opcodes[seq.control];
+                }
+                return *res = ret;
+
+        case VTE_PARSER_ACTION_ESC_DISPATCH:
+                for (i = parser->esc_heads[seq.final - 0x30]; i != 0; i = pattern->next) {
+                        pattern = &g_array_index(parser->patterns,
+                                                 struct _vte_parser_pattern, i - 1);
+                        if (pattern->intermediate == seq.intermediate)
+                                break;
+                }
+                if (i == 0)
+                        pattern = NULL;
+                break;
+
+        case VTE_PARSER_ACTION_CSI_DISPATCH:
+                pattern = _vte_parser_find_csi(parser, &seq);
+                break;
+
+        case VTE_PARSER_ACTION_OSC_DISPATCH:
+        case VTE_PARSER_ACTION_DCS_DISPATCH:
+                pattern = _vte_parser_find_string(parser, &seq);
+                break;
+
+        case VTE_PARSER_ACTION_IGNORE:
+                break;
+        }
+
+        if (pattern == NULL) {
+                /* A complete but unknown or malformed sequence: have the
+                 * caller discard it as garbage. */
+                _vte_debug_print(VTE_DEBUG_PARSE,
+                                 "Discarding %ld characters of unknown sequence.\n",
+                                 (long) (seq.end - candidate));
+                *consumed = MAX(seq.end - 1, candidate);
+                return *res = "";
+        }
+
+        *consumed = seq.end;
+        *opcode = pattern->opcode;
+        if (params == NULL)
+                return *res = pattern->result;
+
+        switch (pattern->kind) {
+        case KIND_CSI:
+                if (pattern->n_slots == 1 && pattern->slots[0] == SLOT_LIST) {
+                        for (i = 0; i < seq.n_params; i++) {
+                                _vte_parser_append_long(params, &group,
+                                                        MAX(seq.params[i], 0),
+                                                        (seq.colon_mask & (1u << i)) != 0);
+                        }
+                        if (group != NULL) {
+                                /* Dangling ':' after the last parameter. */
+                                _vte_parser_append_long(params, &group, 0, FALSE);
+                        }
+                } else {
+                        for (i = 0; i < seq.n_params; i++) {
+                                if (pattern->slots[i] == SLOT_NUMBER)
+                                        _vte_parser_append_long(params, &group,
+                                                                seq.params[i], FALSE);
+                        }
+                }
+                break;
+        case KIND_OSC:
+        case KIND_DCS:
+                _vte_parser_match_string_args(pattern,
+                                              seq.str + pattern->prefix_len,
+                                              seq.str_len - pattern->prefix_len,
+                                              params);
+                break;
+        default:
+                break;
+        }
+
+        return *res = pattern->result;
+}
+
+/* Dump out the known sequences. */
+void
+_vte_parser_print(struct _vte_parser *parser)
+{
+        static const char slot_names[][4] = { "", "%d", "%m", "%s" };
+        const struct _vte_parser_pattern *pattern;
+        guint i, j;
+
+        for (i = 0; i < VTE_PARSER_N_CLASSES; i++) {
+                if (parser->controls[i] != NULL)
+                        g_printerr("0x%02x = `%s'\n", i, parser->controls[i]);
+        }
+        for (i = 0; i < parser->patterns->len; i++) {
+                pattern = &g_array_index(parser->patterns,
+                                         struct _vte_parser_pattern, i);
+                g_printerr("%s", pattern->kind == KIND_ESC ? "ESC " :
+                                 pattern->kind == KIND_CSI ? "CSI " :
+                                 pattern->kind == KIND_OSC ? "OSC " : "DCS ");
+                if (pattern->kind == KIND_DCS)
+                        g_printerr("%lc", (wint_t) pattern->introducer);
+                if (pattern->private_marker)
+                        g_printerr("%lc", (wint_t) pattern->private_marker);
+                for (j = 0; j < pattern->prefix_len; j++)
+                        g_printerr("%lc", (wint_t) pattern->prefix[j]);
+                for (j = 0; j < pattern->n_slots; j++)
+                        g_printerr("%s%s", j ? ";" : "", slot_names[pattern->slots[j]]);
+                if (pattern->intermediate)
+                        g_printerr("%lc", (wint_t) pattern->intermediate);
+                if (pattern->final)
+                        g_printerr("%lc", (wint_t) pattern->final);
+                if (pattern->kind == KIND_OSC || pattern->kind == KIND_DCS)
+                        g_printerr(pattern->st_terminated ? " ST" : " BEL");
+                g_printerr(" = `%s'\n", pattern->result);
+        }
+        g_printerr("%u patterns = %ld bytes.\n", parser->patterns->len,
+                   (long) (parser->patterns->len * sizeof(struct _vte_parser_pattern) +
+                           sizeof(struct _vte_parser)));
+}
+
+#ifdef PARSER_MAIN
+
+#include "caps.h"
+#include "table.h"
+
+/* Spread out a narrow string into a wide-character string. */
+static gunichar *
+make_wide(const char *p, gsize length)
+{
+        gunichar *ret;
+        gsize i;
+
+        ret = g_new(gunichar, length + 1);
+        for (i = 0; i < length; i++)
+                ret[i] = (guchar) p[i];
+        ret[i] = '\0';
+        return ret;
+}
+
+static struct _vte_parser *parser;
+static struct _vte_table *table;
+
+static void
+add_caps(void)
+{
+        const char *code, *value;
+        const char *names[1024];
+        guint opcode, n_names = 0;
+
+        parser = _vte_parser_new();
+        table = _vte_table_new();
+
+        /* Hand out opcodes the same way the matcher does. */
+        code = _vte_xterm_capability_strings;
+        do {
+                value = strchr(code, '\0') + 1;
+                for (opcode = 0; opcode < n_names; opcode++)
+                        if (strcmp(names[opcode], value) == 0)
+                                break;
+                if (opcode == n_names) {
+                        g_assert_cmpuint(n_names, <, G_N_ELEMENTS(names));
+                        names[n_names++] = value;
+                }
+                _vte_parser_add(parser, code, strlen(code), value, opcode + 1);
+                _vte_table_add(table, code, strlen(code), value, opcode + 1);
+                code = strchr(value, '\0') + 1;
+        } while (*code);
+}
+
+static void
+assert_params_equal(const struct _vte_matcher_params *a,
+                    const struct _vte_matcher_params *b)
+{
+        guint i, j;
+
+        g_assert_cmpuint(a->n_params, ==, b->n_params);
+        for (i = 0; i < a->n_params; i++) {
+                const struct _vte_matcher_param *pa = &a->params[i];
+                const struct _vte_matcher_param *pb = &b->params[i];
+
+                g_assert_cmpint(pa->type, ==, pb->type);
+                switch (pa->type) {
+                case VTE_MATCHER_PARAM_NUMBER:
+                        g_assert_cmpint(pa->number, ==, pb->number);
+                        break;
+                case VTE_MATCHER_PARAM_SUBPARAMS:
+                        g_assert_cmpuint(pa->n_sub, ==, pb->n_sub);
+                        for (j = 0; j < pa->n_sub; j++)
+                                g_assert_cmpint(a->subparams[pa->sub_start + j], ==,
+                                                b->subparams[pb->sub_start + j]);
+                        break;
+                case VTE_MATCHER_PARAM_STRING:
+                        g_assert_true(pa->str == pb->str);
+                        g_assert_cmpuint(pa->str_len, ==, pb->str_len);
+                        break;
+                }
+        }
+}
+
+/* Well-formed sequences must give the same result as with the table. */
+static void
+test_parser_matches_table(void)
+{
+        static const char *candidates[] = {
+                "\007", "\010", "\r", "\n", "\177",
+                "\0337", "\0338", "\033c", "\033D", "\033M",
+                "\033(0", "\033(B", "\033)0", "\033#8", "\033%G", "\033 F",
+                "\033[A", "\033[5A", "\033[65536B", "\033[12;40H", "\033[H",
+                "\033[;H", "\033[;5H", "\033[5;H", "\033[12;40f",
+                "\033[J", "\033[2J", "\033[?J", "\033[?1J", "\033[K", "\033[1;2K",
+                "\033[m", "\033[0m", "\033[1;31m", "\033[;1m", "\033[38;5;196m",
+                "\033[38:2:10:20:30m", "\033[4:3m", "\033[1;38:5:3;4m",
+                "\033[?1049h", "\033[?25;1000l", "\033[4h", "\033[>c", "\033[>0c",
+                "\033[=c", "\033[c", "\033[6n", "\033[?6n", "\033[!p",
+                "\033[ q", "\033[2 q", "\033[1\"q", "\033[r", "\033[1;24r",
+                "\033[;24r", "\033[5;r", "\033[5T", "\033[1;2;3;4;5T",
+                "\033[s", "\033[u", "\033[8;24;80t", "\033[5b",
+                "\033]0;title\007", "\033]2;a;b\033\\", "\033];x\007",
+                "\033]4;1;rgb:ff/00/00\007", "\033]104\007", "\033]104;1;2\007",
+                "\033]8;id=1;http://x/;y\007", "\033]8;;\033\\",
+                "\033]10;?\007", "\033]777;notify;a;b\007",
+                "\033]7;file:///tmp\033\\", "\033Pqfoo\033\\",
+        };
+        guint i;
+
+        for (i = 0; i < G_N_ELEMENTS(candidates); i++) {
+                gsize length = strlen(candidates[i]);
+                gunichar *candidate = make_wide(candidates[i], length);
+                const char *pres, *tres;
+                guint popcode, topcode;
+                const gunichar *pconsumed, *tconsumed;
+                struct _vte_matcher_params pparams, tparams;
+
+                _vte_parser_match(parser, candidate, length, &pres, &popcode, &pconsumed, &pparams);
+                _vte_table_match(table, candidate, length, &tres, &topcode, &tconsumed, &tparams);
+
+                g_assert_nonnull(tres);
+                g_assert_cmpstr(pres, ==, tres);
+                g_assert_cmpuint(topcode, !=, VTE_MATCHER_OPCODE_NONE);
+                g_assert_cmpuint(popcode, ==, topcode);
+                g_assert_true(pconsumed == tconsumed);
+                assert_params_equal(&pparams, &tparams);
+
+                g_free(candidate);
+        }
+}
+
+static void
+test_parser_incomplete(void)
+{
+        static const char *candidates[] = {
+                "\033", "\033[", "\033[1;", "\033[?25", "\033]0;tit",
+                "\033]0;title\033", "\033P", "\033(",
+        };
+        guint i;
+
+        for (i = 0; i < G_N_ELEMENTS(candidates); i++) {
+                gsize length = strlen(candidates[i]);
+                gunichar *candidate = make_wide(candidates[i], length);
+                const char *res;
+                const gunichar *consumed;
+
+                _vte_parser_match(parser, candidate, length, &res, NULL, &consumed, NULL);
+                g_assert_cmpstr(res, ==, "");
+                g_assert_true(consumed == candidate + length);
+                g_free(candidate);
+        }
+}
+
+static void
+test_parser_actions(void)
+{
+        struct _vte_parser_sequence seq;
+        gunichar *candidate;
+
+        /* Plain text. */
+        candidate = make_wide("abc", 3);
+        g_assert_cmpint(_vte_parser_parse(parser, candidate, 3, &seq), ==, VTE_PARSER_ACTION_NONE);
+        g_free(candidate);
+
+        /* C0 controls inside a sequence are executed in place. */
+        candidate = make_wide("\033[1\n2H", 6);
+        g_assert_cmpint(_vte_parser_parse(parser, candidate, 6, &seq), ==, VTE_PARSER_ACTION_INTERRUPT);
+        g_assert_cmpuint(seq.control, ==, '\n');
+        g_assert_true(seq.end == candidate + 3);
+        g_free(candidate);
+
+        /* ESC aborts a sequence. */
+        candidate = make_wide("\033[1\033[2J", 8);
+        g_assert_cmpint(_vte_parser_parse(parser, candidate, 8, &seq), ==, VTE_PARSER_ACTION_IGNORE);
+        g_assert_true(seq.end == candidate + 3);
+        g_free(candidate);
+
+        /* CAN cancels it, and is consumed. */
+        candidate = make_wide("\033[1\030x", 5);
+        g_assert_cmpint(_vte_parser_parse(parser, candidate, 5, &seq), ==, VTE_PARSER_ACTION_IGNORE);
+        g_assert_true(seq.end == candidate + 4);
+        g_free(candidate);
+
+        /* Parameters, subparameters and defaults. */
+        candidate = make_wide("\033[?1;;38:5:2m", 13);
+        g_assert_cmpint(_vte_parser_parse(parser, candidate, 13, &seq), ==, VTE_PARSER_ACTION_CSI_DISPATCH);
+        g_assert_cmpuint(seq.private_marker, ==, '?');
+        g_assert_cmpuint(seq.final, ==, 'm');
+        g_assert_cmpuint(seq.n_params, ==, 5);
+        g_assert_cmpint(seq.params[0], ==, 1);
+        g_assert_cmpint(seq.params[1], ==, -1);
+        g_assert_cmpint(seq.params[2], ==, 38);
+        g_assert_cmpint(seq.params[3], ==, 5);
+        g_assert_cmpint(seq.params[4], ==, 2);
+        g_assert_cmpuint(seq.colon_mask, ==, (1u << 2) | (1u << 3));
+        g_free(candidate);
+
+        /* Unknown but well-formed sequences are discarded whole. */
+        candidate = make_wide("\033[5;;3Hx", 8);
+        {
+                const char *res;
+                const gunichar *consumed;
+                _vte_parser_match(parser, candidate, 8, &res, NULL, &consumed, NULL);
+                g_assert_cmpstr(res, ==, "");
+                g_assert_true(consumed == candidate + 6);
+        }
+        g_free(candidate);
+
+        /* 8-bit introducers. */
+        candidate = make_wide("\2335A", 3);
+        g_assert_cmpint(_vte_parser_parse(parser, candidate, 3, &seq), ==, VTE_PARSER_ACTION_CSI_DISPATCH);
+        g_assert_cmpuint(seq.introducer, ==, '[');
+        g_free(candidate);
+}
+
+/* Parameters beyond the capacity of the block are dropped, and strings
+ * point into the input. */
+static void
+test_parser_params(void)
+{
+        GString *str;
+        gunichar *candidate;
+        struct _vte_matcher_params params;
+        const char *res;
+        guint i;
+
+        str = g_string_new("\033[");
+        for (i = 0; i < 2 * VTE_MATCHER_MAX_PARAMS; i++)
+                g_string_append_printf(str, "%u;", i);
+        g_string_append(str, "38:2:1:2:3m");
+        candidate = make_wide(str->str, str->len);
+
+        _vte_parser_match(parser, candidate, str->len, &res, NULL, NULL, &params);
+        g_assert_cmpstr(res, ==, "character-attributes");
+        g_assert_cmpuint(params.n_params, ==, VTE_MATCHER_MAX_PARAMS);
+        for (i = 0; i < params.n_params; i++) {
+                g_assert_cmpint(params.params[i].type, ==, VTE_MATCHER_PARAM_NUMBER);
+                g_assert_cmpint(params.params[i].number, ==, i);
+        }
+        _vte_table_match(table, candidate, str->len, &res, NULL, NULL, &params);
+        g_assert_cmpstr(res, ==, "character-attributes");
+        g_assert_cmpuint(params.n_params, ==, VTE_MATCHER_MAX_PARAMS);
+
+        g_free(candidate);
+        g_string_free(str, TRUE);
+
+        candidate = make_wide("\033]2;title\007", 10);
+        _vte_parser_match(parser, candidate, 10, &res, NULL, NULL, &params);
+        g_assert_cmpuint(params.n_params, ==, 1);
+        g_assert_cmpint(params.params[0].type, ==, VTE_MATCHER_PARAM_STRING);
+        g_assert_true(params.params[0].str == candidate + 4);
+        g_assert_cmpuint(params.params[0].str_len, ==, 5);
+        g_free(candidate);
+}
+
+int
+main(int argc, char **argv)
+{
+        int ret;
+
+        g_test_init (&argc, &argv, nullptr);
+
+        add_caps();
+
+        g_test_add_func ("/vte/parser/matches-table", test_parser_matches_table);
+        g_test_add_func ("/vte/parser/incomplete", test_parser_incomplete);
+        g_test_add_func ("/vte/parser/actions", test_parser_actions);
+        g_test_add_func ("/vte/parser/params", test_parser_params);
+
+        ret = g_test_run ();
+
+        _vte_parser_free(parser);
+        _vte_table_free(table);
+        return ret;
+}
+#endif
+
+const struct _vte_matcher_class _vte_matcher_parser = {
+        (_vte_matcher_create_func)_vte_parser_new,
+        (_vte_matcher_add_func)_vte_parser_add,
+        (_vte_matcher_print_func)_vte_parser_print,
+        (_vte_matcher_match_func)_vte_parser_match,
+        (_vte_matcher_destroy_func)_vte_parser_free
+};
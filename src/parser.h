@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* The interfaces in this file are subject to change at any time. */
+
+#ifndef vte_parser_h_included
+#define vte_parser_h_included
+
+
+#include <glib-object.h>
+#include "matcher.h"
+
+G_BEGIN_DECLS
+
+/* A DEC VT500 / ECMA-48 state machine, modelled after Paul Williams'
+ * "A parser for DEC's ANSI-compatible video terminals". It recognizes
+ * sequences without consulting the list of known sequences, and without
+ * allocating memory; the known sequences are only used afterwards to map
+ * a recognized sequence to its name. */
+
+#define VTE_PARSER_MAX_PARAMS 32
+
+typedef enum {
+        VTE_PARSER_ACTION_NONE,         /* a graphic character, not a sequence */
+        VTE_PARSER_ACTION_INCOMPLETE,   /* ran out of data inside a sequence */
+        VTE_PARSER_ACTION_IGNORE,       /* malformed or aborted sequence */
+        VTE_PARSER_ACTION_INTERRUPT,    /* a C0 control inside a sequence */
+        VTE_PARSER_ACTION_EXECUTE,      /* a C0 or C1 control function */
+        VTE_PARSER_ACTION_ESC_DISPATCH,
+        VTE_PARSER_ACTION_CSI_DISPATCH,
+        VTE_PARSER_ACTION_OSC_DISPATCH,
+        VTE_PARSER_ACTION_DCS_DISPATCH  /* DCS, SOS, PM and APC strings */
+} VteParserAction;
+
+struct _vte_parser_sequence {
+        VteParserAction action;
+        gunichar control;               /* EXECUTE and INTERRUPT */
+        gunichar introducer;            /* '[', ']', 'P', 'X', '^', '_' or 0 */
+        gunichar private_marker;        /* '<', '=', '>', '?' or 0 */
+        gunichar intermediate;          /* 0x20..0x2f or 0 */
+        gunichar final;
+        gboolean st_terminated;         /* string ended in ST rather than BEL */
+        guint n_params;
+        guint32 colon_mask;             /* bit i: params[i] is followed by ':' */
+        int params[VTE_PARSER_MAX_PARAMS + 1]; /* -1 if omitted; last is scratch */
+        const gunichar *str;            /* OSC and DCS payload, points into the input */
+        gsize str_len;
+        const gunichar *end;            /* first character not part of the sequence */
+};
+
+struct _vte_parser;
+
+/* Create an empty parser. */
+struct _vte_parser *_vte_parser_new(void);
+
+/* Free a parser. */
+void _vte_parser_free(struct _vte_parser *parser);
+
+/* Teach the parser the name of a sequence. */
+void _vte_parser_add(struct _vte_parser *parser,
+                     const char *pattern, gssize length,
+                     const char *result, guint opcode);
+
+/* Recognize the sequence (if any) at the start of @candidate. */
+VteParserAction _vte_parser_parse(struct _vte_parser *parser,
+                                  const gunichar *candidate, gssize length,
+                                  struct _vte_parser_sequence *seq);
+
+/* Check if a string matches a known sequence, like _vte_table_match(). */
+const char *_vte_parser_match(struct _vte_parser *parser,
+                              const gunichar *candidate, gssize length,
+                              const char **res, guint *opcode,
+                              const gunichar **consumed,
+                              struct _vte_matcher_params *params);
+
+/* Dump out the known sequences. */
+void _vte_parser_print(struct _vte_parser *parser);
+
+extern const struct _vte_matcher_class _vte_matcher_parser;
+
+G_END_DECLS
+
+#endif
@@ -52,6 +52,477 @@ _vte_ring_validate (VteRing * ring)
 #endif
 
 
+/* Thawed row cache */
+
+static void
+_vte_ring_cache_alloc (VteRing *ring, gulong size)
+{
+	gulong i;
+
+	ring->cache_size = MAX (size, 1);
+	ring->cache = g_new0 (VteRingCachedRow, ring->cache_size);
+	for (i = 0; i < ring->cache_size; i++) {
+		_vte_row_data_init (&ring->cache[i].row);
+		ring->cache[i].position = (gulong) -1;
+	}
+	ring->cache_mru = 0;
+	ring->cache_clock = 0;
+}
+
+static void
+_vte_ring_cache_free (VteRing *ring)
+{
+	gulong i;
+
+	for (i = 0; i < ring->cache_size; i++)
+		_vte_row_data_fini (&ring->cache[i].row);
+	g_free (ring->cache);
+	ring->cache = NULL;
+	ring->cache_size = 0;
+}
+
+static void
+_vte_ring_cache_invalidate (VteRing *ring)
+{
+	gulong i;
+
+	for (i = 0; i < ring->cache_size; i++) {
+		ring->cache[i].position = (gulong) -1;
+		ring->cache[i].last_used = 0;
+	}
+}
+
+static void
+_vte_ring_cache_invalidate_row (VteRing *ring, gulong position)
+{
+	gulong i;
+
+	for (i = 0; i < ring->cache_size; i++) {
+		if (ring->cache[i].position == position) {
+			ring->cache[i].position = (gulong) -1;
+			ring->cache[i].last_used = 0;
+			return;
+		}
+	}
+}
+
+/* Returns the slot holding @position, or NULL. */
+static inline VteRingCachedRow *
+_vte_ring_cache_lookup (VteRing *ring, gulong position)
+{
+	gulong i;
+
+	if (G_LIKELY (ring->cache[ring->cache_mru].position == position))
+		return &ring->cache[ring->cache_mru];
+
+	for (i = 0; i < ring->cache_size; i++) {
+		if (ring->cache[i].position == position) {
+			ring->cache_mru = i;
+			return &ring->cache[i];
+		}
+	}
+	return NULL;
+}
+
+/* Returns the least recently used slot, emptied. Unused slots come first. */
+static VteRingCachedRow *
+_vte_ring_cache_evict (VteRing *ring)
+{
+	gulong i, victim = 0;
+
+	for (i = 1; i < ring->cache_size; i++) {
+		if (ring->cache[i].last_used < ring->cache[victim].last_used)
+			victim = i;
+	}
+	ring->cache[victim].position = (gulong) -1;
+	ring->cache[victim].last_used = 0;
+	return &ring->cache[victim];
+}
+
+
+/* Text index
+ *
+ * While enabled, the UTF-8 text of each frozen row is broken into trigrams
+ * (ASCII letters folded to lower case), which are added to a bloom filter
+ * covering VTE_RING_TEXT_INDEX_BLOCK_ROWS rows. Trigrams that span two rows
+ * go to the block of the later row. Rows can be thawed back and frozen again,
+ * which leaves stale trigrams behind; these only cause false positives.
+ *
+ * The text is indexed the way the search sees it: empty cells are spaces,
+ * except at the end of the row where they are dropped. */
+
+static inline guint
+_vte_ring_text_index_hash (guchar a, guchar b, guchar c)
+{
+	guint32 v = (g_ascii_tolower (a) << 16) | (g_ascii_tolower (b) << 8) | g_ascii_tolower (c);
+
+	return (guint32) (v * 2654435761u) >> (32 - VTE_RING_TEXT_INDEX_FILTER_SHIFT);
+}
+
+static void
+_vte_ring_text_index_add (guint8 *filter, const char *text, gsize len)
+{
+	gsize i;
+
+	for (i = 0; i + 2 < len; i++) {
+		guint h = _vte_ring_text_index_hash (text[i], text[i + 1], text[i + 2]);
+		filter[h >> 3] |= 1 << (h & 7);
+	}
+}
+
+static gboolean
+_vte_ring_text_index_filter_contains (const guint8 *filter, const char *literal, gsize len)
+{
+	gsize i;
+
+	for (i = 0; i + 2 < len; i++) {
+		guint h = _vte_ring_text_index_hash (literal[i], literal[i + 1], literal[i + 2]);
+		if (!(filter[h >> 3] & (1 << (h & 7))))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/* Turns the frozen text of a row into what the search gets from get_text(). */
+static void
+_vte_ring_text_index_normalize (GString *text)
+{
+	gsize i, len = text->len;
+	gboolean newline = len && text->str[len - 1] == '\n';
+
+	if (newline)
+		len--;
+	while (len && text->str[len - 1] == '\0')
+		len--;
+	for (i = 0; i < len; i++) {
+		if (text->str[i] == '\0')
+			text->str[i] = ' ';
+	}
+	if (newline)
+		text->str[len++] = '\n';
+	g_string_truncate (text, len);
+}
+
+/* Drops the index, and starts indexing again at @position. */
+static void
+_vte_ring_text_index_restart (VteRing *ring, gulong position)
+{
+	_vte_debug_print (VTE_DEBUG_RING, "Restarting the text index at %lu.\n", position);
+
+	ring->text_index_start = position;
+	ring->text_index_tail_len = -1;
+	ring->text_index_block = position / VTE_RING_TEXT_INDEX_BLOCK_ROWS;
+	ring->text_index_read_block = (gulong) -1;
+	memset (ring->text_index_filter, 0, VTE_RING_TEXT_INDEX_FILTER_SIZE);
+	_vte_stream_reset (ring->text_index_stream, ring->text_index_block * VTE_RING_TEXT_INDEX_FILTER_SIZE);
+}
+
+/* Adds the @row_text of the row about to be frozen at @position.
+ * The end of the previous row's text must be known, see _vte_ring_text_index_load_tail(). */
+static void
+_vte_ring_text_index_row (VteRing *ring, gulong position, const GString *row_text)
+{
+	gulong block = position / VTE_RING_TEXT_INDEX_BLOCK_ROWS;
+	GString *text = ring->text_index_buffer;
+	gsize n, joint_len;
+	char joint[4];
+
+	if (G_UNLIKELY (block != ring->text_index_block)) {
+		if (block != ring->text_index_block + 1) {
+			_vte_ring_text_index_restart (ring, position);
+		} else {
+			_vte_stream_append (ring->text_index_stream,
+					    (const char *) ring->text_index_filter, VTE_RING_TEXT_INDEX_FILTER_SIZE);
+			memset (ring->text_index_filter, 0, VTE_RING_TEXT_INDEX_FILTER_SIZE);
+			ring->text_index_block = block;
+		}
+	}
+
+	g_string_truncate (text, 0);
+	g_string_append_len (text, row_text->str, row_text->len);
+	_vte_ring_text_index_normalize (text);
+
+	/* The trigrams spanning the end of the previous row */
+	g_assert (ring->text_index_tail_len >= 0);
+	memcpy (joint, ring->text_index_tail, ring->text_index_tail_len);
+	n = MIN (text->len, 2);
+	memcpy (joint + ring->text_index_tail_len, text->str, n);
+	joint_len = ring->text_index_tail_len + n;
+	_vte_ring_text_index_add (ring->text_index_filter, joint, joint_len);
+
+	_vte_ring_text_index_add (ring->text_index_filter, text->str, text->len);
+
+	/* Remember the end of the text for the next row */
+	if (text->len >= 2) {
+		memcpy (ring->text_index_tail, text->str + text->len - 2, 2);
+		ring->text_index_tail_len = 2;
+	} else {
+		n = MIN (joint_len, 2);
+		memcpy (ring->text_index_tail, joint + joint_len - n, n);
+		ring->text_index_tail_len = n;
+	}
+}
+
+/* Makes the block of @position, which is about to be thawed, the one being filled again. */
+static void
+_vte_ring_text_index_rewind (VteRing *ring, gulong position)
+{
+	gulong block = position / VTE_RING_TEXT_INDEX_BLOCK_ROWS;
+
+	/* The row before @position is going to end the indexed text */
+	ring->text_index_tail_len = -1;
+
+	if (block >= ring->text_index_block)
+		return;
+
+	if (position < ring->text_index_start ||
+	    block < ring->text_index_start / VTE_RING_TEXT_INDEX_BLOCK_ROWS) {
+		/* Everything from @position on is going to be refrozen */
+		_vte_ring_text_index_restart (ring, position);
+		return;
+	}
+
+	if (!_vte_stream_read (ring->text_index_stream, block * VTE_RING_TEXT_INDEX_FILTER_SIZE,
+			       (char *) ring->text_index_filter, VTE_RING_TEXT_INDEX_FILTER_SIZE))
+		memset (ring->text_index_filter, 0xff, VTE_RING_TEXT_INDEX_FILTER_SIZE);
+	_vte_stream_truncate (ring->text_index_stream, block * VTE_RING_TEXT_INDEX_FILTER_SIZE);
+	ring->text_index_block = block;
+	ring->text_index_read_block = (gulong) -1;
+}
+
+/* Returns the filter of @block, or NULL if it isn't available. */
+static const guint8 *
+_vte_ring_text_index_get_filter (VteRing *ring, gulong block)
+{
+	if (block == ring->text_index_block)
+		return ring->text_index_filter;
+	if (block == ring->text_index_read_block)
+		return ring->text_index_read_filter;
+
+	if (!_vte_stream_read (ring->text_index_stream, block * VTE_RING_TEXT_INDEX_FILTER_SIZE,
+			       (char *) ring->text_index_read_filter, VTE_RING_TEXT_INDEX_FILTER_SIZE)) {
+		ring->text_index_read_block = (gulong) -1;
+		return NULL;
+	}
+	ring->text_index_read_block = block;
+	return ring->text_index_read_filter;
+}
+
+static gsize
+_vte_ring_memory_stream_limit (void)
+{
+        static gsize limit_plus_one = 0;
+
+        if (g_once_init_enter (&limit_plus_one)) {
+                const char *env = g_getenv ("VTE_SCROLLBACK_MEMORY_LIMIT");
+                gsize limit = env ? g_ascii_strtoull (env, NULL, 10) : VTE_RING_MEMORY_STREAM_LIMIT;
+                g_once_init_leave (&limit_plus_one, limit + 1);
+        }
+        return limit_plus_one - 1;
+}
+
+static VteStream *
+_vte_ring_stream_new (void)
+{
+        gsize limit = _vte_ring_memory_stream_limit ();
+
+        return limit ? _vte_mem_stream_new (limit) : _vte_file_stream_new ();
+}
+
+
+/*
+ * VteRingAttrWriter: Encoder of attr_stream and attr_dict_stream
+ */
+
+static void
+_vte_ring_varint_append (GString *buffer, gsize value)
+{
+	while (value >= 0x80) {
+		g_string_append_c (buffer, (char) (value | 0x80));
+		value >>= 7;
+	}
+	g_string_append_c (buffer, (char) value);
+}
+
+static gboolean
+_vte_ring_varint_read (const char **p, const char *end, gsize *value)
+{
+	const guchar *q = (const guchar *) *p;
+	guint shift;
+
+	*value = 0;
+	for (shift = 0; (const char *) q < end && shift < 64; shift += 7) {
+		*value |= (gsize) (*q & 0x7F) << shift;
+		if (!(*q++ & 0x80)) {
+			*p = (const char *) q;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+static inline guint
+_vte_ring_attr_hash (guint64 attr)
+{
+	return (guint) ((attr * G_GUINT64_CONSTANT (0x9E3779B97F4A7C15)) >> 32);
+}
+
+/* The hash table is kept twice as big as the allocated entries. */
+static void
+_vte_ring_attr_writer_rehash (VteRingAttrWriter *writer)
+{
+	guint i, h;
+
+	g_free (writer->dict_hash);
+	writer->dict_hash = g_new0 (guint32, 2 * writer->dict_alloc);
+	writer->dict_hash_mask = 2 * writer->dict_alloc - 1;
+	for (i = 0; i < writer->dict_len; i++) {
+		h = _vte_ring_attr_hash (writer->dict[i]) & writer->dict_hash_mask;
+		while (writer->dict_hash[h])
+			h = (h + 1) & writer->dict_hash_mask;
+		writer->dict_hash[h] = i + 1;
+	}
+}
+
+static void
+_vte_ring_attr_writer_init (VteRingAttrWriter *writer)
+{
+	memset (writer, 0, sizeof (*writer));
+	writer->dict_alloc = 64;
+	writer->dict = g_new (guint64, writer->dict_alloc);
+	_vte_ring_attr_writer_rehash (writer);
+	writer->buffer = g_string_sized_new (64);
+	writer->run_hyperlink = g_string_sized_new (0);
+}
+
+static void
+_vte_ring_attr_writer_fini (VteRingAttrWriter *writer)
+{
+	g_free (writer->dict);
+	g_free (writer->dict_hash);
+	g_string_free (writer->buffer, TRUE);
+	g_string_free (writer->run_hyperlink, TRUE);
+}
+
+/* Forget the current dictionary, the next row starts a new one. */
+static void
+_vte_ring_attr_writer_clear (VteRingAttrWriter *writer)
+{
+	writer->has_dict = FALSE;
+	writer->dict_len = writer->dict_flushed = 0;
+	memset (writer->dict_hash, 0, (writer->dict_hash_mask + 1) * sizeof (writer->dict_hash[0]));
+}
+
+/* Make the @len entries long dictionary at @offset the current one again. */
+static gboolean
+_vte_ring_attr_writer_load (VteRingAttrWriter *writer, VteStream *dict_stream, gsize offset, guint len)
+{
+	_vte_ring_attr_writer_clear (writer);
+	if (len >= writer->dict_alloc) {
+		while (len >= writer->dict_alloc)
+			writer->dict_alloc *= 2;
+		writer->dict = g_renew (guint64, writer->dict, writer->dict_alloc);
+	}
+	if (len && !_vte_stream_read (dict_stream, offset, (char *) writer->dict, len * sizeof (writer->dict[0])))
+		return FALSE;
+	writer->dict_len = writer->dict_flushed = len;
+	writer->dict_offset = offset;
+	writer->has_dict = TRUE;
+	_vte_ring_attr_writer_rehash (writer);
+	return TRUE;
+}
+
+static guint
+_vte_ring_attr_writer_lookup (VteRingAttrWriter *writer, guint64 attr)
+{
+	guint h = _vte_ring_attr_hash (attr) & writer->dict_hash_mask;
+
+	while (writer->dict_hash[h]) {
+		if (writer->dict[writer->dict_hash[h] - 1] == attr)
+			return writer->dict_hash[h] - 1;
+		h = (h + 1) & writer->dict_hash_mask;
+	}
+
+	writer->dict[writer->dict_len] = attr;
+	writer->dict_hash[h] = ++writer->dict_len;
+	if (writer->dict_len == writer->dict_alloc) {
+		writer->dict_alloc *= 2;
+		writer->dict = g_renew (guint64, writer->dict, writer->dict_alloc);
+		_vte_ring_attr_writer_rehash (writer);
+	}
+	return writer->dict_len - 1;
+}
+
+/* Start encoding the row at @position, returns the offset of its dictionary. */
+static gsize
+_vte_ring_attr_writer_begin_row (VteRingAttrWriter *writer, gulong position, VteStream *dict_stream)
+{
+	if (!writer->has_dict ||
+	    position % VTE_RING_ATTR_DICT_ROWS == 0 ||
+	    writer->dict_len >= VTE_RING_ATTR_DICT_MAX) {
+		_vte_ring_attr_writer_clear (writer);
+		writer->has_dict = TRUE;
+		writer->dict_offset = _vte_stream_head (dict_stream);
+	}
+	g_string_set_size (writer->buffer, 0);
+	writer->run_length = 0;
+	return writer->dict_offset;
+}
+
+static void
+_vte_ring_attr_writer_flush_run (VteRingAttrWriter *writer)
+{
+	gsize hyperlinked = writer->run_hyperlink->len != 0;
+
+	if (!writer->run_length)
+		return;
+
+	_vte_ring_varint_append (writer->buffer,
+				 (gsize) _vte_ring_attr_writer_lookup (writer, writer->run_attr) << 1 | hyperlinked);
+	_vte_ring_varint_append (writer->buffer, writer->run_length);
+	if (G_UNLIKELY (hyperlinked)) {
+		_vte_ring_varint_append (writer->buffer, writer->run_hyperlink->len);
+		g_string_append_len (writer->buffer, writer->run_hyperlink->str, writer->run_hyperlink->len);
+	}
+	writer->run_length = 0;
+}
+
+/* Add @length bytes of text with the given attributes to the row. */
+static void
+_vte_ring_attr_writer_append (VteRingAttrWriter *writer, guint64 attr,
+			      const char *hyperlink, gsize hyperlink_length, gsize length)
+{
+	if (G_LIKELY (writer->run_length &&
+		      writer->run_attr == attr &&
+		      writer->run_hyperlink->len == hyperlink_length &&
+		      memcmp (writer->run_hyperlink->str, hyperlink, hyperlink_length) == 0)) {
+		writer->run_length += length;
+		return;
+	}
+
+	_vte_ring_attr_writer_flush_run (writer);
+	writer->run_attr = attr;
+	g_string_truncate (writer->run_hyperlink, 0);
+	g_string_append_len (writer->run_hyperlink, hyperlink, hyperlink_length);
+	writer->run_length = length;
+}
+
+/* Append the row's runs, and the dictionary entries it added, to the streams. */
+static void
+_vte_ring_attr_writer_end_row (VteRingAttrWriter *writer, VteStream *attr_stream, VteStream *dict_stream)
+{
+	_vte_ring_attr_writer_flush_run (writer);
+
+	if (writer->dict_flushed < writer->dict_len) {
+		_vte_stream_append (dict_stream, (const char *) &writer->dict[writer->dict_flushed],
+				    (writer->dict_len - writer->dict_flushed) * sizeof (writer->dict[0]));
+		writer->dict_flushed = writer->dict_len;
+	}
+	if (writer->buffer->len)
+		_vte_stream_append (attr_stream, writer->buffer->str, writer->buffer->len);
+}
+
+
 void
 _vte_ring_init (VteRing *ring, gulong max_rows, gboolean has_streams)
 {
@@ -68,19 +539,24 @@ _vte_ring_init (VteRing *ring, gulong max_rows, gboolean has_streams)
 
 	ring->has_streams = has_streams;
 	if (has_streams) {
-		ring->attr_stream = _vte_file_stream_new ();
-		ring->text_stream = _vte_file_stream_new ();
-		ring->row_stream = _vte_file_stream_new ();
+		ring->attr_stream = _vte_ring_stream_new ();
+		ring->text_stream = _vte_ring_stream_new ();
+		ring->row_stream = _vte_ring_stream_new ();
+		ring->attr_dict_stream = _vte_ring_stream_new ();
+		_vte_ring_attr_writer_init (&ring->attr_writer);
+		ring->attr_dict_read_offset = (gsize) -1;
+		ring->attr_dict_read_alloc = VTE_RING_ATTR_DICT_MAX;
+		ring->attr_dict_read = g_new (guint64, ring->attr_dict_read_alloc);
 	} else {
 		ring->attr_stream = ring->text_stream = ring->row_stream = NULL;
+		ring->attr_dict_stream = NULL;
 	}
 
-	ring->last_attr_text_start_offset = 0;
-	ring->last_attr = basic_cell.attr;
 	ring->utf8_buffer = g_string_sized_new (128);
+	ring->attr_buffer = g_string_sized_new (128);
 
-	_vte_row_data_init (&ring->cached_row);
-	ring->cached_row_num = (gulong) -1;
+	_vte_ring_cache_alloc (ring, VTE_RING_CACHE_SIZE_MIN);
+	ring->cache_hits = ring->cache_misses = 0;
 
         ring->visible_rows = 0;
 
@@ -106,23 +582,41 @@ _vte_ring_fini (VteRing *ring)
 	g_free (ring->array);
 
 	if (ring->has_streams) {
+		_VTE_DEBUG_IF(VTE_DEBUG_RING) {
+			gulong hits[3], misses[3];
+
+			_vte_stream_get_cache_stats (ring->attr_stream, &hits[0], &misses[0]);
+			_vte_stream_get_cache_stats (ring->text_stream, &hits[1], &misses[1]);
+			_vte_stream_get_cache_stats (ring->row_stream, &hits[2], &misses[2]);
+			g_printerr ("Block caches of ring %p: attr %lu/%lu, text %lu/%lu, row %lu/%lu hits/misses.\n",
+				    ring, hits[0], misses[0], hits[1], misses[1], hits[2], misses[2]);
+		}
 		g_object_unref (ring->attr_stream);
 		g_object_unref (ring->text_stream);
 		g_object_unref (ring->row_stream);
+		g_object_unref (ring->attr_dict_stream);
+		_vte_ring_attr_writer_fini (&ring->attr_writer);
+		g_free (ring->attr_dict_read);
 	}
 
 	g_string_free (ring->utf8_buffer, TRUE);
+	g_string_free (ring->attr_buffer, TRUE);
 
         for (i = 0; i < ring->hyperlinks->len; i++)
                 g_string_free (hyperlink_get(ring, i), TRUE);
         g_ptr_array_free (ring->hyperlinks, TRUE);
 
-	_vte_row_data_fini (&ring->cached_row);
+	_vte_debug_print (VTE_DEBUG_RING, "Row cache of ring %p: %lu hits, %lu misses.\n",
+			  ring, ring->cache_hits, ring->cache_misses);
+	_vte_ring_cache_free (ring);
+
+	_vte_ring_set_text_index (ring, FALSE);
 }
 
 typedef struct _VteRowRecord {
 	gsize text_start_offset;  /* offset where text of this row begins */
-	gsize attr_start_offset;  /* offset of the first character's attributes */
+	gsize attr_start_offset;  /* offset of the row's attribute runs */
+	gsize attr_dict_offset;   /* offset of the dictionary the runs refer to */
 	int soft_wrapped: 1;      /* end of line is not '\n' */
 	int is_ascii: 1;          /* for rewrapping speedup: guarantees that line contains 32..126 bytes only. Can be 0 even when ascii only. */
 } VteRowRecord;
@@ -174,7 +668,6 @@ _vte_ring_hyperlink_gc (VteRing *ring)
         /* A few special values not to be garbage collected. */
         SET_BIT(used, ring->hyperlink_current_idx);
         SET_BIT(used, ring->hyperlink_hover_idx);
-        SET_BIT(used, ring->last_attr.hyperlink_idx);
 
         for (i = ring->writable; i < ring->end; i++) {
                 row = _vte_ring_writable_index (ring, i);
@@ -326,6 +819,105 @@ _vte_ring_append_row_record (VteRing *ring, const VteRowRecord *record, gulong p
 	_vte_stream_append (ring->row_stream, (const char *) record, sizeof (*record));
 }
 
+/* Finds the last bytes of the indexed text before the row at @position,
+ * reading back the rows frozen before it. */
+static void
+_vte_ring_text_index_load_tail (VteRing *ring, gulong position)
+{
+	VteRowRecord record;
+	GString *text = ring->text_index_buffer;
+	gsize end = _vte_stream_head (ring->text_stream);
+	gsize n;
+
+	ring->text_index_tail_len = 0;
+	while (ring->text_index_tail_len < 2 && position > ring->start) {
+		position--;
+		if (!_vte_ring_read_row_record (ring, &record, position))
+			break;
+		g_string_set_size (text, end - record.text_start_offset);
+		if (text->len && !_vte_stream_read (ring->text_stream, record.text_start_offset, text->str, text->len))
+			break;
+		end = record.text_start_offset;
+		_vte_ring_text_index_normalize (text);
+
+		n = MIN (text->len, (gsize) (2 - ring->text_index_tail_len));
+		memmove (ring->text_index_tail + n, ring->text_index_tail, ring->text_index_tail_len);
+		memcpy (ring->text_index_tail, text->str + text->len - n, n);
+		ring->text_index_tail_len += n;
+	}
+}
+
+/* A run of identical attributes decoded from attr_stream. */
+typedef struct _VteRingAttrRun {
+	VteStreamCellAttr attr;
+	const char *hyperlink;  /* attr.hyperlink_length bytes, not NUL terminated */
+	gsize length;           /* in bytes of text */
+} VteRingAttrRun;
+
+/* Looks up entry @idx of the dictionary at @offset. The entries are read from
+ * attr_dict_stream in one go, and kept until another dictionary is needed. */
+static gboolean
+_vte_ring_attr_dict_get (VteRing *ring, gsize offset, gsize idx, guint64 *attr)
+{
+	gsize head, n;
+
+	if (G_UNLIKELY (offset != ring->attr_dict_read_offset || idx >= ring->attr_dict_read_len)) {
+		/* Read ahead to a typical dictionary's size; going past its end
+		 * into the next one is harmless. */
+		head = _vte_stream_head (ring->attr_dict_stream);
+		if (offset >= head)
+			return FALSE;
+		n = MIN (MAX (idx + 1, (gsize) VTE_RING_ATTR_DICT_MAX), (head - offset) / sizeof (*attr));
+		if (idx >= n)
+			return FALSE;
+		if (n > ring->attr_dict_read_alloc) {
+			ring->attr_dict_read_alloc = n;
+			ring->attr_dict_read = g_renew (guint64, ring->attr_dict_read, n);
+		}
+		ring->attr_dict_read_offset = (gsize) -1;
+		if (!_vte_stream_read (ring->attr_dict_stream, offset, (char *) ring->attr_dict_read, n * sizeof (*attr)))
+			return FALSE;
+		ring->attr_dict_read_offset = offset;
+		ring->attr_dict_read_len = n;
+	}
+
+	*attr = ring->attr_dict_read[idx];
+	return TRUE;
+}
+
+/* Decode the run at *@p, the row's dictionary being at @dict_offset. */
+static gboolean
+_vte_ring_decode_attr_run (VteRing *ring, gsize dict_offset, const char **p, const char *end, VteRingAttrRun *run)
+{
+	VteRingAttrWriter *writer = &ring->attr_writer;
+	gsize idx, hyperlink_length = 0;
+	guint64 attr;
+
+	if (!_vte_ring_varint_read (p, end, &idx) ||
+	    !_vte_ring_varint_read (p, end, &run->length))
+		return FALSE;
+	run->hyperlink = "";
+	if (G_UNLIKELY (idx & 1)) {
+		if (!_vte_ring_varint_read (p, end, &hyperlink_length) ||
+		    hyperlink_length > VTE_HYPERLINK_TOTAL_LENGTH_MAX ||
+		    hyperlink_length > (gsize) (end - *p))
+			return FALSE;
+		run->hyperlink = *p;
+		*p += hyperlink_length;
+	}
+	idx >>= 1;
+
+	/* The rows near the bottom use the dictionary that's still being built. */
+	if (writer->has_dict && dict_offset == writer->dict_offset && idx < writer->dict_len)
+		attr = writer->dict[idx];
+	else if (!_vte_ring_attr_dict_get (ring, dict_offset, idx, &attr))
+		return FALSE;
+
+	_attrcpy (&run->attr, &attr);
+	run->attr.hyperlink_length = hyperlink_length;
+	return TRUE;
+}
+
 static void
 _vte_ring_freeze_row (VteRing *ring, gulong position, const VteRowData *row)
 {
@@ -343,11 +935,14 @@ _vte_ring_freeze_row (VteRing *ring, gulong position, const VteRowData *row)
 	memset(&record, 0, sizeof (record));
 	record.text_start_offset = _vte_stream_head (ring->text_stream);
 	record.attr_start_offset = _vte_stream_head (ring->attr_stream);
+	record.attr_dict_offset = _vte_ring_attr_writer_begin_row (&ring->attr_writer, position, ring->attr_dict_stream);
 	record.is_ascii = 1;
 
 	g_string_set_size (buffer, 0);
 	for (i = 0, cell = row->cells; i < row->len; i++, cell++) {
 		VteCellAttr attr;
+		guint64 attr_bytes;
+		gsize text_len, base_len;
 		int num_chars;
 
 		/* Attr storage:
@@ -358,63 +953,51 @@ _vte_ring_freeze_row (VteRing *ring, gulong position, const VteRowData *row)
 		 * 2. We store one attr per vteunistr character starting
 		 * from the second character, with columns=0.
 		 *
+		 * 3. Consecutive bytes of text with the same attr are
+		 * merged into one run by the writer.
+		 *
 		 * That's enough to reconstruct the attrs, and to store
 		 * the text in real UTF-8.
 		 */
 		attr = cell->attr;
 		if (G_LIKELY (!attr.fragment)) {
-			VteCellAttrChange attr_change;
-                        guint16 hyperlink_length;
-
-			if (memcmp(&ring->last_attr, &attr, sizeof (VteCellAttr)) != 0) {
-				ring->last_attr_text_start_offset = record.text_start_offset + buffer->len;
-				memset(&attr_change, 0, sizeof (attr_change));
-				attr_change.text_end_offset = ring->last_attr_text_start_offset;
-                                _attrcpy(&attr_change.attr, &ring->last_attr);
-                                hyperlink = hyperlink_get(ring, ring->last_attr.hyperlink_idx);
-                                attr_change.attr.hyperlink_length = hyperlink->len;
-				_vte_stream_append (ring->attr_stream, (const char *) &attr_change, sizeof (attr_change));
-                                if (G_UNLIKELY (hyperlink->len != 0)) {
-                                        _vte_stream_append (ring->attr_stream, hyperlink->str, hyperlink->len);
-                                        froze_hyperlink = TRUE;
-                                }
-                                hyperlink_length = attr_change.attr.hyperlink_length;
-                                _vte_stream_append (ring->attr_stream, (const char *) &hyperlink_length, 2);
-				if (!buffer->len)
-					/* This row doesn't use last_attr, adjust */
-                                        record.attr_start_offset += sizeof (attr_change) + hyperlink_length + 2;
-				ring->last_attr = attr;
-			}
+                        hyperlink = hyperlink_get(ring, attr.hyperlink_idx);
+                        if (G_UNLIKELY (hyperlink->len != 0))
+                                froze_hyperlink = TRUE;
+
+			if (cell->c < 32 || cell->c > 126) record.is_ascii = 0;
+			text_len = buffer->len;
+			_vte_unistr_append_to_string (cell->c, buffer);
+			text_len = buffer->len - text_len;
 
+			_attrcpy (&attr_bytes, &attr);
 			num_chars = _vte_unistr_strlen (cell->c);
 			if (num_chars > 1) {
                                 /* Combining chars */
+				base_len = g_unichar_to_utf8 (_vte_unistr_get_base (cell->c), NULL);
+				_vte_ring_attr_writer_append (&ring->attr_writer, attr_bytes,
+							      hyperlink->str, hyperlink->len, base_len);
 				attr.columns = 0;
-				ring->last_attr_text_start_offset = record.text_start_offset + buffer->len
-								  + g_unichar_to_utf8 (_vte_unistr_get_base (cell->c), NULL);
-				memset(&attr_change, 0, sizeof (attr_change));
-				attr_change.text_end_offset = ring->last_attr_text_start_offset;
-                                _attrcpy(&attr_change.attr, &ring->last_attr);
-                                hyperlink = hyperlink_get(ring, ring->last_attr.hyperlink_idx);
-                                attr_change.attr.hyperlink_length = hyperlink->len;
-				_vte_stream_append (ring->attr_stream, (const char *) &attr_change, sizeof (attr_change));
-                                if (G_UNLIKELY (hyperlink->len != 0)) {
-                                        _vte_stream_append (ring->attr_stream, hyperlink->str, hyperlink->len);
-                                        froze_hyperlink = TRUE;
-                                }
-                                hyperlink_length = attr_change.attr.hyperlink_length;
-                                _vte_stream_append (ring->attr_stream, (const char *) &hyperlink_length, 2);
-				ring->last_attr = attr;
+				_attrcpy (&attr_bytes, &attr);
+				_vte_ring_attr_writer_append (&ring->attr_writer, attr_bytes,
+							      hyperlink->str, hyperlink->len, text_len - base_len);
+			} else {
+				_vte_ring_attr_writer_append (&ring->attr_writer, attr_bytes,
+							      hyperlink->str, hyperlink->len, text_len);
 			}
-
-			if (cell->c < 32 || cell->c > 126) record.is_ascii = 0;
-			_vte_unistr_append_to_string (cell->c, buffer);
 		}
 	}
 	if (!row->attr.soft_wrapped)
 		g_string_append_c (buffer, '\n');
 	record.soft_wrapped = row->attr.soft_wrapped;
 
+	if (ring->text_index_stream != NULL) {
+		if (G_UNLIKELY (ring->text_index_tail_len < 0))
+			_vte_ring_text_index_load_tail (ring, position);
+		_vte_ring_text_index_row (ring, position, buffer);
+	}
+
+	_vte_ring_attr_writer_end_row (&ring->attr_writer, ring->attr_stream, ring->attr_dict_stream);
 	_vte_stream_append (ring->text_stream, buffer->str, buffer->len);
 	_vte_ring_append_row_record (ring, &record, position);
 
@@ -434,11 +1017,13 @@ _vte_ring_thaw_row (VteRing *ring, gulong position, VteRowData *row, gboolean do
                     int hyperlink_column, const char **hyperlink)
 {
 	VteRowRecord records[2], record;
+	VteRingAttrRun run;
 	VteCellAttr attr;
-	VteCellAttrChange attr_change;
 	VteCell cell;
 	const char *p, *q, *end;
+	const char *attr_p, *attr_end;
 	GString *buffer = ring->utf8_buffer;
+	GString *attr_buffer = ring->attr_buffer;
         char hyperlink_readbuf[VTE_HYPERLINK_TOTAL_LENGTH_MAX + 1];
 
         hyperlink_readbuf[0] = '\0';
@@ -453,61 +1038,58 @@ _vte_ring_thaw_row (VteRing *ring, gulong position, VteRowData *row, gboolean do
 
 	_vte_row_data_clear (row);
 
-	attr_change.text_end_offset = 0;
-
 	if (!_vte_ring_read_row_record (ring, &records[0], position))
 		return;
 	if ((position + 1) * sizeof (records[0]) < _vte_stream_head (ring->row_stream)) {
 		if (!_vte_ring_read_row_record (ring, &records[1], position + 1))
 			return;
-	} else
+	} else {
 		records[1].text_start_offset = _vte_stream_head (ring->text_stream);
+		records[1].attr_start_offset = _vte_stream_head (ring->attr_stream);
+	}
 
 	g_string_set_size (buffer, records[1].text_start_offset - records[0].text_start_offset);
 	if (!_vte_stream_read (ring->text_stream, records[0].text_start_offset, buffer->str, buffer->len))
 		return;
 
-	record = records[0];
+	g_string_set_size (attr_buffer, records[1].attr_start_offset - records[0].attr_start_offset);
+	if (attr_buffer->len && !_vte_stream_read (ring->attr_stream, records[0].attr_start_offset, attr_buffer->str, attr_buffer->len))
+		return;
 
 	if (G_LIKELY (buffer->len && buffer->str[buffer->len - 1] == '\n'))
                 g_string_truncate (buffer, buffer->len - 1);
 	else
 		row->attr.soft_wrapped = TRUE;
 
+	attr_p = attr_buffer->str;
+	attr_end = attr_p + attr_buffer->len;
+	run.length = 0;
+
 	p = buffer->str;
 	end = p + buffer->len;
 	while (p < end) {
-		if (record.text_start_offset >= ring->last_attr_text_start_offset) {
-			attr = ring->last_attr;
-                        strcpy(hyperlink_readbuf, hyperlink_get(ring, attr.hyperlink_idx)->str);
-		} else {
-			if (record.text_start_offset >= attr_change.text_end_offset) {
-				if (!_vte_stream_read (ring->attr_stream, record.attr_start_offset, (char *) &attr_change, sizeof (attr_change)))
-					return;
-				record.attr_start_offset += sizeof (attr_change);
-                                g_assert_cmpuint (attr_change.attr.hyperlink_length, <=, VTE_HYPERLINK_TOTAL_LENGTH_MAX);
-                                if (attr_change.attr.hyperlink_length && !_vte_stream_read (ring->attr_stream, record.attr_start_offset, hyperlink_readbuf, attr_change.attr.hyperlink_length))
-                                        return;
-                                hyperlink_readbuf[attr_change.attr.hyperlink_length] = '\0';
-                                record.attr_start_offset += attr_change.attr.hyperlink_length + 2;
-
-                                _attrcpy(&attr, &attr_change.attr);
-                                attr.hyperlink_idx = 0;
-                                if (G_UNLIKELY (attr_change.attr.hyperlink_length)) {
-                                        if (do_truncate) {
-                                                /* Find the existing idx or allocate a new one, just as when receiving an OSC 8 escape sequence.
-                                                 * Do not update the current idx though. */
-                                                attr.hyperlink_idx = _vte_ring_get_hyperlink_idx_no_update_current (ring, hyperlink_readbuf);
-                                        } else {
-                                                /* Use a special hyperlink idx, except if to be underlined because the hyperlink is the same as the hovered cell's. */
-                                                attr.hyperlink_idx = VTE_HYPERLINK_IDX_TARGET_IN_STREAM;
-                                                if (ring->hyperlink_hover_idx != 0 && strcmp(hyperlink_readbuf, hyperlink_get(ring, ring->hyperlink_hover_idx)->str) == 0) {
-                                                        /* FIXME here we're calling the expensive strcmp() above and _vte_ring_get_hyperlink_idx_no_update_current() way too many times. */
-                                                        attr.hyperlink_idx = _vte_ring_get_hyperlink_idx_no_update_current(ring, hyperlink_readbuf);
-                                                }
+		if (run.length == 0) {
+			if (!_vte_ring_decode_attr_run (ring, records[0].attr_dict_offset, &attr_p, attr_end, &run))
+				return;
+                        memcpy(hyperlink_readbuf, run.hyperlink, run.attr.hyperlink_length);
+                        hyperlink_readbuf[run.attr.hyperlink_length] = '\0';
+
+                        _attrcpy(&attr, &run.attr);
+                        attr.hyperlink_idx = 0;
+                        if (G_UNLIKELY (run.attr.hyperlink_length)) {
+                                if (do_truncate) {
+                                        /* Find the existing idx or allocate a new one, just as when receiving an OSC 8 escape sequence.
+                                         * Do not update the current idx though. */
+                                        attr.hyperlink_idx = _vte_ring_get_hyperlink_idx_no_update_current (ring, hyperlink_readbuf);
+                                } else {
+                                        /* Use a special hyperlink idx, except if to be underlined because the hyperlink is the same as the hovered cell's. */
+                                        attr.hyperlink_idx = VTE_HYPERLINK_IDX_TARGET_IN_STREAM;
+                                        if (ring->hyperlink_hover_idx != 0 && strcmp(hyperlink_readbuf, hyperlink_get(ring, ring->hyperlink_hover_idx)->str) == 0) {
+                                                /* FIXME here we're calling the expensive strcmp() above and _vte_ring_get_hyperlink_idx_no_update_current() way too many times. */
+                                                attr.hyperlink_idx = _vte_ring_get_hyperlink_idx_no_update_current(ring, hyperlink_readbuf);
                                         }
                                 }
-			}
+                        }
 		}
 
 		cell.attr = attr;
@@ -520,7 +1102,7 @@ _vte_ring_thaw_row (VteRing *ring, gulong position, VteRowData *row, gboolean do
 		cell.c = g_utf8_get_char (p);
 
 		q = g_utf8_next_char (p);
-		record.text_start_offset += q - p;
+		run.length -= MIN (run.length, (gsize) (q - p));
 		p = q;
 
 		if (G_UNLIKELY (cell.attr.columns == 0)) {
@@ -551,50 +1133,23 @@ _vte_ring_thaw_row (VteRing *ring, gulong position, VteRowData *row, gboolean do
 		}
 	}
 
-        /* FIXME this is extremely complicated (by design), figure out something better.
-           This is the only place where we need to walk backwards in attr_stream,
-           which is the reason for the hyperlink's length being repeated after the hyperlink itself. */
 	if (do_truncate) {
-		gsize attr_stream_truncate_at = records[0].attr_start_offset;
 		_vte_debug_print (VTE_DEBUG_RING, "Truncating\n");
-		if (records[0].text_start_offset <= ring->last_attr_text_start_offset) {
-			/* Check the previous attr record. If its text ends where truncating, this attr record also needs to be removed. */
-                        guint16 hyperlink_length;
-                        if (_vte_stream_read (ring->attr_stream, attr_stream_truncate_at - 2, (char *) &hyperlink_length, 2)) {
-                                g_assert_cmpuint (hyperlink_length, <=, VTE_HYPERLINK_TOTAL_LENGTH_MAX);
-                                if (_vte_stream_read (ring->attr_stream, attr_stream_truncate_at - 2 - hyperlink_length - sizeof (attr_change), (char *) &attr_change, sizeof (attr_change))) {
-                                        if (records[0].text_start_offset == attr_change.text_end_offset) {
-                                                _vte_debug_print (VTE_DEBUG_RING, "... at attribute change\n");
-                                                attr_stream_truncate_at -= sizeof (attr_change) + hyperlink_length + 2;
-                                        }
-				}
-			}
-			/* Reconstruct last_attr from the first record of attr_stream that we cut off,
-			   last_attr_text_start_offset from the last record that we keep. */
-			if (_vte_stream_read (ring->attr_stream, attr_stream_truncate_at, (char *) &attr_change, sizeof (attr_change))) {
-                                _attrcpy(&ring->last_attr, &attr_change.attr);
-                                ring->last_attr.hyperlink_idx = 0;
-                                if (attr_change.attr.hyperlink_length && _vte_stream_read (ring->attr_stream, attr_stream_truncate_at + sizeof (attr_change), (char *) &hyperlink_readbuf, attr_change.attr.hyperlink_length)) {
-                                        hyperlink_readbuf[attr_change.attr.hyperlink_length] = '\0';
-                                        ring->last_attr.hyperlink_idx = _vte_ring_get_hyperlink_idx (ring, hyperlink_readbuf);
-                                }
-                                if (_vte_stream_read (ring->attr_stream, attr_stream_truncate_at - 2, (char *) &hyperlink_length, 2)) {
-                                        g_assert_cmpuint (hyperlink_length, <=, VTE_HYPERLINK_TOTAL_LENGTH_MAX);
-                                        if (_vte_stream_read (ring->attr_stream, attr_stream_truncate_at - 2 - hyperlink_length - sizeof (attr_change), (char *) &attr_change, sizeof (attr_change))) {
-                                                ring->last_attr_text_start_offset = attr_change.text_end_offset;
-                                        } else {
-                                                ring->last_attr_text_start_offset = 0;
-                                        }
-				} else {
-					ring->last_attr_text_start_offset = 0;
-				}
-			} else {
-				ring->last_attr_text_start_offset = 0;
-				ring->last_attr = basic_cell.attr;
-			}
+		/* If this row started a new dictionary, the previous row's one becomes the current again. */
+		if (position > ring->start && _vte_ring_read_row_record (ring, &record, position - 1)) {
+			if (record.attr_dict_offset != records[0].attr_dict_offset &&
+			    !_vte_ring_attr_writer_load (&ring->attr_writer, ring->attr_dict_stream, record.attr_dict_offset,
+							 (records[0].attr_dict_offset - record.attr_dict_offset) / sizeof (guint64)))
+				_vte_ring_attr_writer_clear (&ring->attr_writer);
+		} else {
+			_vte_ring_attr_writer_clear (&ring->attr_writer);
+		}
+		if (records[0].attr_dict_offset != ring->attr_writer.dict_offset || !ring->attr_writer.has_dict) {
+			_vte_stream_truncate (ring->attr_dict_stream, records[0].attr_dict_offset);
+			ring->attr_dict_read_offset = (gsize) -1;
 		}
 		_vte_stream_truncate (ring->row_stream, position * sizeof (record));
-		_vte_stream_truncate (ring->attr_stream, attr_stream_truncate_at);
+		_vte_stream_truncate (ring->attr_stream, records[0].attr_start_offset);
 		_vte_stream_truncate (ring->text_stream, records[0].text_start_offset);
 	}
 }
@@ -604,14 +1159,19 @@ _vte_ring_reset_streams (VteRing *ring, gulong position)
 {
 	_vte_debug_print (VTE_DEBUG_RING, "Reseting streams to %lu.\n", position);
 
+	_vte_ring_cache_invalidate (ring);
+
 	if (ring->has_streams) {
 		_vte_stream_reset (ring->row_stream, position * sizeof (VteRowRecord));
                 _vte_stream_reset (ring->text_stream, _vte_stream_head (ring->text_stream));
                 _vte_stream_reset (ring->attr_stream, _vte_stream_head (ring->attr_stream));
+                _vte_stream_reset (ring->attr_dict_stream, _vte_stream_head (ring->attr_dict_stream));
+		_vte_ring_attr_writer_clear (&ring->attr_writer);
+		ring->attr_dict_read_offset = (gsize) -1;
 	}
 
-	ring->last_attr_text_start_offset = 0;
-	ring->last_attr = basic_cell.attr;
+	if (ring->text_index_stream != NULL)
+		_vte_ring_text_index_restart (ring, position);
 }
 
 long
@@ -621,7 +1181,6 @@ _vte_ring_reset (VteRing *ring)
 
         _vte_ring_reset_streams (ring, ring->end);
         ring->start = ring->writable = ring->end;
-        ring->cached_row_num = (gulong) -1;
 
         return ring->end;
 }
@@ -632,13 +1191,20 @@ _vte_ring_index (VteRing *ring, gulong position)
 	if (G_LIKELY (position >= ring->writable))
 		return _vte_ring_writable_index (ring, position);
 
-	if (ring->cached_row_num != position) {
+	VteRingCachedRow *cached = _vte_ring_cache_lookup (ring, position);
+	if (G_LIKELY (cached != NULL)) {
+		ring->cache_hits++;
+	} else {
 		_vte_debug_print(VTE_DEBUG_RING, "Caching row %lu.\n", position);
-                _vte_ring_thaw_row (ring, position, &ring->cached_row, FALSE, -1, NULL);
-		ring->cached_row_num = position;
+		ring->cache_misses++;
+		cached = _vte_ring_cache_evict (ring);
+                _vte_ring_thaw_row (ring, position, &cached->row, FALSE, -1, NULL);
+		cached->position = position;
+		ring->cache_mru = cached - ring->cache;
 	}
+	cached->last_used = ++ring->cache_clock;
 
-	return &ring->cached_row;
+	return &cached->row;
 }
 
 /*
@@ -666,7 +1232,7 @@ _vte_ring_get_hyperlink_at_position (VteRing *ring, gulong position, int col, bo
 
         if (update_hover_idx) {
                 /* Invalidate the cache because new hover idx might result in new idxs to report. */
-                ring->cached_row_num = (gulong) -1;
+                _vte_ring_cache_invalidate (ring);
         }
 
         if (G_UNLIKELY (position == (gulong) -1 || col == -1)) {
@@ -685,9 +1251,11 @@ _vte_ring_get_hyperlink_at_position (VteRing *ring, gulong position, int col, bo
                 *hyperlink = hyperlink_get(ring, row->cells[col].attr.hyperlink_idx)->str;
                 idx = row->cells[col].attr.hyperlink_idx;
         } else {
-                _vte_ring_thaw_row (ring, position, &ring->cached_row, FALSE, col, hyperlink);
-                /* Note: Intentionally don't set cached_row_num. We're about to update
-                 * ring->hyperlink_hover_idx which makes some idxs no longer valid. */
+                VteRingCachedRow *scratch = _vte_ring_cache_evict (ring);
+                _vte_ring_thaw_row (ring, position, &scratch->row, FALSE, col, hyperlink);
+                /* Note: Intentionally leave the slot unused. The row is only partially
+                 * thawed, and we're about to update ring->hyperlink_hover_idx which
+                 * makes some idxs no longer valid. */
                 idx = _vte_ring_get_hyperlink_idx_no_update_current(ring, *hyperlink);
         }
         if (**hyperlink == '\0')
@@ -732,8 +1300,9 @@ _vte_ring_thaw_one_row (VteRing *ring)
 
 	ring->writable--;
 
-	if (ring->writable == ring->cached_row_num)
-		ring->cached_row_num = (gulong) -1; /* Invalidate cached row */
+	_vte_ring_cache_invalidate_row (ring, ring->writable);
+	if (ring->text_index_stream != NULL)
+		_vte_ring_text_index_rewind (ring, ring->writable);
 
 	row = _vte_ring_writable_index (ring, ring->writable);
 
@@ -752,7 +1321,12 @@ _vte_ring_discard_one_row (VteRing *ring)
 		if (G_LIKELY (_vte_ring_read_row_record (ring, &record, ring->start))) {
 			_vte_stream_advance_tail (ring->text_stream, record.text_start_offset);
 			_vte_stream_advance_tail (ring->attr_stream, record.attr_start_offset);
+			_vte_stream_advance_tail (ring->attr_dict_stream, record.attr_dict_offset);
 		}
+		if (ring->text_index_stream != NULL &&
+		    ring->start / VTE_RING_TEXT_INDEX_BLOCK_ROWS < ring->text_index_block)
+			_vte_stream_advance_tail (ring->text_index_stream,
+						  ring->start / VTE_RING_TEXT_INDEX_BLOCK_ROWS * VTE_RING_TEXT_INDEX_FILTER_SIZE);
 	} else {
 		ring->writable = ring->start;
 	}
@@ -985,6 +1559,124 @@ void
 _vte_ring_set_visible_rows (VteRing *ring, gulong rows)
 {
         ring->visible_rows = rows;
+
+        /* Keep a screenful of scrollback thawed while scrolled back. */
+        if (ring->has_streams)
+                _vte_ring_set_cache_size (ring, MAX (rows, VTE_RING_CACHE_SIZE_MIN));
+}
+
+/**
+ * _vte_ring_set_cache_size:
+ * @ring: a #VteRing
+ * @rows: the number of rows
+ *
+ * Set how many rows thawed from the streams are kept around by
+ * _vte_ring_index(). The least recently used row is evicted first.
+ * Changing the size drops the cached rows.
+ */
+void
+_vte_ring_set_cache_size (VteRing *ring, gulong rows)
+{
+        if (MAX (rows, 1) == ring->cache_size)
+                return;
+
+        _vte_debug_print(VTE_DEBUG_RING, "Resizing row cache from %lu to %lu.\n", ring->cache_size, rows);
+
+        _vte_ring_cache_free (ring);
+        _vte_ring_cache_alloc (ring, rows);
+}
+
+/**
+ * _vte_ring_set_text_index:
+ * @ring: a #VteRing
+ * @enabled: whether to index the text
+ *
+ * Enables or disables the index of the text of the frozen rows, which
+ * _vte_ring_text_index_may_contain() consults. Only the rows frozen
+ * from now on are indexed.
+ */
+void
+_vte_ring_set_text_index (VteRing *ring, gboolean enabled)
+{
+        if (!ring->has_streams || enabled == (ring->text_index_stream != NULL))
+                return;
+
+        if (enabled) {
+                ring->text_index_stream = _vte_ring_stream_new ();
+                ring->text_index_filter = (guint8 *) g_malloc (VTE_RING_TEXT_INDEX_FILTER_SIZE);
+                ring->text_index_read_filter = (guint8 *) g_malloc (VTE_RING_TEXT_INDEX_FILTER_SIZE);
+                ring->text_index_buffer = g_string_sized_new (128);
+                _vte_ring_text_index_restart (ring, ring->writable);
+        } else {
+                g_object_unref (ring->text_index_stream);
+                ring->text_index_stream = NULL;
+                g_free (ring->text_index_filter);
+                ring->text_index_filter = NULL;
+                g_free (ring->text_index_read_filter);
+                ring->text_index_read_filter = NULL;
+                g_string_free (ring->text_index_buffer, TRUE);
+                ring->text_index_buffer = NULL;
+        }
+}
+
+/**
+ * _vte_ring_text_index_may_contain:
+ * @ring: a #VteRing
+ * @start: the first row
+ * @end: the row after the last one
+ * @literal: text to look for, ASCII letters match in any case
+ * @length: the length of @literal in bytes
+ *
+ * Checks the text index to find out whether the text of the rows from @start
+ * to @end, joined as by _vte_ring_write_contents(), may contain @literal.
+ *
+ * Returns: %FALSE if it certainly does not
+ */
+gboolean
+_vte_ring_text_index_may_contain (VteRing *ring, gulong start, gulong end,
+                                  const char *literal, gsize length)
+{
+        guint8 filter[VTE_RING_TEXT_INDEX_FILTER_SIZE];
+        gulong block, first_block, last_block;
+        int i;
+
+        if (ring->text_index_stream == NULL || length < 3 ||
+            start < ring->text_index_start || end > ring->writable || start >= end)
+                return TRUE;
+
+        first_block = start / VTE_RING_TEXT_INDEX_BLOCK_ROWS;
+        last_block = (end - 1) / VTE_RING_TEXT_INDEX_BLOCK_ROWS;
+
+        if (first_block == last_block) {
+                const guint8 *f = _vte_ring_text_index_get_filter (ring, first_block);
+                return f == NULL || _vte_ring_text_index_filter_contains (f, literal, length);
+        }
+
+        /* A match may be spread over the blocks */
+        memset (filter, 0, sizeof (filter));
+        for (block = first_block; block <= last_block; block++) {
+                const guint8 *f = _vte_ring_text_index_get_filter (ring, block);
+                if (f == NULL)
+                        return TRUE;
+                for (i = 0; i < VTE_RING_TEXT_INDEX_FILTER_SIZE; i++)
+                        filter[i] |= f[i];
+        }
+        return _vte_ring_text_index_filter_contains (filter, literal, length);
+}
+
+/**
+ * _vte_ring_get_cache_stats:
+ * @ring: a #VteRing
+ * @hits: (out) (allow-none): number of _vte_ring_index() calls served from the cache
+ * @misses: (out) (allow-none): number of rows thawed by _vte_ring_index()
+ */
+void
+_vte_ring_get_cache_stats (VteRing *ring, gulong *hits, gulong *misses)
+{
+        if (hits)
+                *hits = ring->cache_hits;
+        if (misses)
+                *misses = ring->cache_misses;
 }
 
 
@@ -1142,6 +1834,41 @@ _vte_frozen_row_text_offset_to_column (VteRing *ring,
 }
 
 
+/* Walks the attribute runs of the frozen rows in order, for rewrapping. */
+typedef struct _VteRingAttrReader {
+	gulong row;             /* the next row to load */
+	gsize dict_offset;      /* of the loaded row */
+	const char *p, *end;    /* the loaded row's remaining runs in attr_buffer */
+} VteRingAttrReader;
+
+static gboolean
+_vte_ring_attr_reader_next (VteRing *ring, VteRingAttrReader *reader, VteRingAttrRun *run)
+{
+	VteRowRecord records[2];
+	GString *attr_buffer = ring->attr_buffer;
+
+	while (reader->p == reader->end) {
+		if (reader->row >= ring->writable ||
+		    !_vte_ring_read_row_record (ring, &records[0], reader->row))
+			return FALSE;
+		if (reader->row + 1 < ring->writable) {
+			if (!_vte_ring_read_row_record (ring, &records[1], reader->row + 1))
+				return FALSE;
+		} else
+			records[1].attr_start_offset = _vte_stream_head (ring->attr_stream);
+
+		g_string_set_size (attr_buffer, records[1].attr_start_offset - records[0].attr_start_offset);
+		if (attr_buffer->len && !_vte_stream_read (ring->attr_stream, records[0].attr_start_offset, attr_buffer->str, attr_buffer->len))
+			return FALSE;
+		reader->dict_offset = records[0].attr_dict_offset;
+		reader->p = attr_buffer->str;
+		reader->end = reader->p + attr_buffer->len;
+		reader->row++;
+	}
+	return _vte_ring_decode_attr_run (ring, reader->dict_offset, &reader->p, reader->end, run);
+}
+
+
 /**
  * _vte_ring_rewrap:
  * @ring: a #VteRing
@@ -1164,19 +1891,23 @@ _vte_ring_rewrap (VteRing *ring,
 	VteCellTextOffset *marker_text_offsets;
 	VteVisualPosition *new_markers;
 	VteRowRecord old_record;
-	VteCellAttrChange attr_change;
-	VteStream *new_row_stream;
+	VteRingAttrReader attr_reader;
+	VteRingAttrRun run;
+	VteRingAttrWriter new_attr_writer;
+	VteStream *new_row_stream, *new_attr_stream, *new_attr_dict_stream;
 	gsize paragraph_start_text_offset;
 	gsize paragraph_end_text_offset;
 	gsize paragraph_len;  /* excluding trailing '\n' */
-	gsize attr_offset;
 	gsize old_ring_end;
 
 	if (_vte_ring_length(ring) == 0)
 		return;
 	_vte_debug_print(VTE_DEBUG_RING, "Ring before rewrapping:\n");
 	_vte_ring_validate(ring);
-	new_row_stream = _vte_file_stream_new ();
+	new_row_stream = _vte_ring_stream_new ();
+	new_attr_stream = _vte_ring_stream_new ();
+	new_attr_dict_stream = _vte_ring_stream_new ();
+	_vte_ring_attr_writer_init (&new_attr_writer);
 
 	/* Freeze everything, because rewrapping is really complicated and we don't want to
 	   duplicate the code for frozen and thawed rows. */
@@ -1207,12 +1938,9 @@ _vte_ring_rewrap (VteRing *ring,
 	paragraph_end_text_offset = _vte_stream_head (ring->text_stream);  /* initialized to silence gcc */
 	new_row_index = 0;
 
-	attr_offset = old_record.attr_start_offset;
-	if (!_vte_stream_read(ring->attr_stream, attr_offset, (char *) &attr_change, sizeof (attr_change))) {
-                _attrcpy(&attr_change.attr, &ring->last_attr);
-                attr_change.attr.hyperlink_length = hyperlink_get(ring, ring->last_attr.hyperlink_idx)->len;
-		attr_change.text_end_offset = _vte_stream_head (ring->text_stream);
-	}
+	memset(&attr_reader, 0, sizeof (attr_reader));
+	attr_reader.row = ring->start;
+	run.length = 0;
 
 	old_row_index = ring->start + 1;
 	while (paragraph_start_text_offset < _vte_stream_head (ring->text_stream)) {
@@ -1252,42 +1980,37 @@ _vte_ring_rewrap (VteRing *ring,
 				paragraph_len, paragraph_is_ascii);
 
 		/* Wrap the paragraph */
-		if (attr_change.text_end_offset <= text_offset) {
-			/* Attr change at paragraph boundary, advance to next attr. */
-                        attr_offset += sizeof (attr_change) + attr_change.attr.hyperlink_length + 2;
-			if (!_vte_stream_read(ring->attr_stream, attr_offset, (char *) &attr_change, sizeof (attr_change))) {
-                                _attrcpy(&attr_change.attr, &ring->last_attr);
-                                attr_change.attr.hyperlink_length = hyperlink_get(ring, ring->last_attr.hyperlink_idx)->len;
-				attr_change.text_end_offset = _vte_stream_head (ring->text_stream);
-			}
-		}
 		memset(&new_record, 0, sizeof (new_record));
 		new_record.text_start_offset = text_offset;
-		new_record.attr_start_offset = attr_offset;
+		new_record.attr_start_offset = _vte_stream_head (new_attr_stream);
+		new_record.attr_dict_offset = _vte_ring_attr_writer_begin_row (&new_attr_writer, new_row_index, new_attr_dict_stream);
 		new_record.is_ascii = paragraph_is_ascii;
 
 		while (paragraph_len > 0) {
 			/* Wrap one continuous run of identical attributes within the paragraph. */
 			gsize runlength;  /* number of bytes we process in one run: identical attributes, within paragraph */
-			if (attr_change.text_end_offset <= text_offset) {
-				/* Attr change at line boundary, advance to next attr. */
-                                attr_offset += sizeof (attr_change) + attr_change.attr.hyperlink_length + 2;
-				if (!_vte_stream_read(ring->attr_stream, attr_offset, (char *) &attr_change, sizeof (attr_change))) {
-                                        _attrcpy(&attr_change.attr, &ring->last_attr);
-                                        attr_change.attr.hyperlink_length = hyperlink_get(ring, ring->last_attr.hyperlink_idx)->len;
-					attr_change.text_end_offset = _vte_stream_head (ring->text_stream);
-				}
+			gsize chunk_start;
+			guint64 attr_bytes;
+			if (run.length == 0) {
+				/* Attr change, advance to next attr. */
+				if (!_vte_ring_attr_reader_next (ring, &attr_reader, &run))
+					goto err;
 			}
-			runlength = MIN(paragraph_len, attr_change.text_end_offset - text_offset);
+			runlength = MIN(paragraph_len, run.length);
+			_attrcpy(&attr_bytes, &run.attr);
 
-			if (G_UNLIKELY (attr_change.attr.columns == 0)) {
+			if (G_UNLIKELY (run.attr.columns == 0)) {
 				/* Combining characters all fit in the current row */
+				_vte_ring_attr_writer_append (&new_attr_writer, attr_bytes,
+							      run.hyperlink, run.attr.hyperlink_length, runlength);
 				text_offset += runlength;
 				paragraph_len -= runlength;
+				run.length -= runlength;
 			} else {
 				while (runlength) {
-					if (col >= columns - attr_change.attr.columns + 1) {
+					if (col >= columns - run.attr.columns + 1) {
 						/* Wrap now, write the soft wrapped row's record */
+						_vte_ring_attr_writer_end_row (&new_attr_writer, new_attr_stream, new_attr_dict_stream);
 						new_record.soft_wrapped = 1;
 						_vte_stream_append(new_row_stream, (const char *) &new_record, sizeof (new_record));
 						_vte_debug_print(VTE_DEBUG_RING,
@@ -1304,9 +2027,11 @@ _vte_ring_rewrap (VteRing *ring,
 						}
 						new_row_index++;
 						new_record.text_start_offset = text_offset;
-						new_record.attr_start_offset = attr_offset;
+						new_record.attr_start_offset = _vte_stream_head (new_attr_stream);
+						new_record.attr_dict_offset = _vte_ring_attr_writer_begin_row (&new_attr_writer, new_row_index, new_attr_dict_stream);
 						col = 0;
 					}
+					chunk_start = text_offset;
 					if (paragraph_is_ascii) {
 						/* Shortcut for quickly wrapping ASCII (excluding TAB) text.
 						   Don't read text_stream, and advance by a whole row of characters. */
@@ -1319,7 +2044,7 @@ _vte_ring_rewrap (VteRing *ring,
 						/* Process one character only. */
 						char textbuf[6];  /* fits at least one UTF-8 character */
 						int textbuf_len;
-						col += attr_change.attr.columns;
+						col += run.attr.columns;
 						/* Find beginning of next UTF-8 character */
 						text_offset++; paragraph_len--; runlength--;
 						textbuf_len = MIN(runlength, sizeof (textbuf));
@@ -1329,12 +2054,16 @@ _vte_ring_rewrap (VteRing *ring,
 							text_offset++; paragraph_len--; runlength--;
 						}
 					}
+					_vte_ring_attr_writer_append (&new_attr_writer, attr_bytes,
+								      run.hyperlink, run.attr.hyperlink_length, text_offset - chunk_start);
+					run.length -= text_offset - chunk_start;
 				}
 			}
 		}
 
 		/* Write the record of the paragraph's last row. */
 		/* Hard wrapped, except maybe at the end of the very last paragraph */
+		_vte_ring_attr_writer_end_row (&new_attr_writer, new_attr_stream, new_attr_dict_stream);
 		new_record.soft_wrapped = prev_record_was_soft_wrapped;
 		_vte_stream_append(new_row_stream, (const char *) &new_record, sizeof (new_record));
 		_vte_debug_print(VTE_DEBUG_RING,
@@ -1357,11 +2086,21 @@ _vte_ring_rewrap (VteRing *ring,
 	old_ring_end = ring->end;
 	g_object_unref(ring->row_stream);
 	ring->row_stream = new_row_stream;
+	g_object_unref(ring->attr_stream);
+	ring->attr_stream = new_attr_stream;
+	g_object_unref(ring->attr_dict_stream);
+	ring->attr_dict_stream = new_attr_dict_stream;
+	_vte_ring_attr_writer_fini(&ring->attr_writer);
+	ring->attr_writer = new_attr_writer;
+	ring->attr_dict_read_offset = (gsize) -1;
 	ring->writable = ring->end = new_row_index;
 	ring->start = 0;
 	if (ring->end > ring->max)
 		ring->start = ring->end - ring->max;
-	ring->cached_row_num = (gulong) -1;
+	_vte_ring_cache_invalidate (ring);
+	/* The index refers to the old row numbers */
+	if (ring->text_index_stream != NULL)
+		_vte_ring_text_index_restart (ring, ring->writable);
 
 	/* Find the markers. This requires that the ring is already updated. */
 	for (i = 0; i < num_markers; i++) {
@@ -1392,6 +2131,9 @@ err:
 	g_assert_not_reached();
 #endif
 	g_object_unref(new_row_stream);
+	g_object_unref(new_attr_stream);
+	g_object_unref(new_attr_dict_stream);
+	_vte_ring_attr_writer_fini(&new_attr_writer);
 	g_free(marker_text_offsets);
 	g_free(new_markers);
 }
@@ -38,10 +38,46 @@ typedef struct _VteVisualPosition {
 	long row, col;
 } VteVisualPosition;
 
-typedef struct _VteCellAttrChange {
-	gsize text_end_offset;  /* offset of first character no longer using this attr */
-        VteStreamCellAttr attr;
-} VteCellAttrChange;
+/* Encoder of the frozen rows' attributes, see _vte_ring_freeze_row().
+ * dict holds the entries of the current dictionary, the first dict_flushed
+ * of them are already in attr_dict_stream at dict_offset. */
+typedef struct _VteRingAttrWriter {
+	gboolean has_dict;
+	gsize dict_offset;
+	guint64 *dict;          /* the VTE_CELL_ATTR_COMMON_BYTES of VteCellAttr */
+	guint dict_len, dict_flushed, dict_alloc;
+	guint32 *dict_hash;     /* open addressing, entry index + 1, 0 if unused */
+	guint dict_hash_mask;
+	GString *buffer;        /* runs of the row being encoded */
+	gsize run_length;       /* the pending run, 0 if none */
+	guint64 run_attr;
+	GString *run_hyperlink;
+} VteRingAttrWriter;
+
+/* A scrollback row thawed from the streams, kept around for reuse. */
+typedef struct _VteRingCachedRow {
+	VteRowData row;
+	gulong position;        /* (gulong) -1 if the slot is unused */
+	guint64 last_used;      /* LRU stamp from VteRing.cache_clock */
+} VteRingCachedRow;
+
+/* Number of thawed rows to keep unless a larger screen asks for more. */
+#define VTE_RING_CACHE_SIZE_MIN 16
+
+/* Scrollback streams stay in memory until their compressed contents exceed this
+ * many bytes, then move to a temporary file. The VTE_SCROLLBACK_MEMORY_LIMIT
+ * environment variable overrides it, 0 meaning always use a file. */
+#define VTE_RING_MEMORY_STREAM_LIMIT (256 * 1024)
+
+/* A new attribute dictionary is started at every this many rows, or earlier
+ * if the current one has grown to VTE_RING_ATTR_DICT_MAX entries. */
+#define VTE_RING_ATTR_DICT_ROWS 256
+#define VTE_RING_ATTR_DICT_MAX 256
+
+/* Text index granularity: one bloom filter of the text's trigrams per block of rows. */
+#define VTE_RING_TEXT_INDEX_BLOCK_ROWS 256
+#define VTE_RING_TEXT_INDEX_FILTER_SHIFT 14
+#define VTE_RING_TEXT_INDEX_FILTER_SIZE ((1 << VTE_RING_TEXT_INDEX_FILTER_SHIFT) / 8)
 
 
 /*
@@ -65,20 +101,48 @@ struct _VteRing {
          *
          * text_stream is the text in UTF-8.
          *
-         * attr_stream contains entries that consist of:
-         *  - a VteCellAttrChange.
-         *  - a string of attr.hyperlink_length length containing the (typically empty) hyperlink data.
+         * attr_stream contains the runs of identical attributes of each row's text
+         * (excluding the '\n'), every run consisting of these varints:
+         *  - the index of its attributes in the row's dictionary, shifted left by one,
+         *    the lowest bit telling whether the run is hyperlinked.
+         *  - its length in bytes of text.
+         *  - if hyperlinked, the length of the hyperlink data, followed by the data itself.
          *    As far as the ring is concerned, this hyperlink data is opaque. Only the caller cares that
-         *    if nonempty, it actually contains the ID and URI separated with a semicolon. Not NUL terminated.
-         *  - 2 bytes repeating attr.hyperlink_length so that we can walk backwards.
+         *    it actually contains the ID and URI separated with a semicolon. Not NUL terminated.
+         * A row's runs extend up to the next row's attr_start_offset.
+         *
+         * attr_dict_stream contains the dictionaries, each one the distinct
+         * VTE_CELL_ATTR_COMMON_BYTES of the attributes used in a block of rows.
+         * (These two are also regenerated on rewrap.)
          */
 	VteStream *attr_stream, *text_stream, *row_stream;
-	gsize last_attr_text_start_offset;
-	VteCellAttr last_attr;
+	VteStream *attr_dict_stream;
+	VteRingAttrWriter attr_writer;
+	gsize attr_dict_read_offset;    /* dictionary read into attr_dict_read, or -1 */
+	guint64 *attr_dict_read;        /* its first attr_dict_read_len entries */
+	guint attr_dict_read_len, attr_dict_read_alloc;
 	GString *utf8_buffer;
-
-	VteRowData cached_row;
-	gulong cached_row_num;
+	GString *attr_buffer;
+
+	/* LRU cache of rows thawed by _vte_ring_index() */
+	VteRingCachedRow *cache;
+	gulong cache_size;
+	gulong cache_mru;       /* slot of the most recent hit, checked first */
+	guint64 cache_clock;
+	gulong cache_hits, cache_misses;
+
+        /* Optional index of text_stream, see _vte_ring_set_text_index().
+         * text_index_stream contains the filters of the complete blocks,
+         * the block being frozen into is in text_index_filter. */
+        VteStream *text_index_stream;
+        gulong text_index_start;        /* first indexed row */
+        gulong text_index_block;        /* block of text_index_filter */
+        guint8 *text_index_filter;
+        gulong text_index_read_block;   /* block read into text_index_read_filter, or -1 */
+        guint8 *text_index_read_filter;
+        char text_index_tail[2];        /* last bytes of the indexed text, for the next row */
+        int text_index_tail_len;        /* -1 if not known */
+        GString *text_index_buffer;
 
 	gboolean has_streams;
         gulong visible_rows;  /* to keep at least a screenful of lines in memory, bug 646098 comment 12 */
@@ -100,6 +164,8 @@ struct _VteRing {
 #define _vte_ring_delta(__ring) ((glong) (__ring)->start)
 #define _vte_ring_length(__ring) ((glong) ((__ring)->end - (__ring)->start))
 #define _vte_ring_next(__ring) ((glong) (__ring)->end)
+#define _vte_ring_text_index_block_start(__position) \
+	((__position) - (__position) % VTE_RING_TEXT_INDEX_BLOCK_ROWS)
 
 const VteRowData *_vte_ring_index (VteRing *ring, gulong position);
 VteRowData *_vte_ring_index_writable (VteRing *ring, gulong position);
@@ -117,6 +183,11 @@ VteRowData *_vte_ring_append (VteRing *ring);
 void _vte_ring_remove (VteRing *ring, gulong position);
 void _vte_ring_drop_scrollback (VteRing *ring, gulong position);
 void _vte_ring_set_visible_rows (VteRing *ring, gulong rows);
+void _vte_ring_set_cache_size (VteRing *ring, gulong rows);
+void _vte_ring_get_cache_stats (VteRing *ring, gulong *hits, gulong *misses);
+void _vte_ring_set_text_index (VteRing *ring, gboolean enabled);
+gboolean _vte_ring_text_index_may_contain (VteRing *ring, gulong start, gulong end,
+                                           const char *literal, gsize length);
 void _vte_ring_rewrap (VteRing *ring, glong columns, VteVisualPosition **markers);
 gboolean _vte_ring_write_contents (VteRing *ring,
 				   GOutputStream *stream,
@@ -41,6 +41,7 @@
 struct _vte_table {
 	struct _vte_matcher_impl impl;
 	const char *result;
+	guint opcode;
 	unsigned char *original;
 	gssize original_length;
 	struct _vte_table *table_string;
@@ -191,7 +192,7 @@ static void
 _vte_table_addi(struct _vte_table *table,
 		const unsigned char *original, gssize original_length,
 		const char *pattern, gssize length,
-		const char *result)
+		const char *result, guint opcode)
 {
 	int i;
 	guint8 check;
@@ -212,6 +213,7 @@ _vte_table_addi(struct _vte_table *table,
 					  table->result, result);
 
 		table->result = g_intern_string(result);
+		table->opcode = opcode;
 		if (table->original != NULL) {
 			g_free(table->original);
 		}
@@ -234,7 +236,7 @@ _vte_table_addi(struct _vte_table *table,
 			/* Add the rest of the string to the subtable. */
 			_vte_table_addi(subtable, original, original_length,
 					pattern + 2, length - 2,
-					result);
+					result, opcode);
 			return;
 		}
 
@@ -255,7 +257,7 @@ _vte_table_addi(struct _vte_table *table,
 				_vte_table_addi(table, b->data, b->len,
 						(const char *)b->data + initial,
 						b->len - initial,
-						result);
+						result, opcode);
 				g_byte_array_free(b, TRUE);
 			}
 			/* Create a new subtable. */
@@ -268,7 +270,7 @@ _vte_table_addi(struct _vte_table *table,
 			/* Add the rest of the string to the subtable. */
 			_vte_table_addi(subtable, original, original_length,
 					pattern + 2, length - 2,
-					result);
+					result, opcode);
 			return;
 		}
 
@@ -286,7 +288,7 @@ _vte_table_addi(struct _vte_table *table,
 			/* Add the rest of the string to the subtable. */
 			_vte_table_addi(subtable, original, original_length,
 					pattern + 2, length - 2,
-					result);
+					result, opcode);
 			return;
 		}
 
@@ -307,7 +309,7 @@ _vte_table_addi(struct _vte_table *table,
 			/* Add the rest of the string to the subtable. */
 			_vte_table_addi(subtable, original, original_length,
 					pattern + 2, length - 2,
-					result);
+					result, opcode);
 			return;
 		}
 
@@ -334,7 +336,7 @@ _vte_table_addi(struct _vte_table *table,
 				_vte_table_addi(subtable,
 						original, original_length,
 						pattern + 3, length - 3,
-						result);
+						result, opcode);
 			}
 			/* Also add a subtable for higher characters. */
 			if (table->table == NULL) {
@@ -351,7 +353,7 @@ _vte_table_addi(struct _vte_table *table,
 			/* Add the rest of the string to the subtable. */
 			_vte_table_addi(subtable, original, original_length,
 					pattern + 3, length - 3,
-					result);
+					result, opcode);
 			return;
 		}
 	}
@@ -374,26 +376,26 @@ _vte_table_addi(struct _vte_table *table,
 	/* Add the rest of the string to the subtable. */
 	_vte_table_addi(subtable, original, original_length,
 			pattern + 1, length - 1,
-			result);
+			result, opcode);
 }
 
 /* Add a string to the matching tree. */
 void
 _vte_table_add(struct _vte_table *table,
 	       const char *pattern, gssize length,
-	       const char *result)
+	       const char *result, guint opcode)
 {
 	_vte_table_addi(table,
 			(const unsigned char *) pattern, length,
 			pattern, length,
-			result);
+			result, opcode);
 }
 
 /* Match a string in a subtree. */
 static const char *
 _vte_table_matchi(struct _vte_table *table,
 		  const gunichar *candidate, gssize length,
-		  const char **res, const gunichar **consumed,
+		  const char **res, guint *opcode, const gunichar **consumed,
 		  unsigned char **original, gssize *original_length,
 		  struct _vte_table_arginfo_head *params)
 {
@@ -407,6 +409,7 @@ _vte_table_matchi(struct _vte_table *table,
 		*original = table->original;
 		*original_length = table->original_length;
 		*res = table->result;
+		*opcode = table->opcode;
 		return table->result;
 	}
 
@@ -434,7 +437,7 @@ _vte_table_matchi(struct _vte_table *table,
 		arginfo->length = i;
 		/* Continue. */
 		return _vte_table_matchi(subtable, candidate + i, length - i,
-					 res, consumed,
+					 res, opcode, consumed,
 					 original, original_length, params);
 	}
 
@@ -459,7 +462,7 @@ _vte_table_matchi(struct _vte_table *table,
 		/* Try and continue. */
 		local_result = _vte_table_matchi(subtable,
 					 candidate + i, length - i,
-					 res, consumed,
+					 res, opcode, consumed,
 					 original, original_length,
 					 params);
 		if (local_result != NULL) {
@@ -487,7 +490,7 @@ _vte_table_matchi(struct _vte_table *table,
 		arginfo->length = i;
 		/* Continue. */
 		return _vte_table_matchi(subtable, candidate + i, length - i,
-					 res, consumed,
+					 res, opcode, consumed,
 					 original, original_length, params);
 	}
 
@@ -502,7 +505,7 @@ _vte_table_matchi(struct _vte_table *table,
 		arginfo->length = 1;
 		/* Continue. */
 		return _vte_table_matchi(subtable, candidate + 1, length - 1,
-					 res, consumed,
+					 res, opcode, consumed,
 					 original, original_length, params);
 	}
 
@@ -513,20 +516,13 @@ _vte_table_matchi(struct _vte_table *table,
 }
 
 static void
-_vte_table_extract_numbers(GValueArray **array,
+_vte_table_extract_numbers(struct _vte_matcher_params *params,
 			   struct _vte_table_arginfo *arginfo)
 {
-	GValue value = {0,};
-	GValue subvalue = {0,};
-	GValueArray *subarray = NULL;
+	struct _vte_matcher_param *group = NULL;
+	gboolean in_group = FALSE;
 	gssize i;
 
-        if (G_UNLIKELY (*array == NULL)) {
-                *array = g_value_array_new(1);
-        }
-
-	g_value_init(&value, G_TYPE_LONG);
-	g_value_init(&subvalue, G_TYPE_VALUE_ARRAY);
 	i = 0;
 	do {
 		long total = 0;
@@ -535,57 +531,43 @@ _vte_table_extract_numbers(GValueArray **array,
 			total *= 10;
 			total += v == -1 ?  0 : v;
 		}
-		g_value_set_long(&value, CLAMP (total, 0, G_MAXUSHORT));
+		total = CLAMP (total, 0, G_MAXUSHORT);
 		if (i < arginfo->length && arginfo->start[i] == ':') {
-			if (subarray == NULL) {
-				subarray = g_value_array_new(2);
+			if (!in_group) {
+				group = _vte_matcher_params_add(params,
+								VTE_MATCHER_PARAM_SUBPARAMS);
+				in_group = TRUE;
 			}
-			g_value_array_append(subarray, &value);
+			_vte_matcher_params_add_subparam(params, group, total);
 		} else {
-			if (subarray == NULL) {
-				g_value_array_append(*array, &value);
+			if (!in_group) {
+				_vte_matcher_params_add_number(params, total);
 			} else {
-				g_value_array_append(subarray, &value);
-				g_value_set_boxed(&subvalue, subarray);
-				g_value_array_append(*array, &subvalue);
-				subarray = NULL;
+				_vte_matcher_params_add_subparam(params, group, total);
+				in_group = FALSE;
 			}
 		}
 	} while (i++ < arginfo->length);
-	g_value_unset(&value);
 }
 
 static void
-_vte_table_extract_string(GValueArray **array,
+_vte_table_extract_string(struct _vte_matcher_params *params,
 			  struct _vte_table_arginfo *arginfo)
 {
-	GValue value = {0,};
-	gunichar *ptr;
-
-	ptr = g_new(gunichar, arginfo->length + 1);
-        memcpy(ptr, arginfo->start, sizeof(gunichar) * arginfo->length);
-        ptr[arginfo->length] = '\0';
-	g_value_init(&value, G_TYPE_POINTER);
-	g_value_set_pointer(&value, ptr);
-
-	if (G_UNLIKELY (*array == NULL)) {
-		*array = g_value_array_new(1);
-	}
-	g_value_array_append(*array, &value);
-	g_value_unset(&value);
+	_vte_matcher_params_add_string(params, arginfo->start, arginfo->length);
 }
 
 /* Check if a string matches something in the tree. */
 const char *
 _vte_table_match(struct _vte_table *table,
 		 const gunichar *candidate, gssize length,
-		 const char **res, const gunichar **consumed,
-		 GValueArray **array)
+		 const char **res, guint *opcode,
+		 const gunichar **consumed, struct _vte_matcher_params *values)
 {
 	struct _vte_table *head;
 	const gunichar *dummy_consumed;
 	const char *dummy_res;
-	GValueArray *dummy_array;
+	guint dummy_opcode;
 	const char *ret;
 	unsigned char *original, *p;
 	gssize original_length;
@@ -598,13 +580,16 @@ _vte_table_match(struct _vte_table *table,
 		res = &dummy_res;
 	}
 	*res = NULL;
+	if (G_UNLIKELY (opcode == NULL)) {
+		opcode = &dummy_opcode;
+	}
+	*opcode = VTE_MATCHER_OPCODE_NONE;
 	if (G_UNLIKELY (consumed == NULL)) {
 		consumed = &dummy_consumed;
 	}
 	*consumed = candidate;
-	if (G_UNLIKELY (array == NULL)) {
-		dummy_array = NULL;
-		array = &dummy_array;
+	if (values != NULL) {
+		_vte_matcher_params_clear(values);
 	}
 
 	/* Provide a fast path for the usual "not a sequence" cases. */
@@ -640,6 +625,7 @@ _vte_table_match(struct _vte_table *table,
 		/* Got a literal match. */
 		*consumed = candidate + i;
 		*res = head->result;
+		*opcode = head->opcode;
 		return *res;
 	}
 
@@ -647,13 +633,13 @@ _vte_table_match(struct _vte_table *table,
 
 	/* Check for a pattern match. */
 	ret = _vte_table_matchi(table, candidate, length,
-				res, consumed,
+				res, opcode, consumed,
 				&original, &original_length,
 				&params);
 	*res = ret;
 
 	/* If we got a match, extract the parameters. */
-	if (ret != NULL && ret[0] != '\0' && array != &dummy_array) {
+	if (ret != NULL && ret[0] != '\0' && values != NULL) {
 		g_assert(original != NULL);
 		p = original;
 		arginfo = _vte_table_arginfo_head_reverse (&params);
@@ -666,13 +652,13 @@ _vte_table_match(struct _vte_table *table,
 				}
 				/* Handle numeric parameters. */
 				else if ((p[1] == 'd') || (p[1] == 'm')) {
-					_vte_table_extract_numbers(array,
+					_vte_table_extract_numbers(values,
 								   arginfo);
 					p++;
 				}
 				/* Handle string parameters. */
 				else if (p[1] == 's') {
-					_vte_table_extract_string(array,
+					_vte_table_extract_string(values,
 								  arginfo);
 					p++;
 				} else {
@@ -790,35 +776,38 @@ make_wide(const char *p)
 	return ret;
 }
 
-/* Print the contents of a GValueArray. */
+/* Print the contents of a parameter block. */
 static void
-print_array(GValueArray *array)
+print_params(const struct _vte_matcher_params *params)
 {
-	int i;
-	GValue *value;
-	if (array != NULL) {
+	guint i, j;
+	const struct _vte_matcher_param *param;
+	if (params->n_params > 0) {
 		printf(" (");
-		for (i = 0; i < array->n_values; i++) {
-			value = g_value_array_get_nth(array, i);
+		for (i = 0; i < params->n_params; i++) {
+			param = &params->params[i];
 			if (i > 0) {
 				printf(", ");
 			}
-			if (G_VALUE_HOLDS_LONG(value)) {
-				printf("%ld", g_value_get_long(value));
-			} else
-			if (G_VALUE_HOLDS_STRING(value)) {
-				printf("\"%s\"", g_value_get_string(value));
-			} else
-			if (G_VALUE_HOLDS_POINTER(value)) {
-				printf("\"%ls\"",
-				       (wchar_t*) g_value_get_pointer(value));
-			}
-			if (G_VALUE_HOLDS_BOXED(value)) {
-                                print_array((GValueArray *)g_value_get_boxed(value));
+			switch (param->type) {
+			case VTE_MATCHER_PARAM_NUMBER:
+				printf("%ld", param->number);
+				break;
+			case VTE_MATCHER_PARAM_SUBPARAMS:
+				printf("(");
+				for (j = 0; j < param->n_sub; j++) {
+					printf(j > 0 ? ", %ld" : "%ld",
+					       params->subparams[param->sub_start + j]);
+				}
+				printf(")");
+				break;
+			case VTE_MATCHER_PARAM_STRING:
+				printf("\"%.*ls\"", (int) param->str_len,
+				       (wchar_t*) param->str);
+				break;
 			}
 		}
 		printf(")");
-		/* _vte_matcher_free_params_array(array); */
 	}
 }
 
@@ -850,34 +839,34 @@ main(int argc, char **argv)
 		"s",
 	};
 	const char *result, *p;
+	guint opcode;
 	const gunichar *consumed;
 	char *tmp;
 	gunichar *candidate;
-	GValueArray *array;
+	struct _vte_matcher_params params;
 	g_type_init();
 	table = _vte_table_new();
-	_vte_table_add(table, "ABCDEFG", 7, "ABCDEFG");
-	_vte_table_add(table, "ABCD", 4, "ABCD");
-	_vte_table_add(table, "ABCDEFH", 7, "ABCDEFH");
-	_vte_table_add(table, "ACDEFH", 6, "ACDEFH");
-	_vte_table_add(table, "ACDEF%sJ", 8, "ACDEF%sJ");
-	_vte_table_add(table, "[%mh", 5, "move-cursor");
-	_vte_table_add(table, "[%mm", 5, "character-attributes");
-	_vte_table_add(table, "]3;%s", 7, "set-icon-title");
-	_vte_table_add(table, "]4;%s", 7, "set-window-title");
+	_vte_table_add(table, "ABCDEFG", 7, "ABCDEFG", 1);
+	_vte_table_add(table, "ABCD", 4, "ABCD", 2);
+	_vte_table_add(table, "ABCDEFH", 7, "ABCDEFH", 3);
+	_vte_table_add(table, "ACDEFH", 6, "ACDEFH", 4);
+	_vte_table_add(table, "ACDEF%sJ", 8, "ACDEF%sJ", 5);
+	_vte_table_add(table, "[%mh", 5, "move-cursor", 6);
+	_vte_table_add(table, "[%mm", 5, "character-attributes", 7);
+	_vte_table_add(table, "]3;%s", 7, "set-icon-title", 8);
+	_vte_table_add(table, "]4;%s", 7, "set-window-title", 9);
 	printf("Table contents:\n");
 	_vte_table_print(table);
 	printf("\nTable matches:\n");
 	for (i = 0; i < G_N_ELEMENTS(candidates); i++) {
 		p = candidates[i];
 		candidate = make_wide(p);
-		array = NULL;
 		_vte_table_match(table, candidate, strlen(p),
-				 &result, &consumed, &array);
+				 &result, &opcode, &consumed, &params);
 		tmp = escape(p);
-		printf("`%s' => `%s'", tmp, (result ? result : "(NULL)"));
+		printf("`%s' => `%s' (%u)", tmp, (result ? result : "(NULL)"), opcode);
 		g_free(tmp);
-		print_array(array);
+		print_params(&params);
 		printf(" (%d chars)\n", (int) (consumed ? consumed - candidate: 0));
 		g_free(candidate);
 	}
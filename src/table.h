@@ -37,13 +37,14 @@ void _vte_table_free(struct _vte_table *table);
 /* Add a string to the matching tree. */
 void _vte_table_add(struct _vte_table *table,
 		    const char *pattern, gssize length,
-		    const char *result);
+		    const char *result, guint opcode);
 
 /* Check if a string matches something in the tree. */
 const char *_vte_table_match(struct _vte_table *table,
 			     const gunichar *pattern, gssize length,
-			     const char **res, const gunichar **consumed,
-			     GValueArray **array);
+			     const char **res, guint *opcode,
+			     const gunichar **consumed,
+			     struct _vte_matcher_params *values);
 /* Dump out the contents of a tree. */
 void _vte_table_print(struct _vte_table *table);
 
@@ -102,15 +102,15 @@ static void add_update_timeout(VteTerminalPrivate *that);
 static void remove_update_timeout(VteTerminalPrivate *that);
 
 static gboolean process_timeout (gpointer data);
-static gboolean update_timeout (gpointer data);
-static cairo_region_t *vte_cairo_get_clip_region (cairo_t *cr);
 
 /* these static variables are guarded by the GDK mutex */
 static guint process_timeout_tag = 0;
 static gboolean in_process_timeout;
-static guint update_timeout_tag = 0;
-static gboolean in_update_timeout;
-static GList *g_active_terminals;
+static bool process_timeout_slow; /* only hidden terminals are waiting */
+/* The terminals with input to process or a frame to wait for; the focused
+ * one first, the others in the order they became active. */
+static GQueue g_active_terminals = G_QUEUE_INIT;
+static guint g_active_weight;   /* the sum of their m_input_weight */
 
 static int
 _vte_unichar_width(gunichar c, int utf8_ambiguous_width)
@@ -327,21 +327,102 @@ VteTerminalPrivate::last_displayed_row() const
         return r;
 }
 
+/* Convert the column and row start and end to pixel values
+ * by multiplying by the size of a character cell.
+ * Always include the extra pixel border and overlap pixel.
+ */
+void
+VteTerminalPrivate::cells_to_rect(vte::grid::column_t column_start,
+                                  vte::grid::column_t n_columns,
+                                  vte::grid::row_t row_start,
+                                  vte::grid::row_t n_rows,
+                                  cairo_rectangle_int_t& rect) const
+{
+        rect.x = column_start * m_char_width - 1;
+        /* The extra + 1 is for the faux-bold overdraw */
+        int xend = (column_start + n_columns) * m_char_width + 1 + 1;
+        rect.width = xend - rect.x;
+
+        rect.y = row_to_pixel(row_start) - 1;
+        int yend = row_to_pixel(row_start + n_rows) + 1;
+        rect.height = yend - rect.y;
+}
+
+/* Records damage to the displayed part of the given cells, to be queued for
+ * repainting by invalidate_dirty_rects() on the next frame. */
+void
+VteTerminalPrivate::damage_cells(vte::grid::column_t column_start,
+                                 int n_columns,
+                                 vte::grid::row_t row_start,
+                                 int n_rows)
+{
+        vte::grid::row_t first, n_view, row, end;
+
+        first = first_displayed_row();
+        n_view = last_displayed_row() - first + 1;
+
+        if (n_view > m_damage_n_rows) {
+                m_damage = g_renew(struct vte_damage_span, m_damage, n_view);
+                memset(m_damage + m_damage_n_rows, 0,
+                       (n_view - m_damage_n_rows) * sizeof(struct vte_damage_span));
+                m_damage_n_rows = n_view;
+        }
+
+        /* The view scrolled since the damage was recorded; move it along */
+        if (first != m_damage_first) {
+                vte::grid::row_t delta = first - m_damage_first;
+
+                if (ABS(delta) >= m_damage_n_rows) {
+                        memset(m_damage, 0, m_damage_n_rows * sizeof(struct vte_damage_span));
+                } else if (delta > 0) {
+                        memmove(m_damage, m_damage + delta,
+                                (m_damage_n_rows - delta) * sizeof(struct vte_damage_span));
+                        memset(m_damage + m_damage_n_rows - delta, 0,
+                               delta * sizeof(struct vte_damage_span));
+                } else {
+                        memmove(m_damage - delta, m_damage,
+                                (m_damage_n_rows + delta) * sizeof(struct vte_damage_span));
+                        memset(m_damage, 0, -delta * sizeof(struct vte_damage_span));
+                }
+                m_damage_first = first;
+        }
+
+        row = MAX(row_start, first);
+        end = MIN(row_start + n_rows, first + m_damage_n_rows);
+        for (; row < end; row++) {
+                struct vte_damage_span *span = &m_damage[row - first];
+
+                if (span->start < span->end) {
+                        span->start = MIN(span->start, column_start);
+                        span->end = MAX(span->end, column_start + n_columns);
+                } else {
+                        span->start = column_start;
+                        span->end = column_start + n_columns;
+                }
+        }
+        m_damage_pending = true;
+}
+
 void
 VteTerminalPrivate::invalidate_cells(vte::grid::column_t column_start,
                                      int n_columns,
                                      vte::grid::row_t row_start,
                                      int n_rows)
 {
-	if (G_UNLIKELY (!widget_realized()))
-                return;
-
         /* FIXMEchpe: == 0 is fine, but somehow sometimes we
          * get an actual negative n_columns value passed!?
          */
         if (n_columns <= 0 || n_rows <= 0)
                 return;
 
+        /* Whatever changes on screen changes the text to match against
+         * and the rendered rows, even if it isn't going to be drawn. */
+        match_rows_invalidate(row_start, n_rows);
+        render_rows_invalidate(row_start, n_rows);
+
+	if (G_UNLIKELY (!widget_realized()))
+                return;
+
 	if (m_invalidated_all) {
 		return;
 	}
@@ -358,30 +439,19 @@ VteTerminalPrivate::invalidate_cells(vte::grid::column_t column_start,
 		return;
 	}
 
-        cairo_rectangle_int_t rect;
-	/* Convert the column and row start and end to pixel values
-	 * by multiplying by the size of a character cell.
-	 * Always include the extra pixel border and overlap pixel.
-	 */
-        rect.x = column_start * m_char_width - 1;
-        /* The extra + 1 is for the faux-bold overdraw */
-        int xend = (column_start + n_columns) * m_char_width + 1 + 1;
-        rect.width = xend - rect.x;
-
-        rect.y = row_to_pixel(row_start) - 1;
-        int yend = row_to_pixel(row_start + n_rows) + 1;
-        rect.height = yend - rect.y;
-
-	_vte_debug_print (VTE_DEBUG_UPDATES,
-			"Invalidating pixels at (%d,%d)x(%d,%d).\n",
-			rect.x, rect.y, rect.width, rect.height);
-
 	if (m_active_terminals_link != nullptr) {
-                g_array_append_val(m_update_rects, rect);
-		/* Wait a bit before doing any invalidation, just in
-		 * case updates are coming in really soon. */
+                damage_cells(column_start, n_columns, row_start, n_rows);
+		/* Wait for the next frame before doing any invalidation,
+		 * in case more updates come in before then. */
 		add_update_timeout(this);
 	} else {
+                cairo_rectangle_int_t rect;
+                cells_to_rect(column_start, n_columns, row_start, n_rows, rect);
+
+                _vte_debug_print (VTE_DEBUG_UPDATES,
+                                  "Invalidating pixels at (%d,%d)x(%d,%d).\n",
+                                  rect.x, rect.y, rect.width, rect.height);
+
                 auto allocation = get_allocated_rect();
                 rect.x += allocation.x + m_padding.left;
                 rect.y += allocation.y + m_padding.top;
@@ -427,6 +497,17 @@ VteTerminalPrivate::invalidate(vte::grid::span const& s,
 
 void
 VteTerminalPrivate::invalidate_all()
+{
+        match_rows_invalidate(m_match_rows_first, m_match_rows->len);
+        render_rows_invalidate_all();
+
+        invalidate_view();
+}
+
+/* Repaint the whole view, without discarding the rendered rows; for when
+ * the rows didn't change, only where they are shown. */
+void
+VteTerminalPrivate::invalidate_view()
 {
 	if (G_UNLIKELY (!widget_realized()))
                 return;
@@ -438,21 +519,14 @@ VteTerminalPrivate::invalidate_all()
 	_vte_debug_print (VTE_DEBUG_WORK, "*");
 	_vte_debug_print (VTE_DEBUG_UPDATES, "Invalidating all.\n");
 
-	/* replace invalid regions with one covering the whole terminal */
-	reset_update_rects();
+	/* replace the damage with the whole terminal */
+	reset_damage();
 	m_invalidated_all = TRUE;
 
         if (m_active_terminals_link != nullptr) {
-                auto allocation = get_allocated_rect();
-                cairo_rectangle_int_t rect;
-                rect.x = -m_padding.left;
-                rect.y = -m_padding.top;
-                rect.width = allocation.width;
-                rect.height = allocation.height;
-
-                g_array_append_val(m_update_rects, rect);
-		/* Wait a bit before doing any invalidation, just in
-		 * case updates are coming in really soon. */
+                m_damage_pending = true;
+		/* Wait for the next frame before doing any invalidation,
+		 * in case more updates come in before then. */
 		add_update_timeout(this);
 	} else {
                 gtk_widget_queue_draw(m_widget);
@@ -908,6 +982,41 @@ VteTerminalPrivate::emit_text_scrolled(long delta)
 	g_signal_emit(m_terminal, signals[SIGNAL_TEXT_SCROLLED], 0, (int)delta);
 }
 
+/* Emit "frame-drawn" with the counters of the frame that was just drawn. */
+void
+VteTerminalPrivate::emit_frame_drawn(gint64 draw_time)
+{
+        struct _vte_draw_stats stats;
+        guint64 damage_area;
+
+        /* Reset the counters for the next frame even if nobody listens */
+        _vte_draw_take_stats(m_draw, &stats);
+        damage_area = m_frame_damage_area;
+        m_frame_damage_area = 0;
+
+        if (!g_signal_has_handler_pending(m_terminal, signals[SIGNAL_FRAME_DRAWN], 0, FALSE))
+                return;
+
+        GVariantBuilder builder;
+        g_variant_builder_init(&builder, G_VARIANT_TYPE("a{st}"));
+        g_variant_builder_add(&builder, "{st}", "draw-time", (guint64)draw_time);
+        g_variant_builder_add(&builder, "{st}", "rows-painted", (guint64)m_frame_rows_painted);
+        g_variant_builder_add(&builder, "{st}", "rows-rendered", (guint64)m_frame_rows_rendered);
+        g_variant_builder_add(&builder, "{st}", "damage-area", damage_area);
+        g_variant_builder_add(&builder, "{st}", "glyphs-cairo", (guint64)stats.n_glyphs_cairo);
+        g_variant_builder_add(&builder, "{st}", "glyphs-pango-glyph-string", (guint64)stats.n_glyphs_pango_glyph_string);
+        g_variant_builder_add(&builder, "{st}", "glyphs-pango-layout-line", (guint64)stats.n_glyphs_pango_layout_line);
+        g_variant_builder_add(&builder, "{st}", "glyphs-graphic", (guint64)stats.n_glyphs_graphic);
+        g_variant_builder_add(&builder, "{st}", "show-glyphs-calls", (guint64)stats.n_show_glyphs);
+        g_variant_builder_add(&builder, "{st}", "rectangles", (guint64)stats.n_rectangles);
+        auto variant = g_variant_ref_sink(g_variant_builder_end(&builder));
+
+	_vte_debug_print(VTE_DEBUG_SIGNALS,
+			"Emitting `frame-drawn'.\n");
+	g_signal_emit(m_terminal, signals[SIGNAL_FRAME_DRAWN], 0, variant);
+        g_variant_unref(variant);
+}
+
 void
 VteTerminalPrivate::emit_copy_clipboard()
 {
@@ -1012,32 +1121,129 @@ VteTerminalPrivate::set_default_tabstops()
 	}
 }
 
-/* Clear the cache of the screen contents we keep. */
+/* Clear the cache of the screen contents we keep. The per-row text is
+ * kept; only rows dirtied since the last refresh are extracted again. */
 void
 VteTerminalPrivate::match_contents_clear()
 {
 	match_hilite_clear();
-	if (m_match_contents != nullptr) {
-		g_free(m_match_contents);
-		m_match_contents = nullptr;
-	}
-	if (m_match_attributes != nullptr) {
-		g_array_free(m_match_attributes, TRUE);
-		m_match_attributes = nullptr;
-	}
+	m_match_contents = nullptr;
+}
+
+static void
+match_row_free(struct vte_match_row *entry)
+{
+        if (entry->text != nullptr)
+                g_string_free(entry->text, TRUE);
+        g_array_free(entry->attributes, TRUE);
+}
+
+/* Marks the cached text of the given rows as needing to be extracted again. */
+void
+VteTerminalPrivate::match_rows_invalidate(vte::grid::row_t row_start,
+                                          vte::grid::row_t n_rows)
+{
+        vte::grid::row_t first, end, row;
+
+        first = MAX(row_start, m_match_rows_first);
+        end = MIN(row_start + n_rows, m_match_rows_first + (vte::grid::row_t)m_match_rows->len);
+        for (row = first; row < end; row++)
+                g_array_index(m_match_rows, struct vte_match_row,
+                              row - m_match_rows_first).dirty = true;
+}
+
+/* Makes the per-row cache cover @n_rows rows starting at @first, keeping
+ * the rows it already covers. */
+void
+VteTerminalPrivate::match_rows_set_range(vte::grid::row_t first,
+                                         vte::grid::row_t n_rows)
+{
+        GArray *rows;
+        vte::grid::row_t row, old_end;
+        guint i;
+
+        if (m_match_rows_screen != m_screen) {
+                /* Row numbers refer to a different ring; start over */
+                match_rows_invalidate(m_match_rows_first, m_match_rows->len);
+                m_match_rows_screen = m_screen;
+        }
+
+        if (first == m_match_rows_first &&
+            n_rows == (vte::grid::row_t)m_match_rows->len)
+                return;
+
+        old_end = m_match_rows_first + m_match_rows->len;
+        rows = g_array_sized_new(FALSE, TRUE, sizeof(struct vte_match_row), n_rows);
+        for (row = first; row < first + n_rows; row++) {
+                struct vte_match_row entry;
+
+                if (row >= m_match_rows_first && row < old_end) {
+                        struct vte_match_row *old;
+
+                        old = &g_array_index(m_match_rows, struct vte_match_row,
+                                             row - m_match_rows_first);
+                        entry = *old;
+                        old->attributes = nullptr;
+                } else {
+                        entry.text = nullptr;
+                        entry.attributes = g_array_new(FALSE, TRUE, sizeof(struct _VteCharAttributes));
+                        entry.dirty = true;
+                }
+                g_array_append_val(rows, entry);
+        }
+        for (i = 0; i < m_match_rows->len; i++) {
+                struct vte_match_row *old;
+
+                old = &g_array_index(m_match_rows, struct vte_match_row, i);
+                if (old->attributes != nullptr)
+                        match_row_free(old);
+        }
+        g_array_free(m_match_rows, TRUE);
+
+        m_match_rows = rows;
+        m_match_rows_first = first;
 }
 
 void
 VteTerminalPrivate::match_contents_refresh()
 
 {
+        vte::grid::row_t first, n_rows, row;
+        guint n_extracted = 0;
+
 	match_contents_clear();
-	GArray *array = g_array_new(FALSE, TRUE, sizeof(struct _VteCharAttributes));
-        auto match_contents = get_text_displayed(true /* wrap */,
-                                                 false /* include trailing whitespace */,
-                                                 array);
-        m_match_contents = g_string_free(match_contents, FALSE);
-	m_match_attributes = array;
+
+        /* Same rows as get_text_displayed() */
+        first = first_displayed_row();
+        n_rows = last_displayed_row() - first + 1;
+        match_rows_set_range(first, n_rows);
+
+        g_string_truncate(m_match_text, 0);
+        g_array_set_size(m_match_attributes, 0);
+        for (row = first; row < first + n_rows; row++) {
+                struct vte_match_row *entry;
+
+                entry = &g_array_index(m_match_rows, struct vte_match_row, row - first);
+                if (entry->dirty) {
+                        if (entry->text != nullptr)
+                                g_string_free(entry->text, TRUE);
+                        entry->text = get_text(row, 0, row + 1, -1,
+                                               false /* block */, true /* wrap */,
+                                               false /* include trailing whitespace */,
+                                               entry->attributes);
+                        entry->dirty = false;
+                        n_extracted++;
+                }
+
+                g_string_append_len(m_match_text, entry->text->str, entry->text->len);
+                g_array_append_vals(m_match_attributes,
+                                    entry->attributes->data, entry->attributes->len);
+        }
+        m_match_contents = m_match_text->str;
+
+        _vte_debug_print(VTE_DEBUG_REGEX,
+                         "Refreshed match contents, extracted %u of %ld rows.\n",
+                         n_extracted, n_rows);
 }
 
 static void
@@ -2189,8 +2395,10 @@ VteTerminalPrivate::set_encoding(char const* codeset)
 	}
 
 	/* Set the encoding for incoming text. */
+        input_lock();
 	_vte_iso2022_state_set_codeset(m_iso2022,
 				       m_encoding);
+        input_unlock();
 
 	_vte_debug_print(VTE_DEBUG_IO,
 			"Set terminal encoding to `%s'.\n",
@@ -2843,10 +3051,14 @@ VteTerminalPrivate::cursor_down(bool explicit_sequence)
 				start++;
 				end++;
                                 ring_insert(m_screen->cursor.row, false);
-				/* Force the areas below the region to be
-				 * redrawn -- they've moved. */
-				scroll_region(start,
-							    end - start + 1, 1);
+				/* The inserted row and the ones below it
+				 * have been renumbered, so their rendered and
+				 * matched rows are stale; the ones above keep
+				 * theirs. Everything moves on screen though. */
+				invalidate_cells(0, m_column_count,
+						 m_screen->cursor.row,
+						 m_screen->insert_delta + m_row_count - m_screen->cursor.row);
+				invalidate_view();
 				/* Force scroll. */
 				adjust_adjustments();
 			} else {
@@ -2875,6 +3087,7 @@ VteTerminalPrivate::cursor_down(bool explicit_sequence)
                 if (explicit_sequence && m_fill_defaults.attr.back != VTE_DEFAULT_BG) {
 			VteRowData *rowdata = ensure_row();
                         _vte_row_data_fill (rowdata, &m_fill_defaults, m_column_count);
+                        invalidate_cells(0, m_column_count, m_screen->cursor.row, 1);
 		}
 	} else {
 		/* Otherwise, just move the cursor down. */
@@ -3157,6 +3370,68 @@ not_inserted:
 	return line_wrapped;
 }
 
+/* Insert a run of printable, single-width characters from @chars at the
+ * cursor in one go, stopping at the end of the line or at the first character
+ * that needs insert_char()'s slower path. Returns the number of characters
+ * inserted, which may be 0. */
+long
+VteTerminalPrivate::insert_run(gunichar const* chars,
+                               long max_count)
+{
+	VteCellAttr attr;
+	VteRowData *row;
+	VteCell *cells;
+	long col, n, i;
+
+        if (G_UNLIKELY (m_insert_mode ||
+                        *m_character_replacement != VTE_CHARACTER_REPLACEMENT_NONE))
+                return 0;
+
+        col = m_screen->cursor.col;
+        max_count = MIN(max_count, m_column_count - col);
+
+        for (n = 0; n < max_count; n++) {
+                gunichar c = chars[n];
+                if (G_LIKELY (c >= 0x20 && c < 0x7f))
+                        continue;
+                if (c < 0xa0 || _vte_unichar_width(c, m_utf8_ambiguous_width) != 1)
+                        break;
+        }
+        if (n == 0)
+                return 0;
+
+	_vte_debug_print(VTE_DEBUG_PARSE,
+			"Inserting run of %ld characters (%ld, %ld)\n",
+                         n, col, (long)m_screen->cursor.row);
+
+	row = ensure_cursor();
+	g_assert(row != NULL);
+
+        cleanup_fragments(col, col + n);
+        _vte_row_data_fill (row, &basic_cell, col + n);
+
+        attr = m_defaults.attr;
+        attr.fore = m_color_defaults.attr.fore;
+        attr.back = m_color_defaults.attr.back;
+	attr.columns = 1;
+
+        cells = _vte_row_data_get_writable (row, col);
+        for (i = 0; i < n; i++) {
+                cells[i].c = chars[i];
+                cells[i].attr = attr;
+        }
+
+	if (_vte_row_data_length (row) > m_column_count)
+		cleanup_fragments(m_column_count, _vte_row_data_length (row));
+	_vte_row_data_shrink (row, m_column_count);
+
+        m_screen->cursor.col = col + n;
+        m_last_graphic_character = chars[n - 1];
+	m_text_inserted_flag = TRUE;
+
+        return n;
+}
+
 static void
 reaper_child_exited_cb(VteReaper *reaper,
                        int ipid,
@@ -3241,6 +3516,12 @@ VteTerminalPrivate::connect_pty_read()
 	if (m_pty_channel == NULL)
 		return;
 
+        if (m_threaded_input) {
+                if (m_input_job == nullptr)
+                        start_input_thread();
+                return;
+        }
+
 	if (m_pty_input_source == 0) {
 		_vte_debug_print (VTE_DEBUG_IO, "polling vte_terminal_io_read\n");
 		m_pty_input_source =
@@ -3298,6 +3579,8 @@ VteTerminalPrivate::connect_pty_write()
 void
 VteTerminalPrivate::disconnect_pty_read()
 {
+        stop_input_thread();
+
 	if (m_pty_input_source != 0) {
 		_vte_debug_print (VTE_DEBUG_IO, "disconnecting poll of vte_terminal_io_read\n");
 		g_source_remove(m_pty_input_source);
@@ -3317,6 +3600,273 @@ VteTerminalPrivate::disconnect_pty_write()
 	}
 }
 
+/* Threaded input: a worker thread reads the child's output and converts it
+ * to unicode characters as it arrives, and the main thread picks them up
+ * in process(). Interpreting the characters stays on the main thread, as
+ * that is where the screen and all of the signals live. */
+
+struct vte_input_job {
+        volatile gint ref_count;
+
+        /* Not changed once the worker runs */
+        int fd;
+        GCancellable *cancellable;
+        GMainContext *context;
+
+        GMutex lock;            /* protects the rest, and the terminal's m_iso2022 */
+        GCond cond;             /* signalled when the main thread takes characters */
+        VteTerminalPrivate *terminal; /* nullptr once the job is stopped */
+        GArray *unichars;       /* converted, not taken by the main thread yet */
+        bool dispatch_pending;
+        bool termios_changed;
+        int scroll_lock;        /* -1 if unchanged */
+        bool eof;
+        int error;
+};
+
+static struct vte_input_job *
+vte_input_job_ref(struct vte_input_job *job)
+{
+        g_atomic_int_inc(&job->ref_count);
+        return job;
+}
+
+static void
+vte_input_job_unref(gpointer data)
+{
+        auto job = reinterpret_cast<struct vte_input_job *>(data);
+
+        if (!g_atomic_int_dec_and_test(&job->ref_count))
+                return;
+
+        g_object_unref(job->cancellable);
+        g_main_context_unref(job->context);
+        g_mutex_clear(&job->lock);
+        g_cond_clear(&job->cond);
+        g_array_free(job->unichars, TRUE);
+        g_slice_free(struct vte_input_job, job);
+}
+
+static gboolean
+vte_input_job_dispatch_cb(gpointer data)
+{
+        auto job = reinterpret_cast<struct vte_input_job *>(data);
+
+        if (job->terminal == nullptr)
+                return G_SOURCE_REMOVE;
+
+        G_GNUC_BEGIN_IGNORE_DEPRECATIONS;
+        gdk_threads_enter();
+        G_GNUC_END_IGNORE_DEPRECATIONS;
+
+        job->terminal->start_processing();
+
+        G_GNUC_BEGIN_IGNORE_DEPRECATIONS;
+        gdk_threads_leave();
+        G_GNUC_END_IGNORE_DEPRECATIONS;
+
+        return G_SOURCE_REMOVE;
+}
+
+static gpointer
+vte_input_worker_thread(gpointer data)
+{
+        auto job = reinterpret_cast<struct vte_input_job *>(data);
+        auto bytes = g_byte_array_sized_new(VTE_INPUT_CHUNK_SIZE);
+        guchar buf[1 + VTE_INPUT_CHUNK_SIZE];
+        GPollFD fds[2];
+        bool done = false;
+
+        fds[0].fd = job->fd;
+        fds[0].events = G_IO_IN | G_IO_PRI | G_IO_HUP;
+        g_cancellable_make_pollfd(job->cancellable, &fds[1]);
+
+        while (!done) {
+                fds[0].revents = fds[1].revents = 0;
+                if (g_poll(fds, G_N_ELEMENTS(fds), -1) < 0 && errno != EINTR)
+                        break;
+
+                g_mutex_lock(&job->lock);
+
+                /* The fd is only valid while the job is running; and reading
+                 * under the lock means that nothing gets read after that. */
+                if (job->terminal == nullptr) {
+                        g_mutex_unlock(&job->lock);
+                        break;
+                }
+
+                /* Due to TIOCPKT mode, there's an extra byte at the beginning */
+                int ret = read(job->fd, buf, sizeof(buf));
+                int err = ret < 0 ? errno : 0;
+                if (ret > 0) {
+                        char pkt_header = buf[0];
+
+                        if (pkt_header & TIOCPKT_IOCTL)
+                                job->termios_changed = true;
+                        if (pkt_header & TIOCPKT_STOP)
+                                job->scroll_lock = 1;
+                        else if (pkt_header & TIOCPKT_START)
+                                job->scroll_lock = 0;
+
+                        /* Keep incomplete characters for the next read */
+                        g_byte_array_append(bytes, buf + 1, ret - 1);
+                        gsize processed = _vte_iso2022_process(job->terminal->m_iso2022,
+                                                               bytes->data, bytes->len,
+                                                               job->unichars);
+                        g_byte_array_remove_range(bytes, 0, processed);
+                } else if (err == EAGAIN || err == EBUSY || err == EINTR) {
+                        g_mutex_unlock(&job->lock);
+                        continue;
+                } else if (ret == 0 || err == EIO) {
+                        job->eof = true;
+                        done = true;
+                } else {
+                        job->error = err;
+                        done = true;
+                }
+
+                if (!job->dispatch_pending) {
+                        job->dispatch_pending = true;
+                        g_main_context_invoke_full(job->context, VTE_CHILD_INPUT_PRIORITY,
+                                                   vte_input_job_dispatch_cb,
+                                                   vte_input_job_ref(job),
+                                                   vte_input_job_unref);
+                }
+
+                /* Keep the child waiting until the main thread catches up */
+                while (job->terminal != nullptr &&
+                       job->unichars->len >= VTE_INPUT_THREAD_MAX_PENDING)
+                        g_cond_wait(&job->cond, &job->lock);
+
+                g_mutex_unlock(&job->lock);
+        }
+
+        g_byte_array_free(bytes, TRUE);
+        g_cancellable_release_fd(job->cancellable);
+        vte_input_job_unref(job);
+
+        return nullptr;
+}
+
+void
+VteTerminalPrivate::start_input_thread()
+{
+        auto job = g_slice_new0(struct vte_input_job);
+        job->ref_count = 1;
+        job->fd = vte_pty_get_fd(m_pty);
+        job->cancellable = g_cancellable_new();
+        job->context = g_main_context_ref_thread_default();
+        g_mutex_init(&job->lock);
+        g_cond_init(&job->cond);
+        job->terminal = this;
+        job->unichars = g_array_new(FALSE, FALSE, sizeof(gunichar));
+        job->scroll_lock = -1;
+
+        _vte_debug_print(VTE_DEBUG_IO, "Starting the input thread\n");
+
+        m_input_job = job;
+        g_thread_unref(g_thread_new("vte-input",
+                                    vte_input_worker_thread,
+                                    vte_input_job_ref(job)));
+}
+
+/* Detaches the input thread, if any, keeping the characters it converted. */
+void
+VteTerminalPrivate::stop_input_thread()
+{
+        auto job = m_input_job;
+
+        if (job == nullptr)
+                return;
+
+        _vte_debug_print(VTE_DEBUG_IO, "Stopping the input thread\n");
+
+        g_mutex_lock(&job->lock);
+        g_array_append_vals(m_pending, job->unichars->data, job->unichars->len);
+        g_array_set_size(job->unichars, 0);
+        job->terminal = nullptr;
+        g_cond_signal(&job->cond);
+        g_mutex_unlock(&job->lock);
+        g_cancellable_cancel(job->cancellable);
+
+        m_input_job = nullptr;
+        vte_input_job_unref(job);
+}
+
+/* Takes as many of the characters converted by the input thread as fit in
+ * this pass. Returns whether the thread saw the end of the child's output,
+ * and there is nothing left to take. */
+bool
+VteTerminalPrivate::input_thread_collect()
+{
+        auto job = m_input_job;
+        bool termios_changed, eof;
+        int scroll_lock, error;
+        guint n;
+
+        g_mutex_lock(&job->lock);
+        n = MIN(job->unichars->len, input_budget());
+        g_array_append_vals(m_pending, job->unichars->data, n);
+        g_array_remove_range(job->unichars, 0, n);
+        if (job->unichars->len == 0)
+                job->dispatch_pending = false;
+        termios_changed = job->termios_changed;
+        job->termios_changed = false;
+        scroll_lock = job->scroll_lock;
+        job->scroll_lock = -1;
+        error = job->error;
+        job->error = 0;
+        eof = job->eof && job->unichars->len == 0;
+        g_cond_signal(&job->cond);
+        g_mutex_unlock(&job->lock);
+
+        m_input_bytes = n;
+
+        if (termios_changed)
+                pty_termios_changed();
+        if (scroll_lock != -1)
+                pty_scroll_lock_changed(scroll_lock != 0);
+        if (error)
+                /* Translators: %s is replaced with error message returned by strerror(). */
+                g_warning (_("Error reading from child: " "%s."),
+                           g_strerror (error));
+
+        return eof;
+}
+
+/* Returns the number of characters the input thread has converted that
+ * haven't been taken yet. */
+guint
+VteTerminalPrivate::input_thread_pending()
+{
+        auto job = m_input_job;
+        guint n;
+
+        if (job == nullptr)
+                return 0;
+
+        g_mutex_lock(&job->lock);
+        n = job->unichars->len;
+        g_mutex_unlock(&job->lock);
+
+        return n;
+}
+
+/* Guards m_iso2022 against the input thread. */
+void
+VteTerminalPrivate::input_lock()
+{
+        if (m_input_job != nullptr)
+                g_mutex_lock(&m_input_job->lock);
+}
+
+void
+VteTerminalPrivate::input_unlock()
+{
+        if (m_input_job != nullptr)
+                g_mutex_unlock(&m_input_job->lock);
+}
+
 void
 VteTerminalPrivate::pty_termios_changed()
 {
@@ -3498,6 +4048,23 @@ VteTerminalPrivate::im_reset()
         }
 }
 
+void
+VteTerminalPrivate::deselect_if_changed()
+{
+        if (!m_has_selection)
+                return;
+
+        //FIXMEchpe: this is atrocious
+        auto selection = get_selected_text();
+        if ((selection == nullptr) ||
+            (m_selection[VTE_SELECTION_PRIMARY] == nullptr) ||
+            (strcmp(selection->str, m_selection[VTE_SELECTION_PRIMARY]->str) != 0)) {
+                deselect_all();
+        }
+        if (selection)
+                g_string_free(selection, TRUE);
+}
+
 /* Process incoming data, first converting it to unicode characters, and then
  * processing control sequences. */
 void
@@ -3544,6 +4111,7 @@ VteTerminalPrivate::process_incoming()
 
 	/* Convert the data into unicode characters. */
 	unichars = m_pending;
+        input_lock();
 	for (chunk = _vte_incoming_chunks_reverse (m_incoming);
 			chunk != NULL;
 			chunk = next_chunk) {
@@ -3604,6 +4172,7 @@ skip_chunk:
 		}
 	}
 	m_incoming = chunk;
+        input_unlock();
 
 	/* Compute the number of unicode characters we got. */
 	wbuf = &g_array_index(unichars, gunichar, 0);
@@ -3619,14 +4188,36 @@ skip_chunk:
 
 	while (start < wcount && !leftovers) {
 		const char *seq_match;
+		guint seq_opcode;
 		const gunichar *next;
-		GValueArray *params = NULL;
+		struct _vte_matcher_params params;
+		long run_col, run_row, run;
+
+		/* Printable text can't start a control sequence, so insert
+		 * as much of it as fits on the line in one go. */
+                run_col = m_screen->cursor.col;
+                run_row = m_screen->cursor.row;
+                run = insert_run(&wbuf[start], wcount - start);
+                if (run > 0) {
+			bbox_topleft.x = MIN(bbox_topleft.x, run_col);
+			bbox_topleft.y = MIN(bbox_topleft.y, run_row);
+			bbox_bottomright.x = MAX(bbox_bottomright.x,
+                                                 m_screen->cursor.col);
+                        /* cursor.row + 1 (defer until inv.) */
+			bbox_bottomright.y = MAX(bbox_bottomright.y,
+                                                 m_screen->cursor.row);
+			invalidated_text = TRUE;
+			modified = TRUE;
+			start += run;
+			continue;
+                }
 
 		/* Try to match any control sequences. */
 		_vte_matcher_match(m_matcher,
 				   &wbuf[start],
 				   wcount - start,
 				   &seq_match,
+				   &seq_opcode,
 				   &next,
 				   &params);
 		/* We're in one of three possible situations now.
@@ -3638,7 +4229,7 @@ skip_chunk:
 
 			/* Call the right sequence handler for the requested
 			 * behavior. */
-			handle_sequence(seq_match, params);
+			handle_sequence(seq_opcode, &params);
                         m_last_graphic_character = 0;
 
 			/* Skip over the proper number of unicode chars. */
@@ -3706,6 +4297,7 @@ skip_chunk:
 						   next,
 						   wcount - (next - wbuf),
 						   &tmatch,
+						   NULL,
 						   &tnext,
 						   NULL);
 				/* We only do this for non-control-sequence
@@ -3721,7 +4313,7 @@ skip_chunk:
 					/* Move the control character to the
 					 * front. */
 					wbuf[i] = ctrl;
-					goto next_match;
+					continue;
 				}
 			}
 			_VTE_DEBUG_IF(VTE_DEBUG_PARSE) {
@@ -3820,13 +4412,6 @@ skip_chunk:
 		 * part of the display buffer. */
                 g_assert_cmpint(m_screen->cursor.row, >=, m_screen->insert_delta);
 #endif
-
-next_match:
-		if (G_LIKELY(params != NULL)) {
-			/* Free any parameters we don't care about any more. */
-			_vte_matcher_free_params_array(m_matcher,
-					params);
-		}
 	}
 
 	/* Remove most of the processed characters. */
@@ -3847,18 +4432,11 @@ next_match:
 			maybe_scroll_to_bottom();
 		}
 		/* Deselect the current selection if its contents are changed
-		 * by this insertion. */
-		if (m_has_selection) {
-                        //FIXMEchpe: this is atrocious
-			auto selection = get_selected_text();
-			if ((selection == nullptr) ||
-			    (m_selection[VTE_SELECTION_PRIMARY] == nullptr) ||
-			    (strcmp(selection->str, m_selection[VTE_SELECTION_PRIMARY]->str) != 0)) {
-				deselect_all();
-			}
-                        if (selection)
-                                g_string_free(selection, TRUE);
-		}
+		 * by this insertion; once it can be seen again, if hidden. */
+		if (m_background)
+                        m_selection_check_pending = m_has_selection;
+                else
+                        deselect_if_changed();
 	}
 
 	if (modified || (m_screen != previous_screen)) {
@@ -3903,7 +4481,8 @@ next_match:
 	}
 
 	/* Tell the input method where the cursor is. */
-        im_update_cursor();
+        if (!m_background)
+                im_update_cursor();
 
         /* After processing some data, do a hyperlink GC. The multiplier is totally arbitrary, feel free to fine tune. */
         _vte_ring_hyperlink_maybe_gc(m_screen->row_data, wcount * 4);
@@ -3953,18 +4532,12 @@ VteTerminalPrivate::pty_io_read(GIOChannel *channel,
 		/* Limit the amount read between updates, so as to
 		 * 1. maintain fairness between multiple terminals;
 		 * 2. prevent reading the entire output of a command in one
-		 *    pass, i.e. we always try to refresh the terminal ~40Hz.
-		 *    See time_process_incoming() where we estimate the
-		 *    maximum number of bytes we can read/process in between
-		 *    updates.
+		 *    pass, i.e. we always try to refresh the terminal on
+		 *    every frame. See time_process_incoming() where we
+		 *    estimate the maximum number of bytes we can
+		 *    read/process within a frame.
 		 */
-		max_bytes = m_active_terminals_link != nullptr ?
-		            g_list_length(g_active_terminals) - 1 : 0;
-		if (max_bytes) {
-			max_bytes = m_max_input_bytes / max_bytes;
-		} else {
-			max_bytes = m_max_input_bytes;
-		}
+		max_bytes = input_budget();
 		bytes = m_input_bytes;
 
 		chunk = m_incoming;
@@ -5983,7 +6556,8 @@ VteTerminalPrivate::get_text(vte::grid::row_t start_row,
                              bool block,
                              bool wrap,
                              bool include_trailing_spaces,
-                             GArray *attributes)
+                             GArray *attributes,
+                             GArray *runs)
 {
 	const VteCell *pcell = NULL;
 	GString *string;
@@ -5992,6 +6566,8 @@ VteTerminalPrivate::get_text(vte::grid::row_t start_row,
 
 	if (attributes)
 		g_array_set_size (attributes, 0);
+	if (runs)
+		g_array_set_size (runs, 0);
 
 	string = g_string_new(NULL);
 	memset(&attr, 0, sizeof(attr));
@@ -6007,6 +6583,7 @@ VteTerminalPrivate::get_text(vte::grid::row_t start_row,
                 gsize last_empty, last_nonempty;
                 vte::grid::column_t last_emptycol, last_nonemptycol;
                 vte::grid::column_t line_last_column = (block || row == end_row) ? end_col : G_MAXLONG;
+                vte::grid::column_t run_next_column = -1;
 
 		last_empty = last_nonempty = string->len;
 		last_emptycol = last_nonemptycol = -1;
@@ -6036,6 +6613,14 @@ VteTerminalPrivate::get_text(vte::grid::row_t start_row,
 					attr.underline = pcell->attr.underline;
 					attr.strikethrough = pcell->attr.strikethrough;
 
+					/* Start a new run unless this cell continues the last one */
+					if (runs && col != run_next_column) {
+						struct vte_text_run run = { string->len, row, col };
+						g_array_append_val(runs, run);
+					}
+					/* A cell with combining characters ends the run */
+					run_next_column = (pcell->c == 0 || _vte_unistr_strlen(pcell->c) == 1) ? col + 1 : -1;
+
 					/* Store the cell string */
 					if (pcell->c == 0) {
 						g_string_append_c (string, ' ');
@@ -6081,6 +6666,9 @@ VteTerminalPrivate::get_text(vte::grid::row_t start_row,
 				g_string_truncate(string, last_nonempty);
 				if (attributes)
 					g_array_set_size(attributes, string->len);
+				while (runs && runs->len > 0 &&
+				       g_array_index(runs, struct vte_text_run, runs->len - 1).offset >= string->len)
+					g_array_set_size(runs, runs->len - 1);
 				attr.column = last_nonemptycol;
 			}
 		}
@@ -7398,6 +7986,7 @@ VteTerminalPrivate::widget_focus_in(GdkEventFocus *event)
 	if (widget_realized()) {
 		m_cursor_blink_state = TRUE;
 		m_has_focus = TRUE;
+                update_input_weight();
 
 		check_cursor_blink();
 
@@ -7430,6 +8019,7 @@ VteTerminalPrivate::widget_focus_out(GdkEventFocus *event)
 	}
 
 	m_has_focus = false;
+        update_input_weight();
 	check_cursor_blink();
 }
 
@@ -7505,6 +8095,7 @@ VteTerminalPrivate::widget_visibility_notify(GdkEventVisibility *event)
 	}
 
 	m_visibility_state = event->state;
+        update_input_weight();
 
 	/* no longer visible, stop processing display updates */
 	if (m_visibility_state == GDK_VISIBILITY_FULLY_OBSCURED) {
@@ -7559,12 +8150,52 @@ VteTerminalPrivate::apply_font_metrics(int width,
 	}
 	/* Emit a signal that the font changed. */
 	if (cresize) {
+                /* The rasterized box drawing characters have the old cell size */
+                if (m_draw != nullptr)
+                        _vte_draw_clear_graphics(m_draw);
 		emit_char_size_changed(m_char_width, m_char_height);
 	}
 	/* Repaint. */
 	invalidate_all();
 }
 
+/* Shape the characters on screen in one go, rather than one by one as
+ * they are drawn for the first time in the new font. */
+void
+VteTerminalPrivate::prewarm_font()
+{
+        GHashTable *seen = g_hash_table_new(nullptr, nullptr);
+        GArray *chars = g_array_new(FALSE, FALSE, sizeof(gunichar));
+        vte::grid::row_t row, last = last_displayed_row();
+
+        for (row = first_displayed_row(); row <= last; row++) {
+                VteRowData const* row_data = find_row_data(row);
+                if (row_data == nullptr)
+                        continue;
+
+                for (guint col = 0; col < row_data->len; col++) {
+                        vteunistr c = row_data->cells[col].c;
+
+                        /* ASCII is cached anyway, combined characters
+                         * are shaped as a whole, and the box drawing ones
+                         * are drawn without the font */
+                        if (c < 0x80 || c > 0x10FFFF ||
+                            _vte_draw_unichar_is_local_graphic(c) ||
+                            g_hash_table_contains(seen, GUINT_TO_POINTER(c)))
+                                continue;
+                        g_hash_table_add(seen, GUINT_TO_POINTER(c));
+                        gunichar uc = c;
+                        g_array_append_val(chars, uc);
+                }
+        }
+
+        if (chars->len > 0)
+                _vte_draw_prewarm(m_draw, (gunichar const*)chars->data, chars->len);
+
+        g_array_free(chars, TRUE);
+        g_hash_table_destroy(seen);
+}
+
 void
 VteTerminalPrivate::ensure_font()
 {
@@ -7579,6 +8210,7 @@ VteTerminalPrivate::ensure_font()
 			_vte_draw_set_text_font (m_draw,
                                                  m_widget,
 					m_fontdesc);
+                        prewarm_font();
 			_vte_draw_get_text_metrics (m_draw,
 						    &width, &height, &ascent);
 			apply_font_metrics(width, height, ascent, height - ascent);
@@ -7760,8 +8392,18 @@ VteTerminalPrivate::screen_set_size(VteScreen *screen_,
 
 	old_top_lines = below_current_paragraph.row - screen_->insert_delta;
 
-	if (do_rewrap && old_columns != m_column_count)
+        /* The width is part of the cached text, and rewrapping renumbers rows */
+        if (screen_ == m_match_rows_screen)
+                match_rows_invalidate(m_match_rows_first, m_match_rows->len);
+        if (screen_ == m_render_screen)
+                render_rows_invalidate_all();
+
+	if (do_rewrap && old_columns != m_column_count) {
+                /* Rewrapping renumbers the rows the matches refer to */
+                if (screen_ == m_search_screen)
+                        search_reset();
 		_vte_ring_rewrap(ring, m_column_count, markers);
+        }
 
 	if (_vte_ring_length(ring) > m_row_count) {
 		/* The content won't fit without scrollbars. Before figuring out the position, we might need to
@@ -7924,7 +8566,7 @@ VteTerminalPrivate::vadjustment_value_changed()
 	if (dy != 0) {
 		_vte_debug_print(VTE_DEBUG_ADJ,
 			    "Scrolling by %f\n", dy);
-                invalidate_all();
+                invalidate_view();
 		emit_text_scrolled(dy);
 		queue_contents_changed();
 	} else {
@@ -7997,10 +8639,11 @@ VteTerminalPrivate::VteTerminalPrivate(VteTerminal *t) :
 	gtk_widget_set_redraw_on_allocate(m_widget, FALSE);
 
         m_invalidated_all = false;
-        m_update_rects = g_array_sized_new(FALSE /* zero terminated */,
-                                           FALSE /* clear */,
-                                           sizeof(cairo_rectangle_int_t),
-                                           32 /* preallocated size */);
+
+        /* Matching data; allocated early since invalidating dirties it. */
+        m_match_text = g_string_new(nullptr);
+        m_match_attributes = g_array_new(FALSE, TRUE, sizeof(struct _VteCharAttributes));
+        m_match_rows = g_array_new(FALSE, TRUE, sizeof(struct vte_match_row));
 
 	/* Set an adjustment for the application to use to control scrolling. */
         m_vadjustment = nullptr;
@@ -8047,8 +8690,15 @@ VteTerminalPrivate::VteTerminalPrivate(VteTerminal *t) :
         m_utf8_ambiguous_width = VTE_DEFAULT_UTF8_AMBIGUOUS_WIDTH;
         m_iso2022 = _vte_iso2022_state_new(m_encoding);
 	m_incoming = nullptr;
-	m_pending = g_array_new(FALSE, TRUE, sizeof(gunichar));
+	m_pending = g_array_new(FALSE, FALSE, sizeof(gunichar));
 	m_max_input_bytes = VTE_MAX_INPUT_READ;
+        m_frame_tick_id = 0;
+        m_frame_interval = VTE_DEFAULT_FRAME_INTERVAL;
+        m_input_weight = VTE_INPUT_WEIGHT_HIDDEN;
+        m_background = false;
+        m_background_next_pass = 0;
+        m_background_signals_tag = 0;
+        m_selection_check_pending = false;
 	m_cursor_blink_tag = 0;
 	m_outgoing = _vte_byte_array_new();
 	m_outgoing_conv = VTE_INVALID_CONV;
@@ -8095,6 +8745,8 @@ VteTerminalPrivate::VteTerminalPrivate(VteTerminal *t) :
 	m_allow_bold = TRUE;
         m_deccolm_mode = FALSE;
         m_rewrap_on_resize = TRUE;
+        m_threaded_input = false;
+        m_input_job = nullptr;
 	set_default_tabstops();
 
         m_input_enabled = TRUE;
@@ -8127,6 +8779,11 @@ VteTerminalPrivate::VteTerminalPrivate(VteTerminal *t) :
         /* Search data */
         m_search_regex.regex = nullptr;
         m_search_regex.match_flags = 0;
+        m_search_job = nullptr;
+        m_search_task = nullptr;
+        m_search_screen = nullptr;
+        m_search_source = 0;
+        m_search_matches = g_array_new(FALSE, FALSE, sizeof(struct vte_search_match));
 
 	/* Rendering data */
 	m_draw = _vte_draw_new();
@@ -8279,7 +8936,7 @@ VteTerminalPrivate::widget_size_allocate(GtkAllocation *allocation)
 					allocation->height);
 		/* Force a repaint if we were resized. */
 		if (repaint) {
-			reset_update_rects();
+			reset_damage();
 			invalidate_all();
 		}
 	}
@@ -8290,6 +8947,8 @@ VteTerminalPrivate::widget_unrealize()
 {
 	_vte_debug_print(VTE_DEBUG_LIFECYCLE, "vte_terminal_unrealize()\n");
 
+        render_rows_free();
+
 	/* Deallocate the cursors. */
         m_mouse_cursor_over_widget = FALSE;
 	g_object_unref(m_mouse_default_cursor);
@@ -8350,6 +9009,12 @@ VteTerminalPrivate::widget_unrealize()
 	m_text_modified_flag = FALSE;
 	m_text_inserted_flag = FALSE;
 	m_text_deleted_flag = FALSE;
+        if (m_background_signals_tag != 0) {
+                g_source_remove(m_background_signals_tag);
+                m_background_signals_tag = 0;
+        }
+        m_background = false;
+        m_selection_check_pending = false;
 
 	/* Clear modifiers. */
 	m_modifiers = 0;
@@ -8427,6 +9092,12 @@ VteTerminalPrivate::~VteTerminalPrivate()
 
 	_vte_debug_print(VTE_DEBUG_LIFECYCLE, "vte_terminal_finalize()\n");
 
+        /* The input thread uses m_iso2022 until it's told to stop */
+        stop_input_thread();
+
+        if (m_background_signals_tag != 0)
+                g_source_remove(m_background_signals_tag);
+
 	/* Free the draw structure. */
 	if (m_draw != NULL) {
 		_vte_draw_free(m_draw);
@@ -8444,10 +9115,11 @@ VteTerminalPrivate::~VteTerminalPrivate()
 	}
 
 	/* Free matching data. */
-	if (m_match_attributes != NULL) {
-		g_array_free(m_match_attributes, TRUE);
-	}
-	g_free(m_match_contents);
+	g_array_free(m_match_attributes, TRUE);
+	g_string_free(m_match_text, TRUE);
+        for (i = 0; i < m_match_rows->len; i++)
+                match_row_free(&g_array_index(m_match_rows, struct vte_match_row, i));
+        g_array_free(m_match_rows, TRUE);
 	if (m_match_regexes != NULL) {
 		for (i = 0; i < m_match_regexes->len; i++) {
 			regex = &g_array_index(m_match_regexes,
@@ -8463,8 +9135,11 @@ VteTerminalPrivate::~VteTerminalPrivate()
 	}
 
         regex_and_flags_clear(&m_search_regex);
-	if (m_search_attrs)
-		g_array_free (m_search_attrs, TRUE);
+	if (m_search_runs)
+		g_array_free (m_search_runs, TRUE);
+        /* A search in progress holds a reference on the terminal */
+        g_assert(m_search_job == nullptr);
+        g_array_free(m_search_matches, TRUE);
 
 	/* Disconnect from autoscroll requests. */
 	stop_autoscroll();
@@ -8580,8 +9255,8 @@ VteTerminalPrivate::~VteTerminalPrivate()
                                               0, 0, NULL, NULL,
                                               this);
 
-        /* Update rects */
-        g_array_free(m_update_rects, TRUE /* free segment */);
+        /* Damage */
+        g_free(m_damage);
 }
 
 void
@@ -8678,6 +9353,8 @@ VteTerminalPrivate::widget_map()
 {
         if (m_event_window)
                 gdk_window_show_unraised(m_event_window);
+
+        update_input_weight();
 }
 
 void
@@ -8685,6 +9362,9 @@ VteTerminalPrivate::widget_unmap()
 {
         if (m_event_window)
                 gdk_window_hide(m_event_window);
+
+        /* Still mapped until the parent class unmaps us */
+        set_input_weight(VTE_INPUT_WEIGHT_HIDDEN);
 }
 
 static inline void
@@ -9152,41 +9832,63 @@ VteTerminalPrivate::draw_cells_with_attributes(struct _vte_draw_text_request *it
 }
 
 
-/* Paint the contents of a given row at the given location.  Take advantage
- * of multiple-draw APIs by finding runs of characters with identical
- * attributes and bundling them together. */
+/* Fills the background spans collected by draw_row_backgrounds(), each @height pixels
+ * high starting at @y. */
 void
-VteTerminalPrivate::draw_rows(VteScreen *screen_,
-                              vte::grid::row_t start_row,
-                              vte::grid::row_t end_row,
-                              vte::grid::column_t start_column,
-                              vte::grid::column_t end_column,
-                              gint start_x,
-                              gint start_y,
-                              gint column_width,
-                              gint row_height)
+VteTerminalPrivate::fill_background_spans(GArray *spans,
+                                          gint y,
+                                          gint height)
+{
+        for (guint n = 0; n < spans->len; n++) {
+                struct vte_background_span const* span =
+                        &g_array_index(spans, struct vte_background_span, n);
+                vte::color::rgb bg;
+
+                rgb_from_index(span->back, bg);
+                _vte_draw_fill_rectangle(m_draw,
+                                         span->x, y, span->width, height,
+                                         &bg, VTE_DRAW_OPAQUE);
+        }
+}
+
+/* Paint the backgrounds of the given rows at the given location, the text
+ * is then painted on top of them by draw_rows(). */
+void
+VteTerminalPrivate::draw_row_backgrounds(VteScreen *screen_,
+                                         vte::grid::row_t start_row,
+                                         vte::grid::row_t end_row,
+                                         vte::grid::column_t start_column,
+                                         vte::grid::column_t end_column,
+                                         gint start_x,
+                                         gint start_y,
+                                         gint column_width,
+                                         gint row_height)
 {
-	struct _vte_draw_text_request items[4*VTE_DRAW_MAX_LENGTH];
         vte::grid::row_t row, rows;
         vte::grid::column_t i, j;
         long x, y;
 	guint fore, nfore, back, nback;
-        gboolean underline, nunderline, bold, nbold, italic, nitalic,
-                 hyperlink, nhyperlink, hilite, nhilite,
-		 selected, nselected, strikethrough, nstrikethrough;
-	guint item_count;
+        gboolean bold, selected, nselected;
 	const VteCell *cell;
 	VteRowData const* row_data;
 
 	/* adjust for the absolute start of row */
 	start_x -= start_column * column_width;
 
-	/* clear the background */
+	/* Paint the backgrounds which differ from the default one, already
+	 * painted by the caller. Cells with the same colour on a row are
+	 * merged into a span, and rows with identical spans into one
+	 * rectangle. */
+	GArray *spans = g_array_new(FALSE, FALSE, sizeof(struct vte_background_span));
+	GArray *pending = g_array_new(FALSE, FALSE, sizeof(struct vte_background_span));
+	gint pending_y = start_y, pending_height = 0;
+
 	x = start_x;
 	y = start_y;
 	row = start_row;
 	rows = end_row - start_row;
 	do {
+		g_array_set_size(spans, 0);
 		row_data = find_row_data(row);
 		/* Back up in case this is a multicolumn character,
 		 * making the drawing area a little wider. */
@@ -9231,17 +9933,13 @@ VteTerminalPrivate::draw_rows(VteScreen *screen_,
 					j += cell ? cell->attr.columns : 1;
 				}
 				if (back != VTE_DEFAULT_BG) {
-					vte::color::rgb bg;
 					gint bold_offset = _vte_draw_has_bold(m_draw,
 											VTE_DRAW_BOLD) ? 0 : bold;
-					rgb_from_index(back, bg);
-					_vte_draw_fill_rectangle (
-							m_draw,
-							x + i * column_width,
-							y,
-							(j - i) * column_width + bold_offset,
-							row_height,
-							&bg, VTE_DRAW_OPAQUE);
+					struct vte_background_span span = {
+						(gint)(x + i * column_width),
+						(gint)((j - i) * column_width + bold_offset),
+						back };
+					g_array_append_val(spans, span);
 				}
 				/* We'll need to continue at the first cell which didn't
 				 * match the first one in this set. */
@@ -9260,22 +9958,66 @@ VteTerminalPrivate::draw_rows(VteScreen *screen_,
 				}
 				determine_colors(nullptr, selected, &fore, &back);
 				if (back != VTE_DEFAULT_BG) {
-					vte::color::rgb bg;
-					rgb_from_index(back, bg);
-					_vte_draw_fill_rectangle (m_draw,
-								  x + i *column_width,
-								  y,
-								  (j - i)  * column_width,
-								  row_height,
-								  &bg, VTE_DRAW_OPAQUE);
+					struct vte_background_span span = {
+						(gint)(x + i * column_width),
+						(gint)((j - i) * column_width),
+						back };
+					g_array_append_val(spans, span);
 				}
 				i = j;
 			} while (i < end_column);
 		}
+
+		/* Extend the pending rectangles if this row has the same spans */
+		if (spans->len == pending->len &&
+		    memcmp(spans->data, pending->data,
+			   spans->len * sizeof(struct vte_background_span)) == 0) {
+			pending_height += row_height;
+		} else {
+			fill_background_spans(pending, pending_y, pending_height);
+			GArray *tmp = pending;
+			pending = spans;
+			spans = tmp;
+			pending_y = y;
+			pending_height = row_height;
+		}
+
 		row++;
 		y += row_height;
 	} while (--rows);
+	fill_background_spans(pending, pending_y, pending_height);
+	g_array_free(spans, TRUE);
+	g_array_free(pending, TRUE);
+}
+
+/* Paint the text of a given row at the given location.  Take advantage
+ * of multiple-draw APIs by finding runs of characters with identical
+ * attributes and bundling them together. */
+void
+VteTerminalPrivate::draw_rows(VteScreen *screen_,
+                              vte::grid::row_t start_row,
+                              vte::grid::row_t end_row,
+                              vte::grid::column_t start_column,
+                              vte::grid::column_t end_column,
+                              gint start_x,
+                              gint start_y,
+                              gint column_width,
+                              gint row_height)
+{
+	struct _vte_draw_text_request items[4*VTE_DRAW_MAX_LENGTH];
+        vte::grid::row_t row, rows;
+        vte::grid::column_t i, j;
+        long y;
+	guint fore, nfore, back, nback;
+        gboolean underline, nunderline, bold, nbold, italic, nitalic,
+                 hyperlink, nhyperlink, hilite, nhilite,
+		 selected, strikethrough, nstrikethrough;
+	guint item_count;
+	const VteCell *cell;
+	VteRowData const* row_data;
 
+	/* adjust for the absolute start of row */
+	start_x -= start_column * column_width;
 
 	/* render the text */
 	y = start_y;
@@ -9467,82 +10209,179 @@ fg_out:
 	return;
 }
 
+inline int
+VteTerminalPrivate::render_slot(vte::grid::row_t row) const
+{
+        int slot = row % m_render_n_slots;
+        return slot < 0 ? slot + m_render_n_slots : slot;
+}
+
+/* Marks the rendered copies of the given rows as stale. */
 void
-VteTerminalPrivate::expand_rectangle(cairo_rectangle_int_t& rect) const
+VteTerminalPrivate::render_rows_invalidate(vte::grid::row_t row_start,
+                                           vte::grid::row_t n_rows)
 {
-	/* increase the paint by one pixel on all sides to force the
-	 * inclusion of neighbouring cells */
-        vte::grid::row_t row = pixel_to_row(MAX(0, rect.y - 1));
-        /* Both the value given by MIN() and row_stop are exclusive.
-         * _vte_terminal_pixel_to_row expects an actual value corresponding
-         * to the bottom visible pixel, hence the - 1 + 1 magic. */
-        vte::grid::row_t row_stop = pixel_to_row(MIN(rect.height + rect.y + 1, m_view_usable_extents.height()) - 1) + 1;
-        if (row_stop <= row)
+        vte::grid::row_t row;
+
+        if (m_render_rows == nullptr)
                 return;
 
-        vte::grid::column_t col = MAX(0, (rect.x - 1) / m_char_width);
-        vte::grid::column_t col_stop = MIN(howmany(rect.width + rect.x + 1, m_char_width), m_column_count);
-        if (col_stop <= col)
+        if (n_rows >= m_render_n_slots) {
+                render_rows_invalidate_all();
                 return;
+        }
 
-        cairo_rectangle_int_t old_rect = rect;
-        rect.x = col * m_char_width;
-        rect.width = (col_stop - col) * m_char_width;
-        rect.y = row_to_pixel(row);
-        rect.height = (row_stop - row) * m_char_height;
+        for (row = row_start; row < row_start + n_rows; row++) {
+                int slot = render_slot(row);
+                if (m_render_rows[slot] == row)
+                        m_render_rows[slot] = -1;
+        }
+}
 
-        _vte_debug_print (VTE_DEBUG_UPDATES,
-                          "expand_rectangle"
-                          "	(%d,%d)x(%d,%d) pixels,"
-                          " (%ld,%ld)x(%ld,%ld) cells"
-                          " [(%d,%d)x(%d,%d) pixels]\n",
-                          old_rect.x, old_rect.y, old_rect.width, old_rect.height,
-                          col, row, col_stop - col, row_stop - row,
-                          rect.x, rect.y, rect.width, rect.height);
+void
+VteTerminalPrivate::render_rows_invalidate_all()
+{
+        int slot;
+
+        for (slot = 0; slot < m_render_n_slots; slot++)
+                m_render_rows[slot] = -1;
 }
 
 void
-VteTerminalPrivate::paint_area(GdkRectangle const* area)
+VteTerminalPrivate::render_rows_free()
 {
-        vte::grid::row_t row, row_stop;
-        vte::grid::column_t col, col_stop;
+        if (m_render_surface != nullptr) {
+                cairo_surface_destroy(m_render_surface);
+                m_render_surface = nullptr;
+        }
+        g_free(m_render_rows);
+        m_render_rows = nullptr;
+        m_render_n_slots = 0;
+}
+
+/* Paints the displayed rows, rendering only those whose offscreen copy is
+ * missing or stale. Expects @cr to be in view coordinates. */
+void
+VteTerminalPrivate::paint_rows(cairo_t *cr)
+{
+        vte::grid::row_t first, last, row;
+        int width, height, n_slots, slot, n_rendered = 0;
+        double scale;
+
+        first = first_displayed_row();
+        last = last_displayed_row();
+
+        /* Extend into the right padding, where antialiasing may overflow */
+        width = get_allocated_width() - m_padding.left;
+        /* Enough slots for a partially scrolled view */
+        n_slots = m_row_count + 2;
+        height = n_slots * m_char_height;
+        cairo_surface_get_device_scale(cairo_get_target(cr), &scale, nullptr);
+
+        if (m_render_surface == nullptr ||
+            width != m_render_width ||
+            height != m_render_height ||
+            !_vte_double_equal(scale, m_render_scale)) {
+                render_rows_free();
+                m_render_surface = cairo_surface_create_similar(cairo_get_target(cr),
+                                                                CAIRO_CONTENT_COLOR_ALPHA,
+                                                                width, height);
+                m_render_rows = g_new(vte::grid::row_t, n_slots);
+                m_render_n_slots = n_slots;
+                m_render_width = width;
+                m_render_height = height;
+                m_render_scale = scale;
+                render_rows_invalidate_all();
+        }
+        if (m_render_screen != m_screen) {
+                /* Row numbers refer to a different ring */
+                render_rows_invalidate_all();
+                m_render_screen = m_screen;
+        }
 
-        row = pixel_to_row(MAX(0, area->y));
-        /* Both the value given by MIN() and row_stop are exclusive.
-         * _vte_terminal_pixel_to_row expects an actual value corresponding
-         * to the bottom visible pixel, hence the - 1 + 1 magic. */
-        row_stop = pixel_to_row(MIN(area->height + area->y,
-                                    get_allocated_height() - m_padding.top - m_padding.bottom) - 1) + 1;
-	if (row_stop <= row) {
-		return;
-	}
-	col = MAX(0, area->x / m_char_width);
-	col_stop = MIN((area->width + area->x) / m_char_width,
-		       m_column_count);
-	if (col_stop <= col) {
-		return;
-	}
-	_vte_debug_print (VTE_DEBUG_UPDATES,
-			"paint_area"
-			"	(%d,%d)x(%d,%d) pixels,"
-			" (%ld,%ld)x(%ld,%ld) cells"
-			" [(%ld,%ld)x(%ld,%ld) pixels]\n",
-			area->x, area->y, area->width, area->height,
-			col, row, col_stop - col, row_stop - row,
-			col * m_char_width,
-			row * m_char_height,
-			(col_stop - col) * m_char_width,
-			(row_stop - row) * m_char_height);
-
-	/* Now we're ready to draw the text.  Iterate over the rows we
-	 * need to draw. */
-	draw_rows(m_screen,
-			      row, row_stop,
-			      col, col_stop,
-			      col * m_char_width,
-			      row_to_pixel(row),
-			      m_char_width,
-			      m_char_height);
+        auto rcr = cairo_create(m_render_surface);
+        _vte_draw_set_cairo(m_draw, rcr);
+        for (row = first; row <= last; ) {
+                vte::grid::row_t end, r;
+                int y;
+
+                slot = render_slot(row);
+                if (m_render_rows[slot] == row) {
+                        row++;
+                        continue;
+                }
+
+                /* Render runs of stale rows in adjacent slots together, so
+                 * that draw_row_backgrounds() can merge their backgrounds */
+                for (end = row + 1;
+                     end <= last &&
+                             render_slot(end) == slot + (end - row) &&
+                             m_render_rows[slot + (end - row)] != end;
+                     end++)
+                        ;
+
+                y = slot * m_char_height;
+                cairo_save(rcr);
+                cairo_rectangle(rcr, 0, y, width, (end - row) * m_char_height);
+                cairo_clip(rcr);
+                _vte_draw_clear(m_draw, 0, y, width, (end - row) * m_char_height,
+                                get_color(VTE_DEFAULT_BG), m_background_alpha);
+                draw_row_backgrounds(m_screen,
+                                     row, end,
+                                     0, m_column_count,
+                                     0, y,
+                                     m_char_width,
+                                     m_char_height);
+                cairo_restore(rcr);
+
+                /* Keep overflowing glyphs out of the neighbouring slots,
+                 * whether or not those are rendered in the same run */
+                for (r = row; r < end; r++) {
+                        int ry = y + (r - row) * m_char_height;
+
+                        cairo_save(rcr);
+                        cairo_rectangle(rcr, 0, ry, width, m_char_height);
+                        cairo_clip(rcr);
+                        draw_rows(m_screen,
+                                  r, r + 1,
+                                  0, m_column_count,
+                                  0, ry,
+                                  m_char_width,
+                                  m_char_height);
+                        cairo_restore(rcr);
+                }
+
+                for (r = row; r < end; r++)
+                        m_render_rows[slot + (r - row)] = r;
+                n_rendered += end - row;
+                row = end;
+        }
+        _vte_draw_set_cairo(m_draw, nullptr);
+        cairo_destroy(rcr);
+
+        _vte_debug_print (VTE_DEBUG_UPDATES,
+                          "paint_rows rendered %d of %ld rows\n",
+                          n_rendered, last - first + 1);
+        m_frame_rows_rendered = n_rendered;
+        m_frame_rows_painted = last - first + 1;
+
+        /* Copy the rows to the view, in at most two pieces since the
+         * slots wrap around. */
+        cairo_save(cr);
+        cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+        for (row = first; row <= last; ) {
+                vte::grid::row_t count;
+                int y;
+
+                slot = render_slot(row);
+                count = MIN(last - row + 1, n_slots - slot);
+                y = row_to_pixel(row);
+                cairo_set_source_surface(cr, m_render_surface, 0, y - slot * m_char_height);
+                cairo_rectangle(cr, 0, y, width, count * m_char_height);
+                cairo_fill(cr);
+                row += count;
+        }
+        cairo_restore(cr);
 }
 
 void
@@ -9753,23 +10592,20 @@ void
 VteTerminalPrivate::widget_draw(cairo_t *cr)
 {
         cairo_rectangle_int_t clip_rect;
-        cairo_region_t *region;
         int allocated_width, allocated_height;
         int extra_area_for_cursor;
 
         if (!gdk_cairo_get_clip_rectangle (cr, &clip_rect))
                 return;
 
+        gint64 start_time = g_get_monotonic_time();
+
         _vte_debug_print(VTE_DEBUG_LIFECYCLE, "vte_terminal_draw()\n");
         _vte_debug_print (VTE_DEBUG_WORK, "+");
         _vte_debug_print (VTE_DEBUG_UPDATES, "Draw (%d,%d)x(%d,%d)\n",
                           clip_rect.x, clip_rect.y,
                           clip_rect.width, clip_rect.height);
 
-        region = vte_cairo_get_clip_region (cr);
-        if (region == NULL)
-                return;
-
         allocated_width = get_allocated_width();
         allocated_height = get_allocated_height();
 
@@ -9788,44 +10624,10 @@ VteTerminalPrivate::widget_draw(cairo_t *cr)
 
         cairo_translate(cr, m_padding.left, m_padding.top);
 
-        /* Transform to view coordinates */
-        cairo_region_translate(region, -m_padding.left, -m_padding.top);
-
-        cairo_rectangle_int_t *rectangles;
-        int n, n_rectangles;
-        n_rectangles = cairo_region_num_rectangles (region);
-        rectangles = g_new(cairo_rectangle_int_t, n_rectangles);
-        for (n = 0; n < n_rectangles; n++) {
-                cairo_region_get_rectangle (region, n, &rectangles[n]);
-        }
-
-        /* don't bother to enlarge an invalidate all */
-        if (!(n_rectangles == 1
-              && rectangles[0].width == allocated_width
-              && rectangles[0].height == allocated_height)) {
-                cairo_region_t *rr = cairo_region_create ();
-                /* Expand the rectangles so that they cover whole cells,
-                 * to avoid overlapping XY bands.
-                 */
-                for (n = 0; n < n_rectangles; n++) {
-                        expand_rectangle(rectangles[n]);
-                        cairo_region_union_rectangle(rr, &rectangles[n]);
-                }
-                g_free(rectangles);
-
-                n_rectangles = cairo_region_num_rectangles (rr);
-                rectangles = g_new (cairo_rectangle_int_t, n_rectangles);
-                for (n = 0; n < n_rectangles; n++) {
-                        cairo_region_get_rectangle(rr, n, &rectangles[n]);
-                }
-                cairo_region_destroy(rr);
-        }
-
-        /* and now paint them */
-        for (n = 0; n < n_rectangles; n++) {
-                paint_area(&rectangles[n]);
-        }
-        g_free (rectangles);
+        /* Render what changed, and copy the rows to the view */
+        _vte_draw_set_cairo(m_draw, nullptr);
+        paint_rows(cr);
+        _vte_draw_set_cairo(m_draw, cr);
 
 	paint_im_preedit_string();
 
@@ -9847,50 +10649,9 @@ VteTerminalPrivate::widget_draw(cairo_t *cr)
 	/* Done with various structures. */
 	_vte_draw_set_cairo(m_draw, NULL);
 
-        cairo_region_destroy (region);
-
         m_invalidated_all = FALSE;
-}
-
-/* Handle an expose event by painting the exposed area. */
-static cairo_region_t *
-vte_cairo_get_clip_region (cairo_t *cr)
-{
-        cairo_rectangle_list_t *list;
-        cairo_region_t *region;
-        int i;
-
-        list = cairo_copy_clip_rectangle_list (cr);
-        if (list->status == CAIRO_STATUS_CLIP_NOT_REPRESENTABLE) {
-                cairo_rectangle_int_t clip_rect;
-
-                cairo_rectangle_list_destroy (list);
-
-                if (!gdk_cairo_get_clip_rectangle (cr, &clip_rect))
-                        return NULL;
-                return cairo_region_create_rectangle (&clip_rect);
-        }
-
-
-        region = cairo_region_create ();
-        for (i = list->num_rectangles - 1; i >= 0; --i) {
-                cairo_rectangle_t *rect = &list->rectangles[i];
-                cairo_rectangle_int_t clip_rect;
-
-                clip_rect.x = floor (rect->x);
-                clip_rect.y = floor (rect->y);
-                clip_rect.width = ceil (rect->x + rect->width) - clip_rect.x;
-                clip_rect.height = ceil (rect->y + rect->height) - clip_rect.y;
 
-                if (cairo_region_union_rectangle (region, &clip_rect) != CAIRO_STATUS_SUCCESS) {
-                        cairo_region_destroy (region);
-                        region = NULL;
-                        break;
-                }
-        }
-
-        cairo_rectangle_list_destroy (list);
-        return region;
+        emit_frame_drawn(g_get_monotonic_time() - start_time);
 }
 
 void
@@ -10064,6 +10825,24 @@ VteTerminalPrivate::set_rewrap_on_resize(bool rewrap)
         return true;
 }
 
+bool
+VteTerminalPrivate::set_threaded_input(bool threaded)
+{
+        if (threaded == m_threaded_input)
+                return false;
+
+        m_threaded_input = threaded;
+
+        if (m_pty_channel != nullptr) {
+                disconnect_pty_read();
+                connect_pty_read();
+                /* Characters taken back from the thread */
+                if (m_pending->len > 0)
+                        process_incoming();
+        }
+        return true;
+}
+
 void
 VteTerminalPrivate::update_cursor_blinks()
 {
@@ -10194,6 +10973,9 @@ VteTerminalPrivate::set_scrollback_lines(long lines)
         double scroll_delta;
 	VteScreen *scrn;
 
+        /* Index unlimited scrollback, which can grow too large to search row by row */
+        _vte_ring_set_text_index(m_normal_screen.row_data, lines < 0);
+
 	if (lines < 0)
 		lines = G_MAXLONG;
 
@@ -10299,10 +11081,12 @@ VteTerminalPrivate::reset(bool clear_tabstops,
 	/* Clear the output buffer. */
 	_vte_byte_array_clear(m_outgoing);
 	/* Reset charset substitution state. */
+        input_lock();
 	_vte_iso2022_state_free(m_iso2022);
         m_iso2022 = _vte_iso2022_state_new(nullptr);
 	_vte_iso2022_state_set_codeset(m_iso2022,
 				       m_encoding);
+        input_unlock();
         m_last_graphic_character = 0;
 	/* Reset keypad/cursor key modes. */
 	m_keypad_mode = VTE_KEYMODE_NORMAL;
@@ -10341,6 +11125,9 @@ VteTerminalPrivate::reset(bool clear_tabstops,
                         _vte_ring_reset(m_alternate_screen.row_data);
                 m_alternate_screen.cursor.row = m_alternate_screen.insert_delta;
                 m_alternate_screen.cursor.col = 0;
+                /* Row numbers are reused from the start */
+                match_rows_invalidate(m_match_rows_first, m_match_rows->len);
+                render_rows_invalidate_all();
                 /* Adjust the scrollbar to the new location. */
                 /* Hack: force a change in scroll_delta even if the value remains, so that
                    vte_term_q_adj_val_changed() doesn't shortcut to no-op, see bug 730599. */
@@ -10431,7 +11218,7 @@ VteTerminalPrivate::set_pty(VtePty *new_pty)
 		/* Take one last shot at processing whatever data is pending,
 		 * then flush the buffers in case we're about to run a new
 		 * command, disconnecting the timeout. */
-		if (m_incoming != NULL) {
+		if (m_incoming != NULL || m_pending->len > 0) {
 			process_incoming();
 			_vte_incoming_chunks_release (m_incoming);
 			m_incoming = NULL;
@@ -10527,33 +11314,135 @@ remove_process_timeout_source(void)
         process_timeout_tag = 0;
 }
 
+/* This terminal's share of its input budget: the whole of it when it is
+ * the only one active, and otherwise in proportion to its weight, so that
+ * a terminal flooded with output can't starve the others. */
+guint
+VteTerminalPrivate::input_budget() const
+{
+        guint weight = m_input_weight;
+        guint total = m_active_terminals_link != nullptr ? g_active_weight : g_active_weight + weight;
+        guint64 budget = (guint64)MAX(m_max_input_bytes, VTE_MIN_INPUT_BUDGET) * weight / total;
+
+        /* Hidden terminals are processed less often, see process_timeout() */
+        if (m_background)
+                budget *= VTE_BACKGROUND_INPUT_FACTOR;
+
+        return MAX(budget, VTE_MIN_INPUT_BUDGET);
+}
+
+/* Weighs the terminal's input by whether it can be seen and has the focus. */
+void
+VteTerminalPrivate::update_input_weight()
+{
+        if (!widget_realized() ||
+            !gtk_widget_get_mapped(m_widget) ||
+            m_visibility_state == GDK_VISIBILITY_FULLY_OBSCURED)
+                set_input_weight(VTE_INPUT_WEIGHT_HIDDEN);
+        else if (m_has_focus)
+                set_input_weight(VTE_INPUT_WEIGHT_FOCUSED);
+        else
+                set_input_weight(VTE_INPUT_WEIGHT_VISIBLE);
+}
+
+void
+VteTerminalPrivate::set_input_weight(guint weight)
+{
+        set_background(weight == VTE_INPUT_WEIGHT_HIDDEN && widget_realized());
+
+        if (weight == m_input_weight)
+                return;
+
+        if (m_active_terminals_link != nullptr) {
+                g_active_weight += weight - m_input_weight;
+                /* The focused terminal is processed first */
+                if (weight >= VTE_INPUT_WEIGHT_FOCUSED &&
+                    m_active_terminals_link != g_active_terminals.head) {
+                        g_queue_unlink(&g_active_terminals, m_active_terminals_link);
+                        g_queue_push_head_link(&g_active_terminals, m_active_terminals_link);
+                }
+        }
+        m_input_weight = weight;
+}
+
+/* In background mode, while the terminal can't be seen, its input is
+ * processed in larger chunks less often, and the work that only matters
+ * to the user (signals about changes, selection, input method) is put off
+ * until it can be seen again. */
+void
+VteTerminalPrivate::set_background(bool background)
+{
+        if (background == m_background)
+                return;
+
+        _vte_debug_print(VTE_DEBUG_TIMEOUT, "%s background mode\n",
+                         background ? "Entering" : "Leaving");
+        m_background = background;
+        if (background) {
+                /* Leave the pacing to the process timeout, the frame tick
+                 * would otherwise go on processing at the frame rate. */
+                if (m_frame_tick_id != 0) {
+                        remove_frame_tick();
+                        if (_vte_incoming_chunks_length(m_incoming) != 0 ||
+                            input_thread_pending() != 0)
+                                add_process_timeout(this);
+                }
+                return;
+        }
+
+        m_background_next_pass = 0;
+        if (m_background_signals_tag != 0) {
+                g_source_remove(m_background_signals_tag);
+                m_background_signals_tag = 0;
+        }
+        if (m_selection_check_pending) {
+                m_selection_check_pending = false;
+                deselect_if_changed();
+        }
+        im_update_cursor();
+        emit_batched_signals();
+
+        /* Catch up on the pending input without waiting */
+        if (is_processing())
+                add_process_timeout(this);
+}
+
 static void
-add_update_timeout(VteTerminalPrivate *that)
+add_to_active_list(VteTerminalPrivate *that)
 {
-	if (update_timeout_tag == 0) {
-		_vte_debug_print (VTE_DEBUG_TIMEOUT,
-				"Starting update timeout\n");
-		update_timeout_tag =
-			g_timeout_add_full (GDK_PRIORITY_REDRAW,
-					VTE_UPDATE_TIMEOUT,
-					update_timeout, NULL,
-					NULL);
-	}
-	if (!in_process_timeout) {
-                remove_process_timeout_source();
+        if (that->m_active_terminals_link != nullptr)
+                return;
+
+        _vte_debug_print(VTE_DEBUG_TIMEOUT, "Adding terminal to active list\n");
+        if (that->m_input_weight >= VTE_INPUT_WEIGHT_FOCUSED) {
+                g_queue_push_head(&g_active_terminals, that);
+                that->m_active_terminals_link = g_active_terminals.head;
+        } else {
+                g_queue_push_tail(&g_active_terminals, that);
+                that->m_active_terminals_link = g_active_terminals.tail;
         }
-	if (that->m_active_terminals_link == nullptr) {
-		_vte_debug_print (VTE_DEBUG_TIMEOUT,
-				"Adding terminal to active list\n");
-		that->m_active_terminals_link = g_active_terminals =
-			g_list_prepend(g_active_terminals, that);
-	}
+        g_active_weight += that->m_input_weight;
+}
+
+static void
+add_update_timeout(VteTerminalPrivate *that)
+{
+        add_to_active_list(that);
+
+        /* Without a frame clock there are no frames to wait for; let
+         * the process timeout emit the pending signals instead. */
+        if (that->widget_realized())
+                that->queue_frame();
+        else
+                add_process_timeout(that);
 }
 
 void
-VteTerminalPrivate::reset_update_rects()
+VteTerminalPrivate::reset_damage()
 {
-        g_array_set_size(m_update_rects, 0);
+        if (m_damage != nullptr)
+                memset(m_damage, 0, m_damage_n_rows * sizeof(struct vte_damage_span));
+        m_damage_pending = false;
 
 	/* The invalidated_all flag also marks whether to skip processing
 	 * due to the widget being invisible.
@@ -10565,12 +11454,13 @@ static bool
 remove_from_active_list(VteTerminalPrivate *that)
 {
 	if (that->m_active_terminals_link == nullptr ||
-            that->m_update_rects->len != 0)
+            that->m_damage_pending)
                 return false;
 
         _vte_debug_print(VTE_DEBUG_TIMEOUT, "Removing terminal from active list\n");
-        g_active_terminals = g_list_delete_link(g_active_terminals, that->m_active_terminals_link);
+        g_queue_delete_link(&g_active_terminals, that->m_active_terminals_link);
         that->m_active_terminals_link = nullptr;
+        g_active_weight -= that->m_input_weight;
         return true;
 }
 
@@ -10580,49 +11470,60 @@ stop_processing(VteTerminalPrivate *that)
         if (!remove_from_active_list(that))
                 return;
 
-        if (g_active_terminals != nullptr)
+        if (!g_queue_is_empty(&g_active_terminals))
                 return;
 
         if (!in_process_timeout) {
                 remove_process_timeout_source();
         }
-        if (in_update_timeout == FALSE &&
-            update_timeout_tag != 0) {
-                _vte_debug_print(VTE_DEBUG_TIMEOUT, "Removing update timeout\n");
-                g_source_remove (update_timeout_tag);
-                update_timeout_tag = 0;
-        }
 }
 
 static void
 remove_update_timeout(VteTerminalPrivate *that)
 {
-	that->reset_update_rects();
+	that->reset_damage();
+        that->remove_frame_tick();
         stop_processing(that);
 }
 
+static void
+start_process_timeout_source(bool slow)
+{
+        _vte_debug_print(VTE_DEBUG_TIMEOUT,
+                         "Starting %s process timeout\n", slow ? "slow" : "idle");
+        /* Below the redraw priority, so that input is processed
+         * in between frames but never holds one up. */
+        if (slow)
+                process_timeout_tag =
+                        g_timeout_add_full(VTE_PROCESS_PRIORITY,
+                                           VTE_BACKGROUND_PROCESS_INTERVAL,
+                                           process_timeout, NULL,
+                                           NULL);
+        else
+                process_timeout_tag =
+                        g_idle_add_full(VTE_PROCESS_PRIORITY,
+                                        process_timeout, NULL,
+                                        NULL);
+        process_timeout_slow = slow;
+}
+
 static void
 add_process_timeout(VteTerminalPrivate *that)
 {
-	_vte_debug_print(VTE_DEBUG_TIMEOUT,
-			"Adding terminal to active list\n");
-	that->m_active_terminals_link = g_active_terminals =
-		g_list_prepend(g_active_terminals, that);
-	if (update_timeout_tag == 0 &&
-			process_timeout_tag == 0) {
-		_vte_debug_print(VTE_DEBUG_TIMEOUT,
-				"Starting process timeout\n");
-		process_timeout_tag =
-			g_timeout_add (VTE_DISPLAY_TIMEOUT,
-					process_timeout, NULL);
-	}
+        add_to_active_list(that);
+
+        /* Don't let a visible terminal wait for the hidden ones */
+        if (process_timeout_slow && !that->m_background && !in_process_timeout)
+                remove_process_timeout_source();
+
+	if (process_timeout_tag == 0)
+                start_process_timeout_source(false);
 }
 
 void
 VteTerminalPrivate::start_processing()
 {
-	if (!is_processing())
-		add_process_timeout(this);
+        add_process_timeout(this);
 }
 
 void
@@ -10691,6 +11592,46 @@ VteTerminalPrivate::emit_pending_signals()
         }
 
 	/* Flush any pending "inserted" signals. */
+        if (m_background)
+                queue_batched_signals();
+        else
+                emit_batched_signals();
+
+        g_object_thaw_notify(object);
+}
+
+static gboolean
+batched_signals_timeout_cb(VteTerminalPrivate *that)
+{
+        that->m_background_signals_tag = 0;
+        that->emit_batched_signals();
+        return G_SOURCE_REMOVE;
+}
+
+/* A hidden terminal emits the signals about changes to its contents at
+ * most every VTE_BACKGROUND_SIGNAL_INTERVAL seconds, rather than after
+ * every chunk of input. */
+void
+VteTerminalPrivate::queue_batched_signals()
+{
+        if (m_background_signals_tag != 0)
+                return;
+        if (!m_cursor_moved_pending &&
+            !m_text_modified_flag &&
+            !m_text_inserted_flag &&
+            !m_text_deleted_flag &&
+            !m_contents_changed_pending)
+                return;
+
+        m_background_signals_tag = g_timeout_add_seconds(VTE_BACKGROUND_SIGNAL_INTERVAL,
+                                                         (GSourceFunc)batched_signals_timeout_cb,
+                                                         this);
+}
+
+void
+VteTerminalPrivate::emit_batched_signals()
+{
+	GObject *object = G_OBJECT(m_terminal);
 
         if (m_cursor_moved_pending) {
                 _vte_debug_print(VTE_DEBUG_SIGNALS,
@@ -10729,26 +11670,30 @@ VteTerminalPrivate::emit_pending_signals()
 		g_signal_emit(m_terminal, signals[SIGNAL_CONTENTS_CHANGED], 0);
 		m_contents_changed_pending = false;
 	}
-
-        g_object_thaw_notify(object);
 }
 
+/* Adapts the amount of input read per pass so that processing it takes
+ * about VTE_FRAME_PROCESS_SHARE of a frame, leaving the rest of the frame
+ * for painting. */
 void
 VteTerminalPrivate::time_process_incoming()
 {
 	g_timer_reset(process_timer);
 	process_incoming();
-	auto elapsed = g_timer_elapsed(process_timer, NULL) * 1000;
-	gssize target = VTE_MAX_PROCESS_TIME / elapsed * m_input_bytes;
+	auto elapsed = MAX(g_timer_elapsed(process_timer, NULL) * 1000, 0.01);
+        double budget = m_frame_interval / 1000. * VTE_FRAME_PROCESS_SHARE;
+	gssize target = budget / elapsed * m_input_bytes;
 	m_max_input_bytes = (m_max_input_bytes + target) / 2;
 }
 
 bool
 VteTerminalPrivate::process(bool emit_adj_changed)
 {
-        bool is_active;
+        bool is_active, eof = false;
 
-        if (m_pty_channel) {
+        if (m_input_job != nullptr) {
+                eof = input_thread_collect();
+        } else if (m_pty_channel) {
                 if (m_pty_input_active ||
                     m_pty_input_source == 0) {
                         m_pty_input_active = false;
@@ -10758,28 +11703,29 @@ VteTerminalPrivate::process(bool emit_adj_changed)
         }
         if (emit_adj_changed)
                 emit_adjustment_changed();
-        is_active = _vte_incoming_chunks_length(m_incoming) != 0;
+        is_active = _vte_incoming_chunks_length(m_incoming) != 0 ||
+                (m_input_job != nullptr && m_input_bytes != 0);
         if (is_active) {
-                if (VTE_MAX_PROCESS_TIME) {
-                        time_process_incoming();
-                } else {
-                        process_incoming();
-                }
+                time_process_incoming();
                 m_input_bytes = 0;
         } else
                 emit_pending_signals();
 
+        if (eof)
+                pty_channel_eof();
+
         return is_active;
 }
 
-/* This function is called after DISPLAY_TIMEOUT ms.
- * It makes sure initial output is never delayed by more than DISPLAY_TIMEOUT
+/* Processes input of the active terminals, one budgeted pass each time
+ * the main loop is otherwise idle; repainting happens in frame_tick().
  */
 static gboolean
 process_timeout (gpointer data)
 {
 	GList *l, *next;
-	gboolean again;
+	gboolean again = FALSE, deferred = FALSE;
+        gint64 now = g_get_monotonic_time();
 
         G_GNUC_BEGIN_IGNORE_DEPRECATIONS;
 	gdk_threads_enter();
@@ -10789,36 +11735,54 @@ process_timeout (gpointer data)
 
 	_vte_debug_print (VTE_DEBUG_WORK, "<");
 	_vte_debug_print (VTE_DEBUG_TIMEOUT,
-                          "Process timeout:  %d active\n",
-                          g_list_length(g_active_terminals));
+                          "Process timeout:  %u active\n",
+                          g_queue_get_length(&g_active_terminals));
 
-	for (l = g_active_terminals; l != NULL; l = next) {
+        /* Each terminal reads no more than its share of the input budget,
+         * see input_budget(); so one pass over all of them takes about as
+         * long as one terminal processing its whole budget. */
+	for (l = g_active_terminals.head; l != NULL; l = next) {
 		VteTerminalPrivate *that = reinterpret_cast<VteTerminalPrivate*>(l->data);
 		bool active;
 
 		next = l->next;
 
-		if (l != g_active_terminals) {
+		if (l != g_active_terminals.head) {
 			_vte_debug_print (VTE_DEBUG_WORK, "T");
 		}
 
+                if (that->m_background &&
+                    now < that->m_background_next_pass) {
+                        deferred = TRUE;
+                        continue;
+                }
+
                 // FIXMEchpe find out why we don't emit_adjustment_changed() here!!
                 active = that->process(false);
 
 		if (!active) {
                         remove_from_active_list(that);
+                } else if (that->m_background) {
+                        that->m_background_next_pass = now + VTE_BACKGROUND_PROCESS_INTERVAL * 1000;
+                        deferred = TRUE;
+                } else {
+                        again = TRUE;
 		}
 	}
 
 	_vte_debug_print (VTE_DEBUG_WORK, ">");
 
-	if (g_active_terminals != nullptr && update_timeout_tag == 0) {
-		again = TRUE;
-	} else {
+        /* Terminals left on the active list without input to process
+         * are only waiting for their next frame. If only hidden terminals
+         * have input left, come back for them later. */
+        bool keep = again || deferred;
+        if (keep && process_timeout_slow != !again) {
+                start_process_timeout_source(!again);
+                keep = false;
+        } else if (!keep) {
 		_vte_debug_print(VTE_DEBUG_TIMEOUT,
 				"Stopping process timeout\n");
 		process_timeout_tag = 0;
-		again = FALSE;
 	}
 
 	in_process_timeout = FALSE;
@@ -10827,195 +11791,160 @@ process_timeout (gpointer data)
 	gdk_threads_leave();
         G_GNUC_END_IGNORE_DEPRECATIONS;
 
-	if (again) {
-		/* Force us to relinquish the CPU as the child is running
-		 * at full tilt and making us run to keep up...
-		 */
-		g_usleep (0);
-	} else if (update_timeout_tag == 0) {
-		/* otherwise free up memory used to capture incoming data */
+	if (!again && g_queue_is_empty(&g_active_terminals)) {
+		/* free up memory used to capture incoming data */
 		prune_chunks (10);
 	}
 
-	return again;
+	return keep;
 }
 
 bool
-VteTerminalPrivate::invalidate_dirty_rects_and_process_updates()
+VteTerminalPrivate::invalidate_dirty_rects()
 {
         if (G_UNLIKELY(!widget_realized()))
                 return false;
 	if (m_visibility_state == GDK_VISIBILITY_FULLY_OBSCURED) {
-		reset_update_rects();
+		reset_damage();
 		return false;
 	}
 
-	if (G_UNLIKELY (!m_update_rects->len))
+	if (G_UNLIKELY (!m_damage_pending))
 		return false;
 
         auto region = cairo_region_create();
-        auto n_rects = m_update_rects->len;
-        for (guint i = 0; i < n_rects; i++) {
-                cairo_rectangle_int_t *rect = &g_array_index(m_update_rects, cairo_rectangle_int_t, i);
-                cairo_region_union_rectangle(region, rect);
-	}
-        g_array_set_size(m_update_rects, 0);
-	m_invalidated_all = false;
-
-        auto allocation = get_allocated_rect();
-        cairo_region_translate(region,
-                               allocation.x + m_padding.left,
-                               allocation.y + m_padding.top);
-
-	/* and perform the merge with the window visible area */
+        if (m_invalidated_all) {
+                auto allocation = get_allocated_rect();
+                cairo_rectangle_int_t rect;
+                rect.x = -m_padding.left;
+                rect.y = -m_padding.top;
+                rect.width = allocation.width;
+                rect.height = allocation.height;
+                cairo_region_union_rectangle(region, &rect);
+        } else {
+                /* One rectangle per run of rows with the same damaged columns */
+                int i = 0;
+                while (i < m_damage_n_rows) {
+                        struct vte_damage_span const* span = &m_damage[i];
+                        cairo_rectangle_int_t rect;
+                        int j;
+
+                        if (span->start >= span->end) {
+                                i++;
+                                continue;
+                        }
+                        for (j = i + 1; j < m_damage_n_rows; j++) {
+                                if (m_damage[j].start != span->start ||
+                                    m_damage[j].end != span->end)
+                                        break;
+                        }
+                        cells_to_rect(span->start, span->end - span->start,
+                                      m_damage_first + i, j - i, rect);
+                        cairo_region_union_rectangle(region, &rect);
+                        i = j;
+                }
+        }
+        reset_damage();
+	m_invalidated_all = false;
+
+        guint64 area = 0;
+        int n_rects = cairo_region_num_rectangles(region);
+        for (int n = 0; n < n_rects; n++) {
+                cairo_rectangle_int_t rect;
+                cairo_region_get_rectangle(region, n, &rect);
+                area += (guint64)rect.width * rect.height;
+        }
+        m_repainted_area += area;
+        m_frame_damage_area += area;
+        _vte_debug_print (VTE_DEBUG_UPDATES,
+                          "Queueing %d rectangles, %" G_GUINT64_FORMAT " pixels"
+                          " (%" G_GUINT64_FORMAT " in total).\n",
+                          n_rects, area, m_repainted_area);
+
+        auto allocation = get_allocated_rect();
+        cairo_region_translate(region,
+                               allocation.x + m_padding.left,
+                               allocation.y + m_padding.top);
+
+	/* and perform the merge with the window visible area */
         gtk_widget_queue_draw_region(m_widget, region);
 	cairo_region_destroy (region);
 
-	gdk_window_process_updates(gtk_widget_get_window(m_widget), FALSE);
-
 	_vte_debug_print (VTE_DEBUG_WORK, "-");
 
 	return true;
 }
 
 static gboolean
-update_repeat_timeout (gpointer data)
+frame_tick_cb(GtkWidget *widget,
+              GdkFrameClock *frame_clock,
+              gpointer data)
 {
-	GList *l, *next;
-	bool again;
-
-        G_GNUC_BEGIN_IGNORE_DEPRECATIONS;
-	gdk_threads_enter();
-        G_GNUC_END_IGNORE_DEPRECATIONS;
-
-	in_update_timeout = TRUE;
-
-	_vte_debug_print (VTE_DEBUG_WORK, "[");
-	_vte_debug_print (VTE_DEBUG_TIMEOUT,
-                          "Repeat timeout:  %d active\n",
-                          g_list_length(g_active_terminals));
-
-	for (l = g_active_terminals; l != NULL; l = next) {
-		VteTerminalPrivate *that = reinterpret_cast<VteTerminalPrivate*>(l->data);
-
-                next = l->next;
-
-		if (l != g_active_terminals) {
-			_vte_debug_print (VTE_DEBUG_WORK, "T");
-		}
-
-                that->process(true);
-
-		again = that->invalidate_dirty_rects_and_process_updates();
-		if (!again) {
-                        remove_from_active_list(that);
-		}
-	}
-
-
-	if (g_active_terminals != nullptr) {
-		/* remove the idle source, and draw non-Terminals
-		 * (except for gdk/{directfb,quartz}!)
-		 */
-		gdk_window_process_all_updates ();
-	}
-
-	_vte_debug_print (VTE_DEBUG_WORK, "]");
-
-	/* We only stop the timer if no update request was received in this
-         * past cycle.  Technically, always stop this timer object and maybe
-         * reinstall a new one because we need to delay by the amount of time
-         * it took to repaint the screen: bug 730732.
-	 */
-	if (g_active_terminals == nullptr) {
-		_vte_debug_print(VTE_DEBUG_TIMEOUT,
-				"Stopping update timeout\n");
-		update_timeout_tag = 0;
-		again = false;
-        } else {
-                update_timeout_tag =
-                        g_timeout_add_full (G_PRIORITY_DEFAULT_IDLE,
-                                            VTE_UPDATE_REPEAT_TIMEOUT,
-                                            update_repeat_timeout, NULL,
-                                            NULL);
-                again = true;
-	}
+        VteTerminalPrivate *that = reinterpret_cast<VteTerminalPrivate*>(data);
+        return that->frame_tick(frame_clock);
+}
 
-	in_update_timeout = FALSE;
+/* Asks the frame clock for a frame, in which the damage accumulated until
+ * then is queued for repainting. */
+void
+VteTerminalPrivate::queue_frame()
+{
+        if (m_frame_tick_id != 0)
+                return;
 
-        G_GNUC_BEGIN_IGNORE_DEPRECATIONS;
-	gdk_threads_leave();
-        G_GNUC_END_IGNORE_DEPRECATIONS;
+        _vte_debug_print(VTE_DEBUG_TIMEOUT, "Starting frame tick\n");
+        m_frame_tick_id = gtk_widget_add_tick_callback(m_widget, frame_tick_cb,
+                                                       this, nullptr);
+}
 
-	if (again) {
-		/* Force us to relinquish the CPU as the child is running
-		 * at full tilt and making us run to keep up...
-		 */
-		g_usleep (0);
-	} else {
-		/* otherwise free up memory used to capture incoming data */
-		prune_chunks (10);
-	}
+void
+VteTerminalPrivate::remove_frame_tick()
+{
+        if (m_frame_tick_id == 0)
+                return;
 
-        return FALSE;  /* If we need to go again, we already have a new timer for that. */
+        _vte_debug_print(VTE_DEBUG_TIMEOUT, "Removing frame tick\n");
+        gtk_widget_remove_tick_callback(m_widget, m_frame_tick_id);
+        m_frame_tick_id = 0;
 }
 
-static gboolean
-update_timeout (gpointer data)
+/* Runs at the start of every frame while there is something to repaint.
+ * The tick stays installed as long as each frame brings new damage, so
+ * that continuous output repaints at the monitor's refresh rate; it is
+ * removed on the first frame without any. */
+gboolean
+VteTerminalPrivate::frame_tick(GdkFrameClock *frame_clock)
 {
-	GList *l, *next;
-	gboolean redraw = FALSE;
-
-        G_GNUC_BEGIN_IGNORE_DEPRECATIONS;
-	gdk_threads_enter();
-        G_GNUC_END_IGNORE_DEPRECATIONS;
+        gint64 refresh_interval;
 
-	in_update_timeout = TRUE;
+        gdk_frame_clock_get_refresh_info(frame_clock,
+                                         gdk_frame_clock_get_frame_time(frame_clock),
+                                         &refresh_interval, nullptr);
+        if (refresh_interval > 0)
+                m_frame_interval = refresh_interval;
 
 	_vte_debug_print (VTE_DEBUG_WORK, "{");
-	_vte_debug_print (VTE_DEBUG_TIMEOUT,
-                          "Update timeout:  %d active\n",
-                          g_list_length(g_active_terminals));
-
-        remove_process_timeout_source();
-
-	for (l = g_active_terminals; l != NULL; l = next) {
-		VteTerminalPrivate *that = reinterpret_cast<VteTerminalPrivate*>(l->data);
-
-                next = l->next;
 
-		if (l != g_active_terminals) {
-			_vte_debug_print (VTE_DEBUG_WORK, "T");
-		}
-
-                that->process(true);
-
-		redraw |= that->invalidate_dirty_rects_and_process_updates();
-	}
-
-	if (redraw) {
-		/* remove the idle source, and draw non-Terminals
-		 * (except for gdk/{directfb,quartz}!)
-		 */
-		gdk_window_process_all_updates ();
-	}
+        /* In background mode the input is processed by the process timeout
+         * only; and an unmapped widget never stops having damage. */
+        if (!m_background)
+                process(true);
+        bool again = invalidate_dirty_rects();
 
 	_vte_debug_print (VTE_DEBUG_WORK, "}");
 
-	/* Set a timer such that we do not invalidate for a while. */
-	/* This limits the number of times we draw to ~40fps. */
-	update_timeout_tag =
-		g_timeout_add_full (G_PRIORITY_DEFAULT_IDLE,
-				    VTE_UPDATE_REPEAT_TIMEOUT,
-				    update_repeat_timeout, NULL,
-				    NULL);
-	in_update_timeout = FALSE;
+        if (again && !m_background)
+                return G_SOURCE_CONTINUE;
 
-        G_GNUC_BEGIN_IGNORE_DEPRECATIONS;
-	gdk_threads_leave();
-        G_GNUC_END_IGNORE_DEPRECATIONS;
+        _vte_debug_print(VTE_DEBUG_TIMEOUT, "Stopping frame tick\n");
+        m_frame_tick_id = 0;
+        if (_vte_incoming_chunks_length(m_incoming) != 0 ||
+            input_thread_pending() != 0)
+                add_process_timeout(this);
+        else
+                stop_processing(this);
 
-	return FALSE;
+        return G_SOURCE_REMOVE;
 }
 
 bool
@@ -11035,6 +11964,57 @@ VteTerminalPrivate::write_contents_sync (GOutputStream *stream,
 
 /* TODO Add properties & signals */
 
+/*
+ * vte_text_runs_lookup:
+ * @runs: the runs get_text() produced for @text
+ * @n_runs: the number of runs
+ * @text: the text
+ * @start: the byte offset of the first character of a match in @text
+ * @end: the byte offset just after the match
+ * @span: (out): the cells of the match, the end is inclusive
+ *
+ * Returns: %false if the match isn't backed by any cell
+ */
+static bool
+vte_text_runs_lookup(struct vte_text_run const* runs,
+                     guint n_runs,
+                     char const* text,
+                     gsize start,
+                     gsize end,
+                     vte::grid::span *span)
+{
+        gsize offsets[2];
+        vte::grid::coords coords[2];
+
+        if (n_runs == 0 || end <= start)
+                return false;
+
+        offsets[0] = start;
+        /* The last character of the match */
+        offsets[1] = g_utf8_find_prev_char(text, text + end) - text;
+
+        for (int i = 0; i < 2; i++) {
+                guint lo = 0, hi = n_runs;
+
+                /* Find the last run starting at or before the offset */
+                while (hi - lo > 1) {
+                        guint mid = (lo + hi) / 2;
+                        if (runs[mid].offset <= offsets[i])
+                                lo = mid;
+                        else
+                                hi = mid;
+                }
+
+                coords[i] = vte::grid::coords(runs[lo].row,
+                                              runs[lo].column +
+                                              g_utf8_pointer_to_offset(text + runs[lo].offset,
+                                                                       text + MAX(offsets[i], runs[lo].offset)));
+        }
+
+        span->set(coords[0], coords[1]);
+        return true;
+}
+
 /*
  * VteTerminalPrivate::search_set_regex:
  * @regex: (allow-none): a #VteRegex, or %nullptr
@@ -11061,6 +12041,7 @@ VteTerminalPrivate::search_set_regex (VteRegex *regex,
                 rx->match_flags = flags;
         }
 
+        search_reset();
 	invalidate_all();
 
         return true;
@@ -11083,18 +12064,18 @@ VteTerminalPrivate::search_rows(pcre2_match_context_8 *match_context,
                                 vte::grid::row_t end_row,
                                 bool backward)
 {
-	int start, end;
-	long start_col, end_col;
-	VteCharAttributes *ca;
-	GArray *attrs;
 	gdouble value, page_size;
 
+	if (!m_search_runs)
+		m_search_runs = g_array_new (FALSE, FALSE, sizeof (struct vte_text_run));
+
 	auto row_text = get_text(start_row, 0,
                                  end_row, -1,
                                  false /* block */,
                                  true /* wrap */,
                                  false /* include trailing whitespace */, /* FIXMEchpe maybe do include it since the match may depend on it? */
-                                 nullptr);
+                                 nullptr,
+                                 m_search_runs);
 
         int (* match_fn) (const pcre2_code_8 *,
                           PCRE2_SPTR8, PCRE2_SIZE, PCRE2_SIZE, uint32_t,
@@ -11115,41 +12096,33 @@ VteTerminalPrivate::search_rows(pcre2_match_context_8 *match_context,
                      match_data,
                      match_context);
 
-        if (r == PCRE2_ERROR_NOMATCH)
-                return false;
         // FIXME: handle partial matches (PCRE2_ERROR_PARTIAL)
-        if (r < 0)
+        if (r < 0) {
+                g_string_free(row_text, TRUE);
                 return false;
+        }
 
         ovector = pcre2_get_ovector_pointer_8(match_data);
         so = ovector[0];
         eo = ovector[1];
-        if (G_UNLIKELY(so == PCRE2_UNSET || eo == PCRE2_UNSET))
+        if (G_UNLIKELY(so == PCRE2_UNSET || eo == PCRE2_UNSET)) {
+                g_string_free(row_text, TRUE);
                 return false;
+        }
 
-        start = so;
-        end = eo;
-
-	/* Fetch text again, with attributes */
-	g_string_free(row_text, TRUE);
-	if (!m_search_attrs)
-		m_search_attrs = g_array_new (FALSE, TRUE, sizeof (VteCharAttributes));
-	attrs = m_search_attrs;
-	row_text = get_text(start_row, 0,
-                            end_row, -1,
-                            false /* block */,
-                            true /* wrap */,
-                            false /* include trailing whitespace */, /* FIXMEchpe maybe true? */
-                            attrs);
-
-	ca = &g_array_index (attrs, VteCharAttributes, start);
-	start_row = ca->row;
-	start_col = ca->column;
-	ca = &g_array_index (attrs, VteCharAttributes, end - 1);
-	end_row = ca->row;
-	end_col = ca->column;
-
+        /* Map the match back to cells with the runs from the same pass */
+        vte::grid::span span;
+        bool found = vte_text_runs_lookup(&g_array_index(m_search_runs, struct vte_text_run, 0),
+                                          m_search_runs->len,
+                                          row_text->str, so, eo, &span);
 	g_string_free (row_text, TRUE);
+        if (!found)
+                return false;
+
+        long start_col = span.start_column();
+        long end_col = span.end_column();
+        start_row = span.start_row();
+        end_row = span.end_row();
 
 	select_text(start_col, start_row, end_col, end_row);
 	/* Quite possibly the math here should not access adjustment directly... */
@@ -11166,6 +12139,55 @@ VteTerminalPrivate::search_rows(pcre2_match_context_8 *match_context,
 	return true;
 }
 
+/*
+ * VteTerminalPrivate::search_skip_rows:
+ * @regex: the regex to search for
+ * @row: the first row of a logical line
+ * @end_row: the end of the rows to search
+ *
+ * Consults the text index of the ring to skip the lines that
+ * cannot contain a match of @regex.
+ *
+ * Returns: the first row of a logical line at or after @row, such that the
+ *   lines before it cannot match
+ */
+vte::grid::row_t
+VteTerminalPrivate::search_skip_rows(VteRegex *regex,
+                                     vte::grid::row_t row,
+                                     vte::grid::row_t end_row)
+{
+        auto ring = m_screen->row_data;
+        gsize length;
+
+        auto literal = _vte_regex_get_literal(regex, &length);
+        if (literal == nullptr || ring->text_index_stream == nullptr)
+                return row;
+
+        while (row < end_row) {
+                vte::grid::row_t block_end = MIN(_vte_ring_text_index_block_start(row) + VTE_RING_TEXT_INDEX_BLOCK_ROWS,
+                                                 end_row);
+                if (_vte_ring_text_index_may_contain(ring, row, block_end, literal, length))
+                        break;
+
+                /* The lines that end within the block cannot match;
+                 * the last one may go on past it though. */
+                vte::grid::row_t line_start = block_end;
+                while (line_start > row) {
+                        VteRowData const* row_data = find_row_data(line_start - 1);
+                        if (row_data == nullptr || !row_data->attr.soft_wrapped)
+                                break;
+                        line_start--;
+                }
+                if (line_start == row)
+                        break;
+
+                _vte_debug_print(VTE_DEBUG_WORK, "Search skipping rows %ld to %ld.\n", row, line_start);
+                row = line_start;
+        }
+
+        return row;
+}
+
 bool
 VteTerminalPrivate::search_rows_iter(pcre2_match_context_8 *match_context,
                                      pcre2_match_data_8 *match_data,
@@ -11193,7 +12215,11 @@ VteTerminalPrivate::search_rows_iter(pcre2_match_context_8 *match_context,
 	} else {
 		iter_end_row = start_row;
 		while (iter_end_row < end_row) {
-			iter_start_row = iter_end_row;
+			iter_start_row = search_skip_rows(m_search_regex.regex,
+                                                          iter_end_row, end_row);
+			iter_end_row = iter_start_row;
+			if (iter_end_row >= end_row)
+				break;
 
 			do {
 				row = find_row_data(iter_end_row);
@@ -11282,6 +12308,474 @@ VteTerminalPrivate::search_find (bool backward)
 	return match_found;
 }
 
+/*
+ * Background search
+ *
+ * The ring streams may only be read on the main thread, so the text of the
+ * rows is snapshotted there in time-limited slices, a chunk of logical lines
+ * at a time. A worker thread runs the regex over the chunks and hands the
+ * matches back to the main loop, which appends them to m_search_matches and
+ * emits VteTerminal::search-matches-changed.
+ */
+
+struct vte_search_line {
+        gsize offset;           /* into vte_search_chunk.text */
+        guint first_run;        /* into vte_search_chunk.runs */
+};
+
+struct vte_search_chunk {
+        GString *text;          /* nullptr marks the end of the snapshot */
+        GArray *lines;          /* struct vte_search_line */
+        GArray *runs;           /* struct vte_text_run, offsets relative to their line */
+};
+
+struct vte_search_job {
+        volatile gint ref_count;
+        volatile gint cancelled;
+
+        /* Not changed once the worker runs */
+        struct vte_regex_and_flags regex;
+        GMainContext *context;
+
+        GAsyncQueue *chunks;    /* from the main thread to the worker */
+
+        GMutex lock;            /* protects matches and done */
+        GArray *matches;        /* struct vte_search_match, not collected yet */
+        bool done;
+
+        /* Main thread only, nullptr once the job is stopped */
+        VteTerminalPrivate *terminal;
+};
+
+static void
+vte_search_chunk_free(gpointer data)
+{
+        auto chunk = reinterpret_cast<struct vte_search_chunk *>(data);
+
+        if (chunk->text)
+                g_string_free(chunk->text, TRUE);
+        if (chunk->lines)
+                g_array_free(chunk->lines, TRUE);
+        if (chunk->runs)
+                g_array_free(chunk->runs, TRUE);
+        g_slice_free(struct vte_search_chunk, chunk);
+}
+
+static struct vte_search_job *
+vte_search_job_ref(struct vte_search_job *job)
+{
+        g_atomic_int_inc(&job->ref_count);
+        return job;
+}
+
+static void
+vte_search_job_unref(gpointer data)
+{
+        auto job = reinterpret_cast<struct vte_search_job *>(data);
+
+        if (!g_atomic_int_dec_and_test(&job->ref_count))
+                return;
+
+        regex_and_flags_clear(&job->regex);
+        g_main_context_unref(job->context);
+        g_async_queue_unref(job->chunks);
+        g_mutex_clear(&job->lock);
+        g_array_free(job->matches, TRUE);
+        g_slice_free(struct vte_search_job, job);
+}
+
+/* Runs on the worker thread. */
+static void
+vte_search_chunk_match(struct vte_search_job *job,
+                       struct vte_search_chunk *chunk,
+                       pcre2_match_context_8 *match_context,
+                       pcre2_match_data_8 *match_data,
+                       GArray *found)
+{
+        int (* match_fn) (const pcre2_code_8 *,
+                          PCRE2_SPTR8, PCRE2_SIZE, PCRE2_SIZE, uint32_t,
+                          pcre2_match_data_8 *, pcre2_match_context_8 *);
+        auto code = _vte_regex_get_pcre(job->regex.regex);
+        guint i;
+
+        if (_vte_regex_get_jited(job->regex.regex))
+                match_fn = pcre2_jit_match_8;
+        else
+                match_fn = pcre2_match_8;
+
+        for (i = 0; i < chunk->lines->len; i++) {
+                auto line = &g_array_index(chunk->lines, struct vte_search_line, i);
+                auto next_line = i + 1 < chunk->lines->len ? line + 1 : nullptr;
+                gsize length = (next_line ? next_line->offset : chunk->text->len) - line->offset;
+                guint n_runs = (next_line ? next_line->first_run : chunk->runs->len) - line->first_run;
+                auto text = chunk->text->str + line->offset;
+                gsize position = 0;
+
+                if (g_atomic_int_get(&job->cancelled))
+                        return;
+
+                while (position < length) {
+                        struct vte_search_match match;
+                        gsize *ovector;
+                        int r;
+
+                        r = match_fn(code,
+                                     (PCRE2_SPTR8)text, length,
+                                     position,
+                                     job->regex.match_flags |
+                                     PCRE2_NO_UTF_CHECK | PCRE2_NOTEMPTY,
+                                     match_data,
+                                     match_context);
+                        if (r < 0)
+                                break;
+
+                        ovector = pcre2_get_ovector_pointer_8(match_data);
+                        if (G_UNLIKELY(ovector[0] == PCRE2_UNSET ||
+                                       ovector[1] == PCRE2_UNSET ||
+                                       ovector[1] <= ovector[0]))
+                                break;
+
+                        if (vte_text_runs_lookup(&g_array_index(chunk->runs, struct vte_text_run, line->first_run),
+                                                 n_runs, text, ovector[0], ovector[1],
+                                                 &match.span))
+                                g_array_append_val(found, match);
+
+                        position = ovector[1];
+                }
+        }
+}
+
+static gboolean
+vte_search_job_dispatch_cb(gpointer data)
+{
+        auto job = reinterpret_cast<struct vte_search_job *>(data);
+
+        if (job->terminal != nullptr)
+                job->terminal->search_collect_matches();
+
+        return G_SOURCE_REMOVE;
+}
+
+static gpointer
+vte_search_worker_thread(gpointer data)
+{
+        auto job = reinterpret_cast<struct vte_search_job *>(data);
+        auto match_context = VteTerminalPrivate::create_match_context();
+        auto match_data = pcre2_match_data_create_8(256 /* should be plenty */, nullptr /* general context */);
+        auto found = g_array_new(FALSE, FALSE, sizeof(struct vte_search_match));
+        bool done;
+
+        do {
+                auto chunk = reinterpret_cast<struct vte_search_chunk *>(g_async_queue_pop(job->chunks));
+
+                done = chunk->text == nullptr;
+                if (!done)
+                        vte_search_chunk_match(job, chunk, match_context, match_data, found);
+                vte_search_chunk_free(chunk);
+
+                g_mutex_lock(&job->lock);
+                g_array_append_vals(job->matches, found->data, found->len);
+                job->done = done;
+                g_mutex_unlock(&job->lock);
+                g_array_set_size(found, 0);
+
+                /* Let the main thread collect the matches, and refill the queue */
+                g_main_context_invoke_full(job->context, VTE_SEARCH_PRIORITY,
+                                           vte_search_job_dispatch_cb,
+                                           vte_search_job_ref(job),
+                                           vte_search_job_unref);
+        } while (!done);
+
+        g_array_free(found, TRUE);
+        pcre2_match_data_free_8(match_data);
+        pcre2_match_context_free_8(match_context);
+        vte_search_job_unref(job);
+
+        return nullptr;
+}
+
+static gboolean
+vte_search_task_return_cb(gpointer data)
+{
+        auto task = G_TASK(data);
+        auto error = reinterpret_cast<GError *>(g_task_get_task_data(task));
+
+        if (error)
+                g_task_return_error(task, error);
+        else
+                g_task_return_boolean(task, TRUE);
+
+        return G_SOURCE_REMOVE;
+}
+
+static gboolean
+vte_search_snapshot_cb(VteTerminalPrivate *that)
+{
+        return that->search_snapshot_chunk() ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+/*
+ * VteTerminalPrivate::search_find_all_async:
+ * @cancellable: (allow-none): a #GCancellable, or %nullptr
+ * @callback: called when the search is finished
+ * @user_data: data for @callback
+ *
+ * Starts searching the whole buffer for the search regex in the background,
+ * stopping any search in progress and forgetting its matches. The rows
+ * written after the search started are not searched.
+ */
+void
+VteTerminalPrivate::search_find_all_async(GCancellable *cancellable,
+                                          GAsyncReadyCallback callback,
+                                          gpointer user_data)
+{
+        auto task = g_task_new(m_terminal, cancellable, callback, user_data);
+        g_task_set_source_tag(task, (void*)vte_terminal_search_find_all_async);
+
+        search_reset();
+
+        if (m_search_regex.regex == nullptr) {
+                g_task_return_boolean(task, TRUE);
+                g_object_unref(task);
+                return;
+        }
+
+        auto job = g_slice_new0(struct vte_search_job);
+        job->ref_count = 1;
+        job->regex.regex = vte_regex_ref(m_search_regex.regex);
+        job->regex.match_flags = m_search_regex.match_flags;
+        job->context = g_main_context_ref_thread_default();
+        job->chunks = g_async_queue_new_full(vte_search_chunk_free);
+        g_mutex_init(&job->lock);
+        job->matches = g_array_new(FALSE, FALSE, sizeof(struct vte_search_match));
+        job->terminal = this;
+
+        m_search_job = job;
+        m_search_task = task;
+        m_search_screen = m_screen;
+        m_search_next_row = _vte_ring_delta(m_screen->row_data);
+        m_search_end_row = _vte_ring_next(m_screen->row_data);
+        m_search_snapshot_done = false;
+        m_search_source = g_idle_add_full(VTE_SEARCH_PRIORITY,
+                                          (GSourceFunc)vte_search_snapshot_cb,
+                                          this,
+                                          nullptr);
+
+        _vte_debug_print(VTE_DEBUG_WORK, "Searching rows %ld to %ld in the background.\n",
+                         m_search_next_row, m_search_end_row);
+
+        g_thread_unref(g_thread_new("vte-search",
+                                    vte_search_worker_thread,
+                                    vte_search_job_ref(job)));
+}
+
+/*
+ * VteTerminalPrivate::search_stop:
+ * @error: (transfer full) (allow-none): the error to finish the search
+ *   with, or %nullptr if it finished successfully
+ *
+ * Detaches the background search in progress, if any, and completes its task.
+ * The matches found so far are kept.
+ */
+void
+VteTerminalPrivate::search_stop(GError *error)
+{
+        auto job = m_search_job;
+        auto task = m_search_task;
+
+        if (job == nullptr) {
+                if (error)
+                        g_error_free(error);
+                return;
+        }
+
+        if (m_search_source != 0) {
+                g_source_remove(m_search_source);
+                m_search_source = 0;
+        }
+
+        if (error)
+                g_atomic_int_set(&job->cancelled, TRUE);
+        if (!m_search_snapshot_done) {
+                /* Wake the worker up so that it can exit */
+                g_async_queue_push(job->chunks, g_slice_new0(struct vte_search_chunk));
+                m_search_snapshot_done = true;
+        }
+
+        job->terminal = nullptr;
+        m_search_job = nullptr;
+        m_search_task = nullptr;
+        vte_search_job_unref(job);
+
+        /* Complete the task from the main loop, so that its callback
+         * may start a new search without reentering us. */
+        g_task_set_task_data(task, error, nullptr);
+        g_idle_add_full(VTE_SEARCH_PRIORITY,
+                        vte_search_task_return_cb,
+                        task,
+                        g_object_unref);
+}
+
+/* Cancels the background search and forgets all matches. */
+void
+VteTerminalPrivate::search_reset()
+{
+        search_stop(g_error_new_literal(G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                        "Search cancelled"));
+        g_array_set_size(m_search_matches, 0);
+}
+
+/*
+ * VteTerminalPrivate::search_snapshot_chunk:
+ *
+ * Hands the text of the next rows to the worker, spending at most
+ * VTE_SEARCH_SLICE_TIME milliseconds.
+ *
+ * Returns: %true if it should be called again from the idle handler
+ */
+bool
+VteTerminalPrivate::search_snapshot_chunk()
+{
+        auto job = m_search_job;
+
+        if (g_cancellable_is_cancelled(g_task_get_cancellable(m_search_task)) ||
+            m_screen != m_search_screen) {
+                m_search_source = 0;
+                search_stop(g_error_new_literal(G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                                "Search cancelled"));
+                return false;
+        }
+
+        if (g_async_queue_length(job->chunks) >= VTE_SEARCH_MAX_QUEUED_CHUNKS) {
+                /* search_collect_matches() resumes once the worker caught up */
+                m_search_source = 0;
+                return false;
+        }
+
+        auto ring = m_screen->row_data;
+        auto chunk = g_slice_new(struct vte_search_chunk);
+        chunk->text = g_string_new(nullptr);
+        chunk->lines = g_array_new(FALSE, FALSE, sizeof(struct vte_search_line));
+        chunk->runs = g_array_new(FALSE, FALSE, sizeof(struct vte_text_run));
+
+	if (!m_search_runs)
+		m_search_runs = g_array_new (FALSE, FALSE, sizeof (struct vte_text_run));
+
+        /* Rows may have been dropped from the scrollback meanwhile */
+        vte::grid::row_t row = MAX(m_search_next_row, _vte_ring_delta(ring));
+        vte::grid::row_t end_row = MIN(m_search_end_row, _vte_ring_next(ring));
+        gint64 deadline = g_get_monotonic_time() + VTE_SEARCH_SLICE_TIME * 1000;
+
+        while (row < end_row) {
+                struct vte_search_line line;
+                vte::grid::row_t line_end_row;
+                VteRowData const* row_data;
+
+                row = search_skip_rows(job->regex.regex, row, end_row);
+                if (row >= end_row)
+                        break;
+
+                line_end_row = row;
+                do {
+                        row_data = find_row_data(line_end_row);
+                        line_end_row++;
+                } while (row_data && row_data->attr.soft_wrapped && line_end_row < end_row);
+
+                auto text = get_text(row, 0,
+                                     line_end_row, -1,
+                                     false /* block */,
+                                     true /* wrap */,
+                                     false /* include trailing whitespace */,
+                                     nullptr,
+                                     m_search_runs);
+                line.offset = chunk->text->len;
+                line.first_run = chunk->runs->len;
+                g_array_append_val(chunk->lines, line);
+                g_string_append_len(chunk->text, text->str, text->len);
+                g_array_append_vals(chunk->runs, m_search_runs->data, m_search_runs->len);
+                g_string_free(text, TRUE);
+
+                row = line_end_row;
+                if ((chunk->lines->len & 0x3f) == 0 &&
+                    g_get_monotonic_time() > deadline)
+                        break;
+        }
+
+        m_search_next_row = row;
+        g_async_queue_push(job->chunks, chunk);
+
+        if (row < end_row)
+                return true;
+
+        g_async_queue_push(job->chunks, g_slice_new0(struct vte_search_chunk));
+        m_search_snapshot_done = true;
+        m_search_source = 0;
+        return false;
+}
+
+/*
+ * VteTerminalPrivate::search_collect_matches:
+ *
+ * Takes the matches the worker found so far, and finishes the search once
+ * the worker is done.
+ */
+void
+VteTerminalPrivate::search_collect_matches()
+{
+        auto job = m_search_job;
+        auto n_matches = m_search_matches->len;
+        bool done;
+
+        g_mutex_lock(&job->lock);
+        g_array_append_vals(m_search_matches, job->matches->data, job->matches->len);
+        g_array_set_size(job->matches, 0);
+        done = job->done;
+        g_mutex_unlock(&job->lock);
+
+        if (m_search_matches->len != n_matches) {
+                _vte_debug_print(VTE_DEBUG_SIGNALS,
+                                 "Emitting `search-matches-changed'.\n");
+                g_signal_emit(m_terminal, signals[SIGNAL_SEARCH_MATCHES_CHANGED], 0);
+
+                /* The handler may have stopped the search */
+                if (m_search_job != job)
+                        return;
+        }
+
+        if (done) {
+                search_stop(nullptr);
+                return;
+        }
+
+        if (!m_search_snapshot_done && m_search_source == 0)
+                m_search_source = g_idle_add_full(VTE_SEARCH_PRIORITY,
+                                                  (GSourceFunc)vte_search_snapshot_cb,
+                                                  this,
+                                                  nullptr);
+}
+
+/*
+ * VteTerminalPrivate::search_get_match:
+ * @index: the index of the match
+ * @span: (out): the cells of the match, the end is inclusive
+ *
+ * Returns: %false if there is no such match, or its rows are gone
+ */
+bool
+VteTerminalPrivate::search_get_match(gsize index,
+                                     vte::grid::span *span)
+{
+        if (index >= m_search_matches->len || m_screen != m_search_screen)
+                return false;
+
+        auto match = &g_array_index(m_search_matches, struct vte_search_match, index);
+        if (!_vte_ring_contains(m_screen->row_data, match->span.start_row()))
+                return false;
+
+        *span = match->span;
+        return true;
+}
+
 /*
  * VteTerminalPrivate::set_input_enabled:
  * @enabled: whether to enable user input
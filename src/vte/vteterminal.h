@@ -243,6 +243,11 @@ void vte_terminal_set_rewrap_on_resize(VteTerminal *terminal,
                                        gboolean rewrap) _VTE_GNUC_NONNULL(1);
 _VTE_PUBLIC
 gboolean vte_terminal_get_rewrap_on_resize(VteTerminal *terminal) _VTE_GNUC_NONNULL(1);
+_VTE_PUBLIC
+void vte_terminal_set_threaded_input(VteTerminal *terminal,
+                                     gboolean threaded) _VTE_GNUC_NONNULL(1);
+_VTE_PUBLIC
+gboolean vte_terminal_get_threaded_input(VteTerminal *terminal) _VTE_GNUC_NONNULL(1);
 
 /* Set the color scheme. */
 _VTE_PUBLIC
@@ -426,6 +431,26 @@ _VTE_PUBLIC
 gboolean  vte_terminal_search_find_previous   (VteTerminal *terminal) _VTE_GNUC_NONNULL(1);
 _VTE_PUBLIC
 gboolean  vte_terminal_search_find_next       (VteTerminal *terminal) _VTE_GNUC_NONNULL(1);
+_VTE_PUBLIC
+void      vte_terminal_search_find_all_async  (VteTerminal *terminal,
+                                               GCancellable *cancellable,
+                                               GAsyncReadyCallback callback,
+                                               gpointer user_data) _VTE_GNUC_NONNULL(1);
+_VTE_PUBLIC
+gboolean  vte_terminal_search_find_all_finish (VteTerminal *terminal,
+                                               GAsyncResult *result,
+                                               GError **error) _VTE_GNUC_NONNULL(1) _VTE_GNUC_NONNULL(2);
+_VTE_PUBLIC
+void      vte_terminal_search_cancel          (VteTerminal *terminal) _VTE_GNUC_NONNULL(1);
+_VTE_PUBLIC
+gsize     vte_terminal_search_get_match_count (VteTerminal *terminal) _VTE_GNUC_NONNULL(1);
+_VTE_PUBLIC
+gboolean  vte_terminal_search_get_match       (VteTerminal *terminal,
+                                               gsize index,
+                                               glong *start_row,
+                                               glong *start_col,
+                                               glong *end_row,
+                                               glong *end_col) _VTE_GNUC_NONNULL(1);
 
 
 /* Set the character encoding.  Most of the time you won't need this. */
@@ -75,15 +75,25 @@
 #define VTE_CHILD_INPUT_PRIORITY	G_PRIORITY_DEFAULT_IDLE
 #define VTE_CHILD_OUTPUT_PRIORITY	G_PRIORITY_HIGH
 #define VTE_FX_PRIORITY			G_PRIORITY_DEFAULT_IDLE
+#define VTE_SEARCH_PRIORITY		G_PRIORITY_DEFAULT_IDLE
 #define VTE_REGCOMP_FLAGS		REG_EXTENDED
 #define VTE_REGEXEC_FLAGS		0
 #define VTE_INPUT_CHUNK_SIZE		0x2000
 #define VTE_MAX_INPUT_READ		0x1000
+#define VTE_INPUT_THREAD_MAX_PENDING	0x40000 /* characters converted ahead of the main thread */
+#define VTE_MIN_INPUT_BUDGET		0x100
+#define VTE_INPUT_WEIGHT_HIDDEN		1 /* relative shares of the input budget */
+#define VTE_INPUT_WEIGHT_VISIBLE	4
+#define VTE_INPUT_WEIGHT_FOCUSED	8
+#define VTE_BACKGROUND_PROCESS_INTERVAL	50 /* ms between input passes of hidden terminals */
+#define VTE_BACKGROUND_INPUT_FACTOR	4 /* their input budget, relative to their share */
+#define VTE_BACKGROUND_SIGNAL_INTERVAL	1 /* s between their contents-changed etc. */
 #define VTE_INVALID_BYTE		'?'
-#define VTE_DISPLAY_TIMEOUT		10
-#define VTE_UPDATE_TIMEOUT		15
-#define VTE_UPDATE_REPEAT_TIMEOUT	30
-#define VTE_MAX_PROCESS_TIME		100
+#define VTE_PROCESS_PRIORITY		G_PRIORITY_DEFAULT_IDLE /* below GDK_PRIORITY_REDRAW */
+#define VTE_DEFAULT_FRAME_INTERVAL	16667 /* µs, until the frame clock knows better */
+#define VTE_FRAME_PROCESS_SHARE		0.5 /* of each frame spent processing input */
+#define VTE_SEARCH_SLICE_TIME		10 /* ms of snapshotting per main loop iteration */
+#define VTE_SEARCH_MAX_QUEUED_CHUNKS	8
 #define VTE_CELL_BBOX_SLACK		1
 #define VTE_DEFAULT_UTF8_AMBIGUOUS_WIDTH 1
 
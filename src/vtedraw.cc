@@ -229,6 +229,10 @@ unistr_info_destroy (struct unistr_info *uinfo)
 	g_slice_free (struct unistr_info, uinfo);
 }
 
+#define UNISTR_INFO_PAGE_SHIFT 8
+#define UNISTR_INFO_PAGE_SIZE (1 << UNISTR_INFO_PAGE_SHIFT)
+#define UNISTR_INFO_N_PAGES (0x10000 >> UNISTR_INFO_PAGE_SHIFT)
+
 struct font_info {
 	/* lifecycle */
 	int ref_count;
@@ -237,8 +241,10 @@ struct font_info {
 	/* reusable layout set with font and everything set */
 	PangoLayout *layout;
 
-	/* cache of character info */
-	struct unistr_info ascii_unistr_info[128];
+	/* cache of character info: the BMP is direct-mapped in pages of
+	 * UNISTR_INFO_PAGE_SIZE characters allocated on first use, and
+	 * everything else (astral planes, combined vteunistr) is hashed */
+	struct unistr_info *unistr_info_pages[UNISTR_INFO_N_PAGES];
 	GHashTable *other_unistr_info;
 
 	/* cell metrics */
@@ -260,8 +266,15 @@ font_info_find_unistr_info (struct font_info    *info,
 {
 	struct unistr_info *uinfo;
 
-	if (G_LIKELY (c < G_N_ELEMENTS (info->ascii_unistr_info)))
-		return &info->ascii_unistr_info[c];
+	if (G_LIKELY (c < 0x10000)) {
+		struct unistr_info *page = info->unistr_info_pages[c >> UNISTR_INFO_PAGE_SHIFT];
+
+		if (G_UNLIKELY (page == NULL)) {
+			page = g_new0 (struct unistr_info, UNISTR_INFO_PAGE_SIZE);
+			info->unistr_info_pages[c >> UNISTR_INFO_PAGE_SHIFT] = page;
+		}
+		return &page[c & (UNISTR_INFO_PAGE_SIZE - 1)];
+	}
 
 	if (G_UNLIKELY (info->other_unistr_info == NULL))
 		info->other_unistr_info = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify) unistr_info_destroy);
@@ -276,27 +289,18 @@ font_info_find_unistr_info (struct font_info    *info,
 }
 
 
-static void
-font_info_cache_ascii (struct font_info *info)
+/* Cache the glyphs of the simple clusters of the text in info->layout, so
+ * that they don't have to be shaped one by one later. Returns the number
+ * of characters cached. */
+static int
+font_info_cache_layout (struct font_info *info)
 {
 	PangoLayoutLine *line;
-	PangoGlyphItemIter iter;
-	PangoGlyphItem *glyph_item;
-	PangoGlyphString *glyph_string;
-	PangoFont *pango_font;
-	cairo_scaled_font_t *scaled_font;
+	GSList *runs;
 	const char *text;
-	gboolean more;
 	PangoLanguage *language;
 	gboolean latin_uses_default_language;
-	
-	/* We have info->layout holding most ASCII characters.  We want to
-	 * cache as much info as we can about the ASCII letters so we don't
-	 * have to look them up again later */
-
-	/* Don't cache if unknown glyphs found in layout */
-	if (pango_layout_get_unknown_glyphs_count (info->layout) != 0)
-		return;
+	int n_cached = 0;
 
 	language = pango_context_get_language (pango_layout_get_context (info->layout));
 	if (language == NULL)
@@ -306,76 +310,130 @@ font_info_cache_ascii (struct font_info *info)
 	text = pango_layout_get_text (info->layout);
 
 	line = pango_layout_get_line_readonly (info->layout, 0);
+	if (G_UNLIKELY (!line))
+		return 0;
 
-	/* Don't cache if more than one font used for the line */
-	if (G_UNLIKELY (!line || !line->runs || line->runs->next))
-		return;
-
-	glyph_item = (PangoGlyphItem *)line->runs->data;
-	glyph_string = glyph_item->glyphs;
-	pango_font = glyph_item->item->analysis.font;
-	if (!pango_font)
-		return;
-	scaled_font = pango_cairo_font_get_scaled_font ((PangoCairoFont *) pango_font);
-	if (!scaled_font)
-		return;
+	/* Each run has its own font, e.g. a fallback font for CJK */
+	for (runs = line->runs; runs != NULL; runs = runs->next) {
+		PangoGlyphItemIter iter;
+		PangoGlyphItem *glyph_item;
+		PangoGlyphString *glyph_string;
+		PangoFont *pango_font;
+		cairo_scaled_font_t *scaled_font;
+		gboolean more;
 
-	for (more = pango_glyph_item_iter_init_start (&iter, glyph_item, text);
-	     more;
-	     more = pango_glyph_item_iter_next_cluster (&iter))
-	{
-		struct unistr_info *uinfo;
-		union unistr_font_info *ufi;
-	 	PangoGlyphGeometry *geometry;
-		PangoGlyph glyph;
-		vteunistr c;
-
-		/* Only cache simple clusters */
-		if (iter.start_char +1 != iter.end_char  ||
-		    iter.start_index+1 != iter.end_index ||
-		    iter.start_glyph+1 != iter.end_glyph)
+		glyph_item = (PangoGlyphItem *)runs->data;
+		glyph_string = glyph_item->glyphs;
+		pango_font = glyph_item->item->analysis.font;
+		if (!pango_font)
+			continue;
+		scaled_font = pango_cairo_font_get_scaled_font ((PangoCairoFont *) pango_font);
+		if (!scaled_font)
 			continue;
 
-		c = text[iter.start_index];
-		glyph = glyph_string->glyphs[iter.start_glyph].glyph;
-		geometry = &glyph_string->glyphs[iter.start_glyph].geometry;
+		for (more = pango_glyph_item_iter_init_start (&iter, glyph_item, text);
+		     more;
+		     more = pango_glyph_item_iter_next_cluster (&iter))
+		{
+			struct unistr_info *uinfo;
+			union unistr_font_info *ufi;
+			PangoGlyphGeometry *geometry;
+			PangoGlyph glyph;
+			vteunistr c;
 
-		/* If not using the default locale language, only cache non-common
-		 * characters as common characters get their font from their neighbors
-		 * and we don't want to force Latin on them. */
-		if (!latin_uses_default_language &&
-		    pango_script_for_unichar (c) <= PANGO_SCRIPT_INHERITED)
-			continue;
+			/* Only cache simple clusters */
+			if (iter.start_char +1 != iter.end_char  ||
+			    iter.start_glyph+1 != iter.end_glyph)
+				continue;
 
-		/* Only cache simple glyphs */
-		if (!(glyph <= 0xFFFF) || (geometry->x_offset | geometry->y_offset) != 0)
-			continue;
+			c = g_utf8_get_char (text + iter.start_index);
+			glyph = glyph_string->glyphs[iter.start_glyph].glyph;
+			geometry = &glyph_string->glyphs[iter.start_glyph].geometry;
 
-		uinfo = font_info_find_unistr_info (info, c);
-		if (G_UNLIKELY (uinfo->coverage != COVERAGE_UNKNOWN))
-			continue;
+			/* If not using the default locale language, only cache non-common
+			 * characters as common characters get their font from their neighbors
+			 * and we don't want to force Latin on them. */
+			if (!latin_uses_default_language &&
+			    pango_script_for_unichar (c) <= PANGO_SCRIPT_INHERITED)
+				continue;
 
-		ufi = &uinfo->ufi;
+			/* Only cache simple glyphs; this also skips unknown glyphs */
+			if (!(glyph <= 0xFFFF) || (geometry->x_offset | geometry->y_offset) != 0)
+				continue;
+
+			uinfo = font_info_find_unistr_info (info, c);
+			if (G_UNLIKELY (uinfo->coverage != COVERAGE_UNKNOWN))
+				continue;
 
-		uinfo->width = PANGO_PIXELS_CEIL (geometry->width);
-		uinfo->has_unknown_chars = FALSE;
+			ufi = &uinfo->ufi;
 
-		uinfo->coverage = COVERAGE_USE_CAIRO_GLYPH;
+			uinfo->width = PANGO_PIXELS_CEIL (geometry->width);
+			uinfo->has_unknown_chars = FALSE;
 
-		ufi->using_cairo_glyph.scaled_font = cairo_scaled_font_reference (scaled_font);
-		ufi->using_cairo_glyph.glyph_index = glyph;
+			uinfo->coverage = COVERAGE_USE_CAIRO_GLYPH;
 
+			ufi->using_cairo_glyph.scaled_font = cairo_scaled_font_reference (scaled_font);
+			ufi->using_cairo_glyph.glyph_index = glyph;
+
+			n_cached++;
 #ifdef VTE_DEBUG
-		info->coverage_count[0]++;
-		info->coverage_count[uinfo->coverage]++;
+			info->coverage_count[0]++;
+			info->coverage_count[uinfo->coverage]++;
 #endif
+		}
 	}
 
-#ifdef VTE_DEBUG
+	return n_cached;
+}
+
+static void
+font_info_cache_ascii (struct font_info *info)
+{
+	int n_cached;
+
+	/* We have info->layout holding most ASCII characters.  We want to
+	 * cache as much info as we can about the ASCII letters so we don't
+	 * have to look them up again later */
+	n_cached = font_info_cache_layout (info);
+
 	_vte_debug_print (VTE_DEBUG_PANGOCAIRO,
 			  "vtepangocairo: %p cached %d ASCII letters\n",
-			  info, info->coverage_count[0]);
-#endif
+			  info, n_cached);
+}
+
+/* Shape the given characters in one go and cache their glyphs, instead of
+ * shaping each of them separately when it is first drawn. */
+static void
+font_info_cache_chars (struct font_info *info,
+		       const gunichar *chars,
+		       gsize n_chars)
+{
+	gsize i;
+	int n_cached;
+
+	g_string_set_size (info->string, 0);
+	for (i = 0; i < n_chars; i++) {
+		gunichar c = chars[i];
+
+		/* Common and inherited characters would take the font of
+		 * their unrelated neighbours here, rather than their own. */
+		if (c > 0x10FFFF || !g_unichar_isprint (c) ||
+		    pango_script_for_unichar (c) <= PANGO_SCRIPT_INHERITED ||
+		    font_info_find_unistr_info (info, c)->coverage != COVERAGE_UNKNOWN)
+			continue;
+		g_string_append_unichar (info->string, c);
+	}
+	if (info->string->len == 0)
+		return;
+
+	pango_layout_set_text (info->layout, info->string->str, info->string->len);
+	n_cached = font_info_cache_layout (info);
+	/* release internal layout resources */
+	pango_layout_set_text (info->layout, "", -1);
+
+	_vte_debug_print (VTE_DEBUG_PANGOCAIRO,
+			  "vtepangocairo: %p cached %d of %" G_GSIZE_FORMAT " characters\n",
+			  info, n_cached, n_chars);
 }
 
 static void
@@ -434,6 +492,16 @@ font_info_allocate (PangoContext *context)
 
 	font_info_measure_font (info);
 
+	/* Latin-1 is common enough to always be worth shaping up front */
+	{
+		gunichar latin1[0x100 - 0xa0];
+		gsize i;
+
+		for (i = 0; i < G_N_ELEMENTS (latin1); i++)
+			latin1[i] = 0xa0 + i;
+		font_info_cache_chars (info, latin1, G_N_ELEMENTS (latin1));
+	}
+
 	return info;
 }
 
@@ -455,9 +523,17 @@ font_info_free (struct font_info *info)
 	g_string_free (info->string, TRUE);
 	g_object_unref (info->layout);
 
-	for (i = 0; i < G_N_ELEMENTS (info->ascii_unistr_info); i++)
-		unistr_info_finish (&info->ascii_unistr_info[i]);
-		
+	for (i = 0; i < UNISTR_INFO_N_PAGES; i++) {
+		struct unistr_info *page = info->unistr_info_pages[i];
+		vteunistr j;
+
+		if (page == NULL)
+			continue;
+		for (j = 0; j < UNISTR_INFO_PAGE_SIZE; j++)
+			unistr_info_finish (&page[j]);
+		g_free (page);
+	}
+
 	if (info->other_unistr_info) {
 		g_hash_table_destroy (info->other_unistr_info);
 	}
@@ -753,10 +829,24 @@ guint _vte_draw_get_style(gboolean bold, gboolean italic) {
 	return style;
 }
 
+/* Box drawing and block elements are rasterized once per cell size into
+ * alpha masks, for widths of up to VTE_DRAW_GRAPHIC_MAX_COLUMNS columns. */
+#define VTE_DRAW_GRAPHIC_FIRST 0x2500
+#define VTE_DRAW_GRAPHIC_LAST 0x259f
+#define VTE_DRAW_GRAPHIC_MAX_COLUMNS 2
+
 struct _vte_draw {
 	struct font_info *fonts[4];
 
 	cairo_t *cr;
+
+	/* Masks of the graphic characters, for graphic_width x graphic_height
+	 * cells at graphic_scale; created on demand */
+	cairo_surface_t *graphics[VTE_DRAW_GRAPHIC_LAST - VTE_DRAW_GRAPHIC_FIRST + 1][VTE_DRAW_GRAPHIC_MAX_COLUMNS];
+	gint graphic_width, graphic_height;
+	double graphic_scale;
+
+	struct _vte_draw_stats stats;
 };
 
 struct _vte_draw *
@@ -787,6 +877,8 @@ _vte_draw_free (struct _vte_draw *draw)
 		}
 	}
 
+	_vte_draw_clear_graphics (draw);
+
 	g_slice_free (struct _vte_draw, draw);
 }
 
@@ -805,6 +897,14 @@ _vte_draw_set_cairo (struct _vte_draw *draw,
         }
 }
 
+void
+_vte_draw_take_stats (struct _vte_draw *draw,
+                      struct _vte_draw_stats *stats)
+{
+        *stats = draw->stats;
+        memset (&draw->stats, 0, sizeof (draw->stats));
+}
+
 static void
 _vte_draw_set_source_color_alpha (struct _vte_draw *draw,
                                   vte::color::rgb const* color,
@@ -924,6 +1024,21 @@ _vte_draw_get_char_width (struct _vte_draw *draw, vteunistr c, int columns,
 	return uinfo->width;
 }
 
+void
+_vte_draw_prewarm (struct _vte_draw *draw,
+		   const gunichar *chars, gsize n_chars)
+{
+	gint style;
+
+	g_return_if_fail (draw->fonts[VTE_DRAW_NORMAL] != NULL);
+
+	/* Warm every font once, in case some styles share one */
+	for (style = 0; style < 4; style++) {
+		if (style == 0 || draw->fonts[style] != draw->fonts[style-1])
+			font_info_cache_chars (draw->fonts[style], chars, n_chars);
+	}
+}
+
 gboolean
 _vte_draw_has_bold (struct _vte_draw *draw, guint style)
 {
@@ -932,19 +1047,19 @@ _vte_draw_has_bold (struct _vte_draw *draw, guint style)
 
 /* Check if a unicode character is actually a graphic character we draw
  * ourselves to handle cases where fonts don't have glyphs for them. */
-static gboolean
+gboolean
 _vte_draw_unichar_is_local_graphic(vteunistr c)
 {
         /* Box Drawing & Block Elements */
-        return (c >= 0x2500) && (c <= 0x259f);
+        return (c >= VTE_DRAW_GRAPHIC_FIRST) && (c <= VTE_DRAW_GRAPHIC_LAST);
 }
 
 #include "box_drawing.h"
 
 /* Draw the graphic representation of a line-drawing or special graphics
- * character. */
+ * character into the alpha mask @cr. */
 static void
-_vte_draw_terminal_draw_graphic(struct _vte_draw *draw, vteunistr c, vte::color::rgb const* fg,
+_vte_draw_terminal_draw_graphic(cairo_t *cr, vteunistr c,
                                 gint x, gint y,
                                 gint column_width, gint columns, gint row_height)
 {
@@ -952,9 +1067,6 @@ _vte_draw_terminal_draw_graphic(struct _vte_draw *draw, vteunistr c, vte::color:
         int upper_half, lower_half, left_half, right_half;
         int light_line_width, heavy_line_width;
         double adjust;
-        cairo_t *cr = draw->cr;
-
-        cairo_save (cr);
 
         width = column_width * columns;
         upper_half = row_height / 2;
@@ -1307,11 +1419,7 @@ _vte_draw_terminal_draw_graphic(struct _vte_draw *draw, vteunistr c, vte::color:
         case 0x2591: /* light shade */
         case 0x2592: /* medium shade */
         case 0x2593: /* dark shade */
-                cairo_set_source_rgba (cr,
-                                       fg->red / 65535.,
-                                       fg->green / 65535.,
-                                       fg->blue / 65535.,
-                                       (c - 0x2590) / 4.);
+                cairo_set_source_rgba (cr, 0., 0., 0., (c - 0x2590) / 4.);
                 cairo_rectangle(cr, x, y, width, row_height);
                 cairo_fill (cr);
                 break;
@@ -1397,8 +1505,80 @@ _vte_draw_terminal_draw_graphic(struct _vte_draw *draw, vteunistr c, vte::color:
         }
 
 #undef EIGHTS
+}
+
+void
+_vte_draw_clear_graphics (struct _vte_draw *draw)
+{
+        guint i, j;
 
-        cairo_restore(cr);
+        for (i = 0; i < G_N_ELEMENTS (draw->graphics); i++) {
+                for (j = 0; j < VTE_DRAW_GRAPHIC_MAX_COLUMNS; j++) {
+                        if (draw->graphics[i][j] != NULL) {
+                                cairo_surface_destroy (draw->graphics[i][j]);
+                                draw->graphics[i][j] = NULL;
+                        }
+                }
+        }
+        draw->graphic_width = draw->graphic_height = 0;
+}
+
+/* Rasterize a graphic character into a new alpha mask similar to the
+ * current target, so that it matches its device scale. */
+static cairo_surface_t *
+_vte_draw_create_graphic (struct _vte_draw *draw, vteunistr c,
+                          gint column_width, gint columns, gint row_height)
+{
+        cairo_surface_t *surface;
+        cairo_t *cr;
+
+        surface = cairo_surface_create_similar (cairo_get_target (draw->cr),
+                                                CAIRO_CONTENT_ALPHA,
+                                                column_width * columns, row_height);
+        cr = cairo_create (surface);
+        cairo_set_source_rgba (cr, 0., 0., 0., 1.);
+        _vte_draw_terminal_draw_graphic (cr, c, 0, 0, column_width, columns, row_height);
+        cairo_destroy (cr);
+
+        return surface;
+}
+
+/* Paint a graphic character with the current source, from its cached mask. */
+static void
+_vte_draw_graphic (struct _vte_draw *draw, vteunistr c,
+                   gint x, gint y,
+                   gint column_width, gint columns, gint row_height)
+{
+        cairo_surface_t *surface;
+        double scale;
+
+        if (G_UNLIKELY (columns < 1 || columns > VTE_DRAW_GRAPHIC_MAX_COLUMNS)) {
+                surface = _vte_draw_create_graphic (draw, c, column_width, columns, row_height);
+                cairo_mask_surface (draw->cr, surface, x, y);
+                cairo_surface_destroy (surface);
+                return;
+        }
+
+        cairo_surface_get_device_scale (cairo_get_target (draw->cr), &scale, NULL);
+        if (column_width != draw->graphic_width ||
+            row_height != draw->graphic_height ||
+            !_vte_double_equal (scale, draw->graphic_scale)) {
+                _vte_draw_clear_graphics (draw);
+                draw->graphic_width = column_width;
+                draw->graphic_height = row_height;
+                draw->graphic_scale = scale;
+        }
+
+        surface = draw->graphics[c - VTE_DRAW_GRAPHIC_FIRST][columns - 1];
+        if (surface == NULL) {
+                _vte_debug_print (VTE_DEBUG_DRAW,
+                                  "Rasterizing graphic U+%04X (%dx%d)\n",
+                                  c, column_width * columns, row_height);
+                surface = _vte_draw_create_graphic (draw, c, column_width, columns, row_height);
+                draw->graphics[c - VTE_DRAW_GRAPHIC_FIRST][columns - 1] = surface;
+        }
+
+        cairo_mask_surface (draw->cr, surface, x, y);
 }
 
 static void
@@ -1422,27 +1602,34 @@ _vte_draw_text_internal (struct _vte_draw *draw,
 		vteunistr c = requests[i].c;
 		int x = requests[i].x;
 		int y = requests[i].y + font->ascent;
-		struct unistr_info *uinfo = font_info_get_unistr_info (font, c);
-		union unistr_font_info *ufi = &uinfo->ufi;
+		struct unistr_info *uinfo;
+		union unistr_font_info *ufi;
 
+                /* Drawn by us, so there is no need to shape these */
                 if (_vte_draw_unichar_is_local_graphic(c)) {
-                        _vte_draw_terminal_draw_graphic(draw, c, color,
-                                                        requests[i].x, requests[i].y,
-                                                        font->width, requests[i].columns, font->height);
+                        draw->stats.n_glyphs_graphic++;
+                        _vte_draw_graphic(draw, c,
+                                          requests[i].x, requests[i].y,
+                                          font->width, requests[i].columns, font->height);
                         continue;
                 }
 
+		uinfo = font_info_get_unistr_info (font, c);
+		ufi = &uinfo->ufi;
+
 		switch (uinfo->coverage) {
 		default:
 		case COVERAGE_UNKNOWN:
 			g_assert_not_reached ();
 			break;
 		case COVERAGE_USE_PANGO_LAYOUT_LINE:
+			draw->stats.n_glyphs_pango_layout_line++;
 			cairo_move_to (draw->cr, x, y);
 			pango_cairo_show_layout_line (draw->cr,
 						      ufi->using_pango_layout_line.line);
 			break;
 		case COVERAGE_USE_PANGO_GLYPH_STRING:
+			draw->stats.n_glyphs_pango_glyph_string++;
 			cairo_move_to (draw->cr, x, y);
 			pango_cairo_show_glyph_string (draw->cr,
 						       ufi->using_pango_glyph_string.font,
@@ -1451,6 +1638,7 @@ _vte_draw_text_internal (struct _vte_draw *draw,
 		case COVERAGE_USE_CAIRO_GLYPH:
 			if (last_scaled_font != ufi->using_cairo_glyph.scaled_font || n_cr_glyphs == MAX_RUN_LENGTH) {
 				if (n_cr_glyphs) {
+					draw->stats.n_show_glyphs++;
 					cairo_set_scaled_font (draw->cr, last_scaled_font);
 					cairo_show_glyphs (draw->cr,
 							   cr_glyphs,
@@ -1459,6 +1647,7 @@ _vte_draw_text_internal (struct _vte_draw *draw,
 				}
 				last_scaled_font = ufi->using_cairo_glyph.scaled_font;
 			}
+			draw->stats.n_glyphs_cairo++;
 			cr_glyphs[n_cr_glyphs].index = ufi->using_cairo_glyph.glyph_index;
 			cr_glyphs[n_cr_glyphs].x = x;
 			cr_glyphs[n_cr_glyphs].y = y;
@@ -1467,6 +1656,7 @@ _vte_draw_text_internal (struct _vte_draw *draw,
 		}
 	}
 	if (n_cr_glyphs) {
+		draw->stats.n_show_glyphs++;
 		cairo_set_scaled_font (draw->cr, last_scaled_font);
 		cairo_show_glyphs (draw->cr,
 				   cr_glyphs,
@@ -1589,6 +1779,7 @@ _vte_draw_fill_rectangle (struct _vte_draw *draw,
 			color->red, color->green, color->blue,
 			alpha);
 
+	draw->stats.n_rectangles++;
 	cairo_set_operator (draw->cr, CAIRO_OPERATOR_OVER);
 	cairo_rectangle (draw->cr, x, y, width, height);
 	_vte_draw_set_source_color_alpha (draw, color, alpha);
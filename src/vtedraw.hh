@@ -47,6 +47,16 @@ struct _vte_draw_text_request {
 	gshort x, y, columns;
 };
 
+/* Counters of the drawing work done, for instrumentation. */
+struct _vte_draw_stats {
+	guint n_glyphs_cairo;           /* drawn with cairo_show_glyphs() */
+	guint n_glyphs_pango_glyph_string;
+	guint n_glyphs_pango_layout_line;
+	guint n_glyphs_graphic;         /* box drawing and block elements */
+	guint n_show_glyphs;            /* cairo_show_glyphs() calls */
+	guint n_rectangles;             /* filled rectangles */
+};
+
 guint _vte_draw_get_style(gboolean bold, gboolean italic);
 
 /* Create and destroy a draw structure. */
@@ -56,6 +66,10 @@ void _vte_draw_free(struct _vte_draw *draw);
 void _vte_draw_set_cairo(struct _vte_draw *draw,
                          cairo_t *cr);
 
+/* Get the counters accumulated since the last call, and reset them. */
+void _vte_draw_take_stats(struct _vte_draw *draw,
+                          struct _vte_draw_stats *stats);
+
 void _vte_draw_clear(struct _vte_draw *draw,
 		     gint x, gint y, gint width, gint height,
                      vte::color::rgb const* color, double alpha);
@@ -68,6 +82,14 @@ void _vte_draw_get_text_metrics(struct _vte_draw *draw,
 int _vte_draw_get_char_width(struct _vte_draw *draw, vteunistr c, int columns,
 			     guint style);
 gboolean _vte_draw_has_bold (struct _vte_draw *draw, guint style);
+gboolean _vte_draw_unichar_is_local_graphic(vteunistr c);
+
+/* Shape and cache the given characters in all styles ahead of drawing them. */
+void _vte_draw_prewarm(struct _vte_draw *draw,
+                       const gunichar *chars, gsize n_chars);
+
+/* Drop the rasterized box drawing characters, e.g. when the cell size changes. */
+void _vte_draw_clear_graphics(struct _vte_draw *draw);
 
 void _vte_draw_text(struct _vte_draw *draw,
 		    struct _vte_draw_text_request *requests, gsize n_requests,
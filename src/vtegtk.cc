@@ -490,6 +490,9 @@ vte_terminal_get_property (GObject *object,
                 case PROP_SCROLL_ON_OUTPUT:
                         g_value_set_boolean (value, impl->m_scroll_on_output);
                         break;
+                case PROP_THREADED_INPUT:
+                        g_value_set_boolean (value, vte_terminal_get_threaded_input (terminal));
+                        break;
                 case PROP_WINDOW_TITLE:
                         g_value_set_string (value, vte_terminal_get_window_title (terminal));
                         break;
@@ -579,6 +582,9 @@ vte_terminal_set_property (GObject *object,
                 case PROP_SCROLL_ON_OUTPUT:
                         vte_terminal_set_scroll_on_output (terminal, g_value_get_boolean (value));
                         break;
+                case PROP_THREADED_INPUT:
+                        vte_terminal_set_threaded_input (terminal, g_value_get_boolean (value));
+                        break;
                 case PROP_WORD_CHAR_EXCEPTIONS:
                         vte_terminal_set_word_char_exceptions (terminal, g_value_get_string (value));
                         break;
@@ -615,16 +621,16 @@ vte_terminal_class_init(VteTerminalClass *klass)
                                  "Debugging work flow (top input to bottom output):\n"
                                  "  .  _vte_terminal_process_incoming\n"
                                  "  <  start process_timeout\n"
-                                 "  {[ start update_timeout  [ => rate limited\n"
-                                 "  T  start of terminal in update_timeout\n"
+                                 "  {  start frame_tick\n"
+                                 "  T  start of terminal in process_timeout\n"
                                  "  (  start _vte_terminal_process_incoming\n"
                                  "  ?  _vte_invalidate_cells (call)\n"
                                  "  !  _vte_invalidate_cells (dirty)\n"
                                  "  *  _vte_invalidate_all\n"
                                  "  )  end _vte_terminal_process_incoming\n"
-                                 "  -  gdk_window_process_updates\n"
+                                 "  -  invalidate_dirty_rects\n"
                                  "  =  vte_terminal_paint\n"
-                                 "  ]} end update_timeout\n"
+                                 "  }  end frame_tick\n"
                                  "  >  end process_timeout\n");
 	}
 #endif
@@ -735,6 +741,32 @@ vte_terminal_class_init(VteTerminalClass *klass)
                              g_cclosure_marshal_VOID__VOID,
                              G_TYPE_NONE, 0);
 
+        /**
+         * VteTerminal::frame-drawn:
+         * @vteterminal: the object which received the signal
+         * @stats: a #GVariant of type "a{st}" with the counters of the frame
+         *
+         * Emitted after the terminal has drawn a frame, with counters of the
+         * work it did: "draw-time" (the time spent drawing, in microseconds),
+         * "rows-painted" (rows shown), "rows-rendered" (rows that had to be
+         * rendered again), "damage-area" (pixels queued for repainting since
+         * the previous frame), "glyphs-cairo", "glyphs-pango-glyph-string",
+         * "glyphs-pango-layout-line" and "glyphs-graphic" (characters drawn
+         * by each method), "show-glyphs-calls" (calls to cairo_show_glyphs())
+         * and "rectangles" (filled rectangles). More keys may be added.
+         *
+         * Since: 0.52
+         */
+        signals[SIGNAL_FRAME_DRAWN] =
+                g_signal_new(I_("frame-drawn"),
+                             G_OBJECT_CLASS_TYPE(klass),
+                             G_SIGNAL_RUN_LAST,
+                             0,
+                             NULL,
+                             NULL,
+                             g_cclosure_marshal_VOID__VARIANT,
+                             G_TYPE_NONE, 1, G_TYPE_VARIANT);
+
         /**
          * VteTerminal::child-exited:
          * @vteterminal: the object which received the signal
@@ -918,6 +950,24 @@ vte_terminal_class_init(VteTerminalClass *klass)
                               g_cclosure_marshal_VOID__VOID,
                               G_TYPE_NONE, 0);
 
+        /**
+         * VteTerminal::search-matches-changed:
+         * @vteterminal: the object which received the signal
+         *
+         * Emitted when vte_terminal_search_find_all_async() found new matches.
+         *
+         * Since: 0.52
+         */
+        signals[SIGNAL_SEARCH_MATCHES_CHANGED] =
+                g_signal_new(I_("search-matches-changed"),
+                             G_OBJECT_CLASS_TYPE(klass),
+                             G_SIGNAL_RUN_LAST,
+                             0,
+                             NULL,
+                             NULL,
+                             g_cclosure_marshal_VOID__VOID,
+                             G_TYPE_NONE, 0);
+
         /**
          * VteTerminal::contents-changed:
          * @vteterminal: the object which received the signal
@@ -1484,6 +1534,20 @@ vte_terminal_class_init(VteTerminalClass *klass)
                                       TRUE,
                                       (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY));
 
+        /**
+         * VteTerminal:threaded-input:
+         *
+         * Controls whether the terminal reads and decodes the child's output
+         * on a thread of its own, so that a terminal flooded with output
+         * doesn't hold up the main loop while waiting for or converting it.
+         *
+         * Since: 0.52
+         */
+        pspecs[PROP_THREADED_INPUT] =
+                g_param_spec_boolean ("threaded-input", NULL, NULL,
+                                      FALSE,
+                                      (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY));
+
         /**
          * VteTerminal:window-title:
          *
@@ -2233,6 +2297,143 @@ vte_terminal_search_get_wrap_around (VteTerminal *terminal)
 	return IMPL(terminal)->m_search_wrap_around;
 }
 
+/**
+ * vte_terminal_search_find_all_async:
+ * @terminal: a #VteTerminal
+ * @cancellable: (allow-none): a #GCancellable, or %NULL
+ * @callback: (scope async): a #GAsyncReadyCallback, or %NULL
+ * @user_data: (closure callback): user data for @callback
+ *
+ * Searches the whole buffer for the search regex set with
+ * vte_terminal_search_set_regex(), without blocking the main loop.
+ * Only the rows that exist when the search starts are searched.
+ *
+ * Matches are reported as they are found; #VteTerminal::search-matches-changed
+ * is emitted whenever new ones were added, and they can be retrieved with
+ * vte_terminal_search_get_match().
+ *
+ * Starting a search cancels the search in progress and discards its matches.
+ * So do changing the search regex, and resizing the terminal when its
+ * contents are rewrapped.
+ *
+ * Since: 0.52
+ */
+void
+vte_terminal_search_find_all_async(VteTerminal *terminal,
+                                   GCancellable *cancellable,
+                                   GAsyncReadyCallback callback,
+                                   gpointer user_data)
+{
+        g_return_if_fail(VTE_IS_TERMINAL(terminal));
+        g_return_if_fail(cancellable == nullptr || G_IS_CANCELLABLE(cancellable));
+
+        IMPL(terminal)->search_find_all_async(cancellable, callback, user_data);
+}
+
+/**
+ * vte_terminal_search_find_all_finish:
+ * @terminal: a #VteTerminal
+ * @result: a #GAsyncResult
+ * @error: (allow-none): return location for a #GError, or %NULL
+ *
+ * Finishes a search started with vte_terminal_search_find_all_async().
+ * If the search was cancelled, the matches found until then are still
+ * available unless a new search discarded them.
+ *
+ * Returns: %TRUE if the whole buffer was searched, or %FALSE with @error
+ *   filled in
+ *
+ * Since: 0.52
+ */
+gboolean
+vte_terminal_search_find_all_finish(VteTerminal *terminal,
+                                    GAsyncResult *result,
+                                    GError **error)
+{
+        g_return_val_if_fail(VTE_IS_TERMINAL(terminal), FALSE);
+        g_return_val_if_fail(g_task_is_valid(result, terminal), FALSE);
+        g_return_val_if_fail(error == nullptr || *error == nullptr, FALSE);
+
+        return g_task_propagate_boolean(G_TASK(result), error);
+}
+
+/**
+ * vte_terminal_search_cancel:
+ * @terminal: a #VteTerminal
+ *
+ * Cancels the search started with vte_terminal_search_find_all_async(),
+ * if it is still in progress. The matches found so far are kept.
+ *
+ * Since: 0.52
+ */
+void
+vte_terminal_search_cancel(VteTerminal *terminal)
+{
+        g_return_if_fail(VTE_IS_TERMINAL(terminal));
+
+        IMPL(terminal)->search_stop(g_error_new_literal(G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                                        "Search cancelled"));
+}
+
+/**
+ * vte_terminal_search_get_match_count:
+ * @terminal: a #VteTerminal
+ *
+ * Returns: the number of matches found by vte_terminal_search_find_all_async()
+ *   so far
+ *
+ * Since: 0.52
+ */
+gsize
+vte_terminal_search_get_match_count(VteTerminal *terminal)
+{
+        g_return_val_if_fail(VTE_IS_TERMINAL(terminal), 0);
+
+        return IMPL(terminal)->m_search_matches->len;
+}
+
+/**
+ * vte_terminal_search_get_match:
+ * @terminal: a #VteTerminal
+ * @index: the index of the match, less than vte_terminal_search_get_match_count()
+ * @start_row: (out) (allow-none): the row of the first character of the match
+ * @start_col: (out) (allow-none): the column of the first character of the match
+ * @end_row: (out) (allow-none): the row of the last character of the match
+ * @end_col: (out) (allow-none): the column of the last character of the match
+ *
+ * Retrieves the position of a match found by vte_terminal_search_find_all_async().
+ * Matches are ordered by position. A match is no longer available once its
+ * rows have been dropped from the scrollback.
+ *
+ * Returns: %TRUE if the match is available
+ *
+ * Since: 0.52
+ */
+gboolean
+vte_terminal_search_get_match(VteTerminal *terminal,
+                              gsize index,
+                              glong *start_row,
+                              glong *start_col,
+                              glong *end_row,
+                              glong *end_col)
+{
+        g_return_val_if_fail(VTE_IS_TERMINAL(terminal), FALSE);
+
+        vte::grid::span span;
+        if (!IMPL(terminal)->search_get_match(index, &span))
+                return FALSE;
+
+        if (start_row)
+                *start_row = span.start_row();
+        if (start_col)
+                *start_col = span.start_column();
+        if (end_row)
+                *end_row = span.end_row();
+        if (end_col)
+                *end_col = span.end_column();
+        return TRUE;
+}
+
 
 /**
  * vte_terminal_select_all:
@@ -3957,6 +4158,46 @@ vte_terminal_set_scroll_on_output(VteTerminal *terminal,
                 g_object_notify_by_pspec(G_OBJECT(terminal), pspecs[PROP_SCROLL_ON_OUTPUT]);
 }
 
+/**
+ * vte_terminal_get_threaded_input:
+ * @terminal: a #VteTerminal
+ *
+ * Checks whether the terminal reads the child's output on a thread of its own.
+ *
+ * Returns: %TRUE if threaded input is enabled, %FALSE if not
+ *
+ * Since: 0.52
+ */
+gboolean
+vte_terminal_get_threaded_input(VteTerminal *terminal)
+{
+	g_return_val_if_fail(VTE_IS_TERMINAL(terminal), FALSE);
+	return IMPL(terminal)->m_threaded_input;
+}
+
+/**
+ * vte_terminal_set_threaded_input:
+ * @terminal: a #VteTerminal
+ * @threaded: %TRUE if the terminal should read input on a thread
+ *
+ * Controls whether the terminal reads and decodes the child's output on a
+ * thread of its own. The output is still interpreted, and all signals are
+ * still emitted, on the main thread; but the main loop no longer has to
+ * wait for the child, and a terminal flooded with output takes no more
+ * than its share of each frame to catch up.
+ *
+ * Since: 0.52
+ */
+void
+vte_terminal_set_threaded_input(VteTerminal *terminal,
+                                gboolean threaded)
+{
+        g_return_if_fail(VTE_IS_TERMINAL(terminal));
+
+        if (IMPL(terminal)->set_threaded_input(threaded != FALSE))
+                g_object_notify_by_pspec(G_OBJECT(terminal), pspecs[PROP_THREADED_INPUT]);
+}
+
 /**
  * vte_terminal_get_window_title:
  * @terminal: a #VteTerminal
@@ -39,6 +39,7 @@ enum {
         SIGNAL_DEICONIFY_WINDOW,
         SIGNAL_ENCODING_CHANGED,
         SIGNAL_EOF,
+        SIGNAL_FRAME_DRAWN,
         SIGNAL_HYPERLINK_HOVER_URI_CHANGED,
         SIGNAL_ICON_TITLE_CHANGED,
         SIGNAL_ICONIFY_WINDOW,
@@ -51,6 +52,7 @@ enum {
         SIGNAL_REFRESH_WINDOW,
         SIGNAL_RESIZE_WINDOW,
         SIGNAL_RESTORE_WINDOW,
+        SIGNAL_SEARCH_MATCHES_CHANGED,
         SIGNAL_SELECTION_CHANGED,
         SIGNAL_TEXT_DELETED,
         SIGNAL_TEXT_INSERTED,
@@ -85,6 +87,7 @@ enum {
         PROP_SCROLLBACK_LINES,
         PROP_SCROLL_ON_KEYSTROKE,
         PROP_SCROLL_ON_OUTPUT,
+        PROP_THREADED_INPUT,
         PROP_WINDOW_TITLE,
         PROP_WORD_CHAR_EXCEPTIONS,
         LAST_PROP,
@@ -26,6 +26,7 @@
 #include "ring.h"
 #include "vteconv.h"
 #include "buffer.h"
+#include "matcher.h"
 
 #include "vtepcre2.h"
 #include "vteregexinternal.hh"
@@ -51,6 +52,42 @@ struct vte_regex_and_flags {
         guint32 match_flags;
 };
 
+/* Maps the text returned by get_text() back to cells: a run of cells in
+ * consecutive columns of one row, each contributing one character, whose
+ * text starts at @offset. */
+struct vte_text_run {
+        gsize offset;
+        vte::grid::row_t row;
+        vte::grid::column_t column;
+};
+
+/* The columns [start, end) of a displayed row that need repainting;
+ * empty if start >= end. */
+struct vte_damage_span {
+        vte::grid::column_t start, end;
+};
+
+/* A run of cells on a row painted with the same non-default background. */
+struct vte_background_span {
+        gint x, width;
+        guint back;
+};
+
+/* The displayed text of one row, as used for dingu matching. */
+struct vte_match_row {
+        GString* text;
+        GArray* attributes;
+        bool dirty;
+};
+
+/* A match found by the background search; the end is inclusive. */
+struct vte_search_match {
+        vte::grid::span span;
+};
+
+struct vte_search_job;
+struct vte_input_job;
+
 /* A match regex, with a tag. */
 struct vte_match_regex {
 	gint tag;
@@ -286,6 +323,9 @@ public:
         guint m_pty_input_source;
         guint m_pty_output_source;
         gboolean m_pty_input_active;
+        bool m_threaded_input;
+        /* The thread reading from the pty, if m_threaded_input */
+        struct vte_input_job *m_input_job;
         GPid m_pty_pid;	                /* pid of child process */
         VteReaper *m_reaper;
 
@@ -296,15 +336,42 @@ public:
         _vte_incoming_chunk_t *m_incoming; /* pending bytestream */
         GArray *m_pending;                 /* pending characters */
         gunichar m_last_graphic_character; /* for REP */
-        /* Array of dirty rectangles in view coordinates; need to
-         * add allocation origin and padding when passing to gtk.
+        /* Damaged columns of the displayed rows, from m_damage_first on;
+         * turned into a region once per update.
          */
-        GArray *m_update_rects;
+        struct vte_damage_span *m_damage;
+        int m_damage_n_rows;
+        vte::grid::row_t m_damage_first;
+        bool m_damage_pending;
+        guint64 m_repainted_area;         /* pixels queued for repainting so far */
+        /* Counters for the next "frame-drawn" */
+        guint64 m_frame_damage_area;
+        int m_frame_rows_painted, m_frame_rows_rendered;
         gboolean m_invalidated_all;       /* pending refresh of entire terminal */
+        /* Offscreen copy of the rendered rows, used as a ring buffer: row r
+         * is kept in slot r % m_render_n_slots, and m_render_rows[slot] is
+         * the row the slot holds, or -1 if it needs to be rendered again.
+         */
+        cairo_surface_t *m_render_surface;
+        vte::grid::row_t *m_render_rows;
+        int m_render_n_slots;
+        int m_render_width, m_render_height;
+        double m_render_scale;
+        VteScreen *m_render_screen;
         /* If non-nullptr, contains the GList element for @this in g_active_terminals
          * and means that this terminal is processing data.
          */
         GList *m_active_terminals_link;
+        guint m_input_weight;             /* share of the input budget, see input_budget() */
+        /* Background mode, see set_background() */
+        bool m_background;
+        gint64 m_background_next_pass;    /* when to process input again */
+        guint m_background_signals_tag;
+        bool m_selection_check_pending;
+        /* The tick callback while waiting for a frame, and the frame
+         * interval (in µs) that input processing is budgeted against. */
+        guint m_frame_tick_id;
+        gint64 m_frame_interval;
         // FIXMEchpe should these two be g[s]size ?
         glong m_input_bytes;
         glong m_max_input_bytes;
@@ -432,8 +499,14 @@ public:
         gboolean m_focus_tracking_mode;
 
 	/* State variables for handling match checks. */
-        char* m_match_contents;
+        char* m_match_contents; /* points into m_match_text, or nullptr if stale */
+        GString* m_match_text;
         GArray* m_match_attributes;
+        /* Per-row cache of the text in m_match_text, for the rows from
+         * m_match_rows_first on; dirtied by invalidate_cells(). */
+        GArray* m_match_rows;
+        vte::grid::row_t m_match_rows_first;
+        VteScreen* m_match_rows_screen;
         GArray* m_match_regexes;
         char* m_match;
         int m_match_tag;
@@ -451,7 +524,15 @@ public:
 	/* Search data. */
         struct vte_regex_and_flags m_search_regex;
         gboolean m_search_wrap_around;
-        GArray* m_search_attrs; /* Cache attrs */
+        GArray* m_search_runs; /* Cache runs */
+        /* Background search, see search_find_all_async() */
+        struct vte_search_job *m_search_job;
+        GTask *m_search_task;
+        VteScreen *m_search_screen;
+        guint m_search_source;
+        vte::grid::row_t m_search_next_row, m_search_end_row;
+        bool m_search_snapshot_done;
+        GArray *m_search_matches; /* struct vte_search_match, in row order */
 
 	/* Data used when rendering the text which does not require server
 	 * resources and which can be kept after unrealizing. */
@@ -575,6 +656,8 @@ public:
         bool insert_char(gunichar c,
                          bool insert,
                          bool invalidate_now);
+        long insert_run(gunichar const* chars,
+                        long max_count);
 
         void invalidate(vte::grid::span const& s, bool block = false);
         void invalidate_match_span();
@@ -586,13 +669,31 @@ public:
                                bool block = false);
         void invalidate_selection();
         void invalidate_all();
-
-        void reset_update_rects();
-        bool invalidate_dirty_rects_and_process_updates();
+        void invalidate_view();
+
+        void cells_to_rect(vte::grid::column_t column_start,
+                           vte::grid::column_t n_columns,
+                           vte::grid::row_t row_start,
+                           vte::grid::row_t n_rows,
+                           cairo_rectangle_int_t& rect) const;
+        void damage_cells(vte::grid::column_t column_start, int n_columns,
+                          vte::grid::row_t row_start, int n_rows);
+        void reset_damage();
+        bool invalidate_dirty_rects();
+        void queue_frame();
+        void remove_frame_tick();
+        gboolean frame_tick(GdkFrameClock *frame_clock);
         void time_process_incoming();
         void process_incoming();
         bool process(bool emit_adj_changed);
         inline bool is_processing() const { return m_active_terminals_link != nullptr; }
+        guint input_budget() const;
+        void update_input_weight();
+        void set_input_weight(guint weight);
+        void set_background(bool background);
+        void queue_batched_signals();
+        void emit_batched_signals();
+        void deselect_if_changed();
         void start_processing();
 
         gssize get_preedit_width(bool left_only);
@@ -686,8 +787,12 @@ public:
 
         void widget_settings_notify();
 
-        void expand_rectangle(cairo_rectangle_int_t& rect) const;
-        void paint_area(GdkRectangle const* area);
+        inline int render_slot(vte::grid::row_t row) const;
+        void render_rows_invalidate(vte::grid::row_t row_start,
+                                    vte::grid::row_t n_rows);
+        void render_rows_invalidate_all();
+        void render_rows_free();
+        void paint_rows(cairo_t *cr);
         void paint_cursor();
         void paint_im_preedit_string();
         void draw_cells(struct _vte_draw_text_request *items,
@@ -720,6 +825,18 @@ public:
                                         bool draw_default_bg,
                                         int column_width,
                                         int height);
+        void fill_background_spans(GArray *spans,
+                                   gint y,
+                                   gint height);
+        void draw_row_backgrounds(VteScreen *screen,
+                                  vte::grid::row_t start_row,
+                                  long row_count,
+                                  vte::grid::column_t start_column,
+                                  long column_count,
+                                  gint start_x,
+                                  gint start_y,
+                                  gint column_width,
+                                  gint row_height);
         void draw_rows(VteScreen *screen,
                        vte::grid::row_t start_row,
                        long row_count,
@@ -740,6 +857,12 @@ public:
 
         void connect_pty_read();
         void disconnect_pty_read();
+        void start_input_thread();
+        void stop_input_thread();
+        bool input_thread_collect();
+        guint input_thread_pending();
+        void input_lock();
+        void input_unlock();
 
         void connect_pty_write();
         void disconnect_pty_write();
@@ -827,7 +950,8 @@ public:
                           bool block,
                           bool wrap,
                           bool include_trailing_spaces,
-                          GArray* attributes = nullptr);
+                          GArray* attributes = nullptr,
+                          GArray* runs = nullptr);
 
         GString* get_text_displayed(bool wrap,
                                     bool include_trailing_spaces,
@@ -881,6 +1005,7 @@ public:
 
         void reset_default_attributes(bool reset_hyperlink);
 
+        void prewarm_font();
         void ensure_font();
         void update_font();
         void apply_font_metrics(int width,
@@ -928,6 +1053,7 @@ public:
         void emit_text_inserted();
         void emit_text_modified();
         void emit_text_scrolled(long delta);
+        void emit_frame_drawn(gint64 draw_time);
         void emit_pending_signals();
         void emit_char_size_changed(int width,
                                     int height);
@@ -960,6 +1086,10 @@ public:
 
         void match_contents_clear();
         void match_contents_refresh();
+        void match_rows_invalidate(vte::grid::row_t row_start,
+                                   vte::grid::row_t n_rows);
+        void match_rows_set_range(vte::grid::row_t first,
+                                  vte::grid::row_t n_rows);
         void set_cursor_from_regex_match(struct vte_match_regex *regex);
         void match_hilite_clear();
         bool cursor_inside_match(vte::view::coords const& pos);
@@ -1001,7 +1131,7 @@ public:
                                     gsize *sattr_ptr,
                                     gsize *eattr_ptr);
 
-        pcre2_match_context_8 *create_match_context();
+        static pcre2_match_context_8 *create_match_context();
         bool match_check_pcre(pcre2_match_data_8 *match_data,
                               pcre2_match_context_8 *match_context,
                               VteRegex *regex,
@@ -1048,6 +1178,9 @@ public:
                          vte::grid::row_t start_row,
                          vte::grid::row_t end_row,
                          bool backward);
+        vte::grid::row_t search_skip_rows(VteRegex *regex,
+                                          vte::grid::row_t row,
+                                          vte::grid::row_t end_row);
         bool search_rows_iter(pcre2_match_context_8 *match_context,
                               pcre2_match_data_8 *match_data,
                               vte::grid::row_t start_row,
@@ -1056,6 +1189,16 @@ public:
         bool search_find(bool backward);
         bool search_set_wrap_around(bool wrap);
 
+        void search_find_all_async(GCancellable *cancellable,
+                                   GAsyncReadyCallback callback,
+                                   gpointer user_data);
+        void search_stop(GError *error);
+        void search_reset();
+        bool search_snapshot_chunk();
+        void search_collect_matches();
+        bool search_get_match(gsize index,
+                              vte::grid::span *span);
+
         void set_size(long columns,
                       long rows);
 
@@ -1107,6 +1250,7 @@ public:
         bool set_mouse_autohide(bool autohide);
         bool set_pty(VtePty *pty);
         bool set_rewrap_on_resize(bool rewrap);
+        bool set_threaded_input(bool threaded);
         bool set_scrollback_lines(long lines);
         bool set_scroll_on_keystroke(bool scroll);
         bool set_scroll_on_output(bool scroll);
@@ -1118,9 +1262,10 @@ public:
                                   GError **error);
 
         /* Sequence handlers and their helper functions */
-        void handle_sequence(char const* match,
-                             GValueArray *params);
-        char* ucs4_to_utf8(guchar const* in);
+        void handle_sequence(guint opcode,
+                             const struct _vte_matcher_params *params);
+        char* ucs4_to_utf8(gunichar const* str,
+                           gsize len);
 
         inline void ensure_cursor_is_onscreen();
         inline void seq_home_cursor();
@@ -1135,7 +1280,7 @@ public:
         inline void seq_restore_cursor();
         inline void seq_normal_screen_and_restore_cursor();
         inline void seq_save_cursor_and_alternate_screen();
-        void seq_set_title_internal(GValueArray *params,
+        void seq_set_title_internal(const struct _vte_matcher_params *params,
                                     bool icon_title,
                                     bool window_title);
         inline void seq_set_mode_internal(long setting,
@@ -23,6 +23,7 @@
  */
 
 #include "config.h"
+#include <string.h>
 
 #include "vtemacros.h"
 #include "vteenums.h"
@@ -35,6 +36,8 @@ struct _VteRegex {
         volatile int ref_count;
         VteRegexPurpose purpose;
         pcre2_code_8 *code;
+        char *literal;          /* the text the pattern matches, if it is a plain string */
+        gsize literal_length;
 };
 
 #define DEFAULT_COMPILE_OPTIONS (PCRE2_UTF)
@@ -80,6 +83,8 @@ regex_new(pcre2_code_8 *code,
         regex->ref_count = 1;
         regex->purpose = purpose;
         regex->code = code;
+        regex->literal = nullptr;
+        regex->literal_length = 0;
 
         return regex;
 }
@@ -88,6 +93,7 @@ static void
 regex_free(VteRegex *regex)
 {
         pcre2_code_free_8(regex->code);
+        g_free(regex->literal);
         g_slice_free(VteRegex, regex);
 }
 
@@ -147,6 +153,56 @@ vte_regex_unref(VteRegex *regex)
         return NULL;
 }
 
+/*
+ * regex_get_literal:
+ *
+ * Checks whether @pattern only matches one string, i.e. it has no
+ * metacharacters, and escapes only punctuation. With %PCRE2_CASELESS,
+ * the string must be ASCII since only ASCII letters are folded by
+ * the users of the literal.
+ *
+ * Returns: (transfer full): the string, or %nullptr
+ */
+static char *
+regex_get_literal(const char *pattern,
+                  gssize pattern_length,
+                  guint32 flags,
+                  gsize *length)
+{
+        gsize i, len = pattern_length >= 0 ? pattern_length : strlen(pattern);
+
+        if (flags & PCRE2_EXTENDED)
+                return nullptr;
+
+        auto literal = g_string_sized_new(len);
+        for (i = 0; i < len; i++) {
+                char c = pattern[i];
+
+                if (c == '\\') {
+                        if (++i == len)
+                                break;
+                        c = pattern[i];
+                        if (!g_ascii_ispunct(c) && c != ' ')
+                                break;
+                } else if (c == '\0' || strchr("^$.[]|()?*+{}", c) != nullptr) {
+                        break;
+                } else if ((c & 0x80) && (flags & PCRE2_CASELESS)) {
+                        break;
+                }
+
+                g_string_append_c(literal, c);
+        }
+
+        /* Too short to be of any use */
+        if (i < len || literal->len < 3) {
+                g_string_free(literal, TRUE);
+                return nullptr;
+        }
+
+        *length = literal->len;
+        return g_string_free(literal, FALSE);
+}
+
 static VteRegex *
 vte_regex_new(VteRegexPurpose purpose,
               const char *pattern,
@@ -188,7 +244,9 @@ vte_regex_new(VteRegexPurpose purpose,
                 return NULL;
         }
 
-        return regex_new(code, purpose);
+        auto regex = regex_new(code, purpose);
+        regex->literal = regex_get_literal(pattern, pattern_length, flags, &regex->literal_length);
+        return regex;
 }
 
 VteRegex *
@@ -409,6 +467,23 @@ _vte_regex_get_jited(VteRegex *regex)
         return r == 0 && s != 0;
 }
 
+/*
+ * _vte_regex_get_literal:
+ * @length: (out): the length of the literal in bytes
+ *
+ * Returns: the only string @regex can match (modulo ASCII case when
+ *   compiled with %PCRE2_CASELESS), or %nullptr if it is not that simple
+ */
+const char *
+_vte_regex_get_literal(VteRegex *regex,
+                       gsize *length)
+{
+        g_return_val_if_fail(regex != nullptr, nullptr);
+
+        *length = regex->literal_length;
+        return regex->literal;
+}
+
 /*
  * _vte_regex_get_compile_flags:
  *
@@ -77,7 +77,8 @@ G_STATIC_ASSERT (sizeof (VteCellAttr) == 16);
 G_STATIC_ASSERT (offsetof (VteCellAttr, hyperlink_idx) == VTE_CELL_ATTR_COMMON_BYTES);
 
 /*
- * VteStreamCellAttr: Variant of VteCellAttr to be stored in attr_stream.
+ * VteStreamCellAttr: Variant of VteCellAttr for the frozen rows. The common
+ * bytes go to the ring's attribute dictionaries, hyperlink_length to attr_stream.
  *
  * When adding new attributes, keep in sync with VteCellAttr and
  * update VTE_CELL_ATTR_COMMON_BYTES accordingly.
@@ -34,6 +34,7 @@
 #include "vteutils.h"  /* for strchrnul on non-GNU systems */
 #include "caps.h"
 #include "debug.h"
+#include "matcher.h"
 
 #define BEL "\007"
 #define ST _VTE_CAP_ST
@@ -41,32 +42,35 @@
 /* FUNCTIONS WE USE */
 
 static void
-display_control_sequence(const char *name, GValueArray *params)
+display_control_sequence(const char *name, const struct _vte_matcher_params *params)
 {
 #ifdef VTE_DEBUG
-	guint i;
-	long l;
-	const char *s;
-	const gunichar *w;
-	GValue *value;
+	guint i, j;
+	const struct _vte_matcher_param *value;
 	g_printerr("%s(", name);
 	if (params != NULL) {
-		for (i = 0; i < params->n_values; i++) {
-			value = g_value_array_get_nth(params, i);
+		for (i = 0; i < params->n_params; i++) {
+			value = &params->params[i];
 			if (i > 0) {
 				g_printerr(", ");
 			}
-			if (G_VALUE_HOLDS_LONG(value)) {
-				l = g_value_get_long(value);
-				g_printerr("LONG(%ld)", l);
-			} else
-			if (G_VALUE_HOLDS_STRING(value)) {
-				s = g_value_get_string(value);
-				g_printerr("STRING(\"%s\")", s);
-			} else
-			if (G_VALUE_HOLDS_POINTER(value)) {
-				w = (const gunichar *)g_value_get_pointer(value);
-				g_printerr("WSTRING(\"%ls\")", (const wchar_t*) w);
+			switch (value->type) {
+			case VTE_MATCHER_PARAM_NUMBER:
+				g_printerr("LONG(%ld)", value->number);
+				break;
+			case VTE_MATCHER_PARAM_SUBPARAMS:
+				g_printerr("SUBPARAMS(");
+				for (j = 0; j < value->n_sub; j++) {
+					g_printerr(j > 0 ? ", %ld" : "%ld",
+						   params->subparams[value->sub_start + j]);
+				}
+				g_printerr(")");
+				break;
+			case VTE_MATCHER_PARAM_STRING:
+				g_printerr("WSTRING(\"%.*ls\")",
+					   (int) value->str_len,
+					   (const wchar_t*) value->str);
+				break;
 			}
 		}
 	}
@@ -75,22 +79,13 @@ display_control_sequence(const char *name, GValueArray *params)
 }
 
 
-/* A couple are duplicated from vte.c, to keep them static... */
-
-/* Check how long a string of unichars is.  Slow version. */
-static gssize
-vte_unichar_strlen(gunichar *c)
-{
-	int i;
-	for (i = 0; c[i] != 0; i++) ;
-	return i;
-}
-
 /* Convert a wide character string to a multibyte string */
 char*
-VteTerminalPrivate::ucs4_to_utf8(guchar const* in)
+VteTerminalPrivate::ucs4_to_utf8(gunichar const* str,
+                                 gsize len)
 {
 	gchar *out = NULL;
+	guchar const* in = (guchar const*) str;
 	guchar *buf = NULL, *bufptr = NULL;
 	gsize inlen, outlen;
 	VteConv conv;
@@ -98,7 +93,7 @@ VteTerminalPrivate::ucs4_to_utf8(guchar const* in)
 	conv = _vte_conv_open ("UTF-8", VTE_CONV_GUNICHAR_TYPE);
 
 	if (conv != VTE_INVALID_CONV) {
-		inlen = vte_unichar_strlen ((gunichar *) in) * sizeof (gunichar);
+		inlen = len * sizeof (gunichar);
 		outlen = (inlen * VTE_UTF8_BPC) + 1;
 
 		_vte_byte_array_set_minimum_size (m_conv_buffer, outlen);
@@ -345,7 +340,7 @@ VteTerminalPrivate::seq_scroll_text(vte::grid::row_t scroll_amount)
 
 /* Restore cursor. */
 static void
-vte_sequence_handler_restore_cursor (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_restore_cursor (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->seq_restore_cursor();
 }
@@ -359,7 +354,7 @@ VteTerminalPrivate::seq_restore_cursor()
 
 /* Save cursor. */
 static void
-vte_sequence_handler_save_cursor (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_save_cursor (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->seq_save_cursor();
 }
@@ -372,7 +367,7 @@ VteTerminalPrivate::seq_save_cursor()
 
 /* Switch to normal screen. */
 static void
-vte_sequence_handler_normal_screen (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_normal_screen (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->seq_normal_screen();
 }
@@ -410,7 +405,7 @@ VteTerminalPrivate::seq_switch_screen(VteScreen *new_screen)
 
 /* Switch to alternate screen. */
 static void
-vte_sequence_handler_alternate_screen (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_alternate_screen (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->seq_alternate_screen();
 }
@@ -423,7 +418,7 @@ VteTerminalPrivate::seq_alternate_screen()
 
 /* Switch to normal screen and restore cursor (in this order). */
 static void
-vte_sequence_handler_normal_screen_and_restore_cursor (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_normal_screen_and_restore_cursor (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->seq_normal_screen_and_restore_cursor();
 }
@@ -437,7 +432,7 @@ VteTerminalPrivate::seq_normal_screen_and_restore_cursor()
 
 /* Save cursor and switch to alternate screen (in this order). */
 static void
-vte_sequence_handler_save_cursor_and_alternate_screen (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_save_cursor_and_alternate_screen (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->seq_save_cursor_and_alternate_screen();
 }
@@ -451,29 +446,25 @@ VteTerminalPrivate::seq_save_cursor_and_alternate_screen()
 
 /* Set icon/window titles. */
 void
-VteTerminalPrivate::seq_set_title_internal(GValueArray *params,
+VteTerminalPrivate::seq_set_title_internal(const struct _vte_matcher_params *params,
                                            bool change_icon_title,
                                            bool change_window_title)
 {
-	GValue *value;
+	const struct _vte_matcher_param *value;
 	char *title = NULL;
 
         if (change_icon_title == FALSE && change_window_title == FALSE)
 		return;
 
 	/* Get the string parameter's value. */
-	value = g_value_array_get_nth(params, 0);
-	if (value) {
-		if (G_VALUE_HOLDS_LONG(value)) {
+	if (params != NULL && params->n_params > 0) {
+		value = &params->params[0];
+		if (value->type == VTE_MATCHER_PARAM_NUMBER) {
 			/* Convert the long to a string. */
-			title = g_strdup_printf("%ld", g_value_get_long(value));
-		} else
-		if (G_VALUE_HOLDS_STRING(value)) {
-			/* Copy the string into the buffer. */
-			title = g_value_dup_string(value);
+			title = g_strdup_printf("%ld", value->number);
 		} else
-		if (G_VALUE_HOLDS_POINTER(value)) {
-                        title = ucs4_to_utf8((const guchar *)g_value_get_pointer (value));
+		if (value->type == VTE_MATCHER_PARAM_STRING) {
+                        title = ucs4_to_utf8(value->str, value->str_len);
 		}
 		if (title != NULL) {
 			char *p, *validated;
@@ -535,30 +526,59 @@ VteTerminalPrivate::seq_set_mode_internal(long setting,
  */
 
 /* Typedef the handle type */
-typedef void (*VteTerminalSequenceHandler) (VteTerminalPrivate *that, GValueArray *params);
+typedef void (*VteTerminalSequenceHandler) (VteTerminalPrivate *that, const struct _vte_matcher_params *params);
 
 /* Prototype all handlers... */
 #define VTE_SEQUENCE_HANDLER(name) \
-	static void name (VteTerminalPrivate *that, GValueArray *params);
+	static void name (VteTerminalPrivate *that, const struct _vte_matcher_params *params);
 #include "vteseq-list.h"
 #undef VTE_SEQUENCE_HANDLER
 
 
+/* Copy @params into @copy with a number inserted at @position, for handlers
+ * which forward to another one expecting more parameters. */
+static const struct _vte_matcher_params *
+vte_sequence_params_insert_number(const struct _vte_matcher_params *params,
+                                  guint position,
+                                  long number,
+                                  struct _vte_matcher_params *copy)
+{
+        struct _vte_matcher_param *param;
+
+        if (params != NULL)
+                *copy = *params;
+        else
+                _vte_matcher_params_clear(copy);
+
+        position = MIN(position, copy->n_params);
+        if (copy->n_params == VTE_MATCHER_MAX_PARAMS)
+                copy->n_params--;
+        memmove(&copy->params[position + 1], &copy->params[position],
+                (copy->n_params - position) * sizeof(copy->params[0]));
+        copy->n_params++;
+
+        param = &copy->params[position];
+        param->type = VTE_MATCHER_PARAM_NUMBER;
+        param->number = number;
+        param->n_sub = 0;
+        return copy;
+}
+
 /* Call another function a given number of times, or once. */
 static void
 vte_sequence_handler_multiple_limited(VteTerminalPrivate *that,
-                                      GValueArray *params,
+                                      const struct _vte_matcher_params *params,
                                       VteTerminalSequenceHandler handler,
                                       glong max)
 {
 	long val = 1;
 	int i;
-	GValue *value;
+	const struct _vte_matcher_param *value;
 
-	if ((params != NULL) && (params->n_values > 0)) {
-		value = g_value_array_get_nth(params, 0);
-		if (G_VALUE_HOLDS_LONG(value)) {
-			val = g_value_get_long(value);
+	if ((params != NULL) && (params->n_params > 0)) {
+		value = &params->params[0];
+		if (value->type == VTE_MATCHER_PARAM_NUMBER) {
+			val = value->number;
 			val = CLAMP(val, 1, max);	/* FIXME: vttest. */
 		}
 	}
@@ -568,7 +588,7 @@ vte_sequence_handler_multiple_limited(VteTerminalPrivate *that,
 
 static void
 vte_sequence_handler_multiple_r(VteTerminalPrivate *that,
-                                GValueArray *params,
+                                const struct _vte_matcher_params *params,
                                 VteTerminalSequenceHandler handler)
 {
         vte_sequence_handler_multiple_limited(that, params, handler,
@@ -577,7 +597,7 @@ vte_sequence_handler_multiple_r(VteTerminalPrivate *that,
 
 static void
 vte_reset_mouse_smooth_scroll_delta(VteTerminalPrivate *that,
-                                    GValueArray *params)
+                                    const struct _vte_matcher_params *params)
 {
         that->set_mouse_smooth_scroll_delta(0.);
 }
@@ -590,7 +610,7 @@ VteTerminalPrivate::set_mouse_smooth_scroll_delta(double value)
 
 static void
 vte_set_focus_tracking_mode(VteTerminalPrivate *that,
-                            GValueArray *params)
+                            const struct _vte_matcher_params *params)
 {
         /* We immediately send the terminal a focus event, since otherwise
          * it has no way to know the current status.
@@ -948,7 +968,7 @@ VteTerminalPrivate::seq_decset_internal_post(long setting,
 
 /* Do nothing. */
 static void
-vte_sequence_handler_nop (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_nop (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 }
 
@@ -962,42 +982,42 @@ VteTerminalPrivate::set_character_replacements(unsigned slot,
 
 /* G0 character set is a pass-thru (no mapping). */
 static void
-vte_sequence_handler_designate_g0_plain (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_designate_g0_plain (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->set_character_replacements(0, VTE_CHARACTER_REPLACEMENT_NONE);
 }
 
 /* G0 character set is DEC Special Character and Line Drawing Set. */
 static void
-vte_sequence_handler_designate_g0_line_drawing (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_designate_g0_line_drawing (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->set_character_replacements(0, VTE_CHARACTER_REPLACEMENT_LINE_DRAWING);
 }
 
 /* G0 character set is British (# is converted to £). */
 static void
-vte_sequence_handler_designate_g0_british (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_designate_g0_british (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->set_character_replacements(0, VTE_CHARACTER_REPLACEMENT_BRITISH);
 }
 
 /* G1 character set is a pass-thru (no mapping). */
 static void
-vte_sequence_handler_designate_g1_plain (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_designate_g1_plain (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->set_character_replacements(1, VTE_CHARACTER_REPLACEMENT_NONE);
 }
 
 /* G1 character set is DEC Special Character and Line Drawing Set. */
 static void
-vte_sequence_handler_designate_g1_line_drawing (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_designate_g1_line_drawing (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->set_character_replacements(1, VTE_CHARACTER_REPLACEMENT_LINE_DRAWING);
 }
 
 /* G1 character set is British (# is converted to £). */
 static void
-vte_sequence_handler_designate_g1_british (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_designate_g1_british (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->set_character_replacements(1, VTE_CHARACTER_REPLACEMENT_BRITISH);
 }
@@ -1011,21 +1031,21 @@ VteTerminalPrivate::set_character_replacement(unsigned slot)
 
 /* SI (shift in): switch to G0 character set. */
 static void
-vte_sequence_handler_shift_in (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_shift_in (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->set_character_replacement(0);
 }
 
 /* SO (shift out): switch to G1 character set. */
 static void
-vte_sequence_handler_shift_out (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_shift_out (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->set_character_replacement(1);
 }
 
 /* Beep. */
 static void
-vte_sequence_handler_bell (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_bell (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	that->beep();
         that->emit_bell();
@@ -1033,7 +1053,7 @@ vte_sequence_handler_bell (VteTerminalPrivate *that, GValueArray *params)
 
 /* Backtab. */
 static void
-vte_sequence_handler_cursor_back_tab (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_cursor_back_tab (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->seq_cursor_back_tab();
 }
@@ -1183,16 +1203,16 @@ VteTerminalPrivate::seq_ce()
 
 /* Move the cursor to the given column (horizontal position), 1-based. */
 static void
-vte_sequence_handler_cursor_character_absolute (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_cursor_character_absolute (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
-	GValue *value;
+	const struct _vte_matcher_param *value;
 	long val;
 
         val = 0;
-	if ((params != NULL) && (params->n_values > 0)) {
-		value = g_value_array_get_nth(params, 0);
-		if (G_VALUE_HOLDS_LONG(value)) {
-                        val = g_value_get_long(value) - 1;
+	if ((params != NULL) && (params->n_params > 0)) {
+		value = &params->params[0];
+		if (value->type == VTE_MATCHER_PARAM_NUMBER) {
+                        val = value->number - 1;
 		}
 	}
 
@@ -1279,24 +1299,24 @@ VteTerminalPrivate::set_cursor_coords(vte::grid::row_t row,
 
 /* Move the cursor to the given position, 1-based. */
 static void
-vte_sequence_handler_cursor_position (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_cursor_position (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
-	GValue *row, *col;
+	const struct _vte_matcher_param *row, *col;
 
 	/* We need at least two parameters. */
         vte::grid::row_t rowval = 0;
         vte::grid::column_t colval = 0;
 	rowval = colval = 0;
-	if (params != NULL && params->n_values >= 1) {
+	if (params != NULL && params->n_params >= 1) {
 		/* The first is the row, the second is the column. */
-		row = g_value_array_get_nth(params, 0);
-		if (G_VALUE_HOLDS_LONG(row)) {
-                        rowval = g_value_get_long(row) - 1;
+		row = &params->params[0];
+		if (row->type == VTE_MATCHER_PARAM_NUMBER) {
+                        rowval = row->number - 1;
 		}
-		if (params->n_values >= 2) {
-			col = g_value_array_get_nth(params, 1);
-			if (G_VALUE_HOLDS_LONG(col)) {
-                                colval = g_value_get_long(col) - 1;
+		if (params->n_params >= 2) {
+			col = &params->params[1];
+			if (col->type == VTE_MATCHER_PARAM_NUMBER) {
+                                colval = col->number - 1;
 			}
 		}
 	}
@@ -1306,7 +1326,7 @@ vte_sequence_handler_cursor_position (VteTerminalPrivate *that, GValueArray *par
 
 /* Carriage return. */
 static void
-vte_sequence_handler_carriage_return (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_carriage_return (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->set_cursor_column(0);
 }
@@ -1320,24 +1340,24 @@ VteTerminalPrivate::reset_scrolling_region()
 
 /* Restrict scrolling and updates to a subset of the visible lines. */
 static void
-vte_sequence_handler_set_scrolling_region (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_set_scrolling_region (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	long start=-1, end=-1;
-	GValue *value;
+	const struct _vte_matcher_param *value;
 
 	/* We require two parameters.  Anything less is a reset. */
-	if ((params == NULL) || (params->n_values < 2)) {
+	if ((params == NULL) || (params->n_params < 2)) {
                 that->reset_scrolling_region();
 		return;
 	}
 	/* Extract the two values. */
-	value = g_value_array_get_nth(params, 0);
-	if (G_VALUE_HOLDS_LONG(value)) {
-                start = g_value_get_long(value) - 1;
+	value = &params->params[0];
+	if (value->type == VTE_MATCHER_PARAM_NUMBER) {
+                start = value->number - 1;
 	}
-	value = g_value_array_get_nth(params, 1);
-	if (G_VALUE_HOLDS_LONG(value)) {
-                end = g_value_get_long(value) - 1;
+	value = &params->params[1];
+	if (value->type == VTE_MATCHER_PARAM_NUMBER) {
+                end = value->number - 1;
 	}
 
         that->set_scrolling_region(start, end);
@@ -1381,7 +1401,7 @@ VteTerminalPrivate::set_scrolling_region(vte::grid::row_t start /* relative */,
 
 /* Move the cursor to the beginning of the Nth next line, no scrolling. */
 static void
-vte_sequence_handler_cursor_next_line (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_cursor_next_line (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->set_cursor_column(0);
         vte_sequence_handler_cursor_down (that, params);
@@ -1389,7 +1409,7 @@ vte_sequence_handler_cursor_next_line (VteTerminalPrivate *that, GValueArray *pa
 
 /* Move the cursor to the beginning of the Nth previous line, no scrolling. */
 static void
-vte_sequence_handler_cursor_preceding_line (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_cursor_preceding_line (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->set_cursor_column(0);
         vte_sequence_handler_cursor_up (that, params);
@@ -1397,13 +1417,13 @@ vte_sequence_handler_cursor_preceding_line (VteTerminalPrivate *that, GValueArra
 
 /* Move the cursor to the given row (vertical position), 1-based. */
 static void
-vte_sequence_handler_line_position_absolute (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_line_position_absolute (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         long val = 0;
-	if ((params != NULL) && (params->n_values > 0)) {
-		GValue* value = g_value_array_get_nth(params, 0);
-		if (G_VALUE_HOLDS_LONG(value)) {
-                        val = g_value_get_long(value) - 1;
+	if ((params != NULL) && (params->n_params > 0)) {
+		const struct _vte_matcher_param *value = &params->params[0];
+		if (value->type == VTE_MATCHER_PARAM_NUMBER) {
+                        val = value->number - 1;
 		}
 	}
 
@@ -1414,7 +1434,7 @@ vte_sequence_handler_line_position_absolute (VteTerminalPrivate *that, GValueArr
 
 /* Delete a character at the current cursor position. */
 static void
-_vte_sequence_handler_dc (VteTerminalPrivate *that, GValueArray *params)
+_vte_sequence_handler_dc (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->seq_dc();
 }
@@ -1456,20 +1476,20 @@ VteTerminalPrivate::seq_dc()
 
 /* Delete N characters at the current cursor position. */
 static void
-vte_sequence_handler_delete_characters (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_delete_characters (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         vte_sequence_handler_multiple_r(that, params, _vte_sequence_handler_dc);
 }
 
 /* Cursor down N lines, no scrolling. */
 static void
-vte_sequence_handler_cursor_down (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_cursor_down (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         long val = 1;
-        if (params != NULL && params->n_values >= 1) {
-                GValue* value = g_value_array_get_nth(params, 0);
-                if (G_VALUE_HOLDS_LONG(value)) {
-                        val = g_value_get_long(value);
+        if (params != NULL && params->n_params >= 1) {
+                const struct _vte_matcher_param *value = &params->params[0];
+                if (value->type == VTE_MATCHER_PARAM_NUMBER) {
+                        val = value->number;
                 }
         }
 
@@ -1498,14 +1518,14 @@ VteTerminalPrivate::seq_cursor_down(vte::grid::row_t rows)
 /* Erase characters starting at the cursor position (overwriting N with
  * spaces, but not moving the cursor). */
 static void
-vte_sequence_handler_erase_characters (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_erase_characters (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	/* If we got a parameter, use it. */
 	long count = 1;
-	if ((params != NULL) && (params->n_values > 0)) {
-                GValue* value = g_value_array_get_nth(params, 0);
-		if (G_VALUE_HOLDS_LONG(value)) {
-			count = g_value_get_long(value);
+	if ((params != NULL) && (params->n_params > 0)) {
+                const struct _vte_matcher_param *value = &params->params[0];
+		if (value->type == VTE_MATCHER_PARAM_NUMBER) {
+			count = value->number;
 		}
 	}
 
@@ -1555,14 +1575,14 @@ VteTerminalPrivate::seq_erase_characters(long count)
 
 /* Form-feed / next-page. */
 static void
-vte_sequence_handler_form_feed (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_form_feed (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         vte_sequence_handler_line_feed (that, params);
 }
 
 /* Insert a blank character. */
 static void
-_vte_sequence_handler_insert_character (VteTerminalPrivate *that, GValueArray *params)
+_vte_sequence_handler_insert_character (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->seq_insert_blank_character();
 }
@@ -1580,14 +1600,14 @@ VteTerminalPrivate::seq_insert_blank_character()
 /* Insert N blank characters. */
 /* TODOegmont: Insert them in a single run, so that we call cleanup_fragments only once. */
 static void
-vte_sequence_handler_insert_blank_characters (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_insert_blank_characters (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         vte_sequence_handler_multiple_r(that, params, _vte_sequence_handler_insert_character);
 }
 
 /* Repeat the last graphic character once. */
 static void
-vte_sequence_handler_repeat_internal (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_repeat_internal (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         if (that->m_last_graphic_character != 0)
                 that->insert_char (that->m_last_graphic_character, false, true);
@@ -1595,7 +1615,7 @@ vte_sequence_handler_repeat_internal (VteTerminalPrivate *that, GValueArray *par
 
 /* REP: Repeat the last graphic character n times. */
 static void
-vte_sequence_handler_repeat (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_repeat (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         vte_sequence_handler_multiple_limited (that,
                                                params,
@@ -1605,14 +1625,14 @@ vte_sequence_handler_repeat (VteTerminalPrivate *that, GValueArray *params)
 
 /* Cursor down 1 line, with scrolling. */
 static void
-vte_sequence_handler_index (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_index (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         vte_sequence_handler_line_feed (that, params);
 }
 
 /* Cursor left. */
 static void
-vte_sequence_handler_backspace (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_backspace (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->seq_backspace();
 }
@@ -1630,16 +1650,16 @@ VteTerminalPrivate::seq_backspace()
 
 /* Cursor left N columns. */
 static void
-vte_sequence_handler_cursor_backward (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_cursor_backward (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
-        GValue *value;
+        const struct _vte_matcher_param *value;
         long val;
 
         val = 1;
-        if (params != NULL && params->n_values >= 1) {
-                value = g_value_array_get_nth(params, 0);
-                if (G_VALUE_HOLDS_LONG(value)) {
-                        val = g_value_get_long(value);
+        if (params != NULL && params->n_params >= 1) {
+                value = &params->params[0];
+                if (value->type == VTE_MATCHER_PARAM_NUMBER) {
+                        val = value->number;
                 }
         }
 
@@ -1658,13 +1678,13 @@ VteTerminalPrivate::seq_cursor_backward(vte::grid::column_t columns)
 
 /* Cursor right N columns. */
 static void
-vte_sequence_handler_cursor_forward (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_cursor_forward (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         long val = 1;
-        if (params != NULL && params->n_values >= 1) {
-                GValue* value = g_value_array_get_nth(params, 0);
-                if (G_VALUE_HOLDS_LONG(value)) {
-                        val = g_value_get_long(value);
+        if (params != NULL && params->n_params >= 1) {
+                const struct _vte_matcher_param *value = &params->params[0];
+                if (value->type == VTE_MATCHER_PARAM_NUMBER) {
+                        val = value->number;
                 }
         }
 
@@ -1688,7 +1708,7 @@ VteTerminalPrivate::seq_cursor_forward(vte::grid::column_t columns)
 
 /* Move the cursor to the beginning of the next line, scrolling if necessary. */
 static void
-vte_sequence_handler_next_line (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_next_line (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->set_cursor_column(0);
         that->cursor_down(true);
@@ -1696,23 +1716,23 @@ vte_sequence_handler_next_line (VteTerminalPrivate *that, GValueArray *params)
 
 /* No-op. */
 static void
-vte_sequence_handler_linux_console_cursor_attributes (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_linux_console_cursor_attributes (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 }
 
 /* Scroll the text down N lines, but don't move the cursor. */
 static void
-vte_sequence_handler_scroll_down (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_scroll_down (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	long val = 1;
-	GValue *value;
+	const struct _vte_matcher_param *value;
 
         /* No ensure_cursor_is_onscreen() here as per xterm */
 
-	if ((params != NULL) && (params->n_values > 0)) {
-		value = g_value_array_get_nth(params, 0);
-		if (G_VALUE_HOLDS_LONG(value)) {
-			val = g_value_get_long(value);
+	if ((params != NULL) && (params->n_params > 0)) {
+		value = &params->params[0];
+		if (value->type == VTE_MATCHER_PARAM_NUMBER) {
+			val = value->number;
 			val = MAX(val, 1);
 		}
 	}
@@ -1722,17 +1742,15 @@ vte_sequence_handler_scroll_down (VteTerminalPrivate *that, GValueArray *params)
 
 /* Internal helper for changing color in the palette */
 static void
-vte_sequence_handler_change_color_internal (VteTerminalPrivate *that, GValueArray *params,
+vte_sequence_handler_change_color_internal (VteTerminalPrivate *that, const struct _vte_matcher_params *params,
 					    const char *terminator)
 {
-	if (params != NULL && params->n_values > 0) {
-                GValue* value = g_value_array_get_nth (params, 0);
+	if (params != NULL && params->n_params > 0) {
+                const struct _vte_matcher_param *value = &params->params[0];
 
                 char *str = NULL;
-		if (G_VALUE_HOLDS_STRING (value))
-			str = g_value_dup_string (value);
-		else if (G_VALUE_HOLDS_POINTER (value))
-			str = that->ucs4_to_utf8((const guchar *)g_value_get_pointer (value));
+		if (value->type == VTE_MATCHER_PARAM_STRING)
+			str = that->ucs4_to_utf8(value->str, value->str_len);
 
 		if (! str)
 			return;
@@ -1783,33 +1801,33 @@ VteTerminalPrivate::seq_change_color_internal(char const* str,
 
 /* Change color in the palette, BEL terminated */
 static void
-vte_sequence_handler_change_color_bel (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_change_color_bel (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	vte_sequence_handler_change_color_internal (that, params, BEL);
 }
 
 /* Change color in the palette, ST terminated */
 static void
-vte_sequence_handler_change_color_st (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_change_color_st (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	vte_sequence_handler_change_color_internal (that, params, ST);
 }
 
 /* Reset color in the palette */
 static void
-vte_sequence_handler_reset_color (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_reset_color (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
-	GValue *value;
+	const struct _vte_matcher_param *value;
         guint i;
 	long idx;
 
-	if (params != NULL && params->n_values > 0) {
-		for (i = 0; i < params->n_values; i++) {
-			value = g_value_array_get_nth (params, i);
+	if (params != NULL && params->n_params > 0) {
+		for (i = 0; i < params->n_params; i++) {
+			value = &params->params[i];
 
-			if (!G_VALUE_HOLDS_LONG (value))
+			if (value->type != VTE_MATCHER_PARAM_NUMBER)
 				continue;
-			idx = g_value_get_long (value);
+			idx = value->number;
 			if (idx < 0 || idx >= VTE_DEFAULT_FG)
 				continue;
 
@@ -1824,17 +1842,17 @@ vte_sequence_handler_reset_color (VteTerminalPrivate *that, GValueArray *params)
 
 /* Scroll the text up N lines, but don't move the cursor. */
 static void
-vte_sequence_handler_scroll_up (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_scroll_up (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	long val = 1;
-	GValue *value;
+	const struct _vte_matcher_param *value;
 
         /* No ensure_cursor_is_onscreen() here as per xterm */
 
-	if ((params != NULL) && (params->n_values > 0)) {
-		value = g_value_array_get_nth(params, 0);
-		if (G_VALUE_HOLDS_LONG(value)) {
-			val = g_value_get_long(value);
+	if ((params != NULL) && (params->n_params > 0)) {
+		value = &params->params[0];
+		if (value->type == VTE_MATCHER_PARAM_NUMBER) {
+			val = value->number;
 			val = MAX(val, 1);
 		}
 	}
@@ -1844,7 +1862,7 @@ vte_sequence_handler_scroll_up (VteTerminalPrivate *that, GValueArray *params)
 
 /* Cursor down 1 line, with scrolling. */
 static void
-vte_sequence_handler_line_feed (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_line_feed (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->ensure_cursor_is_onscreen();
 
@@ -1853,7 +1871,7 @@ vte_sequence_handler_line_feed (VteTerminalPrivate *that, GValueArray *params)
 
 /* Cursor up 1 line, with scrolling. */
 static void
-vte_sequence_handler_reverse_index (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_reverse_index (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->seq_reverse_index();
 }
@@ -1893,7 +1911,7 @@ VteTerminalPrivate::seq_reverse_index()
 
 /* Set tab stop in the current column. */
 static void
-vte_sequence_handler_tab_set (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_tab_set (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->seq_tab_set();
 }
@@ -1909,7 +1927,7 @@ VteTerminalPrivate::seq_tab_set()
 
 /* Tab. */
 static void
-vte_sequence_handler_tab (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_tab (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->seq_tab();
 }
@@ -1987,22 +2005,22 @@ VteTerminalPrivate::seq_tab()
 }
 
 static void
-vte_sequence_handler_cursor_forward_tabulation (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_cursor_forward_tabulation (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         vte_sequence_handler_multiple_r(that, params, vte_sequence_handler_tab);
 }
 
 /* Clear tabs selectively. */
 static void
-vte_sequence_handler_tab_clear (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_tab_clear (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
-	GValue *value;
+	const struct _vte_matcher_param *value;
 	long param = 0;
 
-	if ((params != NULL) && (params->n_values > 0)) {
-		value = g_value_array_get_nth(params, 0);
-		if (G_VALUE_HOLDS_LONG(value)) {
-			param = g_value_get_long(value);
+	if ((params != NULL) && (params->n_params > 0)) {
+		value = &params->params[0];
+		if (value->type == VTE_MATCHER_PARAM_NUMBER) {
+			param = value->number;
 		}
 	}
 
@@ -2024,13 +2042,13 @@ VteTerminalPrivate::seq_tab_clear(long param)
 
 /* Cursor up N lines, no scrolling. */
 static void
-vte_sequence_handler_cursor_up (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_cursor_up (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         long val = 1;
-        if (params != NULL && params->n_values >= 1) {
-                GValue* value = g_value_array_get_nth(params, 0);
-                if (G_VALUE_HOLDS_LONG(value)) {
-                        val = g_value_get_long(value);
+        if (params != NULL && params->n_params >= 1) {
+                const struct _vte_matcher_param *value = &params->params[0];
+                if (value->type == VTE_MATCHER_PARAM_NUMBER) {
+                        val = value->number;
                 }
         }
 
@@ -2058,47 +2076,35 @@ VteTerminalPrivate::seq_cursor_up(vte::grid::row_t rows)
 
 /* Vertical tab. */
 static void
-vte_sequence_handler_vertical_tab (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_vertical_tab (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         vte_sequence_handler_line_feed (that, params);
 }
 
-/* Parse parameters of SGR 38 or 48, starting at @index within @params.
+/* Parse parameters of SGR 38 or 48, starting at @index within @values.
  * Returns the color index, or -1 on error.
  * Increments @index to point to the last consumed parameter (not beyond). */
 static gint32
-vte_sequence_parse_sgr_38_48_parameters (GValueArray *params, unsigned int *index)
+vte_sequence_parse_sgr_38_48_parameters (long const* values, unsigned int n_values, unsigned int *index)
 {
-	if (*index < params->n_values) {
-		GValue *value0, *value1, *value2, *value3;
+	if (*index < n_values) {
 		long param0, param1, param2, param3;
-		value0 = g_value_array_get_nth(params, *index);
-		if (G_UNLIKELY (!G_VALUE_HOLDS_LONG(value0)))
-			return -1;
-		param0 = g_value_get_long(value0);
+		param0 = values[*index];
 		switch (param0) {
 		case 2:
-			if (G_UNLIKELY (*index + 3 >= params->n_values))
+			if (G_UNLIKELY (*index + 3 >= n_values))
 				return -1;
-			value1 = g_value_array_get_nth(params, *index + 1);
-			value2 = g_value_array_get_nth(params, *index + 2);
-			value3 = g_value_array_get_nth(params, *index + 3);
-			if (G_UNLIKELY (!(G_VALUE_HOLDS_LONG(value1) && G_VALUE_HOLDS_LONG(value2) && G_VALUE_HOLDS_LONG(value3))))
-				return -1;
-			param1 = g_value_get_long(value1);
-			param2 = g_value_get_long(value2);
-			param3 = g_value_get_long(value3);
+			param1 = values[*index + 1];
+			param2 = values[*index + 2];
+			param3 = values[*index + 3];
 			if (G_UNLIKELY (param1 < 0 || param1 >= 256 || param2 < 0 || param2 >= 256 || param3 < 0 || param3 >= 256))
 				return -1;
 			*index += 3;
 			return VTE_RGB_COLOR | (param1 << 16) | (param2 << 8) | param3;
 		case 5:
-			if (G_UNLIKELY (*index + 1 >= params->n_values))
-				return -1;
-			value1 = g_value_array_get_nth(params, *index + 1);
-			if (G_UNLIKELY (!G_VALUE_HOLDS_LONG(value1)))
+			if (G_UNLIKELY (*index + 1 >= n_values))
 				return -1;
-			param1 = g_value_get_long(value1);
+			param1 = values[*index + 1];
 			if (G_UNLIKELY (param1 < 0 || param1 >= 256))
 				return -1;
 			*index += 1;
@@ -2109,37 +2115,35 @@ vte_sequence_parse_sgr_38_48_parameters (GValueArray *params, unsigned int *inde
 }
 
 /* Handle ANSI color setting and related stuffs (SGR).
- * @params contains the values split at semicolons, with sub arrays splitting at colons
- * wherever colons were encountered. */
+ * @params contains the values split at semicolons, with subparameter groups splitting
+ * at colons wherever colons were encountered. */
 static void
-vte_sequence_handler_character_attributes (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_character_attributes (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	unsigned int i;
-	GValue *value;
+	const struct _vte_matcher_param *value;
 	long param;
 	/* The default parameter is zero. */
 	param = 0;
 	/* Step through each numeric parameter. */
-	for (i = 0; (params != NULL) && (i < params->n_values); i++) {
-		value = g_value_array_get_nth(params, i);
-		/* If this parameter is a GValueArray, it can be a fully colon separated 38 or 48
-		 * (see below for details). */
-		if (G_UNLIKELY (G_VALUE_HOLDS_BOXED(value))) {
-			GValueArray *subvalues = (GValueArray *)g_value_get_boxed(value);
-			GValue *value0;
+	for (i = 0; (params != NULL) && (i < params->n_params); i++) {
+		value = &params->params[i];
+		/* If this parameter is a subparameter group, it can be a fully colon separated
+		 * 38 or 48 (see below for details). */
+		if (G_UNLIKELY (value->type == VTE_MATCHER_PARAM_SUBPARAMS)) {
+			long const* subvalues = &params->subparams[value->sub_start];
 			long param0;
 			gint32 color;
 			unsigned int index = 1;
 
-			value0 = g_value_array_get_nth(subvalues, 0);
-			if (G_UNLIKELY (!G_VALUE_HOLDS_LONG(value0)))
+			if (G_UNLIKELY (value->n_sub == 0))
 				continue;
-			param0 = g_value_get_long(value0);
+			param0 = subvalues[0];
 			if (G_UNLIKELY (param0 != 38 && param0 != 48))
 				continue;
-			color = vte_sequence_parse_sgr_38_48_parameters(subvalues, &index);
+			color = vte_sequence_parse_sgr_38_48_parameters(subvalues, value->n_sub, &index);
 			/* Bail out on additional colon-separated values. */
-			if (G_UNLIKELY (index != subvalues->n_values - 1))
+			if (G_UNLIKELY (index != value->n_sub - 1))
 				continue;
 			if (G_LIKELY (color != -1)) {
 				if (param0 == 38) {
@@ -2150,11 +2154,11 @@ vte_sequence_handler_character_attributes (VteTerminalPrivate *that, GValueArray
 			}
 			continue;
 		}
-		/* If this parameter is not a GValueArray and not a number either, skip it. */
-		if (!G_VALUE_HOLDS_LONG(value)) {
+		/* If this parameter is not a group and not a number either, skip it. */
+		if (value->type != VTE_MATCHER_PARAM_NUMBER) {
 			continue;
 		}
-		param = g_value_get_long(value);
+		param = value->number;
 		switch (param) {
 		case 0:
                         that->reset_default_attributes(false);
@@ -2231,19 +2235,28 @@ vte_sequence_handler_character_attributes (VteTerminalPrivate *that, GValueArray
 			 * See bug 685759 for details.
 			 * The fully colon versions were handled above separately. The code is reached
 			 * if the first separator is a semicolon. */
-			if ((i + 1) < params->n_values) {
+			if ((i + 1) < params->n_params) {
 				gint32 color;
-				GValue *value1 = g_value_array_get_nth(params, ++i);
-				if (G_VALUE_HOLDS_LONG(value1)) {
+				const struct _vte_matcher_param *value1 = &params->params[++i];
+				if (value1->type == VTE_MATCHER_PARAM_NUMBER) {
 					/* Only semicolons as separators. */
-					color = vte_sequence_parse_sgr_38_48_parameters(params, &i);
-				} else if (G_VALUE_HOLDS_BOXED(value1)) {
+					long values[4];
+					unsigned int n_values, index = 0;
+					for (n_values = 0;
+					     n_values < G_N_ELEMENTS(values) &&
+					     i + n_values < params->n_params &&
+					     params->params[i + n_values].type == VTE_MATCHER_PARAM_NUMBER;
+					     n_values++)
+						values[n_values] = params->params[i + n_values].number;
+					color = vte_sequence_parse_sgr_38_48_parameters(values, n_values, &index);
+					i += index;
+				} else if (value1->type == VTE_MATCHER_PARAM_SUBPARAMS) {
 					/* The first separator was a semicolon, the rest are colons. */
-					GValueArray *subvalues = (GValueArray *)g_value_get_boxed(value1);
+					long const* subvalues = &params->subparams[value1->sub_start];
 					unsigned int index = 0;
-					color = vte_sequence_parse_sgr_38_48_parameters(subvalues, &index);
+					color = vte_sequence_parse_sgr_38_48_parameters(subvalues, value1->n_sub, &index);
 					/* Bail out on additional colon-separated values. */
-					if (G_UNLIKELY (index != subvalues->n_values - 1))
+					if (G_UNLIKELY (index != value1->n_sub - 1))
 						break;
 				} else {
 					break;
@@ -2312,35 +2325,31 @@ vte_sequence_handler_character_attributes (VteTerminalPrivate *that, GValueArray
 
 /* Move the cursor to the given column in the top row, 1-based. */
 static void
-vte_sequence_handler_cursor_position_top_row (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_cursor_position_top_row (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
-        GValue value = {0};
-
-        g_value_init (&value, G_TYPE_LONG);
-        g_value_set_long (&value, 1);
+        struct _vte_matcher_params copy;
 
-        g_value_array_insert (params, 0, &value);
-
-        vte_sequence_handler_cursor_position(that, params);
+        vte_sequence_handler_cursor_position(that,
+                                             vte_sequence_params_insert_number(params, 0, 1, &copy));
 }
 
 /* Request terminal attributes. */
 static void
-vte_sequence_handler_request_terminal_parameters (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_request_terminal_parameters (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	that->feed_child("\e[?x", -1);
 }
 
 /* Request terminal attributes. */
 static void
-vte_sequence_handler_return_terminal_status (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_return_terminal_status (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	that->feed_child("", 0);
 }
 
 /* Send primary device attributes. */
 static void
-vte_sequence_handler_send_primary_device_attributes (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_send_primary_device_attributes (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	/* Claim to be a VT220 with only national character set support. */
         that->feed_child("\e[?62;c", -1);
@@ -2348,14 +2357,14 @@ vte_sequence_handler_send_primary_device_attributes (VteTerminalPrivate *that, G
 
 /* Send terminal ID. */
 static void
-vte_sequence_handler_return_terminal_id (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_return_terminal_id (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	vte_sequence_handler_send_primary_device_attributes (that, params);
 }
 
 /* Send secondary device attributes. */
 static void
-vte_sequence_handler_send_secondary_device_attributes (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_send_secondary_device_attributes (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->seq_send_secondary_device_attributes();
 }
@@ -2382,39 +2391,36 @@ VteTerminalPrivate::seq_send_secondary_device_attributes()
 
 /* Set one or the other. */
 static void
-vte_sequence_handler_set_icon_title (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_set_icon_title (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	that->seq_set_title_internal(params, true, false);
 }
 
 static void
-vte_sequence_handler_set_window_title (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_set_window_title (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	that->seq_set_title_internal(params, false, true);
 }
 
 /* Set both the window and icon titles to the same string. */
 static void
-vte_sequence_handler_set_icon_and_window_title (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_set_icon_and_window_title (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	that->seq_set_title_internal(params, true, true);
 }
 
 static void
-vte_sequence_handler_set_current_directory_uri (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_set_current_directory_uri (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
-        GValue *value;
+        const struct _vte_matcher_param *value;
         char *uri, *filename;
 
         uri = NULL;
-        if (params != NULL && params->n_values > 0) {
-                value = g_value_array_get_nth(params, 0);
-
-                if (G_VALUE_HOLDS_POINTER(value)) {
-                        uri = that->ucs4_to_utf8((const guchar *)g_value_get_pointer (value));
-                } else if (G_VALUE_HOLDS_STRING(value)) {
-                        /* Copy the string into the buffer. */
-                        uri = g_value_dup_string(value);
+        if (params != NULL && params->n_params > 0) {
+                value = &params->params[0];
+
+                if (value->type == VTE_MATCHER_PARAM_STRING) {
+                        uri = that->ucs4_to_utf8(value->str, value->str_len);
                 }
         }
 
@@ -2441,20 +2447,17 @@ VteTerminalPrivate::set_current_directory_uri_changed(char* uri /* adopted */)
 }
 
 static void
-vte_sequence_handler_set_current_file_uri (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_set_current_file_uri (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
-        GValue *value;
+        const struct _vte_matcher_param *value;
         char *uri, *filename;
 
         uri = NULL;
-        if (params != NULL && params->n_values > 0) {
-                value = g_value_array_get_nth(params, 0);
-
-                if (G_VALUE_HOLDS_POINTER(value)) {
-                        uri = that->ucs4_to_utf8((const guchar *)g_value_get_pointer (value));
-                } else if (G_VALUE_HOLDS_STRING(value)) {
-                        /* Copy the string into the buffer. */
-                        uri = g_value_dup_string(value);
+        if (params != NULL && params->n_params > 0) {
+                value = &params->params[0];
+
+                if (value->type == VTE_MATCHER_PARAM_STRING) {
+                        uri = that->ucs4_to_utf8(value->str, value->str_len);
                 }
         }
 
@@ -2483,31 +2486,25 @@ VteTerminalPrivate::set_current_file_uri_changed(char* uri /* adopted */)
 /* Handle OSC 8 hyperlinks.
  * See bug 779734 and https://gist.github.com/egmontkob/eb114294efbcd5adb1944c9f3cb5feda. */
 static void
-vte_sequence_handler_set_current_hyperlink (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_set_current_hyperlink (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
-        GValue *value;
+        const struct _vte_matcher_param *value;
         char *hyperlink_params;
         char *uri;
 
         hyperlink_params = NULL;
         uri = NULL;
-        if (params != NULL && params->n_values > 1) {
-                value = g_value_array_get_nth(params, 0);
-
-                if (G_VALUE_HOLDS_POINTER(value)) {
-                        hyperlink_params = that->ucs4_to_utf8((const guchar *)g_value_get_pointer (value));
-                } else if (G_VALUE_HOLDS_STRING(value)) {
-                        /* Copy the string into the buffer. */
-                        hyperlink_params = g_value_dup_string(value);
+        if (params != NULL && params->n_params > 1) {
+                value = &params->params[0];
+
+                if (value->type == VTE_MATCHER_PARAM_STRING) {
+                        hyperlink_params = that->ucs4_to_utf8(value->str, value->str_len);
                 }
 
-                value = g_value_array_get_nth(params, 1);
+                value = &params->params[1];
 
-                if (G_VALUE_HOLDS_POINTER(value)) {
-                        uri = that->ucs4_to_utf8((const guchar *)g_value_get_pointer (value));
-                } else if (G_VALUE_HOLDS_STRING(value)) {
-                        /* Copy the string into the buffer. */
-                        uri = g_value_dup_string(value);
+                if (value->type == VTE_MATCHER_PARAM_STRING) {
+                        uri = that->ucs4_to_utf8(value->str, value->str_len);
                 }
         }
 
@@ -2584,29 +2581,23 @@ VteTerminalPrivate::set_current_hyperlink(char *hyperlink_params /* adopted */,
 
 /* Restrict the scrolling region. */
 static void
-vte_sequence_handler_set_scrolling_region_from_start (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_set_scrolling_region_from_start (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
-	GValue value = {0};
-
-	g_value_init (&value, G_TYPE_LONG);
-        g_value_set_long (&value, 0);  /* A missing value is treated as 0 */
-
-	g_value_array_insert (params, 0, &value);
+	struct _vte_matcher_params copy;
 
-        vte_sequence_handler_set_scrolling_region (that, params);
+        /* A missing value is treated as 0 */
+        vte_sequence_handler_set_scrolling_region (that,
+                                                   vte_sequence_params_insert_number(params, 0, 0, &copy));
 }
 
 static void
-vte_sequence_handler_set_scrolling_region_to_end (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_set_scrolling_region_to_end (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
-	GValue value = {0};
+	struct _vte_matcher_params copy;
 
-	g_value_init (&value, G_TYPE_LONG);
-        g_value_set_long (&value, 0);  /* A missing value is treated as 0 */
-
-	g_value_array_insert (params, 1, &value);
-
-        vte_sequence_handler_set_scrolling_region (that, params);
+        /* A missing value is treated as 0 */
+        vte_sequence_handler_set_scrolling_region (that,
+                                                   vte_sequence_params_insert_number(params, 1, 0, &copy));
 }
 
 void
@@ -2617,7 +2608,7 @@ VteTerminalPrivate::set_keypad_mode(VteKeymode mode)
 
 /* Set the application or normal keypad. */
 static void
-vte_sequence_handler_application_keypad (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_application_keypad (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	_vte_debug_print(VTE_DEBUG_KEYBOARD,
 			"Entering application keypad mode.\n");
@@ -2625,7 +2616,7 @@ vte_sequence_handler_application_keypad (VteTerminalPrivate *that, GValueArray *
 }
 
 static void
-vte_sequence_handler_normal_keypad (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_normal_keypad (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	_vte_debug_print(VTE_DEBUG_KEYBOARD,
 			"Leaving application keypad mode.\n");
@@ -2634,104 +2625,104 @@ vte_sequence_handler_normal_keypad (VteTerminalPrivate *that, GValueArray *param
 
 /* Same as cursor_character_absolute, not widely supported. */
 static void
-vte_sequence_handler_character_position_absolute (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_character_position_absolute (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	vte_sequence_handler_cursor_character_absolute (that, params);
 }
 
 /* Set certain terminal attributes. */
 static void
-vte_sequence_handler_set_mode (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_set_mode (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	guint i;
 	long setting;
-	GValue *value;
-	if ((params == NULL) || (params->n_values == 0)) {
+	const struct _vte_matcher_param *value;
+	if ((params == NULL) || (params->n_params == 0)) {
 		return;
 	}
-	for (i = 0; i < params->n_values; i++) {
-		value = g_value_array_get_nth(params, i);
-		if (!G_VALUE_HOLDS_LONG(value)) {
+	for (i = 0; i < params->n_params; i++) {
+		value = &params->params[i];
+		if (value->type != VTE_MATCHER_PARAM_NUMBER) {
 			continue;
 		}
-		setting = g_value_get_long(value);
+		setting = value->number;
 		that->seq_set_mode_internal(setting, true);
 	}
 }
 
 /* Unset certain terminal attributes. */
 static void
-vte_sequence_handler_reset_mode (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_reset_mode (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	guint i;
 	long setting;
-	GValue *value;
-	if ((params == NULL) || (params->n_values == 0)) {
+	const struct _vte_matcher_param *value;
+	if ((params == NULL) || (params->n_params == 0)) {
 		return;
 	}
-	for (i = 0; i < params->n_values; i++) {
-		value = g_value_array_get_nth(params, i);
-		if (!G_VALUE_HOLDS_LONG(value)) {
+	for (i = 0; i < params->n_params; i++) {
+		value = &params->params[i];
+		if (value->type != VTE_MATCHER_PARAM_NUMBER) {
 			continue;
 		}
-		setting = g_value_get_long(value);
+		setting = value->number;
 		that->seq_set_mode_internal(setting, false);
 	}
 }
 
 /* Set certain terminal attributes. */
 static void
-vte_sequence_handler_decset (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_decset (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
-	GValue *value;
+	const struct _vte_matcher_param *value;
 	long setting;
 	guint i;
-	if ((params == NULL) || (params->n_values == 0)) {
+	if ((params == NULL) || (params->n_params == 0)) {
 		return;
 	}
-	for (i = 0; i < params->n_values; i++) {
-		value = g_value_array_get_nth(params, i);
-		if (!G_VALUE_HOLDS_LONG(value)) {
+	for (i = 0; i < params->n_params; i++) {
+		value = &params->params[i];
+		if (value->type != VTE_MATCHER_PARAM_NUMBER) {
 			continue;
 		}
-		setting = g_value_get_long(value);
+		setting = value->number;
 		vte_sequence_handler_decset_internal(that, setting, FALSE, FALSE, TRUE);
 	}
 }
 
 /* Unset certain terminal attributes. */
 static void
-vte_sequence_handler_decreset (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_decreset (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
-	GValue *value;
+	const struct _vte_matcher_param *value;
 	long setting;
 	guint i;
-	if ((params == NULL) || (params->n_values == 0)) {
+	if ((params == NULL) || (params->n_params == 0)) {
 		return;
 	}
-	for (i = 0; i < params->n_values; i++) {
-		value = g_value_array_get_nth(params, i);
-		if (!G_VALUE_HOLDS_LONG(value)) {
+	for (i = 0; i < params->n_params; i++) {
+		value = &params->params[i];
+		if (value->type != VTE_MATCHER_PARAM_NUMBER) {
 			continue;
 		}
-		setting = g_value_get_long(value);
+		setting = value->number;
 		vte_sequence_handler_decset_internal(that, setting, FALSE, FALSE, FALSE);
 	}
 }
 
 /* Erase certain lines in the display. */
 static void
-vte_sequence_handler_erase_in_display (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_erase_in_display (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	/* The default parameter is 0. */
 	long param = 0;
         /* Pull out the first parameter. */
-	for (guint i = 0; (params != NULL) && (i < params->n_values); i++) {
-                GValue* value = g_value_array_get_nth(params, i);
-		if (!G_VALUE_HOLDS_LONG(value)) {
+	for (guint i = 0; (params != NULL) && (i < params->n_params); i++) {
+                const struct _vte_matcher_param *value = &params->params[i];
+		if (value->type != VTE_MATCHER_PARAM_NUMBER) {
 			continue;
 		}
-		param = g_value_get_long(value);
+		param = value->number;
                 break;
 	}
 
@@ -2771,17 +2762,17 @@ VteTerminalPrivate::seq_erase_in_display(long param)
 
 /* Erase certain parts of the current line in the display. */
 static void
-vte_sequence_handler_erase_in_line (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_erase_in_line (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	/* The default parameter is 0. */
 	long param = 0;
         /* Pull out the first parameter. */
-	for (guint i = 0; (params != NULL) && (i < params->n_values); i++) {
-                GValue* value = g_value_array_get_nth(params, i);
-		if (!G_VALUE_HOLDS_LONG(value)) {
+	for (guint i = 0; (params != NULL) && (i < params->n_params); i++) {
+                const struct _vte_matcher_param *value = &params->params[i];
+		if (value->type != VTE_MATCHER_PARAM_NUMBER) {
 			continue;
 		}
-		param = g_value_get_long(value);
+		param = value->number;
                 break;
 	}
 
@@ -2814,22 +2805,22 @@ VteTerminalPrivate::seq_erase_in_line(long param)
 
 /* Perform a full-bore reset. */
 static void
-vte_sequence_handler_full_reset (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_full_reset (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	that->reset(true, true);
 }
 
 /* Insert a certain number of lines below the current cursor. */
 static void
-vte_sequence_handler_insert_lines (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_insert_lines (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	/* The default is one. */
 	long param = 1;
 	/* Extract any parameters. */
-	if ((params != NULL) && (params->n_values > 0)) {
-		GValue* value = g_value_array_get_nth(params, 0);
-		if (G_VALUE_HOLDS_LONG(value)) {
-			param = g_value_get_long(value);
+	if ((params != NULL) && (params->n_params > 0)) {
+		const struct _vte_matcher_param *value = &params->params[0];
+		if (value->type == VTE_MATCHER_PARAM_NUMBER) {
+			param = value->number;
 		}
 	}
 
@@ -2872,15 +2863,15 @@ VteTerminalPrivate::seq_insert_lines(vte::grid::row_t param)
 
 /* Delete certain lines from the scrolling region. */
 static void
-vte_sequence_handler_delete_lines (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_delete_lines (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	/* The default is one. */
 	long param = 1;
 	/* Extract any parameters. */
-	if ((params != NULL) && (params->n_values > 0)) {
-		GValue* value = g_value_array_get_nth(params, 0);
-		if (G_VALUE_HOLDS_LONG(value)) {
-			param = g_value_get_long(value);
+	if ((params != NULL) && (params->n_params > 0)) {
+		const struct _vte_matcher_param *value = &params->params[0];
+		if (value->type == VTE_MATCHER_PARAM_NUMBER) {
+			param = value->number;
 		}
 	}
 
@@ -2925,12 +2916,12 @@ VteTerminalPrivate::seq_delete_lines(vte::grid::row_t param)
 /* Device status reports. The possible reports are the cursor position and
  * whether or not we're okay. */
 static void
-vte_sequence_handler_device_status_report (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_device_status_report (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
-	if ((params != NULL) && (params->n_values > 0)) {
-		GValue* value = g_value_array_get_nth(params, 0);
-		if (G_VALUE_HOLDS_LONG(value)) {
-			auto param = g_value_get_long(value);
+	if ((params != NULL) && (params->n_params > 0)) {
+		const struct _vte_matcher_param *value = &params->params[0];
+		if (value->type == VTE_MATCHER_PARAM_NUMBER) {
+			auto param = value->number;
                         that->seq_device_status_report(param);
                 }
         }
@@ -2972,12 +2963,12 @@ VteTerminalPrivate::seq_device_status_report(long param)
 
 /* DEC-style device status reports. */
 static void
-vte_sequence_handler_dec_device_status_report (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_dec_device_status_report (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
-	if ((params != NULL) && (params->n_values > 0)) {
-		GValue* value = g_value_array_get_nth(params, 0);
-		if (G_VALUE_HOLDS_LONG(value)) {
-			auto param = g_value_get_long(value);
+	if ((params != NULL) && (params->n_params > 0)) {
+		const struct _vte_matcher_param *value = &params->params[0];
+		if (value->type == VTE_MATCHER_PARAM_NUMBER) {
+			auto param = value->number;
                         that->seq_dec_device_status_report(param);
                 }
         }
@@ -3030,40 +3021,40 @@ VteTerminalPrivate::seq_dec_device_status_report(long param)
 
 /* Restore a certain terminal attribute. */
 static void
-vte_sequence_handler_restore_mode (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_restore_mode (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
-	GValue *value;
+	const struct _vte_matcher_param *value;
 	long setting;
 	guint i;
-	if ((params == NULL) || (params->n_values == 0)) {
+	if ((params == NULL) || (params->n_params == 0)) {
 		return;
 	}
-	for (i = 0; i < params->n_values; i++) {
-		value = g_value_array_get_nth(params, i);
-		if (!G_VALUE_HOLDS_LONG(value)) {
+	for (i = 0; i < params->n_params; i++) {
+		value = &params->params[i];
+		if (value->type != VTE_MATCHER_PARAM_NUMBER) {
 			continue;
 		}
-		setting = g_value_get_long(value);
+		setting = value->number;
 		vte_sequence_handler_decset_internal(that, setting, TRUE, FALSE, FALSE);
 	}
 }
 
 /* Save a certain terminal attribute. */
 static void
-vte_sequence_handler_save_mode (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_save_mode (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
-	GValue *value;
+	const struct _vte_matcher_param *value;
 	long setting;
 	guint i;
-	if ((params == NULL) || (params->n_values == 0)) {
+	if ((params == NULL) || (params->n_params == 0)) {
 		return;
 	}
-	for (i = 0; i < params->n_values; i++) {
-		value = g_value_array_get_nth(params, i);
-		if (!G_VALUE_HOLDS_LONG(value)) {
+	for (i = 0; i < params->n_params; i++) {
+		value = &params->params[i];
+		if (value->type != VTE_MATCHER_PARAM_NUMBER) {
 			continue;
 		}
-		setting = g_value_get_long(value);
+		setting = value->number;
 		vte_sequence_handler_decset_internal(that, setting, FALSE, TRUE, FALSE);
 	}
 }
@@ -3071,7 +3062,7 @@ vte_sequence_handler_save_mode (VteTerminalPrivate *that, GValueArray *params)
 /* Perform a screen alignment test -- fill all visible cells with the
  * letter "E". */
 static void
-vte_sequence_handler_screen_alignment_test (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_screen_alignment_test (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         that->seq_screen_alignment_test();
 }
@@ -3108,24 +3099,24 @@ VteTerminalPrivate::seq_screen_alignment_test()
 
 /* DECSCUSR set cursor style */
 static void
-vte_sequence_handler_set_cursor_style (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_set_cursor_style (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         long style;
 
-        if ((params == NULL) || (params->n_values > 1)) {
+        if ((params == NULL) || (params->n_params > 1)) {
                 return;
         }
 
-        if (params->n_values == 0) {
+        if (params->n_params == 0) {
                 /* no parameters means default (according to vt100.net) */
                 style = VTE_CURSOR_STYLE_TERMINAL_DEFAULT;
         } else {
-                GValue *value = g_value_array_get_nth(params, 0);
+                const struct _vte_matcher_param *value = &params->params[0];
 
-                if (!G_VALUE_HOLDS_LONG(value)) {
+                if (value->type != VTE_MATCHER_PARAM_NUMBER) {
                         return;
                 }
-                style = g_value_get_long(value);
+                style = value->number;
                 if (style < 0 || style > 6) {
                         return;
                 }
@@ -3136,7 +3127,7 @@ vte_sequence_handler_set_cursor_style (VteTerminalPrivate *that, GValueArray *pa
 
 /* Perform a soft reset. */
 static void
-vte_sequence_handler_soft_reset (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_soft_reset (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	that->reset(false, false);
 }
@@ -3146,29 +3137,29 @@ vte_sequence_handler_soft_reset (VteTerminalPrivate *that, GValueArray *params)
  * is free to ignore, so they're harmless.  Handle at most one action,
  * see bug 741402. */
 static void
-vte_sequence_handler_window_manipulation (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_window_manipulation (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
-        if (params == NULL || params->n_values == 0) {
+        if (params == NULL || params->n_params == 0) {
                 return;
         }
-        GValue* value = g_value_array_get_nth(params, 0);
-        if (!G_VALUE_HOLDS_LONG(value)) {
+        const struct _vte_matcher_param *value = &params->params[0];
+        if (value->type != VTE_MATCHER_PARAM_NUMBER) {
                 return;
         }
-        auto param = g_value_get_long(value);
+        auto param = value->number;
 
         long arg1, arg2;
         arg1 = arg2 = -1;
-        if (params->n_values > 1) {
-                value = g_value_array_get_nth(params, 1);
-                if (G_VALUE_HOLDS_LONG(value)) {
-                        arg1 = g_value_get_long(value);
+        if (params->n_params > 1) {
+                value = &params->params[1];
+                if (value->type == VTE_MATCHER_PARAM_NUMBER) {
+                        arg1 = value->number;
                 }
         }
-        if (params->n_values > 2) {
-                value = g_value_array_get_nth(params, 2);
-                if (G_VALUE_HOLDS_LONG(value)) {
-                        arg2 = g_value_get_long(value);
+        if (params->n_params > 2) {
+                value = &params->params[2];
+                if (value->type == VTE_MATCHER_PARAM_NUMBER) {
+                        arg2 = value->number;
                 }
         }
 
@@ -3357,18 +3348,16 @@ VteTerminalPrivate::seq_window_manipulation(long param,
 
 /* Internal helper for setting/querying special colors */
 static void
-vte_sequence_handler_change_special_color_internal (VteTerminalPrivate *that, GValueArray *params,
+vte_sequence_handler_change_special_color_internal (VteTerminalPrivate *that, const struct _vte_matcher_params *params,
 						    int index, int index_fallback, int osc,
 						    const char *terminator)
 {
-	if (params != NULL && params->n_values > 0) {
-		GValue* value = g_value_array_get_nth (params, 0);
+	if (params != NULL && params->n_params > 0) {
+		const struct _vte_matcher_param *value = &params->params[0];
 
                 char *name = nullptr;
-		if (G_VALUE_HOLDS_STRING (value))
-			name = g_value_dup_string (value);
-		else if (G_VALUE_HOLDS_POINTER (value))
-			name = that->ucs4_to_utf8((const guchar *)g_value_get_pointer (value));
+		if (value->type == VTE_MATCHER_PARAM_STRING)
+			name = that->ucs4_to_utf8(value->str, value->str_len);
 
 		if (! name)
 			return;
@@ -3404,7 +3393,7 @@ VteTerminalPrivate::seq_change_special_color_internal(char const* name,
 
 /* Change the default foreground cursor, BEL terminated */
 static void
-vte_sequence_handler_change_foreground_color_bel (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_change_foreground_color_bel (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	vte_sequence_handler_change_special_color_internal (that, params,
 							    VTE_DEFAULT_FG, -1, 10, BEL);
@@ -3412,7 +3401,7 @@ vte_sequence_handler_change_foreground_color_bel (VteTerminalPrivate *that, GVal
 
 /* Change the default foreground cursor, ST terminated */
 static void
-vte_sequence_handler_change_foreground_color_st (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_change_foreground_color_st (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	vte_sequence_handler_change_special_color_internal (that, params,
 							    VTE_DEFAULT_FG, -1, 10, ST);
@@ -3420,14 +3409,14 @@ vte_sequence_handler_change_foreground_color_st (VteTerminalPrivate *that, GValu
 
 /* Reset the default foreground color */
 static void
-vte_sequence_handler_reset_foreground_color (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_reset_foreground_color (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	that->reset_color(VTE_DEFAULT_FG, VTE_COLOR_SOURCE_ESCAPE);
 }
 
 /* Change the default background cursor, BEL terminated */
 static void
-vte_sequence_handler_change_background_color_bel (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_change_background_color_bel (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	vte_sequence_handler_change_special_color_internal (that, params,
 							    VTE_DEFAULT_BG, -1, 11, BEL);
@@ -3435,7 +3424,7 @@ vte_sequence_handler_change_background_color_bel (VteTerminalPrivate *that, GVal
 
 /* Change the default background cursor, ST terminated */
 static void
-vte_sequence_handler_change_background_color_st (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_change_background_color_st (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	vte_sequence_handler_change_special_color_internal (that, params,
 							    VTE_DEFAULT_BG, -1, 11, ST);
@@ -3443,14 +3432,14 @@ vte_sequence_handler_change_background_color_st (VteTerminalPrivate *that, GValu
 
 /* Reset the default background color */
 static void
-vte_sequence_handler_reset_background_color (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_reset_background_color (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	that->reset_color(VTE_DEFAULT_BG, VTE_COLOR_SOURCE_ESCAPE);
 }
 
 /* Change the color of the cursor background, BEL terminated */
 static void
-vte_sequence_handler_change_cursor_background_color_bel (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_change_cursor_background_color_bel (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	vte_sequence_handler_change_special_color_internal (that, params,
 							    VTE_CURSOR_BG, VTE_DEFAULT_FG, 12, BEL);
@@ -3458,7 +3447,7 @@ vte_sequence_handler_change_cursor_background_color_bel (VteTerminalPrivate *tha
 
 /* Change the color of the cursor background, ST terminated */
 static void
-vte_sequence_handler_change_cursor_background_color_st (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_change_cursor_background_color_st (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	vte_sequence_handler_change_special_color_internal (that, params,
 							    VTE_CURSOR_BG, VTE_DEFAULT_FG, 12, ST);
@@ -3466,14 +3455,14 @@ vte_sequence_handler_change_cursor_background_color_st (VteTerminalPrivate *that
 
 /* Reset the color of the cursor */
 static void
-vte_sequence_handler_reset_cursor_background_color (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_reset_cursor_background_color (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	that->reset_color(VTE_CURSOR_BG, VTE_COLOR_SOURCE_ESCAPE);
 }
 
 /* Change the highlight background color, BEL terminated */
 static void
-vte_sequence_handler_change_highlight_background_color_bel (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_change_highlight_background_color_bel (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	vte_sequence_handler_change_special_color_internal (that, params,
 							    VTE_HIGHLIGHT_BG, VTE_DEFAULT_FG, 17, BEL);
@@ -3481,7 +3470,7 @@ vte_sequence_handler_change_highlight_background_color_bel (VteTerminalPrivate *
 
 /* Change the highlight background color, ST terminated */
 static void
-vte_sequence_handler_change_highlight_background_color_st (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_change_highlight_background_color_st (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	vte_sequence_handler_change_special_color_internal (that, params,
 							    VTE_HIGHLIGHT_BG, VTE_DEFAULT_FG, 17, ST);
@@ -3489,14 +3478,14 @@ vte_sequence_handler_change_highlight_background_color_st (VteTerminalPrivate *t
 
 /* Reset the highlight background color */
 static void
-vte_sequence_handler_reset_highlight_background_color (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_reset_highlight_background_color (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	that->reset_color(VTE_HIGHLIGHT_BG, VTE_COLOR_SOURCE_ESCAPE);
 }
 
 /* Change the highlight foreground color, BEL terminated */
 static void
-vte_sequence_handler_change_highlight_foreground_color_bel (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_change_highlight_foreground_color_bel (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	vte_sequence_handler_change_special_color_internal (that, params,
 							    VTE_HIGHLIGHT_FG, VTE_DEFAULT_BG, 19, BEL);
@@ -3504,7 +3493,7 @@ vte_sequence_handler_change_highlight_foreground_color_bel (VteTerminalPrivate *
 
 /* Change the highlight foreground color, ST terminated */
 static void
-vte_sequence_handler_change_highlight_foreground_color_st (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_change_highlight_foreground_color_st (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	vte_sequence_handler_change_special_color_internal (that, params,
 							    VTE_HIGHLIGHT_FG, VTE_DEFAULT_BG, 19, ST);
@@ -3512,7 +3501,7 @@ vte_sequence_handler_change_highlight_foreground_color_st (VteTerminalPrivate *t
 
 /* Reset the highlight foreground color */
 static void
-vte_sequence_handler_reset_highlight_foreground_color (VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_reset_highlight_foreground_color (VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
 	that->reset_color(VTE_HIGHLIGHT_FG, VTE_COLOR_SOURCE_ESCAPE);
 }
@@ -3520,7 +3509,7 @@ vte_sequence_handler_reset_highlight_foreground_color (VteTerminalPrivate *that,
 /* URXVT generic OSC 777 */
 
 static void
-vte_sequence_handler_urxvt_777(VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_urxvt_777(VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         /* Accept but ignore this for compatibility with downstream-patched vte (bug #711059)*/
 }
@@ -3528,7 +3517,7 @@ vte_sequence_handler_urxvt_777(VteTerminalPrivate *that, GValueArray *params)
 /* iterm2 OSC 133 & 1337 */
 
 static void
-vte_sequence_handler_iterm2_133(VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_iterm2_133(VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         /* Accept but ignore this for compatibility when sshing to an osx host
          * where the iterm2 integration is loaded even when not actually using
@@ -3537,7 +3526,7 @@ vte_sequence_handler_iterm2_133(VteTerminalPrivate *that, GValueArray *params)
 }
 
 static void
-vte_sequence_handler_iterm2_1337(VteTerminalPrivate *that, GValueArray *params)
+vte_sequence_handler_iterm2_1337(VteTerminalPrivate *that, const struct _vte_matcher_params *params)
 {
         /* Accept but ignore this for compatibility when sshing to an osx host
          * where the iterm2 integration is loaded even when not actually using
@@ -3564,19 +3553,42 @@ _vte_sequence_get_handler (const char *name)
 	}
 }
 
+/* Handlers indexed by matcher opcode.  The matcher hands out the same
+ * opcodes every time it's created, so this is only built once. */
+static VteTerminalSequenceHandler *_vte_sequence_handlers = NULL;
+static guint _vte_sequence_n_handlers = 0;
+
+static void
+_vte_sequence_init_handlers(struct _vte_matcher *matcher)
+{
+	guint opcode, n_opcodes;
+
+	n_opcodes = _vte_matcher_get_n_opcodes(matcher);
+	_vte_sequence_handlers = g_new0(VteTerminalSequenceHandler, n_opcodes);
+	for (opcode = VTE_MATCHER_OPCODE_NONE + 1; opcode < n_opcodes; opcode++) {
+		_vte_sequence_handlers[opcode] =
+			_vte_sequence_get_handler(_vte_matcher_get_opcode_name(matcher, opcode));
+	}
+	_vte_sequence_n_handlers = n_opcodes;
+}
 
 /* Handle a terminal control sequence and its parameters. */
 void
-VteTerminalPrivate::handle_sequence(char const* str,
-                                    GValueArray *params)
+VteTerminalPrivate::handle_sequence(guint opcode,
+                                    const struct _vte_matcher_params *params)
 {
 	VteTerminalSequenceHandler handler;
 
+	if (G_UNLIKELY(_vte_sequence_handlers == NULL))
+		_vte_sequence_init_handlers(m_matcher);
+
 	_VTE_DEBUG_IF(VTE_DEBUG_PARSE)
-		display_control_sequence(str, params);
+		display_control_sequence(_vte_matcher_get_opcode_name(m_matcher, opcode),
+					 params);
 
 	/* Find the handler for this control sequence. */
-	handler = _vte_sequence_get_handler (str);
+	handler = G_LIKELY(opcode < _vte_sequence_n_handlers) ?
+		_vte_sequence_handlers[opcode] : NULL;
 
 	if (handler != NULL) {
 		/* Let the handler handle it. */
@@ -3584,6 +3596,6 @@ VteTerminalPrivate::handle_sequence(char const* str,
 	} else {
 		_vte_debug_print (VTE_DEBUG_MISC,
 				  "No handler for control sequence `%s' defined.\n",
-				  str);
+				  _vte_matcher_get_opcode_name(m_matcher, opcode));
 	}
 }
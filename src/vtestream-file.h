@@ -58,6 +58,10 @@
  *   counter is incremented each time the data at a certain logical offset is
  *   overwritten, this is used in constructing a unique IV.
  *
+ *   The compression codec (zlib, and optionally LZ4 or zstd) is chosen when
+ *   the stream is constructed, and recorded in each block so that decoding
+ *   doesn't depend on the current choice.
+ *
  *   The name was chosen because the world of encryption is full of three
  *   letter abbreviations. At this moment we use GNU TLS's method for doing
  *   AES GCM. Also, because grown-ups might think it's a hat, when actually
@@ -84,6 +88,13 @@
 #include <unistd.h>
 #include <zlib.h>
 
+#ifdef WITH_LZ4
+# include <lz4.h>
+#endif
+#ifdef WITH_ZSTD
+# include <zstd.h>
+#endif
+
 #ifdef WITH_GNUTLS
 # include <gnutls/gnutls.h>
 # include <gnutls/crypto.h>
@@ -108,11 +119,13 @@ G_BEGIN_DECLS
 # define VTE_SNAKE_BLOCKSIZE 65536
 typedef guint32 _vte_block_datalength_t;
 typedef guint32 _vte_overwrite_counter_t;
+# define VTE_BLOCK_CODEC_SHIFT   24
 #else
 /* Smaller sizes for unit testing */
 # define VTE_SNAKE_BLOCKSIZE    10
 typedef guint8 _vte_block_datalength_t;
 typedef guint8 _vte_overwrite_counter_t;
+# define VTE_BLOCK_CODEC_SHIFT   4
 # undef VTE_CIPHER_TAG_SIZE
 # define VTE_CIPHER_TAG_SIZE     1
 #endif
@@ -125,6 +138,10 @@ typedef guint8 _vte_overwrite_counter_t;
 #define ALIGN_BOA(x) ((x) / VTE_BOA_BLOCKSIZE * VTE_BOA_BLOCKSIZE)
 #define MOD_BOA(x)   ((x) % VTE_BOA_BLOCKSIZE)
 
+/* The data length field's top bits hold the codec the block was compressed with. */
+#define VTE_BLOCK_DATALENGTH_MASK ((1U << VTE_BLOCK_CODEC_SHIFT) - 1)
+#define VTE_BLOCK_CODEC(x)        ((x) >> VTE_BLOCK_CODEC_SHIFT)
+
 /******************************************************************************************/
 
 #ifndef HAVE_EXPLICIT_BZERO
@@ -622,7 +639,8 @@ _vte_snake_class_init (VteSnakeClass *klass)
  *                       boa block 65512(7)
  *
  * Structure of the block that we give to the snake:
- * - 0..4 (0..1): The length of the compressed and encrypted Data, that is D-8 (D-2) [VTE_BLOCK_DATALENGTH_SIZE bytes]
+ * - 0..4 (0..1): The length of the compressed and encrypted Data, that is D-8 (D-2), in the low 24 (4) bits,
+ *                and the codec in the high 8 (4) bits [VTE_BLOCK_DATALENGTH_SIZE bytes]
  * - 4..8 (1..2): Overwrite counter [VTE_OVERWRITE_COUNTER_SIZE bytes]
  * - 8..D (2..D): The compressed and encrypted Data [<= VTE_BOA_BLOCKSIZE bytes]
  * - D..T: Encryption verification Tag [VTE_CIPHER_TAG_SIZE bytes]
@@ -642,6 +660,27 @@ _vte_snake_class_init (VteSnakeClass *klass)
         } VteIv;
 #endif
 
+/* State that the compression codecs keep between blocks. Zero-initialized. */
+typedef struct _VteCodecContext {
+#if !defined VTESTREAM_MAIN && defined WITH_ZSTD
+        /* Reused, they're expensive to set up for each block */
+        ZSTD_CCtx *zstd_cctx;
+        ZSTD_DCtx *zstd_dctx;
+#endif
+} VteCodecContext;
+
+static void
+_vte_codec_context_clear (VteCodecContext *ctx)
+{
+#if !defined VTESTREAM_MAIN && defined WITH_ZSTD
+        /* Both accept NULL */
+        ZSTD_freeCCtx (ctx->zstd_cctx);
+        ZSTD_freeDCtx (ctx->zstd_dctx);
+        ctx->zstd_cctx = NULL;
+        ctx->zstd_dctx = NULL;
+#endif
+}
+
 typedef struct _VteBoa {
         VteSnake parent;
         gsize tail, head;
@@ -650,6 +689,8 @@ typedef struct _VteBoa {
         gnutls_cipher_hd_t cipher_hd;
         VteIv iv;
 #endif
+        VteCodecContext codec_ctx;
+        VteStreamCodec codec;
         int compressBound;
 } VteBoa;
 
@@ -734,8 +775,10 @@ _vte_boa_decrypt (VteBoa *boa, gsize offset, guint32 overwrite_counter, char *da
         return !faulty;
 }
 
+/* zlib: the default codec, and the only one that is always available. */
+
 static int
-_vte_boa_compressBound (unsigned int len)
+_vte_boa_zlib_compressBound (unsigned int len)
 {
 #ifndef VTESTREAM_MAIN
         return compressBound(len);
@@ -746,7 +789,7 @@ _vte_boa_compressBound (unsigned int len)
 
 /* Compress; returns the compressed size which might be bigger than the original. */
 static unsigned int
-_vte_boa_compress (char *dst, unsigned int dstlen, const char *src, unsigned int srclen)
+_vte_boa_zlib_compress (VteCodecContext *ctx, char *dst, unsigned int dstlen, const char *src, unsigned int srclen)
 {
 #ifndef VTESTREAM_MAIN
         uLongf dstlen_ulongf = dstlen;
@@ -784,7 +827,7 @@ _vte_boa_compress (char *dst, unsigned int dstlen, const char *src, unsigned int
 
 /* Uncompress; returns the uncompressed size. */
 static unsigned int
-_vte_boa_uncompress (char *dst, unsigned int dstlen, const char *src, unsigned int srclen)
+_vte_boa_zlib_uncompress (VteCodecContext *ctx, char *dst, unsigned int dstlen, const char *src, unsigned int srclen)
 {
 #ifndef VTESTREAM_MAIN
         uLongf dstlen_ulongf = dstlen;
@@ -810,6 +853,172 @@ _vte_boa_uncompress (char *dst, unsigned int dstlen, const char *src, unsigned i
 #endif
 }
 
+/* LZ4: a lot faster than zlib at both ends, for a somewhat worse ratio. */
+
+#if defined VTESTREAM_MAIN || defined WITH_LZ4
+
+static int
+_vte_boa_lz4_compressBound (unsigned int len)
+{
+#ifndef VTESTREAM_MAIN
+        return LZ4_compressBound(len);
+#else
+        return 2 * len;
+#endif
+}
+
+static unsigned int
+_vte_boa_lz4_compress (VteCodecContext *ctx, char *dst, unsigned int dstlen, const char *src, unsigned int srclen)
+{
+#ifndef VTESTREAM_MAIN
+        int ret;
+
+        ret = LZ4_compress_default (src, dst, srclen, dstlen);
+        g_assert_cmpint (ret, >, 0);
+        return ret;
+#else
+        /* Fake compression for unit testing, so that it differs from the fake zlib:
+         * the repetition count follows the char, and is omitted if it's the same as the previous.
+         * E.g. abcdef <-> a1bcdef
+         *      beeeeee <-> b1e6
+         */
+        unsigned int len = 0, prevrepeat = 0;
+        while (srclen) {
+                unsigned int repeat = 1;
+                while (repeat < srclen && src[repeat] == src[0]) repeat++;
+                *dst++ = src[0];
+                len++;
+                if (repeat != prevrepeat) {
+                        *dst++ = '0' + repeat;
+                        prevrepeat = repeat;
+                        len++;
+                }
+                src += repeat, srclen -= repeat;
+        }
+        return len;
+#endif
+}
+
+static unsigned int
+_vte_boa_lz4_uncompress (VteCodecContext *ctx, char *dst, unsigned int dstlen, const char *src, unsigned int srclen)
+{
+#ifndef VTESTREAM_MAIN
+        int ret;
+
+        ret = LZ4_decompress_safe (src, dst, srclen, dstlen);
+        g_assert_cmpint (ret, >=, 0);
+        return ret;
+#else
+        /* Fake decompression for unit testing; see above. */
+        unsigned int len = 0, repeat = 1;
+        while (srclen) {
+                unsigned char c = *src++;
+                srclen--;
+                if (srclen && *src >= '0' && *src <= '9') {
+                        repeat = *src - '0';
+                        src++; srclen--;
+                }
+                memset (dst, c, repeat);
+                dst += repeat, len += repeat;
+        }
+        return len;
+#endif
+}
+
+#endif /* VTESTREAM_MAIN || WITH_LZ4 */
+
+/* zstd: about zlib's speed for a noticeably better ratio. */
+
+#if !defined VTESTREAM_MAIN && defined WITH_ZSTD
+
+#define VTE_ZSTD_LEVEL 1
+
+static int
+_vte_boa_zstd_compressBound (unsigned int len)
+{
+        return ZSTD_compressBound(len);
+}
+
+static unsigned int
+_vte_boa_zstd_compress (VteCodecContext *ctx, char *dst, unsigned int dstlen, const char *src, unsigned int srclen)
+{
+        size_t ret;
+
+        if (ctx->zstd_cctx == NULL)
+                ctx->zstd_cctx = ZSTD_createCCtx();
+        ret = ZSTD_compressCCtx (ctx->zstd_cctx, dst, dstlen, src, srclen, VTE_ZSTD_LEVEL);
+        g_assert (!ZSTD_isError(ret));
+        return ret;
+}
+
+static unsigned int
+_vte_boa_zstd_uncompress (VteCodecContext *ctx, char *dst, unsigned int dstlen, const char *src, unsigned int srclen)
+{
+        size_t ret;
+
+        if (ctx->zstd_dctx == NULL)
+                ctx->zstd_dctx = ZSTD_createDCtx();
+        ret = ZSTD_decompressDCtx (ctx->zstd_dctx, dst, dstlen, src, srclen);
+        g_assert (!ZSTD_isError(ret));
+        return ret;
+}
+
+#endif /* !VTESTREAM_MAIN && WITH_ZSTD */
+
+typedef struct _VteBoaCodec {
+        const char *name;
+        int (*compressBound) (unsigned int len);
+        unsigned int (*compress) (VteCodecContext *ctx, char *dst, unsigned int dstlen, const char *src, unsigned int srclen);
+        unsigned int (*uncompress) (VteCodecContext *ctx, char *dst, unsigned int dstlen, const char *src, unsigned int srclen);
+} VteBoaCodec;
+
+/* Indexed by VteStreamCodec, which is the tag stored in the blocks, so never reorder.
+ * Codecs that aren't compiled in have NULL methods. */
+static const VteBoaCodec _vte_boa_codecs[VTE_STREAM_N_CODECS] = {
+        { "zlib", _vte_boa_zlib_compressBound, _vte_boa_zlib_compress, _vte_boa_zlib_uncompress },
+#if defined VTESTREAM_MAIN || defined WITH_LZ4
+        { "lz4", _vte_boa_lz4_compressBound, _vte_boa_lz4_compress, _vte_boa_lz4_uncompress },
+#else
+        { "lz4", NULL, NULL, NULL },
+#endif
+#if !defined VTESTREAM_MAIN && defined WITH_ZSTD
+        { "zstd", _vte_boa_zstd_compressBound, _vte_boa_zstd_compress, _vte_boa_zstd_uncompress },
+#else
+        { "zstd", NULL, NULL, NULL },
+#endif
+};
+
+static gboolean
+_vte_boa_codec_available (VteStreamCodec codec)
+{
+        return (guint) codec < VTE_STREAM_N_CODECS && _vte_boa_codecs[codec].compress != NULL;
+}
+
+/* Select the codec for subsequent writes. Falls back to zlib if the codec isn't compiled in. */
+static void
+_vte_boa_set_codec (VteBoa *boa, VteStreamCodec codec)
+{
+        if (G_UNLIKELY (!_vte_boa_codec_available (codec)))
+                codec = VTE_STREAM_CODEC_ZLIB;
+
+        boa->codec = codec;
+        boa->compressBound = _vte_boa_codecs[codec].compressBound(VTE_BOA_BLOCKSIZE);
+}
+
+/* Compress with the boa's codec; returns the compressed size which might be bigger than the original. */
+static unsigned int
+_vte_boa_compress (VteBoa *boa, char *dst, unsigned int dstlen, const char *src, unsigned int srclen)
+{
+        return _vte_boa_codecs[boa->codec].compress (&boa->codec_ctx, dst, dstlen, src, srclen);
+}
+
+/* Uncompress with the given codec; returns the uncompressed size. */
+static unsigned int
+_vte_boa_uncompress (VteBoa *boa, VteStreamCodec codec, char *dst, unsigned int dstlen, const char *src, unsigned int srclen)
+{
+        return _vte_boa_codecs[codec].uncompress (&boa->codec_ctx, dst, dstlen, src, srclen);
+}
+
 /*----------------------------------------------------------------------------------------*/
 
 static void
@@ -840,21 +1049,23 @@ _vte_boa_init (VteBoa *boa)
         explicit_bzero(&boa->iv, sizeof(boa->iv));
 #endif
 
-        boa->compressBound = _vte_boa_compressBound(VTE_BOA_BLOCKSIZE);
+        _vte_boa_set_codec (boa, VTE_STREAM_CODEC_ZLIB);
 }
 
 static void
 _vte_boa_finalize (GObject *object)
 {
-#if !defined VTESTREAM_MAIN && defined WITH_GNUTLS
         VteBoa *boa = (VteBoa *) object;
 
+#if !defined VTESTREAM_MAIN && defined WITH_GNUTLS
         explicit_bzero(&boa->iv, sizeof(boa->iv));
 
         gnutls_cipher_deinit (boa->cipher_hd);
         gnutls_global_deinit ();
 #endif
 
+        _vte_codec_context_clear (&boa->codec_ctx);
+
         G_OBJECT_CLASS (_vte_boa_parent_class)->finalize(object);
 }
 
@@ -885,6 +1096,7 @@ static gboolean
 _vte_boa_read_with_overwrite_counter (VteBoa *boa, gsize offset, char *data, _vte_overwrite_counter_t *overwrite_counter)
 {
         _vte_block_datalength_t compressed_len;
+        VteStreamCodec codec;
         char *buf = g_newa(char, VTE_SNAKE_BLOCKSIZE);
 
         g_assert_cmpuint (offset % VTE_BOA_BLOCKSIZE, ==, 0);
@@ -893,12 +1105,16 @@ _vte_boa_read_with_overwrite_counter (VteBoa *boa, gsize offset, char *data, _vt
         if (G_UNLIKELY (!_vte_snake_read (&boa->parent, OFFSET_BOA_TO_SNAKE(offset), buf)))
                 return FALSE;
 
-        compressed_len = *((_vte_block_datalength_t *) buf);
+        compressed_len = *((_vte_block_datalength_t *) buf) & VTE_BLOCK_DATALENGTH_MASK;
+        codec = (VteStreamCodec) VTE_BLOCK_CODEC(*((_vte_block_datalength_t *) buf));
         *overwrite_counter = *((_vte_overwrite_counter_t *) (buf + VTE_BLOCK_DATALENGTH_SIZE));
 
         /* We could have read an empty block due to a previous disk full. Treat that as an error too. Perform other sanity checks. */
         if (G_UNLIKELY (compressed_len <= 0 || compressed_len > VTE_BOA_BLOCKSIZE || *overwrite_counter <= 0))
                 return FALSE;
+        /* Same for a block compressed with a codec we don't have. */
+        if (G_UNLIKELY (compressed_len < VTE_BOA_BLOCKSIZE && !_vte_boa_codec_available (codec)))
+                return FALSE;
 
         /* Decrypt, bail out on tag mismatch */
         if (G_UNLIKELY (!_vte_boa_decrypt (boa, offset, *overwrite_counter, buf + VTE_BLOCK_DATALENGTH_SIZE + VTE_OVERWRITE_COUNTER_SIZE, compressed_len)))
@@ -910,7 +1126,7 @@ _vte_boa_read_with_overwrite_counter (VteBoa *boa, gsize offset, char *data, _vt
                         memcpy (data, buf + VTE_BLOCK_DATALENGTH_SIZE + VTE_OVERWRITE_COUNTER_SIZE, VTE_BOA_BLOCKSIZE);
                 } else {
                         unsigned int uncompressed_len;
-                        uncompressed_len = _vte_boa_uncompress(data, VTE_BOA_BLOCKSIZE, buf + VTE_BLOCK_DATALENGTH_SIZE + VTE_OVERWRITE_COUNTER_SIZE, compressed_len);
+                        uncompressed_len = _vte_boa_uncompress(boa, codec, data, VTE_BOA_BLOCKSIZE, buf + VTE_BLOCK_DATALENGTH_SIZE + VTE_OVERWRITE_COUNTER_SIZE, compressed_len);
                         g_assert_cmpuint (uncompressed_len, ==, VTE_BOA_BLOCKSIZE);
                 }
         }
@@ -967,14 +1183,14 @@ _vte_boa_write (VteBoa *boa, gsize offset, const char *data)
         _vte_block_datalength_t compressed_len;
 
         /* Compress, or copy if uncompressable */
-        compressed_len = _vte_boa_compress (buf + VTE_BLOCK_DATALENGTH_SIZE + VTE_OVERWRITE_COUNTER_SIZE, boa->compressBound,
+        compressed_len = _vte_boa_compress (boa, buf + VTE_BLOCK_DATALENGTH_SIZE + VTE_OVERWRITE_COUNTER_SIZE, boa->compressBound,
                                             data, VTE_BOA_BLOCKSIZE);
         if (G_UNLIKELY (compressed_len >= VTE_BOA_BLOCKSIZE)) {
                 memcpy (buf + VTE_BLOCK_DATALENGTH_SIZE + VTE_OVERWRITE_COUNTER_SIZE, data, VTE_BOA_BLOCKSIZE);
                 compressed_len = VTE_BOA_BLOCKSIZE;
         }
 
-        *((_vte_block_datalength_t *) buf) = (_vte_block_datalength_t) compressed_len;
+        *((_vte_block_datalength_t *) buf) = (_vte_block_datalength_t) (compressed_len | (boa->codec << VTE_BLOCK_CODEC_SHIFT));
         *((_vte_overwrite_counter_t *) (buf + VTE_BLOCK_DATALENGTH_SIZE)) = (_vte_overwrite_counter_t) overwrite_counter;
 
         /* Encrypt */
@@ -1031,22 +1247,53 @@ _vte_boa_class_init (VteBoaClass *klass)
 
 /*
  * VteFileStream: Implement buffering/caching on top of VteBoa.
+ *
+ * Reading keeps the last few uncompressed (and decrypted) blocks around, so
+ * that going back and forth between neighboring blocks, e.g. when reading
+ * the rows around a block boundary, doesn't decode the same blocks again.
+ *
+ * Writing is done behind the caller's back: a completed block is put on the
+ * stream's write queue, and a writer thread shared by all the streams
+ * compresses, encrypts and writes it out, so that this doesn't happen in the
+ * middle of processing the terminal's input. Blocks are read back from the
+ * queue until they're written. The queue is bounded, appending waits for the
+ * writer if it gets full. Whoever touches the boa holds boa_lock, operations
+ * that change the boa's head (reset and truncate) wait for the queue to drain.
  */
 
+#define VTE_FILE_STREAM_CACHE_BLOCKS 4
+#define VTE_FILE_STREAM_WRITE_QUEUE  4
+
+typedef struct _VteFileStreamBlock {
+        /* Offset of the cached record, always a multiple of block size.
+         * Use a value of 1 (or anything that's not a multiple of block size)
+         * to denote if no record is cached. */
+        gsize offset;
+        char *data;             /* allocated on first use */
+} VteFileStreamBlock;
+
 typedef struct _VteFileStream {
         GObject parent;
 
         VteBoa *boa;
 
-        char *rbuf;
-        /* Offset of the cached record, always a multiple of block size.
-         * Use a value of 1 (or anything that's not a multiple of block size)
-         * to denote if no record is cached. */
-        gsize rbuf_offset;
+        /* Most recently used first */
+        VteFileStreamBlock *rcache;
+        guint rcache_size;
+        gulong rcache_hits, rcache_misses;
 
         char *wbuf;
         gsize wbuf_len;
 
+        /* Write-behind */
+        gboolean write_behind;
+        GMutex boa_lock;
+        GMutex lock;            /* protects the following ones */
+        GCond cond;
+        GQueue wqueue;          /* VteFileStreamBlock, oldest first, still in there while being written */
+        gboolean writing;       /* the stream is pushed to the writer */
+        char *wspare;           /* a written block's buffer, for the next wbuf */
+
         gsize head, tail;
 } VteFileStream;
 
@@ -1057,20 +1304,182 @@ static GType _vte_file_stream_get_type (void);
 
 G_DEFINE_TYPE (VteFileStream, _vte_file_stream, VTE_TYPE_STREAM)
 
+static GThreadPool *_vte_file_stream_writer_pool;
+
+/* Prefer the faster codecs if we have them */
+static VteStreamCodec
+_vte_stream_default_codec (void)
+{
+#if !defined VTESTREAM_MAIN && defined WITH_LZ4
+        return VTE_STREAM_CODEC_LZ4;
+#elif !defined VTESTREAM_MAIN && defined WITH_ZSTD
+        return VTE_STREAM_CODEC_ZSTD;
+#else
+        return VTE_STREAM_CODEC_ZLIB;
+#endif
+}
+
 VteStream *
 _vte_file_stream_new (void)
 {
-	return (VteStream *) g_object_new (VTE_TYPE_FILE_STREAM, NULL);
+        return _vte_file_stream_new_with_codec (_vte_stream_default_codec ());
+}
+
+/* The codec only applies to blocks written from now on, which is why it's
+ * chosen at construction; unavailable codecs fall back to zlib. */
+VteStream *
+_vte_file_stream_new_with_codec (VteStreamCodec codec)
+{
+        VteFileStream *stream = (VteFileStream *) g_object_new (VTE_TYPE_FILE_STREAM, NULL);
+
+        _vte_boa_set_codec (stream->boa, codec);
+        return (VteStream *) stream;
+}
+
+gboolean
+_vte_file_stream_codec_available (VteStreamCodec codec)
+{
+        return _vte_boa_codec_available (codec);
+}
+
+/* Forget the cached blocks from offset on. */
+static void
+_vte_file_stream_invalidate_cache (VteFileStream *stream, gsize offset)
+{
+        guint i;
+
+        for (i = 0; i < stream->rcache_size; i++) {
+                if (stream->rcache[i].offset >= offset)
+                        stream->rcache[i].offset = 1;  /* Invalidate */
+        }
+}
+
+static void
+_vte_file_stream_free_cache (VteFileStream *stream)
+{
+        guint i;
+
+        for (i = 0; i < stream->rcache_size; i++)
+                g_free(stream->rcache[i].data);
+        g_free(stream->rcache);
 }
 
 static void
 _vte_file_stream_init (VteFileStream *stream)
 {
+        guint i;
+
         stream->boa = (VteBoa *)g_object_new (VTE_TYPE_BOA, NULL);
 
-        stream->rbuf = (char *)g_malloc(VTE_BOA_BLOCKSIZE);
+#ifndef VTESTREAM_MAIN
+        stream->write_behind = TRUE;
+#else
+        /* The unit tests check the file right after appending */
+        stream->write_behind = FALSE;
+#endif
+        g_mutex_init (&stream->boa_lock);
+        g_mutex_init (&stream->lock);
+        g_cond_init (&stream->cond);
+        g_queue_init (&stream->wqueue);
+
+        stream->rcache_size = VTE_FILE_STREAM_CACHE_BLOCKS;
+        stream->rcache = g_new0 (VteFileStreamBlock, stream->rcache_size);
+        for (i = 0; i < stream->rcache_size; i++)
+                stream->rcache[i].offset = 1;  /* Invalidate */
         stream->wbuf = (char *)g_malloc(VTE_BOA_BLOCKSIZE);
-        stream->rbuf_offset = 1;  /* Invalidate */
+}
+
+/* Runs in the writer thread: write the queued blocks in order. */
+static void
+_vte_file_stream_writer (gpointer data, gpointer user_data)
+{
+        VteFileStream *stream = (VteFileStream *) data;
+        VteFileStreamBlock *block;
+
+        g_mutex_lock (&stream->lock);
+        while ((block = (VteFileStreamBlock *) g_queue_peek_head (&stream->wqueue)) != NULL) {
+                g_mutex_unlock (&stream->lock);
+
+                g_mutex_lock (&stream->boa_lock);
+                _vte_boa_write (stream->boa, block->offset, block->data);
+                g_mutex_unlock (&stream->boa_lock);
+
+                /* Only dequeue once written, so that it can be read from one place or the other */
+                g_mutex_lock (&stream->lock);
+                g_queue_pop_head (&stream->wqueue);
+                if (stream->wspare == NULL)
+                        stream->wspare = block->data;
+                else
+                        g_free (block->data);
+                g_slice_free (VteFileStreamBlock, block);
+                g_cond_broadcast (&stream->cond);
+        }
+        stream->writing = FALSE;
+        g_cond_broadcast (&stream->cond);
+        /* The stream may be finalized as soon as this returns */
+        g_mutex_unlock (&stream->lock);
+}
+
+/* Hand over wbuf, a complete block at offset, to the writer. */
+static void
+_vte_file_stream_queue_write (VteFileStream *stream, gsize offset)
+{
+        VteFileStreamBlock *block;
+        char *wbuf;
+
+        g_mutex_lock (&stream->lock);
+        while (stream->wqueue.length >= VTE_FILE_STREAM_WRITE_QUEUE)
+                g_cond_wait (&stream->cond, &stream->lock);
+
+        block = g_slice_new (VteFileStreamBlock);
+        block->offset = offset;
+        block->data = stream->wbuf;
+        g_queue_push_tail (&stream->wqueue, block);
+
+        wbuf = stream->wspare;
+        stream->wspare = NULL;
+
+        if (!stream->writing) {
+                stream->writing = TRUE;
+                g_thread_pool_push (_vte_file_stream_writer_pool, stream, NULL);
+        }
+        g_mutex_unlock (&stream->lock);
+
+        stream->wbuf = wbuf ? wbuf : (char *)g_malloc(VTE_BOA_BLOCKSIZE);
+}
+
+/* Wait until all the queued blocks are written. */
+static void
+_vte_file_stream_flush (VteFileStream *stream)
+{
+        g_mutex_lock (&stream->lock);
+        while (stream->writing)
+                g_cond_wait (&stream->cond, &stream->lock);
+        g_mutex_unlock (&stream->lock);
+}
+
+/* Read a block from the write queue if it's still there, from the boa otherwise. */
+static gboolean
+_vte_file_stream_read_boa (VteFileStream *stream, gsize offset, char *data)
+{
+        GList *l;
+        gboolean ret;
+
+        g_mutex_lock (&stream->lock);
+        for (l = stream->wqueue.head; l != NULL; l = l->next) {
+                VteFileStreamBlock *block = (VteFileStreamBlock *) l->data;
+                if (block->offset == offset) {
+                        memcpy (data, block->data, VTE_BOA_BLOCKSIZE);
+                        g_mutex_unlock (&stream->lock);
+                        return TRUE;
+                }
+        }
+        g_mutex_unlock (&stream->lock);
+
+        g_mutex_lock (&stream->boa_lock);
+        ret = _vte_boa_read (stream->boa, offset, data);
+        g_mutex_unlock (&stream->boa_lock);
+        return ret;
 }
 
 static void
@@ -1078,13 +1487,55 @@ _vte_file_stream_finalize (GObject *object)
 {
         VteFileStream *stream = (VteFileStream *) object;
 
-        g_free(stream->rbuf);
+        _vte_file_stream_flush (stream);
+
+        _vte_file_stream_free_cache (stream);
         g_free(stream->wbuf);
+        g_free(stream->wspare);
         g_object_unref (stream->boa);
+        g_cond_clear (&stream->cond);
+        g_mutex_clear (&stream->lock);
+        g_mutex_clear (&stream->boa_lock);
 
         G_OBJECT_CLASS (_vte_file_stream_parent_class)->finalize(object);
 }
 
+/* Returns the cached contents of the block at offset_aligned, reading it
+ * into the least recently used slot if it's not cached; or NULL if the
+ * block can't be read. */
+static const char *
+_vte_file_stream_read_block (VteFileStream *stream, gsize offset_aligned)
+{
+        VteFileStreamBlock block;
+        guint i;
+
+        for (i = 0; i < stream->rcache_size - 1; i++) {
+                if (stream->rcache[i].offset == offset_aligned)
+                        break;
+        }
+
+        block = stream->rcache[i];
+        if (block.offset == offset_aligned) {
+                stream->rcache_hits++;
+        } else {
+                stream->rcache_misses++;
+                if (block.data == NULL)
+                        block.data = (char *)g_malloc(VTE_BOA_BLOCKSIZE);
+                if (G_UNLIKELY (!_vte_file_stream_read_boa (stream, offset_aligned, block.data))) {
+                        stream->rcache[i].data = block.data;
+                        stream->rcache[i].offset = 1;  /* Invalidate */
+                        return NULL;
+                }
+                block.offset = offset_aligned;
+        }
+
+        /* Move it to the front */
+        memmove(&stream->rcache[1], &stream->rcache[0], i * sizeof(VteFileStreamBlock));
+        stream->rcache[0] = block;
+
+        return block.data;
+}
+
 static void
 _vte_file_stream_reset (VteStream *astream, gsize offset)
 {
@@ -1095,6 +1546,7 @@ _vte_file_stream_reset (VteStream *astream, gsize offset)
          * to catch if this expectation is broken within a block. */
         g_assert_cmpuint (offset, >=, stream->head);
 
+        _vte_file_stream_flush (stream);
         _vte_boa_reset (stream->boa, offset_aligned);
         stream->tail = stream->head = offset;
 
@@ -1109,7 +1561,7 @@ _vte_file_stream_reset (VteStream *astream, gsize offset)
 #endif
 
         stream->wbuf_len = MOD_BOA(offset);
-        stream->rbuf_offset = 1;  /* Invalidate */
+        _vte_file_stream_invalidate_cache (stream, 0);
 }
 
 static gboolean
@@ -1134,13 +1586,10 @@ _vte_file_stream_read (VteStream *astream, gsize offset, char *data, gsize len)
 
         while (len && offset < ALIGN_BOA(stream->head)) {
                 gsize l = MIN(VTE_BOA_BLOCKSIZE - MOD_BOA(offset), len);
-                gsize offset_aligned = ALIGN_BOA(offset);
-                if (offset_aligned != stream->rbuf_offset) {
-                        if (G_UNLIKELY (!_vte_boa_read (stream->boa, offset_aligned, stream->rbuf)))
-                                return FALSE;
-                        stream->rbuf_offset = offset_aligned;
-                }
-                memcpy(data, stream->rbuf + MOD_BOA(offset), l);
+                const char *block = _vte_file_stream_read_block (stream, ALIGN_BOA(offset));
+                if (G_UNLIKELY (block == NULL))
+                        return FALSE;
+                memcpy(data, block + MOD_BOA(offset), l);
                 offset += l; data += l; len -= l;
         }
         if (len) {
@@ -1160,7 +1609,10 @@ _vte_file_stream_append (VteStream *astream, const char *data, gsize len)
                 memcpy(stream->wbuf + stream->wbuf_len, data, l);
                 stream->wbuf_len += l; data += l; len -= l;
                 if (stream->wbuf_len == VTE_BOA_BLOCKSIZE) {
-                        _vte_boa_write (stream->boa, ALIGN_BOA(stream->head), stream->wbuf);
+                        if (stream->write_behind)
+                                _vte_file_stream_queue_write (stream, ALIGN_BOA(stream->head));
+                        else
+                                _vte_boa_write (stream->boa, ALIGN_BOA(stream->head), stream->wbuf);
                         stream->wbuf_len = 0;
                 }
                 stream->head += l;
@@ -1183,14 +1635,13 @@ _vte_file_stream_truncate (VteStream *astream, gsize offset)
                  * intact, that is, read back the new partial last block to
                  * the write cache. */
                 gsize offset_aligned = ALIGN_BOA(offset);
+                _vte_file_stream_flush (stream);
                 if (G_UNLIKELY (!_vte_boa_read (stream->boa, offset_aligned, stream->wbuf))) {
                         /* what now? */
                         memset(stream->wbuf, 0, VTE_BOA_BLOCKSIZE);
                 }
 
-                if (stream->rbuf_offset >= offset_aligned) {
-                        stream->rbuf_offset = 1;  /* Invalidate */
-                }
+                _vte_file_stream_invalidate_cache (stream, offset_aligned);
         }
         stream->wbuf_len = MOD_BOA(offset);
 	stream->head = offset;
@@ -1204,8 +1655,23 @@ _vte_file_stream_advance_tail (VteStream *astream, gsize offset)
         g_assert_cmpuint (offset, >=, stream->tail);
         g_assert_cmpuint (offset, <=, stream->head);
 
-        if (ALIGN_BOA(offset) > ALIGN_BOA(stream->tail))
+        if (ALIGN_BOA(offset) > ALIGN_BOA(stream->tail)) {
+                VteFileStreamBlock *block;
+                gboolean flush;
+
+                /* The boa can't advance its tail past its head, which is where the queued
+                 * blocks start; wait for them if needed (only with a tiny scrollback). */
+                g_mutex_lock (&stream->lock);
+                block = (VteFileStreamBlock *) g_queue_peek_head (&stream->wqueue);
+                flush = block != NULL && block->offset < ALIGN_BOA(offset);
+                g_mutex_unlock (&stream->lock);
+                if (G_UNLIKELY (flush))
+                        _vte_file_stream_flush (stream);
+
+                g_mutex_lock (&stream->boa_lock);
                 _vte_boa_advance_tail (stream->boa, ALIGN_BOA(offset));
+                g_mutex_unlock (&stream->boa_lock);
+        }
 
         stream->tail = offset;
 }
@@ -1226,6 +1692,50 @@ _vte_file_stream_head (VteStream *astream)
 	return stream->head;
 }
 
+/**
+ * _vte_file_stream_set_cache_size:
+ * @astream: a file stream
+ * @blocks: the number of uncompressed blocks to keep around for reading, at least 1
+ */
+void
+_vte_file_stream_set_cache_size (VteStream *astream, guint blocks)
+{
+	VteFileStream *stream = (VteFileStream *) astream;
+        guint i;
+
+        g_assert_cmpuint (blocks, >=, 1);
+
+        if (blocks == stream->rcache_size)
+                return;
+
+        /* Keep the most recently used ones */
+        for (i = blocks; i < stream->rcache_size; i++)
+                g_free(stream->rcache[i].data);
+        stream->rcache = g_renew (VteFileStreamBlock, stream->rcache, blocks);
+        for (i = stream->rcache_size; i < blocks; i++) {
+                stream->rcache[i].offset = 1;  /* Invalidate */
+                stream->rcache[i].data = NULL;
+        }
+        stream->rcache_size = blocks;
+}
+
+/**
+ * _vte_file_stream_get_cache_stats:
+ * @astream: a file stream
+ * @hits: (out) (allow-none): number of blocks read from the cache
+ * @misses: (out) (allow-none): number of blocks read from the file
+ */
+void
+_vte_file_stream_get_cache_stats (VteStream *astream, gulong *hits, gulong *misses)
+{
+	VteFileStream *stream = (VteFileStream *) astream;
+
+        if (hits)
+                *hits = stream->rcache_hits;
+        if (misses)
+                *misses = stream->rcache_misses;
+}
+
 static void
 _vte_file_stream_class_init (VteFileStreamClass *klass)
 {
@@ -1233,6 +1743,9 @@ _vte_file_stream_class_init (VteFileStreamClass *klass)
 
 	gobject_class->finalize = _vte_file_stream_finalize;
 
+        /* One writer for all the streams, the disk doesn't get any faster with more */
+        _vte_file_stream_writer_pool = g_thread_pool_new (_vte_file_stream_writer, NULL, 1, FALSE, NULL);
+
 	klass->reset = _vte_file_stream_reset;
 	klass->read = _vte_file_stream_read;
 	klass->append = _vte_file_stream_append;
@@ -1323,38 +1836,55 @@ test_fakes (void)
 
         /* Compress, but becomes bigger */
         strcpy(buf, "abcdef");
-        g_assert_cmpuint(_vte_boa_compress (buf2, 100, buf, 6), ==, 7);
+        g_assert_cmpuint(_vte_boa_zlib_compress (&boa->codec_ctx, buf2, 100, buf, 6), ==, 7);
         g_assert(strncmp (buf2, "1abcdef", 7) == 0);
 
         /* Uncompress */
         strcpy(buf, "1abcdef");
-        g_assert_cmpuint(_vte_boa_uncompress (buf2, 100, buf, 7), ==, 6);
+        g_assert_cmpuint(_vte_boa_zlib_uncompress (&boa->codec_ctx, buf2, 100, buf, 7), ==, 6);
         g_assert(strncmp (buf2, "abcdef", 6) == 0);
 
         /* Compress, becomes smaller */
         strcpy(buf, "www");
-        g_assert_cmpuint(_vte_boa_compress (buf2, 100, buf, 3), ==, 2);
+        g_assert_cmpuint(_vte_boa_zlib_compress (&boa->codec_ctx, buf2, 100, buf, 3), ==, 2);
         g_assert(strncmp (buf2, "3w", 2) == 0);
 
         /* Uncompress */
         strcpy(buf, "3w");
-        g_assert_cmpuint(_vte_boa_uncompress (buf2, 100, buf, 2), ==, 3);
+        g_assert_cmpuint(_vte_boa_zlib_uncompress (&boa->codec_ctx, buf2, 100, buf, 2), ==, 3);
         g_assert(strncmp (buf2, "www", 3) == 0);
 
         /* Compress, remains the same size */
         strcpy(buf, "zebraaa");
-        g_assert_cmpuint(_vte_boa_compress (buf2, 100, buf, 7), ==, 7);
+        g_assert_cmpuint(_vte_boa_zlib_compress (&boa->codec_ctx, buf2, 100, buf, 7), ==, 7);
         g_assert(strncmp (buf2, "1zebr3a", 7) == 0);
 
         /* Uncompress */
         strcpy(buf, "1zebr3a");
-        g_assert_cmpuint(_vte_boa_uncompress (buf2, 100, buf, 7), ==, 7);
+        g_assert_cmpuint(_vte_boa_zlib_uncompress (&boa->codec_ctx, buf2, 100, buf, 7), ==, 7);
         g_assert(strncmp (buf2, "zebraaa", 7) == 0);
 
         /* Trying to uncompress the original does *not* give back the same contents.
          * This will be important below. */
         strcpy(buf, "zebraaa");
-        g_assert_cmpuint(_vte_boa_uncompress (buf2, 100, buf, 7), ==, 0);
+        g_assert_cmpuint(_vte_boa_zlib_uncompress (&boa->codec_ctx, buf2, 100, buf, 7), ==, 0);
+
+        /* The other fake codec */
+        strcpy(buf, "abcdef");
+        g_assert_cmpuint(_vte_boa_lz4_compress (&boa->codec_ctx, buf2, 100, buf, 6), ==, 7);
+        g_assert(strncmp (buf2, "a1bcdef", 7) == 0);
+
+        strcpy(buf, "a1bcdef");
+        g_assert_cmpuint(_vte_boa_lz4_uncompress (&boa->codec_ctx, buf2, 100, buf, 7), ==, 6);
+        g_assert(strncmp (buf2, "abcdef", 6) == 0);
+
+        strcpy(buf, "beeeeee");
+        g_assert_cmpuint(_vte_boa_lz4_compress (&boa->codec_ctx, buf2, 100, buf, 7), ==, 4);
+        g_assert(strncmp (buf2, "b1e6", 4) == 0);
+
+        strcpy(buf, "b1e6");
+        g_assert_cmpuint(_vte_boa_lz4_uncompress (&boa->codec_ctx, buf2, 100, buf, 4), ==, 7);
+        g_assert(strncmp (buf2, "beeeeee", 7) == 0);
 
         g_object_unref (boa);
 }
@@ -1526,6 +2056,20 @@ test_boa (void)
         assert_snake (snake, 1, 250, 260, "\007\001ZEBRAAA\311");
         assert_boa (boa, 175, 182, "zebraaa");
 
+        /* Switch codecs. The codec is recorded in the high bits of the length,
+         * and the block written with the previous codec remains readable. */
+        _vte_boa_set_codec (boa, VTE_STREAM_CODEC_LZ4);
+        _vte_boa_write (boa, 182, "beeeeee");
+        assert_file (snake->fd, "\007\001ZEBRAAA\311" "\024\001B1E6\321...");
+        assert_snake (snake, 1, 250, 270, "\007\001ZEBRAAA\311" "\024\001B1E6\321...");
+        assert_boa (boa, 175, 189, "zebraaa" "beeeeee");
+
+        /* A block with a codec that isn't available can't be read */
+        _vte_boa_set_codec (boa, VTE_STREAM_CODEC_ZSTD);
+        g_assert_cmpuint (boa->codec, ==, VTE_STREAM_CODEC_ZLIB);
+        snake_write (snake, 260, "\044\001B1E6\321...");
+        g_assert_false (_vte_boa_read (boa, 182, NULL));
+
         g_object_unref (boa);
 }
 
@@ -1754,17 +2298,236 @@ test_stream (void)
         g_object_unref (astream);
 }
 
+static void
+test_stream_cache (void)
+{
+        char buf[8];
+        gulong hits, misses;
+
+        VteStream *astream = _vte_file_stream_new();
+        _vte_file_stream_set_cache_size (astream, 2);
+
+#define assert_read(__offset, __len, __contents, __hits, __misses) do { \
+        g_assert (_vte_stream_read (astream, __offset, buf, __len)); \
+        g_assert (memcmp(buf, __contents, __len) == 0); \
+        _vte_file_stream_get_cache_stats (astream, &hits, &misses); \
+        g_assert_cmpuint (hits, ==, __hits); \
+        g_assert_cmpuint (misses, ==, __misses); \
+} while (0)
+
+        stream_append (astream, "axolotl" "bobcats" "caracal" "dormice");
+
+        assert_read (0, 7, "axolotl", 0, 1);
+        assert_read (7, 7, "bobcats", 0, 2);
+        assert_read (3, 2, "lo", 1, 2);
+        /* Evicts the least recently used one, "bobcats" */
+        assert_read (14, 7, "caracal", 1, 3);
+        assert_read (0, 7, "axolotl", 2, 3);
+        assert_read (7, 7, "bobcats", 2, 4);
+        /* Across a block boundary, both cached */
+        assert_read (5, 4, "tlbo", 4, 4);
+
+        /* Shrinking keeps the most recently used ones */
+        _vte_file_stream_set_cache_size (astream, 1);
+        assert_read (7, 7, "bobcats", 5, 4);
+        assert_read (0, 7, "axolotl", 5, 5);
+
+        /* Truncating drops the cached blocks from there on, and the new
+         * partial last block is read from the write buffer */
+        _vte_stream_truncate (astream, 10);
+        assert_read (7, 3, "bob", 5, 5);
+        assert_read (0, 7, "axolotl", 6, 5);
+
+#undef assert_read
+
+        g_object_unref (astream);
+}
+
+static void
+test_stream_write_behind (void)
+{
+        VteStream *astream = _vte_file_stream_new();
+        VteFileStream *stream = (VteFileStream *) astream;
+        VteBoa *boa = stream->boa;
+
+        stream->write_behind = TRUE;
+
+        /* More blocks than the queue holds; whether they're written yet
+         * or not, they read back the same */
+        stream_append (astream, "axolotl" "bobcats" "caracal" "dormice" "echidna" "ferrets");
+        assert_stream (astream, 0, 42, "axolotl" "bobcats" "caracal" "dormice" "echidna" "ferrets");
+
+        _vte_file_stream_flush (stream);
+        g_assert_true (g_queue_is_empty (&stream->wqueue));
+        assert_boa (boa, 0, 42, "axolotl" "bobcats" "caracal" "dormice" "echidna" "ferrets");
+
+        /* Truncate, then overwrite a block from the queue */
+        _vte_stream_truncate (astream, 10);
+        assert_stream (astream, 0, 10, "axolotl" "bob");
+        stream_append (astream, "ar" "racal");
+        assert_stream (astream, 0, 17, "axolotl" "bobarra" "cal");
+
+        /* Advancing the tail past the queued block waits for it */
+        _vte_stream_advance_tail (astream, 14);
+        assert_boa (boa, 14, 42, "caracal" "dormice" "echidna" "ferrets");
+        assert_stream (astream, 14, 17, "cal");
+
+        g_object_unref (astream);
+}
+
+#endif /* VTESTREAM_MAIN */
+
+#ifdef VTESTREAM_BENCH
+
+/*
+ * Micro-benchmark of the compression codecs on terminal-like text:
+ * compression ratio and throughput per codec, one boa block at a time,
+ * just like the boa does it.
+ *
+ * Usage: vtestream-bench [FILE]
+ * Without FILE, a few MB of synthetic output (directory listings, build
+ * logs, compiler warnings, kernel messages) is generated.
+ */
+
+#define VTE_BENCH_SIZE   (4 * 1024 * 1024)
+#define VTE_BENCH_ROUNDS 4
+
+static const char *bench_words[] = {
+        "ring", "stream", "buffer", "terminal", "cursor", "parser", "widget",
+        "matcher", "iso2022", "keymap", "pty", "draw", "utf8", "caps", "debug",
+};
+
+static GString *
+bench_synthesize (gsize size)
+{
+        GString *str = g_string_sized_new (size);
+        GRand *rand = g_rand_new_with_seed (42);
+        guint n = G_N_ELEMENTS (bench_words);
+
+        while (str->len < size) {
+                const char *w1 = bench_words[g_rand_int_range (rand, 0, n)];
+                const char *w2 = bench_words[g_rand_int_range (rand, 0, n)];
+
+                switch (g_rand_int_range (rand, 0, 4)) {
+                case 0:
+                        g_string_append_printf (str, "-rw-r--r--  1 user users %7u Oct %2u %02u:%02u %s-%s.cc\n",
+                                                g_rand_int_range (rand, 0, 1000000), g_rand_int_range (rand, 1, 32),
+                                                g_rand_int_range (rand, 0, 24), g_rand_int_range (rand, 0, 60), w1, w2);
+                        break;
+                case 1:
+                        g_string_append_printf (str, "  CXX      libvte_2_91_la-%s%s.lo\n", w1, w2);
+                        break;
+                case 2:
+                        g_string_append_printf (str, "%s.cc:%u:%u: warning: unused variable '%s_%s' [-Wunused-variable]\n",
+                                                w1, g_rand_int_range (rand, 1, 5000), g_rand_int_range (rand, 1, 80), w2, w1);
+                        break;
+                default:
+                        g_string_append_printf (str, "[%5u.%06u] %s: %s %u bytes at 0x%08x\n",
+                                                g_rand_int_range (rand, 0, 100000), g_rand_int_range (rand, 0, 1000000),
+                                                w1, w2, g_rand_int_range (rand, 0, 65536), g_rand_int (rand));
+                        break;
+                }
+        }
+
+        g_rand_free (rand);
+        return str;
+}
+
+static void
+bench_codec (VteBoa *boa, VteStreamCodec codec, const char *data, gsize nblocks)
+{
+        char *cdata, *ubuf;
+        unsigned int *clens;
+        guint64 compressed = 0;
+        gint64 start, compress_time, uncompress_time;
+        gsize i;
+        int round;
+
+        _vte_boa_set_codec (boa, codec);
+
+        cdata = (char *) g_malloc (nblocks * boa->compressBound);
+        clens = g_new (unsigned int, nblocks);
+        ubuf = (char *) g_malloc (VTE_BOA_BLOCKSIZE);
+
+        start = g_get_monotonic_time ();
+        for (round = 0; round < VTE_BENCH_ROUNDS; round++)
+                for (i = 0; i < nblocks; i++)
+                        clens[i] = _vte_boa_compress (boa, cdata + i * boa->compressBound, boa->compressBound,
+                                                      data + i * VTE_BOA_BLOCKSIZE, VTE_BOA_BLOCKSIZE);
+        compress_time = MAX (g_get_monotonic_time () - start, 1);
+
+        start = g_get_monotonic_time ();
+        for (round = 0; round < VTE_BENCH_ROUNDS; round++)
+                for (i = 0; i < nblocks; i++) {
+                        unsigned int len;
+                        /* Stored uncompressed by the boa, see _vte_boa_write() */
+                        if (clens[i] >= VTE_BOA_BLOCKSIZE)
+                                continue;
+                        len = _vte_boa_uncompress (boa, codec, ubuf, VTE_BOA_BLOCKSIZE,
+                                                   cdata + i * boa->compressBound, clens[i]);
+                        g_assert_cmpuint (len, ==, VTE_BOA_BLOCKSIZE);
+                }
+        uncompress_time = MAX (g_get_monotonic_time () - start, 1);
+
+        for (i = 0; i < nblocks; i++)
+                compressed += MIN (clens[i], VTE_BOA_BLOCKSIZE);
+
+        /* Bytes per microsecond equals MB/s */
+        printf ("%-5s  ratio %6.2f  compress %8.1f MB/s  uncompress %8.1f MB/s\n",
+                _vte_boa_codecs[codec].name,
+                (double) nblocks * VTE_BOA_BLOCKSIZE / compressed,
+                (double) VTE_BENCH_ROUNDS * nblocks * VTE_BOA_BLOCKSIZE / compress_time,
+                (double) VTE_BENCH_ROUNDS * nblocks * VTE_BOA_BLOCKSIZE / uncompress_time);
+
+        g_free (ubuf);
+        g_free (clens);
+        g_free (cdata);
+}
+
 int
 main (int argc, char **argv)
 {
-        test_fakes();
+        GString *str;
+        VteBoa *boa;
+        gsize nblocks;
+        int codec;
+
+        if (argc > 1) {
+                char *contents;
+                gsize len;
+                GError *error = NULL;
+
+                if (!g_file_get_contents (argv[1], &contents, &len, &error)) {
+                        fprintf (stderr, "%s\n", error->message);
+                        g_error_free (error);
+                        return 1;
+                }
+                str = g_string_new_len (contents, len);
+                g_free (contents);
+        } else {
+                str = bench_synthesize (VTE_BENCH_SIZE);
+        }
+
+        nblocks = str->len / VTE_BOA_BLOCKSIZE;
+        if (nblocks == 0) {
+                fprintf (stderr, "Need at least %d bytes of input\n", (int) VTE_BOA_BLOCKSIZE);
+                return 1;
+        }
 
-        test_snake();
-        test_boa();
-        test_stream();
+        printf ("%" G_GSIZE_FORMAT " blocks of %d bytes, %d rounds\n",
+                nblocks, (int) VTE_BOA_BLOCKSIZE, VTE_BENCH_ROUNDS);
 
-        printf("vtestream-file tests passed :)\n");
+        boa = (VteBoa *) g_object_new (VTE_TYPE_BOA, NULL);
+        for (codec = 0; codec < VTE_STREAM_N_CODECS; codec++) {
+                if (_vte_boa_codec_available ((VteStreamCodec) codec))
+                        bench_codec (boa, (VteStreamCodec) codec, str->str, nblocks);
+                else
+                        printf ("%-5s  not available\n", _vte_boa_codecs[codec].name);
+        }
+
+        g_object_unref (boa);
+        g_string_free (str, TRUE);
         return 0;
 }
 
-#endif /* VTESTREAM_MAIN */
+#endif /* VTESTREAM_BENCH */
@@ -0,0 +1,502 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * VteMemStream: Keep a small stream in memory, spill it to a file when it grows.
+ *
+ * Most terminals never have more than a few thousand lines of scrollback,
+ * which compressed takes up much less than a temporary file, a file
+ * descriptor and the syscalls to read and write it are worth.
+ *
+ * Complete blocks are compressed, using the same codecs as VteBoa, into an
+ * arena: a single buffer that they're appended to in order. The blocks that
+ * fall off the tail leave a gap at the start of the arena, which is closed
+ * once it takes up half of the arena. The last incomplete block is kept
+ * uncompressed in the write buffer, and the most recently read block in the
+ * read buffer, just like VteFileStream does.
+ *
+ * When the compressed blocks exceed the limit, the contents are copied to a
+ * new VteFileStream, and from then on every operation is forwarded to it.
+ */
+
+#ifndef VTESTREAM_MAIN
+# define VTE_MEM_STREAM_BLOCKSIZE 16384
+#else
+/* Smaller size for unit testing */
+# define VTE_MEM_STREAM_BLOCKSIZE 7
+#endif
+
+#define ALIGN_MEM(x) ((x) / VTE_MEM_STREAM_BLOCKSIZE * VTE_MEM_STREAM_BLOCKSIZE)
+#define MOD_MEM(x)   ((x) % VTE_MEM_STREAM_BLOCKSIZE)
+
+G_BEGIN_DECLS
+
+typedef struct _VteMemStreamBlock {
+        gsize arena_offset;
+        /* Compressed length, or VTE_MEM_STREAM_BLOCKSIZE if stored uncompressed */
+        unsigned int len;
+} VteMemStreamBlock;
+
+typedef struct _VteMemStream {
+        GObject parent;
+
+        /* Once spilled, everything is forwarded to this */
+        VteStream *file;
+        gsize limit;
+
+        VteCodecContext codec_ctx;
+        VteStreamCodec codec;
+        int compressBound;
+
+        /* The live blocks are arena[arena_start..arena_len) */
+        char *arena;
+        gsize arena_start, arena_len, arena_size;
+
+        /* VteMemStreamBlock, the complete blocks from blocks_offset on */
+        GArray *blocks;
+        gsize blocks_offset;
+
+        char *rbuf;
+        gsize rbuf_offset;      /* 1 (or anything that's not a multiple of block size) if invalid */
+        gulong rbuf_hits, rbuf_misses;
+
+        char *wbuf;
+        gsize wbuf_len;
+
+        gsize head, tail;
+} VteMemStream;
+
+typedef VteStreamClass VteMemStreamClass;
+
+static GType _vte_mem_stream_get_type (void);
+#define VTE_TYPE_MEM_STREAM _vte_mem_stream_get_type ()
+#define VTE_IS_MEM_STREAM(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), VTE_TYPE_MEM_STREAM))
+
+G_DEFINE_TYPE (VteMemStream, _vte_mem_stream, VTE_TYPE_STREAM)
+
+/**
+ * _vte_mem_stream_new:
+ * @limit: the size of the compressed contents above which the stream moves to a file
+ */
+VteStream *
+_vte_mem_stream_new (gsize limit)
+{
+        VteMemStream *stream = (VteMemStream *) g_object_new (VTE_TYPE_MEM_STREAM, NULL);
+
+        stream->limit = limit;
+        return (VteStream *) stream;
+}
+
+static void
+_vte_mem_stream_init (VteMemStream *stream)
+{
+        stream->codec = _vte_stream_default_codec ();
+        stream->compressBound = _vte_boa_codecs[stream->codec].compressBound(VTE_MEM_STREAM_BLOCKSIZE);
+
+        stream->blocks = g_array_new (FALSE, FALSE, sizeof (VteMemStreamBlock));
+        stream->rbuf_offset = 1;  /* Invalidate */
+        stream->wbuf = (char *)g_malloc(VTE_MEM_STREAM_BLOCKSIZE);
+}
+
+/* Release everything that's only needed while in memory */
+static void
+_vte_mem_stream_free_memory (VteMemStream *stream)
+{
+        _vte_codec_context_clear (&stream->codec_ctx);
+        g_free (stream->arena);
+        stream->arena = NULL;
+        stream->arena_start = stream->arena_len = stream->arena_size = 0;
+        if (stream->blocks != NULL)
+                g_array_free (stream->blocks, TRUE);
+        stream->blocks = NULL;
+        g_free (stream->rbuf);
+        stream->rbuf = NULL;
+        g_free (stream->wbuf);
+        stream->wbuf = NULL;
+}
+
+static void
+_vte_mem_stream_finalize (GObject *object)
+{
+        VteMemStream *stream = (VteMemStream *) object;
+
+        _vte_mem_stream_free_memory (stream);
+        if (stream->file != NULL)
+                g_object_unref (stream->file);
+
+        G_OBJECT_CLASS (_vte_mem_stream_parent_class)->finalize(object);
+}
+
+/* Uncompress the block at offset_aligned to data. */
+static void
+_vte_mem_stream_uncompress_block (VteMemStream *stream, gsize offset_aligned, char *data)
+{
+        const VteMemStreamBlock *block;
+        unsigned int uncompressed_len;
+
+        block = &g_array_index (stream->blocks, VteMemStreamBlock,
+                                (offset_aligned - stream->blocks_offset) / VTE_MEM_STREAM_BLOCKSIZE);
+        if (G_UNLIKELY (block->len >= VTE_MEM_STREAM_BLOCKSIZE)) {
+                memcpy (data, stream->arena + block->arena_offset, VTE_MEM_STREAM_BLOCKSIZE);
+                return;
+        }
+        uncompressed_len = _vte_boa_codecs[stream->codec].uncompress (&stream->codec_ctx, data, VTE_MEM_STREAM_BLOCKSIZE,
+                                                                       stream->arena + block->arena_offset, block->len);
+        g_assert_cmpuint (uncompressed_len, ==, VTE_MEM_STREAM_BLOCKSIZE);
+}
+
+/* Close the gap left by the blocks dropped off the tail once it's big enough. */
+static void
+_vte_mem_stream_compact (VteMemStream *stream)
+{
+        guint i;
+
+        if (stream->arena_start == 0 || stream->arena_start < stream->arena_len / 2)
+                return;
+
+        memmove (stream->arena, stream->arena + stream->arena_start, stream->arena_len - stream->arena_start);
+        for (i = 0; i < stream->blocks->len; i++)
+                g_array_index (stream->blocks, VteMemStreamBlock, i).arena_offset -= stream->arena_start;
+        stream->arena_len -= stream->arena_start;
+        stream->arena_start = 0;
+
+        /* Give back memory after a burst of output got scrolled off */
+        if (stream->arena_size > 4 * (stream->arena_len + stream->compressBound)) {
+                stream->arena_size /= 2;
+                stream->arena = (char *)g_realloc (stream->arena, stream->arena_size);
+        }
+}
+
+/* Compress the full write buffer to the end of the arena. */
+static void
+_vte_mem_stream_push_block (VteMemStream *stream)
+{
+        VteMemStreamBlock block;
+
+        if (stream->arena_len + stream->compressBound > stream->arena_size) {
+                stream->arena_size = MAX (2 * stream->arena_size, stream->arena_len + stream->compressBound);
+                stream->arena = (char *)g_realloc (stream->arena, stream->arena_size);
+        }
+
+        block.arena_offset = stream->arena_len;
+        block.len = _vte_boa_codecs[stream->codec].compress (&stream->codec_ctx, stream->arena + stream->arena_len, stream->compressBound,
+                                                             stream->wbuf, VTE_MEM_STREAM_BLOCKSIZE);
+        /* Store it uncompressed if it didn't shrink, see _vte_boa_write() */
+        if (G_UNLIKELY (block.len >= VTE_MEM_STREAM_BLOCKSIZE)) {
+                memcpy (stream->arena + stream->arena_len, stream->wbuf, VTE_MEM_STREAM_BLOCKSIZE);
+                block.len = VTE_MEM_STREAM_BLOCKSIZE;
+        }
+        stream->arena_len += block.len;
+        g_array_append_val (stream->blocks, block);
+        stream->wbuf_len = 0;
+}
+
+static gboolean _vte_mem_stream_read (VteStream *astream, gsize offset, char *data, gsize len);
+
+/* Move the contents to a file stream. */
+static void
+_vte_mem_stream_spill (VteMemStream *stream)
+{
+        VteStream *file = _vte_file_stream_new ();
+        char *buf = (char *)g_malloc(VTE_MEM_STREAM_BLOCKSIZE);
+        gsize offset, l;
+
+        _vte_stream_reset (file, stream->tail);
+        for (offset = stream->tail; offset < stream->head; offset += l) {
+                l = MIN(VTE_MEM_STREAM_BLOCKSIZE - MOD_MEM(offset), stream->head - offset);
+                _vte_mem_stream_read ((VteStream *) stream, offset, buf, l);
+                _vte_stream_append (file, buf, l);
+        }
+        g_free (buf);
+
+        _vte_mem_stream_free_memory (stream);
+        stream->file = file;
+}
+
+static void
+_vte_mem_stream_reset (VteStream *astream, gsize offset)
+{
+        VteMemStream *stream = (VteMemStream *) astream;
+
+        if (stream->file != NULL) {
+                _vte_stream_reset (stream->file, offset);
+                return;
+        }
+
+        g_assert_cmpuint (offset, >=, stream->head);
+
+        g_array_set_size (stream->blocks, 0);
+        stream->blocks_offset = ALIGN_MEM(offset);
+        stream->arena_start = stream->arena_len = 0;
+        stream->rbuf_offset = 1;  /* Invalidate */
+
+        /* Same as in _vte_file_stream_reset() */
+#ifndef VTESTREAM_MAIN
+        memset(stream->wbuf, 0, MOD_MEM(offset));
+#else
+        memset(stream->wbuf, '-', MOD_MEM(offset));
+#endif
+        stream->wbuf_len = MOD_MEM(offset);
+        stream->tail = stream->head = offset;
+}
+
+static gboolean
+_vte_mem_stream_read (VteStream *astream, gsize offset, char *data, gsize len)
+{
+        VteMemStream *stream = (VteMemStream *) astream;
+
+        if (stream->file != NULL)
+                return _vte_stream_read (stream->file, offset, data, len);
+
+        /* Same bounds checking as in _vte_file_stream_read() */
+        if (G_UNLIKELY (offset < stream->tail || offset + len > stream->head || offset + len < offset)) {
+                if (G_LIKELY (offset + len <= stream->tail || offset >= stream->head))
+                        return FALSE;
+                g_assert_not_reached();
+        }
+
+        while (len && offset < ALIGN_MEM(stream->head)) {
+                gsize l = MIN(VTE_MEM_STREAM_BLOCKSIZE - MOD_MEM(offset), len);
+                if (stream->rbuf_offset == ALIGN_MEM(offset)) {
+                        stream->rbuf_hits++;
+                } else {
+                        stream->rbuf_misses++;
+                        if (stream->rbuf == NULL)
+                                stream->rbuf = (char *)g_malloc(VTE_MEM_STREAM_BLOCKSIZE);
+                        _vte_mem_stream_uncompress_block (stream, ALIGN_MEM(offset), stream->rbuf);
+                        stream->rbuf_offset = ALIGN_MEM(offset);
+                }
+                memcpy(data, stream->rbuf + MOD_MEM(offset), l);
+                offset += l; data += l; len -= l;
+        }
+        if (len) {
+                g_assert_cmpuint (MOD_MEM(offset) + len, <=, stream->wbuf_len);
+                memcpy(data, stream->wbuf + MOD_MEM(offset), len);
+        }
+        return TRUE;
+}
+
+static void
+_vte_mem_stream_append (VteStream *astream, const char *data, gsize len)
+{
+        VteMemStream *stream = (VteMemStream *) astream;
+
+        if (stream->file != NULL) {
+                _vte_stream_append (stream->file, data, len);
+                return;
+        }
+
+        while (len) {
+                gsize l = MIN(VTE_MEM_STREAM_BLOCKSIZE - stream->wbuf_len, len);
+                memcpy(stream->wbuf + stream->wbuf_len, data, l);
+                stream->wbuf_len += l; data += l; len -= l;
+                stream->head += l;
+                if (stream->wbuf_len == VTE_MEM_STREAM_BLOCKSIZE) {
+                        _vte_mem_stream_push_block (stream);
+                        if (G_UNLIKELY (stream->arena_len - stream->arena_start > stream->limit)) {
+                                _vte_mem_stream_spill (stream);
+                                if (len)
+                                        _vte_stream_append (stream->file, data, len);
+                                return;
+                        }
+                }
+        }
+}
+
+static void
+_vte_mem_stream_truncate (VteStream *astream, gsize offset)
+{
+        VteMemStream *stream = (VteMemStream *) astream;
+
+        if (stream->file != NULL) {
+                _vte_stream_truncate (stream->file, offset);
+                return;
+        }
+
+        g_assert_cmpuint (offset, >=, stream->tail);
+        g_assert_cmpuint (offset, <=, stream->head);
+
+        if (offset < ALIGN_MEM(stream->head)) {
+                /* Read back the new partial last block to the write buffer,
+                 * and drop it and the ones after it, as in _vte_file_stream_truncate() */
+                gsize offset_aligned = ALIGN_MEM(offset);
+                guint i = (offset_aligned - stream->blocks_offset) / VTE_MEM_STREAM_BLOCKSIZE;
+
+                _vte_mem_stream_uncompress_block (stream, offset_aligned, stream->wbuf);
+                stream->arena_len = g_array_index (stream->blocks, VteMemStreamBlock, i).arena_offset;
+                g_array_set_size (stream->blocks, i);
+                if (stream->rbuf_offset >= offset_aligned)
+                        stream->rbuf_offset = 1;  /* Invalidate */
+        }
+        stream->wbuf_len = MOD_MEM(offset);
+        stream->head = offset;
+}
+
+static void
+_vte_mem_stream_advance_tail (VteStream *astream, gsize offset)
+{
+        VteMemStream *stream = (VteMemStream *) astream;
+        guint n;
+
+        if (stream->file != NULL) {
+                _vte_stream_advance_tail (stream->file, offset);
+                return;
+        }
+
+        g_assert_cmpuint (offset, >=, stream->tail);
+        g_assert_cmpuint (offset, <=, stream->head);
+
+        /* Drop the complete blocks before the new tail */
+        n = MIN((ALIGN_MEM(offset) - stream->blocks_offset) / VTE_MEM_STREAM_BLOCKSIZE, stream->blocks->len);
+        if (n > 0) {
+                stream->arena_start = n < stream->blocks->len ? g_array_index (stream->blocks, VteMemStreamBlock, n).arena_offset
+                                                              : stream->arena_len;
+                g_array_remove_range (stream->blocks, 0, n);
+                stream->blocks_offset += n * VTE_MEM_STREAM_BLOCKSIZE;
+                _vte_mem_stream_compact (stream);
+        }
+
+        stream->tail = offset;
+}
+
+static gsize
+_vte_mem_stream_tail (VteStream *astream)
+{
+        VteMemStream *stream = (VteMemStream *) astream;
+
+        return stream->file != NULL ? _vte_stream_tail (stream->file) : stream->tail;
+}
+
+static gsize
+_vte_mem_stream_head (VteStream *astream)
+{
+        VteMemStream *stream = (VteMemStream *) astream;
+
+        return stream->file != NULL ? _vte_stream_head (stream->file) : stream->head;
+}
+
+static void
+_vte_mem_stream_class_init (VteMemStreamClass *klass)
+{
+        GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+        gobject_class->finalize = _vte_mem_stream_finalize;
+
+        klass->reset = _vte_mem_stream_reset;
+        klass->read = _vte_mem_stream_read;
+        klass->append = _vte_mem_stream_append;
+        klass->truncate = _vte_mem_stream_truncate;
+        klass->advance_tail = _vte_mem_stream_advance_tail;
+        klass->tail = _vte_mem_stream_tail;
+        klass->head = _vte_mem_stream_head;
+}
+
+/**
+ * _vte_stream_get_cache_stats:
+ * @astream: a file or memory stream
+ * @hits: (out) (allow-none): number of blocks read from the cache
+ * @misses: (out) (allow-none): number of blocks uncompressed
+ */
+void
+_vte_stream_get_cache_stats (VteStream *astream, gulong *hits, gulong *misses)
+{
+        if (VTE_IS_MEM_STREAM (astream)) {
+                VteMemStream *stream = (VteMemStream *) astream;
+
+                if (stream->file == NULL) {
+                        if (hits)
+                                *hits = stream->rbuf_hits;
+                        if (misses)
+                                *misses = stream->rbuf_misses;
+                        return;
+                }
+                astream = stream->file;
+        }
+
+        _vte_file_stream_get_cache_stats (astream, hits, misses);
+}
+
+G_END_DECLS
+
+/******************************************************************************************/
+
+#ifdef VTESTREAM_MAIN
+
+static void
+test_mem_stream (void)
+{
+        char buf[8];
+
+        VteStream *astream = _vte_mem_stream_new (12);
+        VteMemStream *stream = (VteMemStream *) astream;
+
+        /* Append; with the fake compression the first block is stored as is, the second takes 4 bytes */
+        stream_append (astream, "axolot");
+        assert_stream (astream, 0, 6, "axolot");
+        g_assert_cmpuint (stream->blocks->len, ==, 0);
+
+        stream_append (astream, "l" "beeeeee" "ca");
+        g_assert_cmpuint (stream->blocks->len, ==, 2);
+        g_assert_cmpuint (stream->arena_len, ==, 7 + 4);
+        assert_stream (astream, 0, 16, "axolotl" "beeeeee" "ca");
+
+        /* Truncate within a compressed block, then append again */
+        _vte_stream_truncate (astream, 9);
+        g_assert_cmpuint (stream->blocks->len, ==, 1);
+        g_assert_cmpuint (stream->arena_len, ==, 7);
+        assert_stream (astream, 0, 9, "axolotl" "be");
+        stream_append (astream, "eeeee" "ca");
+        assert_stream (astream, 0, 16, "axolotl" "beeeeee" "ca");
+
+        /* Advance the tail, dropping and compacting the first block */
+        _vte_stream_advance_tail (astream, 8);
+        g_assert_cmpuint (stream->blocks->len, ==, 1);
+        g_assert_cmpuint (stream->blocks_offset, ==, 7);
+        g_assert_cmpuint (stream->arena_start, ==, 0);
+        g_assert_cmpuint (stream->arena_len, ==, 4);
+        assert_stream (astream, 8, 16, "eeeeee" "ca");
+        g_assert (_vte_stream_read (astream, 14, buf, 2));
+        g_assert (strncmp (buf, "ca", 2) == 0);
+
+        /* Going above the limit moves it to a file */
+        stream_append (astream, "racal" "dormice");
+        g_assert (stream->file != NULL);
+        g_assert (stream->blocks == NULL);
+        assert_stream (astream, 8, 28, "eeeeee" "caracal" "dormice");
+
+        /* Forwarded to the file from now on */
+        stream_append (astream, "eel");
+        _vte_stream_truncate (astream, 26);
+        _vte_stream_advance_tail (astream, 21);
+        assert_stream (astream, 21, 26, "dormi");
+
+        g_object_unref (astream);
+
+        /* Reset */
+        astream = _vte_mem_stream_new (100);
+        stream = (VteMemStream *) astream;
+        stream_append (astream, "axolotl" "bob");
+        _vte_stream_reset (astream, 17);
+        g_assert_cmpuint (stream->blocks->len, ==, 0);
+        stream_append (astream, "cat" "dingo");
+        assert_stream (astream, 17, 25, "cat" "dingo");
+
+        g_object_unref (astream);
+}
+
+#endif /* VTESTREAM_MAIN */
@@ -31,3 +31,25 @@
 
 #include "vtestream-base.h"
 #include "vtestream-file.h"
+#include "vtestream-mem.h"
+
+#ifdef VTESTREAM_MAIN
+
+int
+main (int argc, char **argv)
+{
+        test_fakes();
+
+        test_snake();
+        test_boa();
+        test_stream();
+        test_stream_cache();
+        test_stream_write_behind();
+
+        test_mem_stream();
+
+        printf("vtestream-file tests passed :)\n");
+        return 0;
+}
+
+#endif /* VTESTREAM_MAIN */
@@ -38,8 +38,27 @@ gsize _vte_stream_head (VteStream *stream);
 
 /* Various streams */
 
+/* Compression of the file stream's blocks. Each block records the codec it
+ * was written with, so a stream can always read back what it wrote. */
+typedef enum {
+        VTE_STREAM_CODEC_ZLIB,
+        VTE_STREAM_CODEC_LZ4,
+        VTE_STREAM_CODEC_ZSTD,
+        VTE_STREAM_N_CODECS
+} VteStreamCodec;
+
 VteStream *
 _vte_file_stream_new (void);
+VteStream *
+_vte_file_stream_new_with_codec (VteStreamCodec codec);
+gboolean _vte_file_stream_codec_available (VteStreamCodec codec);
+void _vte_file_stream_set_cache_size (VteStream *stream, guint blocks);
+void _vte_file_stream_get_cache_stats (VteStream *stream, gulong *hits, gulong *misses);
+
+VteStream *
+_vte_mem_stream_new (gsize limit);
+
+void _vte_stream_get_cache_stats (VteStream *stream, gulong *hits, gulong *misses);
 
 G_END_DECLS
 